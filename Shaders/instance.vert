@@ -3,24 +3,53 @@ layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTextureCoords;
 layout (location = 3) in mat4 instanceMatrix;
+layout (location = 7) in vec4 instanceAmbient;
+layout (location = 8) in vec4 instanceDiffuse;
+layout (location = 9) in vec4 instanceSpecular;
 
 out VS_OUT {
 	vec3 NaviePos;
 	vec3 FragPos;
 	vec3 Normal;
 	vec2 TexCoords;
+	flat vec4 Ambient;
+	flat vec4 Diffuse;
+	flat vec4 Specular;
 } vs_out;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+#ifdef PERMUTATION
+const bool isCubeMap = PERMUTATION_CUBE_MAP != 0;
+#else
 uniform bool isCubeMap;
+#endif
+
+struct Plane {
+	vec3 position;
+	vec3 normal;
+};
+
+// Normals are unit length and point out of the view volume, see LightingUniformBlocks.h
+layout (std140) uniform ClippingBlock {
+	Plane clippingPlanes[6];
+};
 
 void main() {
 	vs_out.NaviePos = aPosition;
 	vs_out.FragPos =  vec3(instanceMatrix * vec4(aPosition, 1.0));
-	vs_out.Normal = mat3(transpose(inverse(instanceMatrix))) * aNormal;
+	// Instances are only scaled uniformly, the fragment shader normalizes the length away.
+	vs_out.Normal = mat3(instanceMatrix) * aNormal;
 	vs_out.TexCoords = aTextureCoords;
+	vs_out.Ambient = instanceAmbient;
+	vs_out.Diffuse = instanceDiffuse;
+	vs_out.Specular = instanceSpecular;
+
+	// Positive inside the view volume; only used while GL_CLIP_DISTANCE0..5 are enabled.
+	for (int i = 0; i < 6; i++) {
+		gl_ClipDistance[i] = -dot(clippingPlanes[i].normal, vs_out.FragPos - clippingPlanes[i].position);
+	}
 
 	if (isCubeMap) {
 		// øsѪŲ
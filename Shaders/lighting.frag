@@ -47,11 +47,6 @@ struct Fog {
 	vec4 color;
 };
 
-struct Plane {
-	vec3 position;
-	vec3 normal;
-};
-
 // 0 Direction Light; 1 2 3 4 Point Light; 5 6 Spot Light;
 #define NUM_LIGHTS 7
 
@@ -60,27 +55,104 @@ in VS_OUT {
 	vec3 FragPos;
 	vec3 Normal;
 	vec2 TexCoords;
+	flat vec4 Ambient;
+	flat vec4 Diffuse;
+	flat vec4 Specular;
 } fs_in;
 
 uniform vec3 viewPos;
+uniform float GammaValue;
+uniform samplerCube skybox;
+
+uniform Material material;
+
+// Built by ShaderPermutations every switch is a constant and its branches are compiled out,
+// see LightingFeatures.h. Built as a plain Nexus::Shader the switches stay uniforms.
+#ifdef PERMUTATION
+#define FEATURE_BLINN_PHONG (PERMUTATION_BLINN_PHONG != 0)
+#define FEATURE_LIGHTING (PERMUTATION_LIGHTING != 0)
+#define FEATURE_DIFFUSE_TEXTURE (PERMUTATION_DIFFUSE_TEXTURE != 0)
+#define FEATURE_SPECULAR_TEXTURE (PERMUTATION_SPECULAR_TEXTURE != 0)
+#define FEATURE_EMISSION (PERMUTATION_EMISSION != 0)
+#define FEATURE_EMISSION_TEXTURE (PERMUTATION_EMISSION_TEXTURE != 0)
+#define FEATURE_GAMMA (PERMUTATION_GAMMA != 0)
+#define FEATURE_CUBE_MAP (PERMUTATION_CUBE_MAP != 0)
+#define FEATURE_INSTANCE_MATERIAL (PERMUTATION_INSTANCE_MATERIAL != 0)
+#define FEATURE_FOG (PERMUTATION_FOG != 0)
+#define FEATURE_CLUSTERED_LIGHTS (PERMUTATION_CLUSTERED_LIGHTS != 0)
+#define FEATURE_SHADOW (PERMUTATION_SHADOW != 0)
+#define LIGHT_ENABLED(i) ((PERMUTATION_LIGHT_MASK & (1 << (i))) != 0)
+#else
 uniform bool useBlinnPhong;
 uniform bool useLighting;
 uniform bool useDiffuseTexture;
 uniform bool useSpecularTexture;
 uniform bool useEmission;
 uniform bool useGamma;
-uniform float GammaValue;
-
 uniform bool isCubeMap;
-uniform bool enableCulling;
-uniform samplerCube skybox;
+uniform bool useInstanceMaterial;
+#define FEATURE_BLINN_PHONG useBlinnPhong
+#define FEATURE_LIGHTING useLighting
+#define FEATURE_DIFFUSE_TEXTURE (useDiffuseTexture && material.enableDiffuseTexture)
+#define FEATURE_SPECULAR_TEXTURE (useSpecularTexture && material.enableSpecularTexture)
+#define FEATURE_EMISSION (useEmission && material.enableEmission)
+#define FEATURE_EMISSION_TEXTURE material.enableEmissionTexture
+#define FEATURE_GAMMA useGamma
+#define FEATURE_CUBE_MAP isCubeMap
+#define FEATURE_INSTANCE_MATERIAL useInstanceMaterial
+#define FEATURE_FOG fog.enable
+#define FEATURE_CLUSTERED_LIGHTS (clusterDims.w > 0)
+#define FEATURE_SHADOW (shadowParams.x > 0.0)
+#define LIGHT_ENABLED(i) lights[i].enable
+#endif
+
+// std140 blocks shared by every program, see LightingUniformBlocks.h
+layout (std140) uniform LightBlock {
+	Light lights[NUM_LIGHTS];
+};
+layout (std140) uniform FogBlock {
+	Fog fog;
+};
+// The clustered point lights, see ClusteredLighting.h
+layout (std140) uniform ClusterBlock {
+	mat4 clusterViewProjection;
+	vec4 clusterViewDepth;
+	vec4 clusterSlicing;
+	ivec4 clusterDims;
+};
 
-uniform Material material;
-uniform Light lights[NUM_LIGHTS];
-uniform Plane clippingPlanes[6];
-uniform Fog fog;
+// Two texels per light: position and range, then colour.
+uniform samplerBuffer clusterLights;
+// Offset and count of the light list of each cluster.
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+
+// Shadow map of lights[0], see CachedShadowMap.h
+layout (std140) uniform ShadowBlock {
+	mat4 shadowLightSpace;
+	// Enabled, depth bias, texel size.
+	vec4 shadowParams;
+};
+uniform sampler2DShadow shadowMap;
+
+// 1 where lights[0] reaches the fragment, 0 where it is shadowed; 3 x 3 comparisons, each filtered.
+// Fragments outside the fitted light frustum are lit.
+float CalcShadow() {
+	vec4 light_space = shadowLightSpace * vec4(fs_in.FragPos, 1.0);
+	vec3 coords = light_space.xyz / light_space.w * 0.5 + 0.5;
+	if (coords.z > 1.0 || any(lessThan(coords.xy, vec2(0.0))) || any(greaterThan(coords.xy, vec2(1.0)))) {
+		return 1.0;
+	}
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++) {
+		for (int y = -1; y <= 1; y++) {
+			lit += texture(shadowMap, vec3(coords.xy + vec2(x, y) * shadowParams.z, coords.z - shadowParams.y));
+		}
+	}
+	return lit / 9.0;
+}
 
-vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4 texel_diffuse, vec4 texel_specular) {
+vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4 texel_diffuse, vec4 texel_specular, float shadow) {
 
 	vec3 ambient = vec3(0.0);
 	vec3 diffuse = vec3(0.0);
@@ -97,7 +169,7 @@ vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4
 	float diff = max(dot(normal, lightDir), 0.0);
 
 	float spec = 0.0;
-	if (useBlinnPhong) {
+	if (FEATURE_BLINN_PHONG) {
 		vec3 halfway = normalize(lightDir + viewDir);
 		spec = pow(max(dot(normal, halfway), 0.0), material.shininess);
 	} else {
@@ -111,14 +183,14 @@ vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4
 
 	if (light.caster == 0) {
 		// Direction Light
-		if (isCubeMap) {
+		if (FEATURE_CUBE_MAP) {
 			ambient = light.diffuse * texel_ambient.rgb;
 			diffuse = light.diffuse * texel_diffuse.rgb;
 			specular *= 0.0f;
 		}
 	} else {
 		// Point Light or Spot Light
-		if (isCubeMap) {
+		if (FEATURE_CUBE_MAP) {
 			ambient *= 0.0f;
 			diffuse *= 0.0f;
 			specular *= 0.0f;
@@ -144,7 +216,48 @@ vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec4 texel_ambient, vec4
 		}
 	}
 
-	return ambient + diffuse + specular;
+	return ambient + shadow * (diffuse + specular);
+}
+
+// Only the lights listed for the cluster of this fragment. Fragments outside the grid (seen from another
+// camera than the one it was built for) get none.
+vec3 CalcClusterLights(vec3 normal, vec3 viewDir, vec4 texel_diffuse, vec4 texel_specular) {
+	vec4 clip = clusterViewProjection * vec4(fs_in.FragPos, 1.0);
+	vec2 ndc = clip.xy / clip.w;
+	float depth = -dot(clusterViewDepth, vec4(fs_in.FragPos, 1.0));
+	if (clip.w <= 0.0 || any(greaterThan(abs(ndc), vec2(1.0))) || depth < clusterSlicing.z || depth > clusterSlicing.w) {
+		return vec3(0.0);
+	}
+	ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(clusterDims.xy)), ivec2(0), clusterDims.xy - 1);
+	int slice = clamp(int(log(depth) * clusterSlicing.x + clusterSlicing.y), 0, clusterDims.z - 1);
+	uvec2 list = texelFetch(clusterGrid, tile.x + clusterDims.x * (tile.y + clusterDims.y * slice)).rg;
+
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < list.y; i++) {
+		int light = int(texelFetch(clusterIndices, int(list.x + i)).r);
+		vec4 position_range = texelFetch(clusterLights, light * 2);
+		vec3 color = texelFetch(clusterLights, light * 2 + 1).rgb;
+
+		vec3 toLight = position_range.xyz - fs_in.FragPos;
+		float distance = length(toLight);
+		if (distance >= position_range.w) {
+			continue;
+		}
+		vec3 lightDir = toLight / distance;
+		// Inverse square, windowed to reach exactly zero at the range the light was clustered with.
+		float window = clamp(1.0 - pow(distance / position_range.w, 4.0), 0.0, 1.0);
+		float attenuation = window * window / (1.0 + distance * distance);
+
+		float diff = max(dot(normal, lightDir), 0.0);
+		float spec = 0.0;
+		if (FEATURE_BLINN_PHONG) {
+			spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), material.shininess);
+		} else {
+			spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), material.shininess);
+		}
+		result += color * attenuation * (diff * texel_diffuse.rgb + spec * texel_specular.rgb);
+	}
+	return result;
 }
 
 void main() {
@@ -154,46 +267,33 @@ void main() {
 	vec4 texel_ambient = vec4(0.0);
 	vec4 texel_diffuse = vec4(0.0);
 	vec4 texel_specular = vec4(0.0);
-	if (isCubeMap) {
+	if (FEATURE_CUBE_MAP) {
 		// ĥ cubemap
 		texel_ambient = texture(skybox, normalize(fs_in.NaviePos));
 		texel_diffuse = texture(skybox, normalize(fs_in.NaviePos));
 		texel_specular = texture(skybox, normalize(fs_in.NaviePos));
-	} else if (useDiffuseTexture && material.enableDiffuseTexture) {
+	} else if (FEATURE_DIFFUSE_TEXTURE) {
 		// pG}ܧ B Ӫ馳KϮ => Ϥ
 		texel_ambient = texture(material.diffuse_texture, fs_in.TexCoords);
 		texel_diffuse = texture(material.diffuse_texture, fs_in.TexCoords);
-		if (useSpecularTexture && material.enableSpecularTexture) {
+		if (FEATURE_SPECULAR_TEXTURE) {
 			texel_specular = texture(material.specular_texture, fs_in.TexCoords);
 		} else {
 			texel_specular = texture(material.diffuse_texture, fs_in.TexCoords);
 		}
 	} else {
 		// ¦
-		texel_ambient = material.ambient;
-		texel_diffuse = material.diffuse;
-		if (useSpecularTexture && material.enableSpecularTexture) {
+		texel_ambient = FEATURE_INSTANCE_MATERIAL ? fs_in.Ambient : material.ambient;
+		texel_diffuse = FEATURE_INSTANCE_MATERIAL ? fs_in.Diffuse : material.diffuse;
+		if (FEATURE_SPECULAR_TEXTURE) {
 			texel_specular = texture(material.specular_texture, fs_in.TexCoords);
 		} else {
-			texel_specular = material.specular;
-		}
-	}
-
-	// Culling with view volume
-	if (enableCulling) {
-		for(int i = 0; i < 6; i++) {
-			vec3 temp_1 = normalize(clippingPlanes[i].normal);
-			vec3 temp_2 = normalize(fs_in.FragPos - clippingPlanes[i].position);
-			float angle = dot(temp_1, temp_2);
-			if(angle > 0) {
-				discard;
-				break;
-			}
+			texel_specular = FEATURE_INSTANCE_MATERIAL ? fs_in.Specular : material.specular;
 		}
 	}
 
 	// O_}ҥ
-	if (!useLighting) {
+	if (!FEATURE_LIGHTING) {
 		// hz
 		if (texel_diffuse.a < 0.1) {
 			discard;
@@ -205,16 +305,20 @@ void main() {
 		vec3 illumination = vec3(0.0);
 
 		for (int i = 0; i < NUM_LIGHTS; i++) {
-			if (!lights[i].enable) {
+			if (!LIGHT_ENABLED(i)) {
 				continue;
 			}
-			illumination += CalcLight(lights[i], norm, viewDir, texel_ambient, texel_diffuse, texel_specular);
+			float shadow = (i == 0 && FEATURE_SHADOW && !FEATURE_CUBE_MAP) ? CalcShadow() : 1.0;
+			illumination += CalcLight(lights[i], norm, viewDir, texel_ambient, texel_diffuse, texel_specular, shadow);
+		}
+		if (FEATURE_CLUSTERED_LIGHTS && !FEATURE_CUBE_MAP) {
+			illumination += CalcClusterLights(norm, viewDir, texel_diffuse, texel_specular);
 		}
 
 		// }Ҧ۵o
-		if (useEmission && material.enableEmission) {
+		if (FEATURE_EMISSION) {
 			// }Ҧ۵oﶵ B Ӫ馳}Ҧ۵o
-			if (material.enableEmissionTexture) {
+			if (FEATURE_EMISSION_TEXTURE) {
 				// ϥΦ۵o
 				illumination += texture(material.emission_texture, fs_in.TexCoords).rgb;
 			} else {
@@ -242,7 +346,7 @@ void main() {
 			distance = length(viewPos - fs_in.FragPos);
 		}
 
-		if (fog.enable) {
+		if (FEATURE_FOG) {
 			if (fog.mode == 0) {
 			// Foggy Effect Linear
 			fogFactor = clamp((fog.f_end - distance) / (fog.f_end - fog.f_start), 0.0, 1.0);
@@ -260,7 +364,7 @@ void main() {
 		}
 
 		// {ե
-		if (useGamma) {
+		if (FEATURE_GAMMA) {
 			FinalColor = vec4(pow(FinalColor.xyz, vec3(GammaValue)), FinalColor.w);
 		}
 
@@ -8,19 +8,44 @@ out VS_OUT {
 	vec3 FragPos;
 	vec3 Normal;
 	vec2 TexCoords;
+	flat vec4 Ambient;
+	flat vec4 Diffuse;
+	flat vec4 Specular;
 } vs_out;
 
 uniform mat4 model;
 uniform mat3 normalModel;
 uniform mat4 view;
 uniform mat4 projection;
+#ifdef PERMUTATION
+const bool isCubeMap = PERMUTATION_CUBE_MAP != 0;
+#else
 uniform bool isCubeMap;
+#endif
+
+struct Plane {
+	vec3 position;
+	vec3 normal;
+};
+
+// Normals are unit length and point out of the view volume, see LightingUniformBlocks.h
+layout (std140) uniform ClippingBlock {
+	Plane clippingPlanes[6];
+};
 
 void main() {
 	vs_out.NaviePos = aPosition;
 	vs_out.FragPos =  vec3(model * vec4(aPosition, 1.0));
 	vs_out.Normal = normalModel * aNormal;
 	vs_out.TexCoords = aTextureCoords;
+	vs_out.Ambient = vec4(0.0);
+	vs_out.Diffuse = vec4(0.0);
+	vs_out.Specular = vec4(0.0);
+
+	// Positive inside the view volume; only used while GL_CLIP_DISTANCE0..5 are enabled.
+	for (int i = 0; i < 6; i++) {
+		gl_ClipDistance[i] = -dot(clippingPlanes[i].normal, vs_out.FragPos - clippingPlanes[i].position);
+	}
 
 	if (isCubeMap) {
 		// øsѪŲ
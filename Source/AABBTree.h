@@ -0,0 +1,374 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Fat boxes are this much larger than what they hold, so small moves do not touch the tree.
+constexpr float AABB_TREE_MARGIN = 0.1f;
+// Moving proxies are also stretched this many steps' worth of displacement ahead.
+constexpr float AABB_TREE_DISPLACEMENT_MULTIPLIER = 2.0f;
+// Depth-first stack of the queries. A balanced tree this deep would hold far more than 2^64 leaves.
+constexpr int AABB_TREE_STACK_SIZE = 128;
+constexpr int AABB_TREE_NULL_NODE = -1;
+
+struct AABB {
+	glm::vec3 Min;
+	glm::vec3 Max;
+
+	AABB() = default;
+	AABB(const glm::vec3& min, const glm::vec3& max) : Min(min), Max(max) {}
+
+	bool Overlaps(const AABB& other) const {
+		return this->Min.x <= other.Max.x && this->Max.x >= other.Min.x
+			&& this->Min.y <= other.Max.y && this->Max.y >= other.Min.y
+			&& this->Min.z <= other.Max.z && this->Max.z >= other.Min.z;
+	}
+
+	bool Contains(const AABB& other) const {
+		return this->Min.x <= other.Min.x && this->Min.y <= other.Min.y && this->Min.z <= other.Min.z
+			&& this->Max.x >= other.Max.x && this->Max.y >= other.Max.y && this->Max.z >= other.Max.z;
+	}
+
+	float GetSurfaceArea() const {
+		glm::vec3 extent = this->Max - this->Min;
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+	// Where the segment origin + t * delta, t in [0, max_fraction], enters the box grown by radius.
+	// enter is 0 when the segment starts inside.
+	bool IntersectSegment(const glm::vec3& origin, const glm::vec3& delta, float radius, float max_fraction, float& enter) const {
+		enter = 0.0f;
+		float exit = max_fraction;
+		for (int axis = 0; axis < 3; axis++) {
+			float min = this->Min[axis] - radius, max = this->Max[axis] + radius;
+			if (delta[axis] == 0.0f) {
+				if (origin[axis] < min || origin[axis] > max) {
+					return false;
+				}
+				continue;
+			}
+			float t0 = (min - origin[axis]) / delta[axis];
+			float t1 = (max - origin[axis]) / delta[axis];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			enter = std::max(enter, t0);
+			exit = std::min(exit, t1);
+			if (enter > exit) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static AABB Union(const AABB& a, const AABB& b) {
+		return AABB(glm::min(a.Min, b.Min), glm::max(a.Max, b.Max));
+	}
+};
+
+// Dynamic bounding volume hierarchy. Every proxy is a leaf holding a fat box and a user value; inner
+// nodes are inserted by surface area cost and kept balanced by rotations, so queries are O(log n).
+// MoveProxy only re-inserts a leaf when its object leaves the fat box, so slow movers are almost free.
+class AABBTree {
+public:
+	int CreateProxy(const AABB& aabb, unsigned int user_data) {
+		int proxy = this->AllocateNode();
+		Node& node = this->Nodes[proxy];
+		node.Box = AABB(aabb.Min - glm::vec3(AABB_TREE_MARGIN), aabb.Max + glm::vec3(AABB_TREE_MARGIN));
+		node.UserData = user_data;
+		node.Height = 0;
+		this->InsertLeaf(proxy);
+		this->ProxyCount++;
+		return proxy;
+	}
+
+	void DestroyProxy(int proxy) {
+		this->RemoveLeaf(proxy);
+		this->FreeNode(proxy);
+		this->ProxyCount--;
+	}
+
+	// Returns true when the leaf had to be re-inserted.
+	bool MoveProxy(int proxy, const AABB& aabb, const glm::vec3& displacement) {
+		if (this->Nodes[proxy].Box.Contains(aabb)) {
+			return false;
+		}
+		this->RemoveLeaf(proxy);
+		AABB fat(aabb.Min - glm::vec3(AABB_TREE_MARGIN), aabb.Max + glm::vec3(AABB_TREE_MARGIN));
+		glm::vec3 ahead = displacement * AABB_TREE_DISPLACEMENT_MULTIPLIER;
+		fat.Min += glm::min(ahead, glm::vec3(0.0f));
+		fat.Max += glm::max(ahead, glm::vec3(0.0f));
+		this->Nodes[proxy].Box = fat;
+		this->InsertLeaf(proxy);
+		return true;
+	}
+
+	void Clear() {
+		this->Nodes.clear();
+		this->Root = AABB_TREE_NULL_NODE;
+		this->FreeList = AABB_TREE_NULL_NODE;
+		this->ProxyCount = 0;
+	}
+
+	unsigned int GetUserData(int proxy) const { return this->Nodes[proxy].UserData; }
+	const AABB& GetFatAABB(int proxy) const { return this->Nodes[proxy].Box; }
+	unsigned int GetProxyCount() const { return this->ProxyCount; }
+	int GetHeight() const { return this->Root == AABB_TREE_NULL_NODE ? 0 : this->Nodes[this->Root].Height; }
+
+	// Calls callback(user_data) for every proxy whose fat box overlaps aabb.
+	template <typename Callback>
+	void Query(const AABB& aabb, Callback callback) const {
+		int stack[AABB_TREE_STACK_SIZE];
+		this->QueryWithStack(aabb, callback, stack);
+	}
+
+	// Query for many spheres in a row: sphere(k, center, radius) fills in sphere k, then callback(k, user_data)
+	// runs for every proxy overlapping its bounds. The spheres are read one at a time, so the callback may
+	// move the sphere it was called for.
+	template <typename SphereFn, typename Callback>
+	void QuerySpheres(unsigned int begin, unsigned int end, SphereFn sphere, Callback callback) const {
+		if (this->Root == AABB_TREE_NULL_NODE) {
+			return;
+		}
+		int stack[AABB_TREE_STACK_SIZE];
+		for (unsigned int k = begin; k < end; k++) {
+			glm::vec3 center;
+			float radius;
+			sphere(k, center, radius);
+			AABB bounds(center - glm::vec3(radius), center + glm::vec3(radius));
+			this->QueryWithStack(bounds, [&](unsigned int user_data) { callback(k, user_data); }, stack);
+		}
+	}
+
+	// Casts the segment origin + t * delta, t in [0, max_fraction], fattened by radius (0 for a plain ray)
+	// against the fat boxes. callback(user_data, max_fraction) returns the fraction to clip the segment
+	// to: the hit of its own exact test, max_fraction to ignore the proxy or 0 to stop.
+	template <typename Callback>
+	void RayCast(const glm::vec3& origin, const glm::vec3& delta, float radius, float max_fraction, Callback callback) const {
+		if (this->Root == AABB_TREE_NULL_NODE) {
+			return;
+		}
+		int stack[AABB_TREE_STACK_SIZE];
+		int count = 0;
+		stack[count++] = this->Root;
+		while (count > 0) {
+			const Node& node = this->Nodes[stack[--count]];
+			float enter;
+			if (!node.Box.IntersectSegment(origin, delta, radius, max_fraction, enter)) {
+				continue;
+			}
+			if (node.IsLeaf()) {
+				float value = callback(node.UserData, max_fraction);
+				if (value == 0.0f) {
+					return;
+				}
+				max_fraction = std::min(max_fraction, value);
+			} else if (count + 2 <= AABB_TREE_STACK_SIZE) {
+				stack[count++] = node.Child1;
+				stack[count++] = node.Child2;
+			}
+		}
+	}
+
+private:
+	struct Node {
+		AABB Box;
+		unsigned int UserData = 0;
+		// Parent while in the tree, next free node while in the free list.
+		int Parent = AABB_TREE_NULL_NODE;
+		int Child1 = AABB_TREE_NULL_NODE;
+		int Child2 = AABB_TREE_NULL_NODE;
+		// Leaves are 0, free nodes -1.
+		int Height = -1;
+
+		bool IsLeaf() const { return this->Child1 == AABB_TREE_NULL_NODE; }
+	};
+
+	std::vector<Node> Nodes;
+	int Root = AABB_TREE_NULL_NODE;
+	int FreeList = AABB_TREE_NULL_NODE;
+	unsigned int ProxyCount = 0;
+
+	template <typename Callback>
+	void QueryWithStack(const AABB& aabb, Callback&& callback, int* stack) const {
+		if (this->Root == AABB_TREE_NULL_NODE) {
+			return;
+		}
+		int count = 0;
+		stack[count++] = this->Root;
+		while (count > 0) {
+			const Node& node = this->Nodes[stack[--count]];
+			if (!node.Box.Overlaps(aabb)) {
+				continue;
+			}
+			if (node.IsLeaf()) {
+				callback(node.UserData);
+			} else if (count + 2 <= AABB_TREE_STACK_SIZE) {
+				stack[count++] = node.Child1;
+				stack[count++] = node.Child2;
+			}
+		}
+	}
+
+	int AllocateNode() {
+		if (this->FreeList == AABB_TREE_NULL_NODE) {
+			this->Nodes.emplace_back();
+			return (int)this->Nodes.size() - 1;
+		}
+		int node = this->FreeList;
+		this->FreeList = this->Nodes[node].Parent;
+		this->Nodes[node] = Node();
+		return node;
+	}
+
+	void FreeNode(int node) {
+		this->Nodes[node].Parent = this->FreeList;
+		this->Nodes[node].Height = -1;
+		this->FreeList = node;
+	}
+
+	void InsertLeaf(int leaf) {
+		if (this->Root == AABB_TREE_NULL_NODE) {
+			this->Root = leaf;
+			this->Nodes[leaf].Parent = AABB_TREE_NULL_NODE;
+			return;
+		}
+
+		// Walk down to the sibling that grows the total surface area the least.
+		AABB leaf_box = this->Nodes[leaf].Box;
+		int index = this->Root;
+		while (!this->Nodes[index].IsLeaf()) {
+			const Node& node = this->Nodes[index];
+			float area = node.Box.GetSurfaceArea();
+			float combined_area = AABB::Union(node.Box, leaf_box).GetSurfaceArea();
+			// Cost of making a new parent for this node and the leaf, and the cost pushed down to the children.
+			float cost = 2.0f * combined_area;
+			float inheritance_cost = 2.0f * (combined_area - area);
+			float cost1 = this->GetDescendCost(node.Child1, leaf_box) + inheritance_cost;
+			float cost2 = this->GetDescendCost(node.Child2, leaf_box) + inheritance_cost;
+			if (cost < cost1 && cost < cost2) {
+				break;
+			}
+			index = cost1 < cost2 ? node.Child1 : node.Child2;
+		}
+		int sibling = index;
+
+		int old_parent = this->Nodes[sibling].Parent;
+		int new_parent = this->AllocateNode();
+		this->Nodes[new_parent].Parent = old_parent;
+		this->Nodes[new_parent].Box = AABB::Union(leaf_box, this->Nodes[sibling].Box);
+		this->Nodes[new_parent].Height = this->Nodes[sibling].Height + 1;
+		this->Nodes[new_parent].Child1 = sibling;
+		this->Nodes[new_parent].Child2 = leaf;
+		this->Nodes[sibling].Parent = new_parent;
+		this->Nodes[leaf].Parent = new_parent;
+		if (old_parent == AABB_TREE_NULL_NODE) {
+			this->Root = new_parent;
+		} else if (this->Nodes[old_parent].Child1 == sibling) {
+			this->Nodes[old_parent].Child1 = new_parent;
+		} else {
+			this->Nodes[old_parent].Child2 = new_parent;
+		}
+
+		this->Refit(this->Nodes[leaf].Parent);
+	}
+
+	float GetDescendCost(int child, const AABB& leaf_box) const {
+		const Node& node = this->Nodes[child];
+		float combined_area = AABB::Union(leaf_box, node.Box).GetSurfaceArea();
+		return node.IsLeaf() ? combined_area : combined_area - node.Box.GetSurfaceArea();
+	}
+
+	void RemoveLeaf(int leaf) {
+		if (leaf == this->Root) {
+			this->Root = AABB_TREE_NULL_NODE;
+			return;
+		}
+		int parent = this->Nodes[leaf].Parent;
+		int grand_parent = this->Nodes[parent].Parent;
+		int sibling = this->Nodes[parent].Child1 == leaf ? this->Nodes[parent].Child2 : this->Nodes[parent].Child1;
+
+		if (grand_parent == AABB_TREE_NULL_NODE) {
+			this->Root = sibling;
+			this->Nodes[sibling].Parent = AABB_TREE_NULL_NODE;
+			this->FreeNode(parent);
+			return;
+		}
+		if (this->Nodes[grand_parent].Child1 == parent) {
+			this->Nodes[grand_parent].Child1 = sibling;
+		} else {
+			this->Nodes[grand_parent].Child2 = sibling;
+		}
+		this->Nodes[sibling].Parent = grand_parent;
+		this->FreeNode(parent);
+		this->Refit(grand_parent);
+	}
+
+	// Walks up from index, rebalancing and recomputing heights and boxes.
+	void Refit(int index) {
+		while (index != AABB_TREE_NULL_NODE) {
+			index = this->Balance(index);
+			Node& node = this->Nodes[index];
+			const Node& child1 = this->Nodes[node.Child1];
+			const Node& child2 = this->Nodes[node.Child2];
+			node.Height = 1 + std::max(child1.Height, child2.Height);
+			node.Box = AABB::Union(child1.Box, child2.Box);
+			index = node.Parent;
+		}
+	}
+
+	// Rotates the taller grandchild up when the children of a differ in height by more than one.
+	// Returns the node that now sits where a was.
+	int Balance(int a) {
+		Node& node_a = this->Nodes[a];
+		if (node_a.IsLeaf() || node_a.Height < 2) {
+			return a;
+		}
+		int b = node_a.Child1;
+		int c = node_a.Child2;
+		int balance = this->Nodes[c].Height - this->Nodes[b].Height;
+		if (balance > 1) {
+			return this->Rotate(a, c, b);
+		}
+		if (balance < -1) {
+			return this->Rotate(a, b, c);
+		}
+		return a;
+	}
+
+	// Lifts child (the taller child of a) into a's place; a keeps other and the shorter grandchild.
+	int Rotate(int a, int child, int other) {
+		int f = this->Nodes[child].Child1;
+		int g = this->Nodes[child].Child2;
+
+		Node& node_child = this->Nodes[child];
+		node_child.Child1 = a;
+		node_child.Parent = this->Nodes[a].Parent;
+		this->Nodes[a].Parent = child;
+		if (node_child.Parent == AABB_TREE_NULL_NODE) {
+			this->Root = child;
+		} else if (this->Nodes[node_child.Parent].Child1 == a) {
+			this->Nodes[node_child.Parent].Child1 = child;
+		} else {
+			this->Nodes[node_child.Parent].Child2 = child;
+		}
+
+		int tall = this->Nodes[f].Height > this->Nodes[g].Height ? f : g;
+		int short_one = tall == f ? g : f;
+		node_child.Child2 = tall;
+		if (this->Nodes[a].Child1 == child) {
+			this->Nodes[a].Child1 = short_one;
+		} else {
+			this->Nodes[a].Child2 = short_one;
+		}
+		this->Nodes[short_one].Parent = a;
+
+		Node& node_a = this->Nodes[a];
+		node_a.Box = AABB::Union(this->Nodes[other].Box, this->Nodes[short_one].Box);
+		node_a.Height = 1 + std::max(this->Nodes[other].Height, this->Nodes[short_one].Height);
+		node_child.Box = AABB::Union(node_a.Box, this->Nodes[tall].Box);
+		node_child.Height = 1 + std::max(node_a.Height, this->Nodes[tall].Height);
+		return child;
+	}
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+struct AllocationCount {
+	size_t Allocations = 0;
+	size_t Bytes = 0;
+
+	AllocationCount operator-(const AllocationCount& other) const {
+		return { this->Allocations - other.Allocations, this->Bytes - other.Bytes };
+	}
+
+	AllocationCount& operator+=(const AllocationCount& other) {
+		this->Allocations += other.Allocations;
+		this->Bytes += other.Bytes;
+		return *this;
+	}
+};
+
+// Counts every call to the global operator new of the program (all threads). The replacement operators
+// are only compiled in the translation unit that defines ALLOCATION_TRACKER_IMPLEMENTATION before
+// including this header; without them the counters simply stay at zero.
+class AllocationTracker {
+public:
+	static AllocationCount GetTotal() {
+		return { TotalAllocations.load(std::memory_order_relaxed), TotalBytes.load(std::memory_order_relaxed) };
+	}
+
+	static void Record(size_t size) {
+		TotalAllocations.fetch_add(1, std::memory_order_relaxed);
+		TotalBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+private:
+	static inline std::atomic<size_t> TotalAllocations{ 0 };
+	static inline std::atomic<size_t> TotalBytes{ 0 };
+};
+
+// Adds the allocations made during its lifetime to a counter: { AllocationScope scope(update_allocations); ... }
+class AllocationScope {
+public:
+	explicit AllocationScope(AllocationCount& target) : Target(target), Start(AllocationTracker::GetTotal()) {}
+	~AllocationScope() { this->Target += AllocationTracker::GetTotal() - this->Start; }
+
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+	AllocationCount& Target;
+	AllocationCount Start;
+};
+
+#if defined(ALLOCATION_TRACKER_IMPLEMENTATION)
+static void* TrackedAllocate(size_t size) {
+	AllocationTracker::Record(size);
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+static void* TrackedAllocateAligned(size_t size, std::align_val_t alignment) {
+	AllocationTracker::Record(size);
+	size_t align = (size_t)alignment;
+	size = (size + align - 1) / align * align;
+#if defined(_MSC_VER)
+	void* memory = _aligned_malloc(size == 0 ? align : size, align);
+#else
+	void* memory = std::aligned_alloc(align, size == 0 ? align : size);
+#endif
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+static void TrackedFreeAligned(void* memory) {
+#if defined(_MSC_VER)
+	_aligned_free(memory);
+#else
+	std::free(memory);
+#endif
+}
+
+void* operator new(size_t size) { return TrackedAllocate(size); }
+void* operator new[](size_t size) { return TrackedAllocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { try { return TrackedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return TrackedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new(size_t size, std::align_val_t alignment) { return TrackedAllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return TrackedAllocateAligned(size, alignment); }
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { TrackedFreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { TrackedFreeAligned(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { TrackedFreeAligned(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { TrackedFreeAligned(memory); }
+#endif
@@ -0,0 +1,495 @@
+#pragma once
+#include "Shader.h"
+#include "Logger.h"
+#include "Stopwatch.h"
+#include "stb_image.h"
+#include "BakedTexture.h"
+#include "MappedFile.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+// The upload ring has three pixel buffers so the CPU fills one while the GPU still copies out of the others.
+constexpr unsigned int TEXTURE_UPLOAD_RING_SLOTS = 3;
+constexpr size_t TEXTURE_UPLOAD_BYTES_PER_FRAME = 4 << 20;
+
+typedef unsigned int TextureHandle;
+
+enum TextureState : unsigned char {
+	TEXTURE_LOADING,
+	TEXTURE_READY,
+	TEXTURE_FAILED
+};
+
+// Loads textures without stalling the frame. Image files are decoded on worker threads; each frame
+// Update() copies at most a fixed number of bytes into a ring of pixel unpack buffers and lets the GPU
+// pull the rows from there. Until a texture is complete its handle binds a small placeholder, so the
+// first frame can be drawn as soon as Initialize() returns.
+// A baked file next to the image (see BakedTexture.h) wins when it was baked from the same image bytes:
+// it is only mapped, never decoded, and brings its own mip chain.
+class AssetLoader {
+public:
+	explicit AssetLoader(unsigned int thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1, size_t bytes_per_frame = TEXTURE_UPLOAD_BYTES_PER_FRAME)
+		: SlotSize(bytes_per_frame) {
+		this->CreatePlaceholders();
+		GLuint buffers[TEXTURE_UPLOAD_RING_SLOTS];
+		glGenBuffers(TEXTURE_UPLOAD_RING_SLOTS, buffers);
+		for (unsigned int s = 0; s < TEXTURE_UPLOAD_RING_SLOTS; s++) {
+			this->Ring[s].Buffer = buffers[s];
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[s]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, this->SlotSize, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		thread_count = std::max(1u, thread_count);
+		for (unsigned int i = 0; i < thread_count; i++) {
+			this->Workers.emplace_back([this]() { this->WorkerLoop(); });
+		}
+	}
+
+	~AssetLoader() {
+		{
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			this->Running = false;
+		}
+		this->Condition.notify_all();
+		for (std::thread& worker : this->Workers) {
+			worker.join();
+		}
+		for (DecodedImage& image : this->Decoded) {
+			Release(image);
+		}
+		for (DecodedImage& image : this->Uploads) {
+			Release(image);
+		}
+		for (Slot& slot : this->Ring) {
+			if (slot.Fence != nullptr) {
+				glDeleteSync(slot.Fence);
+			}
+			glDeleteBuffers(1, &slot.Buffer);
+		}
+		for (const TextureEntry& entry : this->Textures) {
+			if (entry.Texture != 0) {
+				glDeleteTextures(1, &entry.Texture);
+			}
+		}
+		glDeleteTextures(1, &this->Placeholder2D);
+		glDeleteTextures(1, &this->PlaceholderCube);
+	}
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	TextureHandle Load2D(const std::string& path, bool mipmaps = true, GLint wrap = GL_REPEAT) {
+		return this->Request(GL_TEXTURE_2D, &path, 1, mipmaps, wrap, true);
+	}
+
+	// Faces in the order +X, -X, +Y, -Y, +Z, -Z (right, left, top, bottom, front, back).
+	TextureHandle LoadCubeMap(const std::vector<std::string>& faces) {
+		return this->Request(GL_TEXTURE_CUBE_MAP, faces.data(), (unsigned int)std::min<size_t>(faces.size(), 6), false, GL_CLAMP_TO_EDGE, false);
+	}
+
+	// Streams the next part of the pending uploads. Call once per frame on the GL thread.
+	void Update() {
+		{
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			while (!this->Decoded.empty()) {
+				this->Accept(std::move(this->Decoded.front()));
+				this->Decoded.pop_front();
+			}
+		}
+		if (this->Uploads.empty()) {
+			return;
+		}
+
+		// Skip a frame rather than wait when the GPU has not finished with this slot yet.
+		Slot& slot = this->Ring[this->RingIndex];
+		if (slot.Fence != nullptr) {
+			if (glClientWaitSync(slot.Fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+				return;
+			}
+			glDeleteSync(slot.Fence);
+			slot.Fence = nullptr;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.Buffer);
+		unsigned char* mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, this->SlotSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		if (mapped == nullptr) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return;
+		}
+
+		// Rows are pixel rows, or rows of 4x4 blocks for compressed levels.
+		this->Chunks.clear();
+		size_t used = 0;
+		for (DecodedImage& image : this->Uploads) {
+			while (image.Level < image.LevelCount) {
+				const BakedTextureLevel& level = image.Levels[image.Level];
+				size_t row_bytes = GetBakedRowBytes(image.Format, level.Width);
+				unsigned int row_count = GetBakedRowCount(image.Format, level.Height);
+				unsigned int rows = (unsigned int)std::min<size_t>(row_count - image.NextRow, (this->SlotSize - used) / row_bytes);
+				if (rows == 0) {
+					break;
+				}
+				std::memcpy(mapped + used, image.Data + level.Offset + image.NextRow * row_bytes, rows * row_bytes);
+				this->Chunks.push_back({ &image, image.Level, image.NextRow, rows, used });
+				used += rows * row_bytes;
+				image.NextRow += rows;
+				if (image.NextRow == row_count) {
+					image.Level++;
+					image.NextRow = 0;
+				}
+			}
+			if (image.Level < image.LevelCount) {
+				break;
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		for (const Chunk& chunk : this->Chunks) {
+			DecodedImage& image = *chunk.Image;
+			TextureEntry& entry = this->Textures[image.Handle];
+			const BakedTextureLevel& level = image.Levels[chunk.Level];
+			GLenum target = entry.Target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.Face : GL_TEXTURE_2D;
+			unsigned int row_height = GetBakedRowHeight(image.Format);
+			GLint y = (GLint)(chunk.Row * row_height);
+			GLsizei height = (GLsizei)std::min<uint32_t>(chunk.Rows * row_height, level.Height - y);
+			GLsizei size = (GLsizei)(chunk.Rows * GetBakedRowBytes(image.Format, level.Width));
+			glBindTexture(entry.Target, entry.Texture);
+			if (image.Format == BAKED_FORMAT_RGBA8) {
+				glTexSubImage2D(target, chunk.Level, 0, y, level.Width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)chunk.Offset);
+			} else {
+				glCompressedTexSubImage2D(target, chunk.Level, 0, y, level.Width, height, GetInternalFormat(image.Format), size, (void*)chunk.Offset);
+			}
+			this->UploadedBytes += size;
+			if (chunk.Level + 1 == image.LevelCount && chunk.Row + chunk.Rows == GetBakedRowCount(image.Format, level.Height)) {
+				this->FinishFace(entry, image);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		this->RingIndex = (this->RingIndex + 1) % TEXTURE_UPLOAD_RING_SLOTS;
+
+		while (!this->Uploads.empty() && this->Uploads.front().Level == this->Uploads.front().LevelCount) {
+			this->Uploads.pop_front();
+		}
+	}
+
+	// The texture once it is complete, the matching placeholder before that.
+	GLuint Get(TextureHandle handle) const {
+		const TextureEntry& entry = this->Textures[handle];
+		if (entry.State == TEXTURE_READY) {
+			return entry.Texture;
+		}
+		return entry.Target == GL_TEXTURE_CUBE_MAP ? this->PlaceholderCube : this->Placeholder2D;
+	}
+
+	void Bind(TextureHandle handle, unsigned int unit) const {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(this->Textures[handle].Target, this->Get(handle));
+	}
+
+	GLenum GetTarget(TextureHandle handle) const { return this->Textures[handle].Target; }
+	TextureState GetState(TextureHandle handle) const { return this->Textures[handle].State; }
+	unsigned int GetTextureCount() const { return (unsigned int)this->Textures.size(); }
+	unsigned int GetReadyCount() const { return this->ReadyCount; }
+	unsigned int GetThreadCount() const { return (unsigned int)this->Workers.size(); }
+	size_t GetUploadedBytes() const { return this->UploadedBytes; }
+	unsigned int GetBakedCount() const { return this->BakedCount; }
+	bool IsIdle() const { return this->ReadyCount + this->FailedCount == this->Textures.size(); }
+	// From the first request to the last texture that completed.
+	float GetLoadMilliseconds() const { return this->LoadMilliseconds; }
+
+private:
+	struct TextureEntry {
+		GLenum Target = GL_TEXTURE_2D;
+		GLuint Texture = 0;
+		unsigned int FaceCount = 1;
+		unsigned int FacesDone = 0;
+		bool Mipmaps = false;
+		GLint Wrap = GL_REPEAT;
+		TextureState State = TEXTURE_LOADING;
+	};
+
+	struct DecodeRequest {
+		TextureHandle Handle;
+		unsigned int Face;
+		std::string Path;
+		bool Flip;
+	};
+
+	// One face ready for upload: either stb_image output (one RGBA8 level) or a mapped baked file.
+	struct DecodedImage {
+		TextureHandle Handle = 0;
+		unsigned int Face = 0;
+		unsigned char* Pixels = nullptr;
+		std::unique_ptr<MappedFile> Baked;
+		const unsigned char* Data = nullptr;
+		uint32_t Format = BAKED_FORMAT_RGBA8;
+		unsigned int LevelCount = 0;
+		BakedTextureLevel Levels[BAKED_TEXTURE_MAX_LEVELS] = {};
+		// Upload cursor.
+		unsigned int Level = 0;
+		unsigned int NextRow = 0;
+	};
+
+	struct Chunk {
+		DecodedImage* Image;
+		unsigned int Level;
+		unsigned int Row;
+		unsigned int Rows;
+		size_t Offset;
+	};
+
+	struct Slot {
+		GLuint Buffer = 0;
+		GLsync Fence = nullptr;
+	};
+
+	std::vector<TextureEntry> Textures;
+	GLuint Placeholder2D = 0;
+	GLuint PlaceholderCube = 0;
+	unsigned int ReadyCount = 0;
+	unsigned int FailedCount = 0;
+	unsigned int BakedCount = 0;
+
+	// Shared with the workers.
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable Condition;
+	std::deque<DecodeRequest> Requests;
+	std::deque<DecodedImage> Decoded;
+	bool Running = true;
+
+	// Main thread only.
+	std::deque<DecodedImage> Uploads;
+	std::vector<Chunk> Chunks;
+	Slot Ring[TEXTURE_UPLOAD_RING_SLOTS];
+	unsigned int RingIndex = 0;
+	size_t SlotSize = 0;
+	size_t UploadedBytes = 0;
+	Stopwatch LoadWatch;
+	float LoadMilliseconds = 0.0f;
+
+	TextureHandle Request(GLenum target, const std::string* paths, unsigned int face_count, bool mipmaps, GLint wrap, bool flip) {
+		if (this->IsIdle()) {
+			this->LoadWatch.Reset();
+		}
+		TextureHandle handle = (TextureHandle)this->Textures.size();
+		TextureEntry entry;
+		entry.Target = target;
+		entry.FaceCount = face_count;
+		entry.Mipmaps = mipmaps;
+		entry.Wrap = wrap;
+		glGenTextures(1, &entry.Texture);
+		this->Textures.push_back(entry);
+		{
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			for (unsigned int f = 0; f < face_count; f++) {
+				this->Requests.push_back({ handle, f, paths[f], flip });
+			}
+		}
+		this->Condition.notify_all();
+		return handle;
+	}
+
+	void WorkerLoop() {
+		while (true) {
+			DecodeRequest request;
+			{
+				std::unique_lock<std::mutex> lock(this->Mutex);
+				this->Condition.wait(lock, [this]() { return !this->Running || !this->Requests.empty(); });
+				if (!this->Running) {
+					return;
+				}
+				request = std::move(this->Requests.front());
+				this->Requests.pop_front();
+			}
+
+			DecodedImage image;
+			image.Handle = request.Handle;
+			image.Face = request.Face;
+			if (!OpenBaked(request, image)) {
+				int width = 0, height = 0, channels = 0;
+				image.Pixels = stbi_load(request.Path.c_str(), &width, &height, &channels, 4);
+				if (image.Pixels == nullptr) {
+					Nexus::Logger::Message(Nexus::LOG_ERROR, "Failed to load texture: " + request.Path);
+				} else {
+					if (request.Flip) {
+						// OpenGL starts at the bottom row.
+						FlipRows(image.Pixels, width, height);
+					}
+					image.Data = image.Pixels;
+					image.LevelCount = 1;
+					image.Levels[0] = { (uint32_t)width, (uint32_t)height, 0, (uint64_t)width * height * 4 };
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			this->Decoded.push_back(std::move(image));
+		}
+	}
+
+	// Maps path.ntex when it exists, was baked from this version of the image, matches the row order
+	// asked for and holds a format this context can take.
+	static bool OpenBaked(const DecodeRequest& request, DecodedImage& image) {
+		std::error_code error;
+		uintmax_t source_size = std::filesystem::file_size(request.Path, error);
+		auto file = std::make_unique<MappedFile>();
+		if (error || !file->Open(request.Path + BAKED_TEXTURE_EXTENSION)) {
+			return false;
+		}
+		const BakedTextureHeader* header = ReadBakedTextureHeader(file->GetData(), file->GetSize());
+		if (header == nullptr || header->SourceSize != source_size || ((header->Flags & BAKED_FLAG_FLIPPED) != 0) != request.Flip || GetInternalFormat(header->Format) == 0) {
+			return false;
+		}
+		// A same-size edit of the image only shows in its content.
+		MappedFile source(request.Path);
+		if (source.GetData() == nullptr || HashBakedSource(source.GetData(), source.GetSize()) != header->SourceHash) {
+			return false;
+		}
+		image.Data = file->GetData();
+		image.Format = header->Format;
+		image.LevelCount = header->LevelCount;
+		std::memcpy(image.Levels, header->Levels, sizeof(image.Levels));
+		image.Baked = std::move(file);
+		return true;
+	}
+
+	static GLenum GetInternalFormat(uint32_t format) {
+		switch (format) {
+		case BAKED_FORMAT_RGBA8:
+			return GL_RGBA8;
+#if defined(GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) && defined(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		case BAKED_FORMAT_BC1:
+			return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		case BAKED_FORMAT_BC3:
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+#endif
+		default:
+			return 0;
+		}
+	}
+
+	static void Release(DecodedImage& image) {
+		stbi_image_free(image.Pixels);
+		image.Pixels = nullptr;
+		image.Baked.reset();
+		image.Data = nullptr;
+	}
+
+	static void FlipRows(unsigned char* pixels, int width, int height) {
+		size_t row_bytes = (size_t)width * 4;
+		std::vector<unsigned char> row(row_bytes);
+		for (int y = 0; y < height / 2; y++) {
+			unsigned char* top = pixels + y * row_bytes;
+			unsigned char* bottom = pixels + (height - 1 - y) * row_bytes;
+			std::memcpy(row.data(), top, row_bytes);
+			std::memcpy(top, bottom, row_bytes);
+			std::memcpy(bottom, row.data(), row_bytes);
+		}
+	}
+
+	// Allocates the storage of every level of a freshly loaded face and queues its rows, or gives up on it.
+	// Runs before the unpack buffer is bound, otherwise the null pointer would be read as an offset.
+	void Accept(DecodedImage&& image) {
+		TextureEntry& entry = this->Textures[image.Handle];
+		if (image.Data == nullptr || GetBakedRowBytes(image.Format, image.Levels[0].Width) > this->SlotSize || entry.State != TEXTURE_LOADING) {
+			Release(image);
+			this->Fail(entry);
+			return;
+		}
+		if (!entry.Mipmaps) {
+			image.LevelCount = 1;
+		}
+		GLenum target = entry.Target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.Face : GL_TEXTURE_2D;
+		glBindTexture(entry.Target, entry.Texture);
+		for (unsigned int l = 0; l < image.LevelCount; l++) {
+			const BakedTextureLevel& level = image.Levels[l];
+			if (image.Format == BAKED_FORMAT_RGBA8) {
+				glTexImage2D(target, l, GL_RGBA8, level.Width, level.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			} else {
+				glCompressedTexImage2D(target, l, GetInternalFormat(image.Format), level.Width, level.Height, 0, (GLsizei)level.Size, nullptr);
+			}
+		}
+		glBindTexture(entry.Target, 0);
+		if (image.Baked != nullptr) {
+			this->BakedCount++;
+		}
+		this->Uploads.push_back(std::move(image));
+	}
+
+	void FinishFace(TextureEntry& entry, DecodedImage& image) {
+		unsigned int level_count = image.LevelCount;
+		bool can_generate = image.Format == BAKED_FORMAT_RGBA8;
+		Release(image);
+		entry.FacesDone++;
+		if (entry.FacesDone < entry.FaceCount) {
+			return;
+		}
+		glTexParameteri(entry.Target, GL_TEXTURE_WRAP_S, entry.Wrap);
+		glTexParameteri(entry.Target, GL_TEXTURE_WRAP_T, entry.Wrap);
+		if (entry.Target == GL_TEXTURE_CUBE_MAP) {
+			glTexParameteri(entry.Target, GL_TEXTURE_WRAP_R, entry.Wrap);
+		}
+		glTexParameteri(entry.Target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// Baked levels are used as they are; a single decoded level gets its chain from the driver.
+		if (entry.Mipmaps && level_count > 1) {
+			glTexParameteri(entry.Target, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+			glTexParameteri(entry.Target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		} else if (entry.Mipmaps && can_generate) {
+			glGenerateMipmap(entry.Target);
+			glTexParameteri(entry.Target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		} else {
+			glTexParameteri(entry.Target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		}
+		entry.State = TEXTURE_READY;
+		this->ReadyCount++;
+		this->Completed();
+	}
+
+	void Fail(TextureEntry& entry) {
+		if (entry.State == TEXTURE_LOADING) {
+			entry.State = TEXTURE_FAILED;
+			this->FailedCount++;
+			this->Completed();
+		}
+	}
+
+	void Completed() {
+		if (this->IsIdle()) {
+			this->LoadMilliseconds = this->LoadWatch.GetElapsedMilliseconds();
+		}
+	}
+
+	// Grey checkerboards, 2x2 texels.
+	void CreatePlaceholders() {
+		const unsigned char pixels[16] = {
+			96, 96, 96, 255, 160, 160, 160, 255,
+			160, 160, 160, 255, 96, 96, 96, 255
+		};
+		glGenTextures(1, &this->Placeholder2D);
+		glBindTexture(GL_TEXTURE_2D, this->Placeholder2D);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenTextures(1, &this->PlaceholderCube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, this->PlaceholderCube);
+		for (unsigned int f = 0; f < 6; f++) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Layout of the .ntex files written by Tools/TextureBaker: a fixed header followed by every mip level,
+// each starting on a 16 byte boundary. The level data is exactly what glTexSubImage2D or
+// glCompressedTexSubImage2D take, so a mapped file can be uploaded as it is.
+constexpr uint32_t BAKED_TEXTURE_MAGIC = 0x5854584E; // "NXTX"
+constexpr uint32_t BAKED_TEXTURE_VERSION = 2;
+constexpr unsigned int BAKED_TEXTURE_MAX_LEVELS = 16;
+constexpr unsigned int BAKED_TEXTURE_ALIGNMENT = 16;
+// Baked files sit next to their source: chessboard.png -> chessboard.png.ntex
+constexpr const char* BAKED_TEXTURE_EXTENSION = ".ntex";
+
+enum BakedTextureFormat : uint32_t {
+	BAKED_FORMAT_RGBA8,
+	BAKED_FORMAT_BC1,
+	BAKED_FORMAT_BC3
+};
+
+enum BakedTextureFlag : uint32_t {
+	// Rows are stored bottom-up, the way OpenGL expects a 2D image.
+	BAKED_FLAG_FLIPPED = 1u << 0
+};
+
+struct BakedTextureLevel {
+	uint32_t Width;
+	uint32_t Height;
+	uint64_t Offset;
+	uint64_t Size;
+};
+
+struct BakedTextureHeader {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t Format;
+	uint32_t Flags;
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t LevelCount;
+	// Size and HashBakedSource() of the image the file was baked from; if either differs the file is
+	// stale. Timestamps do not survive the copy into the build directory, so the content is compared.
+	uint32_t SourceSize;
+	uint64_t SourceHash;
+	BakedTextureLevel Levels[BAKED_TEXTURE_MAX_LEVELS];
+};
+static_assert(sizeof(BakedTextureHeader) == 40 + 24 * BAKED_TEXTURE_MAX_LEVELS, "BakedTextureHeader must not have padding");
+
+// FNV-1a of the bytes of the source image file.
+inline uint64_t HashBakedSource(const unsigned char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Bytes per 4x4 block, 0 for uncompressed formats.
+inline unsigned int GetBakedBlockBytes(uint32_t format) {
+	return format == BAKED_FORMAT_BC1 ? 8 : (format == BAKED_FORMAT_BC3 ? 16 : 0);
+}
+
+// Uploads go in rows: pixel rows for RGBA8, rows of 4x4 blocks for the compressed formats.
+inline unsigned int GetBakedRowHeight(uint32_t format) {
+	return GetBakedBlockBytes(format) == 0 ? 1 : 4;
+}
+
+inline size_t GetBakedRowBytes(uint32_t format, uint32_t width) {
+	unsigned int block_bytes = GetBakedBlockBytes(format);
+	return block_bytes == 0 ? (size_t)width * 4 : (size_t)((width + 3) / 4) * block_bytes;
+}
+
+inline unsigned int GetBakedRowCount(uint32_t format, uint32_t height) {
+	unsigned int row_height = GetBakedRowHeight(format);
+	return (height + row_height - 1) / row_height;
+}
+
+// The header of a baked file, or nullptr when the data is not a complete file of this version.
+inline const BakedTextureHeader* ReadBakedTextureHeader(const unsigned char* data, size_t size) {
+	if (data == nullptr || size < sizeof(BakedTextureHeader)) {
+		return nullptr;
+	}
+	const BakedTextureHeader* header = reinterpret_cast<const BakedTextureHeader*>(data);
+	if (header->Magic != BAKED_TEXTURE_MAGIC || header->Version != BAKED_TEXTURE_VERSION || header->Format > BAKED_FORMAT_BC3) {
+		return nullptr;
+	}
+	if (header->LevelCount == 0 || header->LevelCount > BAKED_TEXTURE_MAX_LEVELS) {
+		return nullptr;
+	}
+	for (unsigned int l = 0; l < header->LevelCount; l++) {
+		const BakedTextureLevel& level = header->Levels[l];
+		uint64_t expected = (uint64_t)GetBakedRowBytes(header->Format, level.Width) * GetBakedRowCount(header->Format, level.Height);
+		if (level.Width == 0 || level.Height == 0 || level.Size != expected || level.Offset > size || level.Size > size - level.Offset) {
+			return nullptr;
+		}
+	}
+	return header;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "ViewVolume.h"
+#include "BallSystem.h"
+#include "FrameArena.h"
+
+enum BallViewState : unsigned char {
+	BALL_INSIDE,
+	BALL_INTERSECTION,
+	BALL_OUTSIDE
+};
+
+const glm::vec4 BALL_AMBIENT = glm::vec4(0.2f, 0.2f, 0.2f, 1.0);
+const glm::vec4 BALL_SPECULAR = glm::vec4(0.55f, 0.45f, 0.45f, 1.0);
+// Inside: red, Intersection: green, Outside: blue
+const glm::vec4 BALL_DIFFUSE[3] = {
+	glm::vec4(1.0f, 0.25f, 0.25f, 1.0),
+	glm::vec4(0.25f, 1.0f, 0.25f, 1.0),
+	glm::vec4(0.25f, 0.25f, 1.0f, 1.0)
+};
+
+// The six planes of the view volume as n . p + d = 0 with unit outward normals, in SoA form so the
+// culling kernel can broadcast them. Built once per frame.
+struct FrustumPlanes {
+	float NormalX[6];
+	float NormalY[6];
+	float NormalZ[6];
+	float Distance[6];
+
+	static FrustumPlanes FromViewVolume(const Nexus::ViewVolume* view_volume) {
+		FrustumPlanes planes;
+		for (unsigned int p = 0; p < 6; p++) {
+			// Front, Top, Right pass through the near plane; Back, Bottom, Left through the far plane.
+			glm::vec3 point = (p <= 2) ? glm::vec3(view_volume->NearPlaneVertex[0]) : glm::vec3(view_volume->FarPlaneVertex[1]);
+			glm::vec3 normal = glm::normalize(glm::vec3(view_volume->ViewVolumeNormal[p]));
+			planes.NormalX[p] = normal.x;
+			planes.NormalY[p] = normal.y;
+			planes.NormalZ[p] = normal.z;
+			planes.Distance[p] = -glm::dot(normal, point);
+		}
+		return planes;
+	}
+};
+
+// Result of one culling pass. Every array lives in the frame arena and is valid until the next Reset().
+struct BallCullingLists {
+	BallViewState* States = nullptr;
+	unsigned int* Indices[3] = { nullptr, nullptr, nullptr };
+	unsigned int Counts[3] = { 0, 0, 0 };
+	unsigned int BallCount = 0;
+
+	const unsigned int* GetIndices(BallViewState state) const { return this->Indices[state]; }
+	unsigned int GetCount(BallViewState state) const { return this->Counts[state]; }
+};
+
+inline void EmitBallStates(BallCullingLists& lists, unsigned int first, unsigned int lanes, int outside_bits, int intersect_bits) {
+	for (unsigned int k = 0; k < lanes; k++) {
+		BallViewState state = (outside_bits >> k) & 1 ? BALL_OUTSIDE : ((intersect_bits >> k) & 1 ? BALL_INTERSECTION : BALL_INSIDE);
+		lists.States[first + k] = state;
+		lists.Indices[state][lists.Counts[state]++] = first + k;
+	}
+}
+
+#if defined(BALL_SYSTEM_AVX2)
+// Classifies whole groups of eight and returns the first ball left for the narrower paths.
+BALL_SYSTEM_AVX2_TARGET inline unsigned int CullBalls8(const BallSystem& balls, const FrustumPlanes& planes, BallCullingLists& lists, unsigned int count) {
+	unsigned int i = 0;
+	__m256 nx[6], ny[6], nz[6], nd[6];
+	for (unsigned int p = 0; p < 6; p++) {
+		nx[p] = _mm256_set1_ps(planes.NormalX[p]);
+		ny[p] = _mm256_set1_ps(planes.NormalY[p]);
+		nz[p] = _mm256_set1_ps(planes.NormalZ[p]);
+		nd[p] = _mm256_set1_ps(planes.Distance[p]);
+	}
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_loadu_ps(&balls.RenderX[i]);
+		__m256 y = _mm256_loadu_ps(&balls.RenderY[i]);
+		__m256 z = _mm256_loadu_ps(&balls.RenderZ[i]);
+		__m256 r = _mm256_loadu_ps(&balls.Radius[i]);
+		__m256 negative_r = _mm256_sub_ps(_mm256_setzero_ps(), r);
+		__m256 outside = _mm256_setzero_ps();
+		__m256 intersect = _mm256_setzero_ps();
+		for (unsigned int p = 0; p < 6; p++) {
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], x), _mm256_mul_ps(ny[p], y)), _mm256_mul_ps(nz[p], z)), nd[p]);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, r, _CMP_GE_OQ));
+			intersect = _mm256_or_ps(intersect, _mm256_cmp_ps(d, negative_r, _CMP_GT_OQ));
+		}
+		EmitBallStates(lists, i, 8, _mm256_movemask_ps(outside), _mm256_movemask_ps(intersect));
+	}
+	return i;
+}
+#endif
+
+// Classifies every ball, at the position it is drawn at, against the view volume, eight (AVX2, when the
+// CPU has it) or four (SSE2) balls at a time.
+// 點到平面的有號距離：正值在外側，負值在內側，介於 r ~ -r 之間都算是相交
+// 6平面只要任一個平面是判定 OutSide 就是OutSide
+inline void CullBalls(const BallSystem& balls, const FrustumPlanes& planes, FrameArena& arena, BallCullingLists& lists) {
+	unsigned int count = balls.Size();
+	lists.BallCount = count;
+	lists.States = arena.AllocateArray<BallViewState>(count);
+	for (unsigned int s = 0; s < 3; s++) {
+		lists.Indices[s] = arena.AllocateArray<unsigned int>(count);
+		lists.Counts[s] = 0;
+	}
+
+	unsigned int i = 0;
+#if defined(BALL_SYSTEM_AVX2)
+	if (CpuHasAVX2()) {
+		i = CullBalls8(balls, planes, lists, count);
+	}
+#endif
+#if defined(BALL_SYSTEM_SSE2)
+	__m128 nx[6], ny[6], nz[6], nd[6];
+	for (unsigned int p = 0; p < 6; p++) {
+		nx[p] = _mm_set1_ps(planes.NormalX[p]);
+		ny[p] = _mm_set1_ps(planes.NormalY[p]);
+		nz[p] = _mm_set1_ps(planes.NormalZ[p]);
+		nd[p] = _mm_set1_ps(planes.Distance[p]);
+	}
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_loadu_ps(&balls.RenderX[i]);
+		__m128 y = _mm_loadu_ps(&balls.RenderY[i]);
+		__m128 z = _mm_loadu_ps(&balls.RenderZ[i]);
+		__m128 r = _mm_loadu_ps(&balls.Radius[i]);
+		__m128 negative_r = _mm_sub_ps(_mm_setzero_ps(), r);
+		__m128 outside = _mm_setzero_ps();
+		__m128 intersect = _mm_setzero_ps();
+		for (unsigned int p = 0; p < 6; p++) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)), _mm_mul_ps(nz[p], z)), nd[p]);
+			outside = _mm_or_ps(outside, _mm_cmpge_ps(d, r));
+			intersect = _mm_or_ps(intersect, _mm_cmpgt_ps(d, negative_r));
+		}
+		EmitBallStates(lists, i, 4, _mm_movemask_ps(outside), _mm_movemask_ps(intersect));
+	}
+#endif
+	for (; i < count; i++) {
+		float x = balls.RenderX[i], y = balls.RenderY[i], z = balls.RenderZ[i], r = balls.Radius[i];
+		int outside = 0, intersect = 0;
+		for (unsigned int p = 0; p < 6; p++) {
+			float d = ((planes.NormalX[p] * x + planes.NormalY[p] * y) + planes.NormalZ[p] * z) + planes.Distance[p];
+			outside |= d >= r;
+			intersect |= d > -r;
+		}
+		EmitBallStates(lists, i, 1, outside, intersect);
+	}
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include "Shader.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+#include "BallSystem.h"
+#include "BallCulling.h"
+#include "LightingUniformBlocks.h"
+#include "RenderStateCache.h"
+
+// The persistent instance buffer is split in regions so the CPU writes one frame while the GPU reads the others.
+constexpr unsigned int BALL_INSTANCE_REGIONS = 3;
+constexpr unsigned int BALL_INSTANCE_MIN_CAPACITY = 1024;
+
+// Matches the per-instance attributes of instance.vert (locations 3 to 9).
+struct BallInstance {
+	glm::mat4 Model;
+	glm::vec4 Ambient;
+	glm::vec4 Diffuse;
+	glm::vec4 Specular;
+};
+
+// Draws every ball with instanced calls. Upload() writes the model matrices and colours straight into
+// a mapped instance buffer: persistently mapped when the context has GL 4.4 buffer storage, otherwise
+// orphaned and mapped again every frame. With culling the balls inside the view volume come first, the
+// intersecting ones after them and the outside ones, kept only for the shadow pass, last; so each group
+// is one draw and only the intersecting one pays for clipping.
+class BallRenderer {
+public:
+	BallRenderer(unsigned int sectors = 36, unsigned int stacks = 18) {
+#if defined(GL_MAP_PERSISTENT_BIT)
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		this->Persistent = major > 4 || (major == 4 && minor >= 4);
+#endif
+		this->CreateSphere(sectors, stacks);
+	}
+
+	~BallRenderer() {
+		this->ReleaseInstanceBuffer();
+		glDeleteBuffers(1, &this->VBO);
+		glDeleteBuffers(1, &this->EBO);
+		glDeleteVertexArrays(1, &this->VAO);
+	}
+
+	BallRenderer(const BallRenderer&) = delete;
+	BallRenderer& operator=(const BallRenderer&) = delete;
+
+	// Call once per frame, before any Draw() of that frame. With cull set Draw() skips the balls outside
+	// the view volume and the hardware clips the intersecting ones. They still cast shadows into it, so
+	// with shadows set they are uploaded for DrawShadow() all the same.
+	void Upload(const BallSystem& balls, const BallCullingLists& lists, bool cull, bool shadows) {
+		bool include_outside = !cull || shadows;
+		unsigned int count = lists.GetCount(BALL_INSIDE) + lists.GetCount(BALL_INTERSECTION) + (include_outside ? lists.GetCount(BALL_OUTSIDE) : 0);
+		this->Reserve(count);
+
+		BallInstance* instances = nullptr;
+		if (this->Persistent) {
+			// Fence the region the last frame drew from, then move on to the oldest one.
+			this->Fences[this->Region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			this->Region = (this->Region + 1) % BALL_INSTANCE_REGIONS;
+			this->WaitRegion(this->Region);
+			instances = this->Mapped + this->Region * this->Capacity;
+			this->InstanceOffset = this->Region * this->Capacity;
+		} else {
+			glBindBuffer(GL_ARRAY_BUFFER, this->InstanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, this->Capacity * sizeof(BallInstance), nullptr, GL_STREAM_DRAW);
+			if (count > 0) {
+				instances = static_cast<BallInstance*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(BallInstance), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+			}
+			this->InstanceOffset = 0;
+		}
+
+		if (instances != nullptr) {
+			unsigned int written = 0;
+			for (unsigned int s = BALL_INSIDE; s <= BALL_OUTSIDE; s++) {
+				BallViewState state = (BallViewState)s;
+				if (state == BALL_OUTSIDE && !include_outside) {
+					break;
+				}
+				WriteInstances(balls, lists.GetIndices(state), lists.GetCount(state), BALL_DIFFUSE[state], instances + written);
+				written += lists.GetCount(state);
+			}
+		} else {
+			count = 0;
+		}
+		this->ViewCount = (cull && count > 0) ? lists.GetCount(BALL_INSIDE) + lists.GetCount(BALL_INTERSECTION) : count;
+		this->ClippedFirst = (cull && count > 0) ? lists.GetCount(BALL_INSIDE) : count;
+
+		if (!this->Persistent) {
+			if (instances != nullptr) {
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		this->InstanceCount = count;
+	}
+
+	// The shader must come from instance.vert with useInstanceMaterial set. GL 3.3 has no base instance,
+	// so the clipped group is reached by moving the attribute offset. The vertex array is left bound;
+	// the state cache drops the next bind when nothing else bound one in between.
+	void Draw(RenderStateCache& state) {
+		if (this->ViewCount == 0) {
+			return;
+		}
+		state.BindVertexArray(this->VAO);
+		if (this->ClippedFirst > 0) {
+			this->DrawRange(0, this->ClippedFirst);
+		}
+		if (this->ClippedFirst < this->ViewCount) {
+			LightingUniformBlocks::EnableClipping(true);
+			this->DrawRange(this->ClippedFirst, this->ViewCount - this->ClippedFirst);
+			LightingUniformBlocks::EnableClipping(false);
+		}
+	}
+
+	// Every uploaded instance in one call and without clipping, for depth passes with a shader that reads
+	// only the position and the instance matrix (simple_depth_instance.vert).
+	void DrawShadow(RenderStateCache& state) {
+		if (this->InstanceCount == 0) {
+			return;
+		}
+		state.BindVertexArray(this->VAO);
+		this->DrawRange(0, this->InstanceCount);
+	}
+
+	bool IsPersistent() const { return this->Persistent; }
+	unsigned int GetInstanceCount() const { return this->InstanceCount; }
+	// Instances the camera draws; the rest are there for the shadow pass only.
+	unsigned int GetViewCount() const { return this->ViewCount; }
+	unsigned int GetClippedCount() const { return this->ViewCount - this->ClippedFirst; }
+	unsigned int GetCapacity() const { return this->Capacity; }
+
+private:
+	bool Persistent = false;
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+	GLsizei IndexCount = 0;
+
+	GLuint InstanceBuffer = 0;
+	BallInstance* Mapped = nullptr;
+	GLsync Fences[BALL_INSTANCE_REGIONS] = {};
+	unsigned int Region = 0;
+	unsigned int Capacity = 0;
+	unsigned int InstanceCount = 0;
+	unsigned int InstanceOffset = 0;
+	unsigned int ClippedFirst = 0;
+	unsigned int ViewCount = 0;
+	unsigned int BoundOffset = ~0u;
+
+	static void WriteInstances(const BallSystem& balls, const unsigned int* indices, unsigned int count, const glm::vec4& diffuse, BallInstance* instances) {
+		for (unsigned int k = 0; k < count; k++) {
+			unsigned int i = indices[k];
+			float radius = balls.Radius[i];
+			BallInstance& instance = instances[k];
+			instance.Model = glm::mat4(
+				glm::vec4(radius, 0.0f, 0.0f, 0.0f),
+				glm::vec4(0.0f, radius, 0.0f, 0.0f),
+				glm::vec4(0.0f, 0.0f, radius, 0.0f),
+				glm::vec4(balls.RenderX[i], balls.RenderY[i], balls.RenderZ[i], 1.0f)
+			);
+			instance.Ambient = BALL_AMBIENT;
+			instance.Diffuse = diffuse;
+			instance.Specular = BALL_SPECULAR;
+		}
+	}
+
+	// Unit sphere with clockwise front faces, like the rest of the scene (glFrontFace(GL_CW)).
+	void CreateSphere(unsigned int sectors, unsigned int stacks) {
+		const float pi = 3.14159265358979f;
+		std::vector<float> vertices;
+		std::vector<unsigned int> indices;
+		vertices.reserve((stacks + 1) * (sectors + 1) * 8);
+		for (unsigned int i = 0; i <= stacks; i++) {
+			float phi = pi / 2.0f - i * pi / stacks;
+			for (unsigned int j = 0; j <= sectors; j++) {
+				float theta = j * 2.0f * pi / sectors;
+				glm::vec3 p = glm::vec3(std::cos(phi) * std::cos(theta), std::sin(phi), std::cos(phi) * std::sin(theta));
+				vertices.insert(vertices.end(), { p.x, p.y, p.z, p.x, p.y, p.z, (float)j / sectors, (float)i / stacks });
+			}
+		}
+		for (unsigned int i = 0; i < stacks; i++) {
+			for (unsigned int j = 0; j < sectors; j++) {
+				unsigned int k1 = i * (sectors + 1) + j;
+				unsigned int k2 = k1 + sectors + 1;
+				if (i != 0) {
+					indices.insert(indices.end(), { k1, k2, k1 + 1 });
+				}
+				if (i != stacks - 1) {
+					indices.insert(indices.end(), { k1 + 1, k2, k2 + 1 });
+				}
+			}
+		}
+		this->IndexCount = (GLsizei)indices.size();
+
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glGenBuffers(1, &this->EBO);
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+		glBindVertexArray(0);
+	}
+
+	void Reserve(unsigned int count) {
+		if (count <= this->Capacity && this->InstanceBuffer != 0) {
+			return;
+		}
+		unsigned int capacity = std::max(BALL_INSTANCE_MIN_CAPACITY, this->Capacity);
+		while (capacity < count) {
+			capacity *= 2;
+		}
+		this->ReleaseInstanceBuffer();
+		this->Capacity = capacity;
+
+		glGenBuffers(1, &this->InstanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, this->InstanceBuffer);
+#if defined(GL_MAP_PERSISTENT_BIT)
+		if (this->Persistent) {
+			GLsizeiptr size = (GLsizeiptr)BALL_INSTANCE_REGIONS * capacity * sizeof(BallInstance);
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+			this->Mapped = static_cast<BallInstance*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+			if (this->Mapped == nullptr) {
+				// Fall back to orphaning with a fresh buffer, a storage buffer cannot be resized.
+				this->Persistent = false;
+				glDeleteBuffers(1, &this->InstanceBuffer);
+				glGenBuffers(1, &this->InstanceBuffer);
+				glBindBuffer(GL_ARRAY_BUFFER, this->InstanceBuffer);
+			}
+		}
+#endif
+		if (!this->Persistent) {
+			glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(BallInstance), nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		this->BoundOffset = ~0u;
+	}
+
+	void ReleaseInstanceBuffer() {
+		for (unsigned int r = 0; r < BALL_INSTANCE_REGIONS; r++) {
+			this->WaitRegion(r);
+		}
+		if (this->InstanceBuffer != 0) {
+			if (this->Mapped != nullptr) {
+				glBindBuffer(GL_ARRAY_BUFFER, this->InstanceBuffer);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				this->Mapped = nullptr;
+			}
+			glDeleteBuffers(1, &this->InstanceBuffer);
+			this->InstanceBuffer = 0;
+		}
+	}
+
+	void WaitRegion(unsigned int region) {
+		if (this->Fences[region] == nullptr) {
+			return;
+		}
+		GLenum result = glClientWaitSync(this->Fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED) {
+			result = glClientWaitSync(this->Fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		glDeleteSync(this->Fences[region]);
+		this->Fences[region] = nullptr;
+	}
+
+	void DrawRange(unsigned int first, unsigned int count) {
+		if (this->BoundOffset != this->InstanceOffset + first) {
+			this->BindInstanceAttributes(this->InstanceOffset + first);
+		}
+		glDrawElementsInstanced(GL_TRIANGLES, this->IndexCount, GL_UNSIGNED_INT, nullptr, count);
+	}
+
+	// The instance attributes point at the region of this frame, so switching region only moves the offset.
+	void BindInstanceAttributes(unsigned int first_instance) {
+		glBindBuffer(GL_ARRAY_BUFFER, this->InstanceBuffer);
+		size_t base = (size_t)first_instance * sizeof(BallInstance);
+		for (unsigned int column = 0; column < 4; column++) {
+			glEnableVertexAttribArray(3 + column);
+			glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(BallInstance), (void*)(base + offsetof(BallInstance, Model) + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + column, 1);
+		}
+		glEnableVertexAttribArray(7);
+		glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(BallInstance), (void*)(base + offsetof(BallInstance, Ambient)));
+		glVertexAttribDivisor(7, 1);
+		glEnableVertexAttribArray(8);
+		glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(BallInstance), (void*)(base + offsetof(BallInstance, Diffuse)));
+		glVertexAttribDivisor(8, 1);
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, sizeof(BallInstance), (void*)(base + offsetof(BallInstance, Specular)));
+		glVertexAttribDivisor(9, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		this->BoundOffset = first_instance;
+	}
+};
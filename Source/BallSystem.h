@@ -0,0 +1,568 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "Obstacle.h"
+#include "AABBTree.h"
+
+// The AVX2 kernels are compiled per function and only run when the CPU reports AVX2, so the build needs
+// no -mavx2 and the same binary falls back to SSE2 (or scalar code) everywhere else.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define BALL_SYSTEM_AVX2
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define BALL_SYSTEM_AVX2_TARGET
+#else
+#define BALL_SYSTEM_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BALL_SYSTEM_SSE2
+#endif
+
+#if defined(BALL_SYSTEM_AVX2)
+// AVX2 needs both the instructions (CPUID leaf 7) and the OS saving the YMM registers (OSXSAVE + XCR0).
+inline bool CpuHasAVX2() {
+	static const bool has_avx2 = [] {
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+		if (!avx || (_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}();
+	return has_avx2;
+}
+#endif
+
+constexpr float BALL_MAX_SPEED = 5.0f;
+constexpr float BALL_CONTACT_MARGIN = 0.01f;
+constexpr float BALL_RADIUS_PER_MASS = 0.05f;
+// A ball is at rest while it moves slower than this after its collisions, and may sleep once its whole
+// island has been at rest for BALL_SLEEP_TIME. A ball lying on something still gains gravity * dt
+// every step before the floor or an obstacle bounces it back, so that much is allowed on top.
+constexpr float BALL_SLEEP_SPEED = 0.1f;
+constexpr float BALL_SLEEP_TIME = 0.5f;
+// Most impacts a fast ball resolves within one step before it stops where the last one put it.
+constexpr unsigned int BALL_MAX_SWEEP_IMPACTS = 4;
+
+// B of a contact with the room or an obstacle: this bit plus the wall (0-5) or BALL_CONTACT_OBSTACLE + index.
+constexpr unsigned int BALL_CONTACT_STATIC = 0x80000000u;
+constexpr unsigned int BALL_CONTACT_OBSTACLE = 6;
+
+// A contact of ball A with ball B or with something static. Normal points from B to A.
+struct BallContact {
+	unsigned int A;
+	unsigned int B;
+	glm::vec3 Normal;
+	// Distance between the surfaces, negative while they overlap.
+	float Separation;
+
+	bool IsStatic() const { return (this->B & BALL_CONTACT_STATIC) != 0; }
+};
+
+// A ball that travels further than its radius in one step, and where it started that step.
+struct SweptBall {
+	unsigned int Index;
+	glm::vec3 Start;
+};
+
+// Structure-of-arrays storage for every ball in the room. The integration kernel only streams
+// the arrays it needs (position, velocity, force, inverse mass), so a ball costs 40 bytes per step
+// instead of the whole object.
+class BallSystem {
+public:
+	std::vector<float> PositionX, PositionY, PositionZ;
+	std::vector<float> VelocityX, VelocityY, VelocityZ;
+	std::vector<float> ForceX, ForceY, ForceZ;
+	std::vector<float> Mass;
+	std::vector<float> InverseMass;
+	std::vector<float> Radius;
+	// Position at the start of the last step, and the position drawn this frame: PhysicsWorld blends
+	// the two steps around the frame time so rendering stays smooth at any physics rate.
+	std::vector<float> PreviousX, PreviousY, PreviousZ;
+	std::vector<float> RenderX, RenderY, RenderZ;
+	// How long the ball has been at rest.
+	std::vector<float> RestTime;
+	// Sleeping balls are skipped by every pass of PhysicsWorld until their island is woken.
+	std::vector<unsigned char> Awake;
+	// Island of a sleeping ball, the index of one of its members when it fell asleep.
+	std::vector<unsigned int> Island;
+
+	unsigned int Add(glm::vec3 position, glm::vec3 velocity, float mass = 1.0f) {
+		this->PositionX.push_back(position.x);
+		this->PositionY.push_back(position.y);
+		this->PositionZ.push_back(position.z);
+		this->VelocityX.push_back(velocity.x);
+		this->VelocityY.push_back(velocity.y);
+		this->VelocityZ.push_back(velocity.z);
+		this->ForceX.push_back(0.0f);
+		this->ForceY.push_back(0.0f);
+		this->ForceZ.push_back(0.0f);
+		this->Mass.push_back(mass);
+		this->InverseMass.push_back(1.0f / mass);
+		this->Radius.push_back(mass * BALL_RADIUS_PER_MASS);
+		this->PreviousX.push_back(position.x);
+		this->PreviousY.push_back(position.y);
+		this->PreviousZ.push_back(position.z);
+		this->RenderX.push_back(position.x);
+		this->RenderY.push_back(position.y);
+		this->RenderZ.push_back(position.z);
+		this->RestTime.push_back(0.0f);
+		this->Awake.push_back(1);
+		this->Island.push_back(0);
+		this->MaxRadius = std::max(this->MaxRadius, this->Radius.back());
+		this->Revision++;
+		return this->Size() - 1;
+	}
+
+	void PopBack() {
+		bool was_largest = this->Radius.back() >= this->MaxRadius;
+		for (std::vector<float>* array : this->Arrays()) {
+			array->pop_back();
+		}
+		this->Awake.pop_back();
+		this->Island.pop_back();
+		if (was_largest) {
+			this->MaxRadius = this->Radius.empty() ? 0.0f : *std::max_element(this->Radius.begin(), this->Radius.end());
+		}
+		this->Revision++;
+	}
+
+	void Clear() {
+		for (std::vector<float>* array : this->Arrays()) {
+			array->clear();
+		}
+		this->Awake.clear();
+		this->Island.clear();
+		this->MaxRadius = 0.0f;
+		this->Revision++;
+	}
+
+	void Reserve(unsigned int count) {
+		for (std::vector<float>* array : this->Arrays()) {
+			array->reserve(count);
+		}
+		this->Awake.reserve(count);
+		this->Island.reserve(count);
+	}
+
+	// For bulk loads: makes room for count balls, whose arrays the caller then fills in directly before
+	// calling UpdateDerived.
+	void Resize(unsigned int count) {
+		for (std::vector<float>* array : this->Arrays()) {
+			array->resize(count);
+		}
+		this->Awake.resize(count);
+		this->Island.resize(count);
+		this->Revision++;
+	}
+
+	// Inverse mass and radius from the mass, exactly as Add computes them, and the drawn position.
+	void UpdateDerived() {
+		for (unsigned int i = 0; i < this->Size(); i++) {
+			this->InverseMass[i] = 1.0f / this->Mass[i];
+			this->Radius[i] = this->Mass[i] * BALL_RADIUS_PER_MASS;
+		}
+		this->RenderX = this->PositionX;
+		this->RenderY = this->PositionY;
+		this->RenderZ = this->PositionZ;
+		this->MaxRadius = this->Radius.empty() ? 0.0f : *std::max_element(this->Radius.begin(), this->Radius.end());
+		this->Revision++;
+	}
+
+	unsigned int Size() const { return (unsigned int)this->PositionX.size(); }
+	bool Empty() const { return this->PositionX.empty(); }
+
+	glm::vec3 GetPosition(unsigned int i) const { return glm::vec3(this->PositionX[i], this->PositionY[i], this->PositionZ[i]); }
+	glm::vec3 GetRenderPosition(unsigned int i) const { return glm::vec3(this->RenderX[i], this->RenderY[i], this->RenderZ[i]); }
+	glm::vec3 GetVelocity(unsigned int i) const { return glm::vec3(this->VelocityX[i], this->VelocityY[i], this->VelocityZ[i]); }
+	glm::vec3 GetNetForce(unsigned int i) const { return glm::vec3(this->ForceX[i], this->ForceY[i], this->ForceZ[i]); }
+	// Gravity is folded into the kernel instead of being accumulated as a force.
+	glm::vec3 GetAcceleration(unsigned int i) const { return this->GetNetForce(i) * this->InverseMass[i] + glm::vec3(0.0f, -this->Gravity, 0.0f); }
+	// The broad phase sizes its cells from this.
+	float GetMaxRadius() const { return this->MaxRadius; }
+	// Changes whenever balls are added or removed, so PhysicsWorld knows its awake list is out of date.
+	unsigned int GetRevision() const { return this->Revision; }
+	bool IsAwake(unsigned int i) const { return this->Awake[i] != 0; }
+
+	// A sleeping ball is drawn where it stopped; it is not interpolated any more.
+	void Sleep(unsigned int i, unsigned int island) {
+		this->Awake[i] = 0;
+		this->Island[i] = island;
+		this->SetVelocity(i, glm::vec3(0.0f));
+		this->PreviousX[i] = this->RenderX[i] = this->PositionX[i];
+		this->PreviousY[i] = this->RenderY[i] = this->PositionY[i];
+		this->PreviousZ[i] = this->RenderZ[i] = this->PositionZ[i];
+	}
+
+	void Wake(unsigned int i) {
+		this->Awake[i] = 1;
+		this->RestTime[i] = 0.0f;
+	}
+
+	void SetGravity(float gravity) {
+		this->Gravity = gravity;
+	}
+
+	void SetPosition(unsigned int i, const glm::vec3& position) {
+		this->PositionX[i] = position.x;
+		this->PositionY[i] = position.y;
+		this->PositionZ[i] = position.z;
+	}
+
+	void SetVelocity(unsigned int i, const glm::vec3& velocity) {
+		this->VelocityX[i] = velocity.x;
+		this->VelocityY[i] = velocity.y;
+		this->VelocityZ[i] = velocity.z;
+	}
+
+	void ApplyForce(unsigned int i, const glm::vec3& force) {
+		this->ForceX[i] += force.x;
+		this->ForceY[i] += force.y;
+		this->ForceZ[i] += force.z;
+	}
+
+	// Keeps every ball inside the room, flipping and damping the velocity on the hit axis.
+	void Edge(float elasticities) {
+		this->EdgeRange(0, this->Size(), elasticities);
+	}
+
+	void SavePreviousRange(unsigned int begin, unsigned int end) {
+		std::copy(this->PositionX.begin() + begin, this->PositionX.begin() + end, this->PreviousX.begin() + begin);
+		std::copy(this->PositionY.begin() + begin, this->PositionY.begin() + end, this->PreviousY.begin() + begin);
+		std::copy(this->PositionZ.begin() + begin, this->PositionZ.begin() + end, this->PreviousZ.begin() + begin);
+	}
+
+	// alpha = 0 draws the previous step, 1 the current one.
+	void InterpolateRange(unsigned int begin, unsigned int end, float alpha) {
+		for (unsigned int i = begin; i < end; i++) {
+			this->RenderX[i] = this->PreviousX[i] + (this->PositionX[i] - this->PreviousX[i]) * alpha;
+			this->RenderY[i] = this->PreviousY[i] + (this->PositionY[i] - this->PreviousY[i]) * alpha;
+			this->RenderZ[i] = this->PreviousZ[i] + (this->PositionZ[i] - this->PreviousZ[i]) * alpha;
+		}
+	}
+
+	void EdgeRange(unsigned int begin, unsigned int end, float elasticities) {
+		for (unsigned int i = begin; i < end; i++) {
+			float radius = this->Radius[i];
+			EdgeAxis(this->PositionX[i], this->VelocityX[i], radius, -10.0f, 10.0f, elasticities);
+			EdgeAxis(this->PositionY[i], this->VelocityY[i], radius, 0.0f, 20.0f, elasticities);
+			EdgeAxis(this->PositionZ[i], this->VelocityZ[i], radius, -10.0f, 10.0f, elasticities);
+		}
+	}
+
+	bool IsTouching(unsigned int i, unsigned int j) const {
+		float distance = glm::length(this->GetPosition(i) - this->GetPosition(j));
+		return distance < (this->Radius[i] + this->Radius[j] + BALL_CONTACT_MARGIN);
+	}
+
+	// The contact of two touching balls, for the solver.
+	BallContact GetBallContact(unsigned int i, unsigned int j) const {
+		glm::vec3 diff = this->GetPosition(i) - this->GetPosition(j);
+		float distance = glm::length(diff);
+		glm::vec3 normal = distance > 0.0f ? diff / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+		return { i, j, normal, distance - this->Radius[i] - this->Radius[j] };
+	}
+
+	// Contacts of the balls in [begin, end) with the room walls and the obstacles they are touching or
+	// about to touch. Balls sunk into an obstacle are left to CollisionWithObstacle.
+	void FindStaticContacts(unsigned int begin, unsigned int end, const std::vector<Obstacle>& obstacles, const AABBTree& obstacle_tree, std::vector<BallContact>& contacts) const {
+		const glm::vec3 room_min(-10.0f, 0.0f, -10.0f);
+		const glm::vec3 room_max(10.0f, 20.0f, 10.0f);
+		for (unsigned int i = begin; i < end; i++) {
+			glm::vec3 position = this->GetPosition(i);
+			float radius = this->Radius[i];
+			for (int axis = 0; axis < 3; axis++) {
+				glm::vec3 normal(0.0f);
+				float to_min = position[axis] - radius - room_min[axis];
+				if (to_min < BALL_CONTACT_MARGIN) {
+					normal[axis] = 1.0f;
+					contacts.push_back({ i, BALL_CONTACT_STATIC | (unsigned int)(axis * 2), normal, to_min });
+				}
+				float to_max = room_max[axis] - position[axis] - radius;
+				if (to_max < BALL_CONTACT_MARGIN) {
+					normal[axis] = -1.0f;
+					contacts.push_back({ i, BALL_CONTACT_STATIC | (unsigned int)(axis * 2 + 1), normal, to_max });
+				}
+			}
+		}
+		obstacle_tree.QuerySpheres(begin, end, [&](unsigned int i, glm::vec3& center, float& radius) {
+			center = this->GetPosition(i);
+			radius = this->Radius[i] + BALL_CONTACT_MARGIN;
+		}, [&](unsigned int i, unsigned int obstacle) {
+			glm::vec3 position = this->GetPosition(i);
+			glm::vec3 half_extents = obstacles[obstacle].GetSize() / 2.0f;
+			glm::vec3 closest = obstacles[obstacle].GetPosition() + glm::clamp(position - obstacles[obstacle].GetPosition(), -half_extents, half_extents);
+			float distance = glm::length(position - closest);
+			if (distance > 0.0f && distance - this->Radius[i] < BALL_CONTACT_MARGIN) {
+				contacts.push_back({ i, BALL_CONTACT_STATIC | (BALL_CONTACT_OBSTACLE + obstacle), (position - closest) / distance, distance - this->Radius[i] });
+			}
+		});
+	}
+
+	// obstacle_tree holds the index of every obstacle; only the ones near a ball are tested.
+	void CollisionWithObstacles(unsigned int begin, unsigned int end, const std::vector<Obstacle>& obstacles, const AABBTree& obstacle_tree, float elasticities) {
+		obstacle_tree.QuerySpheres(begin, end, [&](unsigned int i, glm::vec3& center, float& radius) {
+			center = this->GetPosition(i);
+			radius = this->Radius[i];
+		}, [&](unsigned int i, unsigned int obstacle) {
+			this->CollisionWithObstacle(i, obstacles[obstacle], elasticities);
+		});
+	}
+
+	void CollisionWithObstacle(unsigned int i, const Obstacle& obstacle, float elasticities) {
+		glm::vec3 position = this->GetPosition(i);
+		glm::vec3 diff = position - obstacle.GetPosition();
+		glm::vec3 aabb_half_extents = obstacle.GetSize() / 2.0f;
+		glm::vec3 clamped = glm::clamp(diff, -aabb_half_extents, aabb_half_extents);
+		glm::vec3 closest = obstacle.GetPosition() + clamped;
+		diff = position - closest;
+
+		if (glm::length(diff) < this->Radius[i]) {
+			// Collision
+			this->SetPosition(i, closest + glm::normalize(diff) * (this->Radius[i] + BALL_CONTACT_MARGIN));
+			this->SetVelocity(i, elasticities * -this->GetVelocity(i));
+		}
+	}
+
+	void UpdateRestTime(unsigned int begin, unsigned int end, float delta_time) {
+		float sleep_speed = BALL_SLEEP_SPEED + this->Gravity * delta_time;
+		for (unsigned int i = begin; i < end; i++) {
+			glm::vec3 velocity = this->GetVelocity(i);
+			bool resting = glm::dot(velocity, velocity) < sleep_speed * sleep_speed;
+			this->RestTime[i] = resting ? this->RestTime[i] + delta_time : 0.0f;
+		}
+	}
+
+	// Collects the balls that will move further than their radius in this step, before IntegrateRange
+	// moves them, so SweepRange can redo their motion without tunnelling.
+	void FindFastBalls(unsigned int begin, unsigned int end, float delta_time, std::vector<SweptBall>& fast) const {
+		for (unsigned int i = begin; i < end; i++) {
+			glm::vec3 velocity = this->GetVelocity(i) + this->GetAcceleration(i) * delta_time;
+			float travel = glm::length(velocity) * delta_time;
+			if (travel > this->Radius[i]) {
+				fast.push_back({ i, this->GetPosition(i) });
+			}
+		}
+	}
+
+	// Continuous collision for the balls found by FindFastBalls, after IntegrateRange gave them their new
+	// velocity: the sphere is swept from its start against the room walls and the obstacle boxes, and at
+	// each time of impact it bounces the same way the discrete tests would make it bounce and goes on
+	// for the rest of the step. Without an impact it ends exactly where IntegrateRange put it.
+	void SweepRange(const std::vector<SweptBall>& fast, float delta_time, const std::vector<Obstacle>& obstacles, const AABBTree& obstacle_tree, float elasticities) {
+		const glm::vec3 room_min(-10.0f, 0.0f, -10.0f);
+		const glm::vec3 room_max(10.0f, 20.0f, 10.0f);
+		for (const SweptBall& swept : fast) {
+			unsigned int i = swept.Index;
+			float radius = this->Radius[i];
+			glm::vec3 position = swept.Start;
+			glm::vec3 velocity = this->GetVelocity(i);
+			float remaining = delta_time;
+			for (unsigned int impact = 0; impact <= BALL_MAX_SWEEP_IMPACTS; impact++) {
+				glm::vec3 motion = velocity * remaining;
+				float first_hit = 1.0f;
+				int wall_axis = -1;
+				const Obstacle* hit_obstacle = nullptr;
+				glm::vec3 hit_normal(0.0f);
+				for (int axis = 0; axis < 3; axis++) {
+					float t = 1.0f;
+					if (motion[axis] > 0.0f) {
+						t = (room_max[axis] - radius - position[axis]) / motion[axis];
+					} else if (motion[axis] < 0.0f) {
+						t = (room_min[axis] + radius - position[axis]) / motion[axis];
+					}
+					if (t < first_hit) {
+						first_hit = std::max(t, 0.0f);
+						wall_axis = axis;
+					}
+				}
+				// The tree has already clipped the segment to the nearest hit so far (max_fraction), so a
+				// candidate only counts when its exact sweep lands before that.
+				obstacle_tree.RayCast(position, motion, radius, first_hit, [&](unsigned int index, float max_fraction) {
+					glm::vec3 normal;
+					float t = SweepSphereBox(position, motion, radius, obstacles[index], normal);
+					if (t >= max_fraction) {
+						return max_fraction;
+					}
+					first_hit = t;
+					wall_axis = -1;
+					hit_obstacle = &obstacles[index];
+					hit_normal = normal;
+					return t;
+				});
+
+				if ((wall_axis < 0 && hit_obstacle == nullptr) || impact == BALL_MAX_SWEEP_IMPACTS) {
+					position = position + motion * first_hit;
+					break;
+				}
+				position = position + motion * first_hit;
+				if (wall_axis >= 0) {
+					position[wall_axis] = motion[wall_axis] > 0.0f ? room_max[wall_axis] - radius : room_min[wall_axis] + radius;
+					velocity[wall_axis] = -velocity[wall_axis] * elasticities;
+				} else {
+					position = position + hit_normal * BALL_CONTACT_MARGIN;
+					velocity = elasticities * -velocity;
+				}
+				remaining = remaining * (1.0f - first_hit);
+			}
+			this->SetPosition(i, position);
+			this->SetVelocity(i, velocity);
+		}
+	}
+
+	// Semi-implicit Euler over every ball: v += (F / m + g) * dt, p += v * dt, then clear the forces.
+	// Runs eight balls per instruction with AVX2 (when the CPU has it), four with SSE2 and falls back to scalar code for the tail.
+	void Integrate(float delta_time, float gravity) {
+		this->SetGravity(gravity);
+		this->IntegrateRange(0, this->Size(), delta_time, gravity);
+	}
+
+	void IntegrateRange(unsigned int begin, unsigned int end, float delta_time, float gravity) {
+		unsigned int i = begin;
+#if defined(BALL_SYSTEM_AVX2)
+		if (CpuHasAVX2()) {
+			i = this->IntegrateRange8(i, end, delta_time, gravity);
+		}
+#endif
+#if defined(BALL_SYSTEM_SSE2)
+		const __m128 dt = _mm_set1_ps(delta_time);
+		const __m128 g = _mm_set1_ps(gravity);
+		const __m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4) {
+			__m128 inverse_mass = _mm_loadu_ps(&this->InverseMass[i]);
+			IntegrateAxis4(&this->PositionX[i], &this->VelocityX[i], &this->ForceX[i], inverse_mass, zero, dt);
+			IntegrateAxis4(&this->PositionY[i], &this->VelocityY[i], &this->ForceY[i], inverse_mass, g, dt);
+			IntegrateAxis4(&this->PositionZ[i], &this->VelocityZ[i], &this->ForceZ[i], inverse_mass, zero, dt);
+		}
+#endif
+		for (; i < end; i++) {
+			float inverse_mass = this->InverseMass[i];
+			IntegrateAxis1(this->PositionX[i], this->VelocityX[i], this->ForceX[i], inverse_mass, 0.0f, delta_time);
+			IntegrateAxis1(this->PositionY[i], this->VelocityY[i], this->ForceY[i], inverse_mass, gravity, delta_time);
+			IntegrateAxis1(this->PositionZ[i], this->VelocityZ[i], this->ForceZ[i], inverse_mass, 0.0f, delta_time);
+		}
+	}
+
+private:
+	float Gravity = 0.0f;
+	float MaxRadius = 0.0f;
+	unsigned int Revision = 0;
+
+	std::array<std::vector<float>*, 19> Arrays() {
+		return {
+			&this->PositionX, &this->PositionY, &this->PositionZ,
+			&this->VelocityX, &this->VelocityY, &this->VelocityZ,
+			&this->ForceX, &this->ForceY, &this->ForceZ,
+			&this->Mass, &this->InverseMass, &this->Radius,
+			&this->PreviousX, &this->PreviousY, &this->PreviousZ,
+			&this->RenderX, &this->RenderY, &this->RenderZ,
+			&this->RestTime
+		};
+	}
+
+	// Time of impact in [0, 1) of a sphere moving by motion against the box grown by the radius, or 1 when
+	// it does not hit. The grown box has square edges, so a ball passing close to a corner stops a little
+	// early, which only makes the sweep conservative. Balls already overlapping are left to the discrete test.
+	static float SweepSphereBox(const glm::vec3& position, const glm::vec3& motion, float radius, const Obstacle& obstacle, glm::vec3& normal) {
+		glm::vec3 half_extents = obstacle.GetSize() / 2.0f + glm::vec3(radius);
+		glm::vec3 box_min = obstacle.GetPosition() - half_extents;
+		glm::vec3 box_max = obstacle.GetPosition() + half_extents;
+		float enter = -1.0f, exit = 1.0f;
+		int enter_axis = -1;
+		for (int axis = 0; axis < 3; axis++) {
+			if (motion[axis] == 0.0f) {
+				if (position[axis] < box_min[axis] || position[axis] > box_max[axis]) {
+					return 1.0f;
+				}
+				continue;
+			}
+			float t0 = (box_min[axis] - position[axis]) / motion[axis];
+			float t1 = (box_max[axis] - position[axis]) / motion[axis];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			if (t0 > enter) {
+				enter = t0;
+				enter_axis = axis;
+			}
+			exit = std::min(exit, t1);
+		}
+		if (enter_axis < 0 || enter < 0.0f || enter > exit || enter >= 1.0f) {
+			return 1.0f;
+		}
+		normal = glm::vec3(0.0f);
+		normal[enter_axis] = motion[enter_axis] > 0.0f ? -1.0f : 1.0f;
+		return enter;
+	}
+
+	static void EdgeAxis(float& position, float& velocity, float radius, float min, float max, float elasticities) {
+		if (position + radius > max) {
+			position = max - radius;
+			velocity = -velocity * elasticities;
+		} else if (position - radius < min) {
+			position = min + radius;
+			velocity = -velocity * elasticities;
+		}
+	}
+
+	// The SIMD and scalar paths do the same mul/sub/add sequence (no FMA) so a ball integrates
+	// to the same bits whichever lane it lands in.
+	static void IntegrateAxis1(float& position, float& velocity, float& force, float inverse_mass, float gravity, float dt) {
+		float acceleration = force * inverse_mass - gravity;
+		velocity = velocity + acceleration * dt;
+		position = position + velocity * dt;
+		force = 0.0f;
+	}
+
+#if defined(BALL_SYSTEM_AVX2)
+	// Integrates whole groups of eight from begin and returns where the narrower paths take over.
+	BALL_SYSTEM_AVX2_TARGET unsigned int IntegrateRange8(unsigned int begin, unsigned int end, float delta_time, float gravity) {
+		unsigned int i = begin;
+		const __m256 dt = _mm256_set1_ps(delta_time);
+		const __m256 g = _mm256_set1_ps(gravity);
+		const __m256 zero = _mm256_setzero_ps();
+		for (; i + 8 <= end; i += 8) {
+			__m256 inverse_mass = _mm256_loadu_ps(&this->InverseMass[i]);
+			IntegrateAxis8(&this->PositionX[i], &this->VelocityX[i], &this->ForceX[i], inverse_mass, zero, dt);
+			IntegrateAxis8(&this->PositionY[i], &this->VelocityY[i], &this->ForceY[i], inverse_mass, g, dt);
+			IntegrateAxis8(&this->PositionZ[i], &this->VelocityZ[i], &this->ForceZ[i], inverse_mass, zero, dt);
+		}
+		return i;
+	}
+
+	BALL_SYSTEM_AVX2_TARGET static void IntegrateAxis8(float* position, float* velocity, float* force, __m256 inverse_mass, __m256 gravity, __m256 dt) {
+		__m256 acceleration = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(force), inverse_mass), gravity);
+		__m256 v = _mm256_add_ps(_mm256_loadu_ps(velocity), _mm256_mul_ps(acceleration, dt));
+		__m256 p = _mm256_add_ps(_mm256_loadu_ps(position), _mm256_mul_ps(v, dt));
+		_mm256_storeu_ps(velocity, v);
+		_mm256_storeu_ps(position, p);
+		_mm256_storeu_ps(force, _mm256_setzero_ps());
+	}
+#endif
+#if defined(BALL_SYSTEM_SSE2)
+	static void IntegrateAxis4(float* position, float* velocity, float* force, __m128 inverse_mass, __m128 gravity, __m128 dt) {
+		__m128 acceleration = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(force), inverse_mass), gravity);
+		__m128 v = _mm_add_ps(_mm_loadu_ps(velocity), _mm_mul_ps(acceleration, dt));
+		__m128 p = _mm_add_ps(_mm_loadu_ps(position), _mm_mul_ps(v, dt));
+		_mm_storeu_ps(velocity, v);
+		_mm_storeu_ps(position, p);
+		_mm_storeu_ps(force, _mm_setzero_ps());
+	}
+#endif
+};
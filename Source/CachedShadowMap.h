@@ -0,0 +1,223 @@
+#pragma once
+#include "Shader.h"
+#include "LightingUniformBlocks.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+constexpr GLsizei SHADOW_MAP_SIZE = 2048;
+// The unit the commented-out shadow code already kept free.
+constexpr unsigned int SHADOW_MAP_UNIT = 4;
+// The light frustum grows and shrinks in steps of this many metres, so small camera moves keep the cache.
+constexpr float SHADOW_FIT_SNAP = 1.0f;
+// Depth bias in the [0, 1] depth of the map, on top of the polygon offset of the passes.
+constexpr float SHADOW_DEPTH_BIAS = 0.0005f;
+
+// std140 image of ShadowBlock in lighting.frag.
+struct ShadowStd140 {
+	glm::mat4 LightSpace;
+	// Enabled (0 or 1), depth bias, texel size; w is unused.
+	glm::vec4 Params;
+};
+static_assert(sizeof(ShadowStd140) == 80, "ShadowStd140 must match the std140 layout of ShadowBlock");
+
+// Shadow map of one directional light, split by caster. Static casters go into a depth map that is only
+// rendered again when the light frustum or the static casters change; every other frame that map is
+// copied into a second one and only the dynamic casters are drawn on top of the copy. The frustum is
+// fitted around the part of the scene the camera can see and snapped to SHADOW_FIT_SNAP. Only GL 3.3 core
+// (depth textures, glBlitFramebuffer, sampler2DShadow) is used, so it runs on software rasterizers too.
+//
+// Per frame: Fit(), SetStaticSignature(), the passes that are needed, then UpdateBlock().
+class CachedShadowMap {
+public:
+	CachedShadowMap() {
+		GLuint textures[2];
+		GLuint framebuffers[2];
+		glGenTextures(2, textures);
+		glGenFramebuffers(2, framebuffers);
+		this->StaticTexture = textures[0];
+		this->DynamicTexture = textures[1];
+		this->StaticFramebuffer = framebuffers[0];
+		this->DynamicFramebuffer = framebuffers[1];
+		this->Complete = CreateDepthTarget(this->StaticFramebuffer, this->StaticTexture) && CreateDepthTarget(this->DynamicFramebuffer, this->DynamicTexture);
+
+		glGenBuffers(1, &this->BlockBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->BlockBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(this->Block), &this->Block, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, this->BlockBuffer);
+	}
+
+	~CachedShadowMap() {
+		GLuint textures[2] = { this->StaticTexture, this->DynamicTexture };
+		GLuint framebuffers[2] = { this->StaticFramebuffer, this->DynamicFramebuffer };
+		glDeleteFramebuffers(2, framebuffers);
+		glDeleteTextures(2, textures);
+		glDeleteBuffers(1, &this->BlockBuffer);
+	}
+
+	CachedShadowMap(const CachedShadowMap&) = delete;
+	CachedShadowMap& operator=(const CachedShadowMap&) = delete;
+
+	// Fits the light frustum for light_direction around receiver_points (e.g. the view volume corners)
+	// clipped to the scene box. Its depth range always covers the whole scene box, so casters outside
+	// the view still throw their shadows into it. Drops the cached map when the result changed.
+	void Fit(const glm::vec3& light_direction, const glm::vec3* receiver_points, unsigned int point_count, const glm::vec3& scene_min, const glm::vec3& scene_max) {
+		this->Composited = false;
+		glm::vec3 direction = glm::normalize(light_direction);
+		glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 light_view = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+		glm::vec3 receiver_min(INFINITY);
+		glm::vec3 receiver_max(-INFINITY);
+		for (unsigned int i = 0; i < point_count; i++) {
+			receiver_min = glm::min(receiver_min, receiver_points[i]);
+			receiver_max = glm::max(receiver_max, receiver_points[i]);
+		}
+		receiver_min = glm::max(receiver_min, scene_min);
+		receiver_max = glm::min(receiver_max, scene_max);
+		if (receiver_min.x > receiver_max.x || receiver_min.y > receiver_max.y || receiver_min.z > receiver_max.z) {
+			// The camera sees none of the scene; keep the map of the whole scene around.
+			receiver_min = scene_min;
+			receiver_max = scene_max;
+		}
+
+		glm::vec3 light_min(INFINITY);
+		glm::vec3 light_max(-INFINITY);
+		for (unsigned int corner = 0; corner < 8; corner++) {
+			glm::vec3 receiver((corner & 1) ? receiver_max.x : receiver_min.x, (corner & 2) ? receiver_max.y : receiver_min.y, (corner & 4) ? receiver_max.z : receiver_min.z);
+			glm::vec3 scene((corner & 1) ? scene_max.x : scene_min.x, (corner & 2) ? scene_max.y : scene_min.y, (corner & 4) ? scene_max.z : scene_min.z);
+			glm::vec3 receiver_light = glm::vec3(light_view * glm::vec4(receiver, 1.0f));
+			glm::vec3 scene_light = glm::vec3(light_view * glm::vec4(scene, 1.0f));
+			light_min.x = std::min(light_min.x, receiver_light.x);
+			light_min.y = std::min(light_min.y, receiver_light.y);
+			light_max.x = std::max(light_max.x, receiver_light.x);
+			light_max.y = std::max(light_max.y, receiver_light.y);
+			light_min.z = std::min(light_min.z, scene_light.z);
+			light_max.z = std::max(light_max.z, scene_light.z);
+		}
+		light_min = glm::floor(light_min / SHADOW_FIT_SNAP) * SHADOW_FIT_SNAP;
+		light_max = -glm::floor(-light_max / SHADOW_FIT_SNAP) * SHADOW_FIT_SNAP;
+		// The light looks down -z: the scene corner nearest to it has the largest z.
+		glm::mat4 light_space = glm::ortho(light_min.x, light_max.x, light_min.y, light_max.y, -light_max.z, -light_min.z) * light_view;
+		if (std::memcmp(&light_space, &this->LightSpace, sizeof(light_space)) != 0) {
+			this->LightSpace = light_space;
+			this->Extent = glm::vec2(light_max.x - light_min.x, light_max.y - light_min.y);
+			this->Cached = false;
+		}
+	}
+
+	// Anything that identifies the static casters, e.g. a hash of their transforms; a new value drops
+	// the cached map.
+	void SetStaticSignature(uint64_t signature) {
+		if (signature != this->StaticSignature) {
+			this->StaticSignature = signature;
+			this->Cached = false;
+		}
+	}
+
+	void Invalidate() { this->Cached = false; }
+
+	bool NeedsStaticPass() const { return this->Complete && !this->Cached; }
+
+	// Binds and clears the static map; draw the static casters with GetLightSpaceMatrix(), then EndPass().
+	void BeginStaticPass() {
+		glBindFramebuffer(GL_FRAMEBUFFER, this->StaticFramebuffer);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		BeginPass();
+		this->Cached = true;
+		this->StaticPasses++;
+	}
+
+	// Copies the static map into the composite one and binds it; draw the dynamic casters, then EndPass().
+	void BeginDynamicPass() {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->StaticFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->DynamicFramebuffer);
+		glBlitFramebuffer(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->DynamicFramebuffer);
+		BeginPass();
+		this->Composited = true;
+		this->DynamicPasses++;
+	}
+
+	// Back to the default framebuffer; the caller sets its viewport again.
+	void EndPass() {
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Uploads the block when it changed; with enable false lighting.frag leaves every fragment lit.
+	void UpdateBlock(bool enable) {
+		ShadowStd140 block = {};
+		block.LightSpace = this->LightSpace;
+		block.Params = glm::vec4(enable && this->Complete ? 1.0f : 0.0f, SHADOW_DEPTH_BIAS, 1.0f / (float)SHADOW_MAP_SIZE, 0.0f);
+		if (std::memcmp(&block, &this->Block, sizeof(block)) != 0) {
+			std::memcpy(&this->Block, &block, sizeof(block));
+			glBindBuffer(GL_UNIFORM_BUFFER, this->BlockBuffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+	}
+
+	// The map to sample this frame: the composite when dynamic casters were drawn, the static one otherwise.
+	GLuint GetTexture() const { return this->Composited ? this->DynamicTexture : this->StaticTexture; }
+	const glm::mat4& GetLightSpaceMatrix() const { return this->LightSpace; }
+	// Width and height of the fitted frustum in metres.
+	const glm::vec2& GetExtent() const { return this->Extent; }
+	bool IsComplete() const { return this->Complete; }
+	unsigned int GetStaticPasses() const { return this->StaticPasses; }
+	unsigned int GetDynamicPasses() const { return this->DynamicPasses; }
+
+private:
+	GLuint StaticTexture = 0;
+	GLuint DynamicTexture = 0;
+	GLuint StaticFramebuffer = 0;
+	GLuint DynamicFramebuffer = 0;
+	GLuint BlockBuffer = 0;
+	bool Complete = false;
+	bool Cached = false;
+	bool Composited = false;
+	uint64_t StaticSignature = 0;
+	glm::mat4 LightSpace = glm::mat4(0.0f);
+	glm::vec2 Extent = glm::vec2(0.0f);
+	// What the GPU currently holds.
+	ShadowStd140 Block = {};
+	unsigned int StaticPasses = 0;
+	unsigned int DynamicPasses = 0;
+
+	// Depth only, sampled with hardware comparison (sampler2DShadow) and bilinear PCF.
+	static bool CreateDepthTarget(GLuint framebuffer, GLuint texture) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return complete;
+	}
+
+	// Only the faces towards the light are drawn (clockwise fronts like the rest of the scene), so the
+	// inside of the room does not shadow itself; the polygon offset keeps the lit faces out of acne.
+	static void BeginPass() {
+		glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		glFrontFace(GL_CW);
+		glCullFace(GL_BACK);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(2.0f, 4.0f);
+	}
+};
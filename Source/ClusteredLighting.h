@@ -0,0 +1,387 @@
+#pragma once
+#include "Shader.h"
+#include "LightingUniformBlocks.h"
+#include "JobSystem.h"
+#include "RenderStateCache.h"
+#include "Stopwatch.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+// Has to match the cluster grid read by lighting.frag: 16 x 9 tiles across the screen, 24 depth slices.
+constexpr unsigned int CLUSTER_X = 16;
+constexpr unsigned int CLUSTER_Y = 9;
+constexpr unsigned int CLUSTER_Z = 24;
+constexpr unsigned int CLUSTER_AMOUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+// Light indices fit in the smallest texture buffer GL 3.3 guarantees; pairs past it are dropped.
+constexpr unsigned int CLUSTER_MAX_LIGHTS = 4096;
+constexpr unsigned int CLUSTER_MAX_INDICES = 65536;
+constexpr unsigned int CLUSTER_LIGHT_JOB_GRAIN = 32;
+
+// Texture units of the cluster buffers, after the shadow map on 4.
+constexpr unsigned int CLUSTER_LIGHT_UNIT = 5;
+constexpr unsigned int CLUSTER_GRID_UNIT = 6;
+constexpr unsigned int CLUSTER_INDEX_UNIT = 7;
+
+// A point light of the clustered set, in world space. It reaches exactly Range metres.
+struct ClusterPointLight {
+	glm::vec3 Position;
+	float Range;
+	glm::vec3 Color;
+	float Padding;
+};
+static_assert(sizeof(ClusterPointLight) == 32, "ClusterPointLight must be two RGBA32F texels");
+
+// std140 image of ClusterBlock in lighting.frag.
+struct ClusterStd140 {
+	// Of the camera the grid was built for, to find the tile of a fragment.
+	glm::mat4 ViewProjection;
+	// Third row of the view matrix: the view depth of p is -dot(ViewDepth, vec4(p, 1)).
+	glm::vec4 ViewDepth;
+	// slice = log(depth) * x + y; z and w are the near and far plane.
+	glm::vec4 Slicing;
+	// X, Y, Z and the light count; a light count of 0 turns the clustered lights off.
+	int Dims[4];
+};
+static_assert(sizeof(ClusterStd140) == 112, "ClusterStd140 must match the std140 layout of ClusterBlock");
+
+// Clustered forward shading for any number of point lights. The view frustum of the camera is cut into
+// CLUSTER_X x CLUSTER_Y x CLUSTER_Z cells with exponentially growing depth slices, every light is listed in
+// the cells its sphere touches, and a fragment only looks at the lights of its own cell. The lists are
+// built on the CPU, one job per CLUSTER_LIGHT_JOB_GRAIN lights, and uploaded as three texture buffers
+// (GL 3.3 has no storage buffers): the lights, an (offset, count) pair per cell and the light indices.
+class ClusteredLighting {
+public:
+	ClusteredLighting() {
+		glGenBuffers(1, &this->BlockBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, this->BlockBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(this->Block), &this->Block, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_BLOCK_BINDING, this->BlockBuffer);
+
+		GLuint buffers[3];
+		GLuint textures[3];
+		glGenBuffers(3, buffers);
+		glGenTextures(3, textures);
+		this->LightBuffer = buffers[0];
+		this->GridBuffer = buffers[1];
+		this->IndexBuffer = buffers[2];
+		this->LightTexture = textures[0];
+		this->GridTexture = textures[1];
+		this->IndexTexture = textures[2];
+		// Full capacity up front, so a frame only ever sub-uploads the part that is used.
+		CreateTextureBuffer(this->LightBuffer, this->LightTexture, GL_RGBA32F, CLUSTER_MAX_LIGHTS * sizeof(ClusterPointLight));
+		CreateTextureBuffer(this->GridBuffer, this->GridTexture, GL_RG32UI, CLUSTER_AMOUNT * 2 * sizeof(uint32_t));
+		CreateTextureBuffer(this->IndexBuffer, this->IndexTexture, GL_R32UI, CLUSTER_MAX_INDICES * sizeof(uint32_t));
+		this->Grid.assign(CLUSTER_AMOUNT * 2, 0);
+		this->UploadedGrid.assign(CLUSTER_AMOUNT * 2, 0);
+	}
+
+	~ClusteredLighting() {
+		GLuint buffers[4] = { this->BlockBuffer, this->LightBuffer, this->GridBuffer, this->IndexBuffer };
+		GLuint textures[3] = { this->LightTexture, this->GridTexture, this->IndexTexture };
+		glDeleteTextures(3, textures);
+		glDeleteBuffers(4, buffers);
+	}
+
+	ClusteredLighting(const ClusteredLighting&) = delete;
+	ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+	// Assigns the lights to the cells of the camera given by view and projection, whose near and far
+	// planes are near_plane and far_plane, and uploads whatever changed. Lights past CLUSTER_MAX_LIGHTS
+	// are ignored. jobs may be null; otherwise it must have been created on the calling thread.
+	void Update(const std::vector<ClusterPointLight>& lights, const glm::mat4& view, const glm::mat4& projection, float near_plane, float far_plane, JobSystem* jobs) {
+		Stopwatch stopwatch;
+		near_plane = std::max(near_plane, 0.001f);
+		far_plane = std::max(far_plane, near_plane * 1.001f);
+		if (projection != this->Projection || near_plane != this->Near || far_plane != this->Far) {
+			this->Projection = projection;
+			this->Near = near_plane;
+			this->Far = far_plane;
+			this->BuildCells();
+		}
+		unsigned int light_amount = (unsigned int)std::min<size_t>(lights.size(), CLUSTER_MAX_LIGHTS);
+		this->ViewLights.resize(light_amount);
+		for (unsigned int i = 0; i < light_amount; i++) {
+			this->ViewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].Position, 1.0f)), lights[i].Range);
+		}
+
+		// Every job lists the (cell, light) pairs of its lights in its own slot.
+		unsigned int chunk_amount = JobSystem::GetChunkAmount(light_amount, CLUSTER_LIGHT_JOB_GRAIN);
+		if (this->ChunkPairs.size() < chunk_amount) {
+			this->ChunkPairs.resize(chunk_amount);
+		}
+		auto assign = [this](unsigned int begin, unsigned int end) {
+			std::vector<CellLight>& pairs = this->ChunkPairs[begin / CLUSTER_LIGHT_JOB_GRAIN];
+			pairs.clear();
+			for (unsigned int light = begin; light < end; light++) {
+				this->AssignLight(light, pairs);
+			}
+		};
+		if (jobs != nullptr) {
+			jobs->ParallelFor(light_amount, CLUSTER_LIGHT_JOB_GRAIN, assign);
+		} else {
+			for (unsigned int begin = 0; begin < light_amount; begin += CLUSTER_LIGHT_JOB_GRAIN) {
+				assign(begin, std::min(light_amount, begin + CLUSTER_LIGHT_JOB_GRAIN));
+			}
+		}
+
+		// Counting sort of the pairs by cell. Chunks are merged in order, so every list is sorted by light.
+		std::fill(this->Grid.begin(), this->Grid.end(), 0u);
+		size_t pair_amount = 0;
+		for (unsigned int c = 0; c < chunk_amount; c++) {
+			for (const CellLight& pair : this->ChunkPairs[c]) {
+				this->Grid[pair.Cell * 2 + 1]++;
+			}
+			pair_amount += this->ChunkPairs[c].size();
+		}
+		uint32_t offset = 0;
+		this->MaxCellLights = 0;
+		for (unsigned int cell = 0; cell < CLUSTER_AMOUNT; cell++) {
+			uint32_t count = std::min(this->Grid[cell * 2 + 1], CLUSTER_MAX_INDICES - offset);
+			this->Grid[cell * 2] = offset;
+			this->Grid[cell * 2 + 1] = count;
+			this->MaxCellLights = std::max(this->MaxCellLights, count);
+			offset += count;
+		}
+		this->Indices.resize(offset);
+		this->Fill.assign(CLUSTER_AMOUNT, 0);
+		for (unsigned int c = 0; c < chunk_amount; c++) {
+			for (const CellLight& pair : this->ChunkPairs[c]) {
+				uint32_t& filled = this->Fill[pair.Cell];
+				if (filled < this->Grid[pair.Cell * 2 + 1]) {
+					this->Indices[this->Grid[pair.Cell * 2] + filled++] = pair.Light;
+				}
+			}
+		}
+		this->LightCount = light_amount;
+		this->PairCount = offset;
+		this->DroppedCount = (unsigned int)(pair_amount - offset);
+
+		ClusterStd140 block = {};
+		block.ViewProjection = projection * view;
+		block.ViewDepth = glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+		float log_range = std::log(this->Far / this->Near);
+		block.Slicing = glm::vec4((float)CLUSTER_Z / log_range, -(float)CLUSTER_Z * std::log(this->Near) / log_range, this->Near, this->Far);
+		block.Dims[0] = CLUSTER_X;
+		block.Dims[1] = CLUSTER_Y;
+		block.Dims[2] = CLUSTER_Z;
+		block.Dims[3] = (int)light_amount;
+		this->Upload(GL_UNIFORM_BUFFER, this->BlockBuffer, &this->Block, &block, sizeof(block));
+		this->UploadVector(this->LightBuffer, this->UploadedLights, lights.data(), light_amount);
+		this->UploadVector(this->GridBuffer, this->UploadedGrid, this->Grid.data(), this->Grid.size());
+		this->UploadVector(this->IndexBuffer, this->UploadedIndices, this->Indices.data(), this->Indices.size());
+		this->AssignMilliseconds = stopwatch.GetElapsedMilliseconds();
+	}
+
+	// Binds the three buffers to their units; the block is bound to CLUSTER_BLOCK_BINDING for good.
+	void Bind(RenderStateCache& state) const {
+		state.BindTexture(CLUSTER_LIGHT_UNIT, GL_TEXTURE_BUFFER, this->LightTexture);
+		state.BindTexture(CLUSTER_GRID_UNIT, GL_TEXTURE_BUFFER, this->GridTexture);
+		state.BindTexture(CLUSTER_INDEX_UNIT, GL_TEXTURE_BUFFER, this->IndexTexture);
+	}
+
+	// As of the last Update().
+	unsigned int GetLightCount() const { return this->LightCount; }
+	// Entries of all cell lists together.
+	unsigned int GetPairCount() const { return this->PairCount; }
+	// Pairs that did not fit in CLUSTER_MAX_INDICES.
+	unsigned int GetDroppedCount() const { return this->DroppedCount; }
+	unsigned int GetMaxCellLights() const { return this->MaxCellLights; }
+	float GetAssignMilliseconds() const { return this->AssignMilliseconds; }
+	unsigned int GetUploadCount() const { return this->UploadCount; }
+	// Offset and count of the list of each cell, x fastest, then y, then the depth slice.
+	const std::vector<uint32_t>& GetGrid() const { return this->Grid; }
+	const std::vector<uint32_t>& GetIndices() const { return this->Indices; }
+
+private:
+	struct CellLight {
+		uint32_t Cell;
+		uint32_t Light;
+	};
+
+	// View space bounds of a cell.
+	struct CellBounds {
+		glm::vec3 Min;
+		glm::vec3 Max;
+	};
+
+	GLuint BlockBuffer = 0;
+	GLuint LightBuffer = 0;
+	GLuint GridBuffer = 0;
+	GLuint IndexBuffer = 0;
+	GLuint LightTexture = 0;
+	GLuint GridTexture = 0;
+	GLuint IndexTexture = 0;
+
+	// The projection the cells were built for.
+	glm::mat4 Projection = glm::mat4(0.0f);
+	float Near = 0.0f;
+	float Far = 0.0f;
+	std::vector<CellBounds> Cells;
+	// View depth where each slice starts, plus the far plane.
+	float SliceDepths[CLUSTER_Z + 1] = {};
+
+	// Centre in view space and range of each light.
+	std::vector<glm::vec4> ViewLights;
+	// One list per job, kept between frames.
+	std::vector<std::vector<CellLight>> ChunkPairs;
+	std::vector<uint32_t> Grid;
+	std::vector<uint32_t> Indices;
+	std::vector<uint32_t> Fill;
+
+	// What the GPU currently holds.
+	ClusterStd140 Block = {};
+	std::vector<ClusterPointLight> UploadedLights;
+	std::vector<uint32_t> UploadedGrid;
+	std::vector<uint32_t> UploadedIndices;
+
+	unsigned int LightCount = 0;
+	unsigned int PairCount = 0;
+	unsigned int DroppedCount = 0;
+	unsigned int MaxCellLights = 0;
+	unsigned int UploadCount = 0;
+	float AssignMilliseconds = 0.0f;
+
+	static void CreateTextureBuffer(GLuint buffer, GLuint texture, GLenum format, GLsizeiptr size) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Cell corners come from unprojecting the tile corners on the near and far planes and walking along
+	// the line between them to the slice depths, which works for perspective and orthographic alike.
+	void BuildCells() {
+		glm::mat4 inverse_projection = glm::inverse(this->Projection);
+		for (unsigned int z = 0; z <= CLUSTER_Z; z++) {
+			this->SliceDepths[z] = this->Near * std::pow(this->Far / this->Near, (float)z / (float)CLUSTER_Z);
+		}
+		this->Cells.resize(CLUSTER_AMOUNT);
+		glm::vec3 near_points[CLUSTER_X + 1][CLUSTER_Y + 1];
+		glm::vec3 far_points[CLUSTER_X + 1][CLUSTER_Y + 1];
+		for (unsigned int x = 0; x <= CLUSTER_X; x++) {
+			for (unsigned int y = 0; y <= CLUSTER_Y; y++) {
+				float ndc_x = (float)x / (float)CLUSTER_X * 2.0f - 1.0f;
+				float ndc_y = (float)y / (float)CLUSTER_Y * 2.0f - 1.0f;
+				glm::vec4 near_point = inverse_projection * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+				glm::vec4 far_point = inverse_projection * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+				near_points[x][y] = glm::vec3(near_point) / near_point.w;
+				far_points[x][y] = glm::vec3(far_point) / far_point.w;
+			}
+		}
+		for (unsigned int z = 0; z < CLUSTER_Z; z++) {
+			for (unsigned int y = 0; y < CLUSTER_Y; y++) {
+				for (unsigned int x = 0; x < CLUSTER_X; x++) {
+					CellBounds bounds = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+					for (unsigned int corner = 0; corner < 8; corner++) {
+						unsigned int cx = x + (corner & 1);
+						unsigned int cy = y + ((corner >> 1) & 1);
+						float depth = this->SliceDepths[z + (corner >> 2)];
+						const glm::vec3& a = near_points[cx][cy];
+						const glm::vec3& b = far_points[cx][cy];
+						glm::vec3 point = a + (b - a) * ((depth + a.z) / (a.z - b.z));
+						bounds.Min = glm::min(bounds.Min, point);
+						bounds.Max = glm::max(bounds.Max, point);
+					}
+					this->Cells[CellIndex(x, y, z)] = bounds;
+				}
+			}
+		}
+	}
+
+	static unsigned int CellIndex(unsigned int x, unsigned int y, unsigned int z) {
+		return x + CLUSTER_X * (y + CLUSTER_Y * z);
+	}
+
+	unsigned int SliceOf(float depth) const {
+		float slice = std::log(depth / this->Near) / std::log(this->Far / this->Near) * (float)CLUSTER_Z;
+		return (unsigned int)std::min(std::max(slice, 0.0f), (float)(CLUSTER_Z - 1));
+	}
+
+	// Narrows the cells down to the slices the sphere spans and the tiles its projected box covers, and
+	// tests those against the sphere.
+	void AssignLight(unsigned int light, std::vector<CellLight>& pairs) const {
+		glm::vec3 center = glm::vec3(this->ViewLights[light]);
+		float range = this->ViewLights[light].w;
+		float min_depth = -center.z - range;
+		float max_depth = -center.z + range;
+		if (range <= 0.0f || max_depth < this->Near || min_depth > this->Far) {
+			return;
+		}
+		unsigned int first_slice = SliceOf(std::max(min_depth, this->Near));
+		unsigned int last_slice = SliceOf(std::min(max_depth, this->Far));
+
+		// The box in front of the near plane projects inside the hull of its projected corners.
+		glm::vec2 tile_min(INFINITY);
+		glm::vec2 tile_max(-INFINITY);
+		for (unsigned int corner = 0; corner < 8; corner++) {
+			glm::vec3 point = center + glm::vec3((corner & 1) ? range : -range, (corner & 2) ? range : -range, (corner & 4) ? range : -range);
+			point.z = std::min(point.z, -this->Near);
+			glm::vec4 clip = this->Projection * glm::vec4(point, 1.0f);
+			float ndc_x = clip.x / clip.w;
+			float ndc_y = clip.y / clip.w;
+			tile_min.x = std::min(tile_min.x, ndc_x);
+			tile_min.y = std::min(tile_min.y, ndc_y);
+			tile_max.x = std::max(tile_max.x, ndc_x);
+			tile_max.y = std::max(tile_max.y, ndc_y);
+		}
+		if (tile_max.x < -1.0f || tile_min.x > 1.0f || tile_max.y < -1.0f || tile_min.y > 1.0f) {
+			return;
+		}
+		unsigned int first_x = TileOf(tile_min.x, CLUSTER_X);
+		unsigned int last_x = TileOf(tile_max.x, CLUSTER_X);
+		unsigned int first_y = TileOf(tile_min.y, CLUSTER_Y);
+		unsigned int last_y = TileOf(tile_max.y, CLUSTER_Y);
+
+		float range_squared = range * range;
+		for (unsigned int z = first_slice; z <= last_slice; z++) {
+			for (unsigned int y = first_y; y <= last_y; y++) {
+				for (unsigned int x = first_x; x <= last_x; x++) {
+					unsigned int cell = CellIndex(x, y, z);
+					const CellBounds& bounds = this->Cells[cell];
+					glm::vec3 closest = glm::clamp(center, bounds.Min, bounds.Max);
+					glm::vec3 offset = closest - center;
+					if (glm::dot(offset, offset) <= range_squared) {
+						pairs.push_back({ cell, light });
+					}
+				}
+			}
+		}
+	}
+
+	static unsigned int TileOf(float ndc, unsigned int tiles) {
+		float tile = (ndc * 0.5f + 0.5f) * (float)tiles;
+		return (unsigned int)std::min(std::max(tile, 0.0f), (float)(tiles - 1));
+	}
+
+	template <typename T>
+	void UploadVector(GLuint buffer, std::vector<T>& uploaded, const T* data, size_t count) {
+		if (uploaded.size() == count && (count == 0 || std::memcmp(uploaded.data(), data, count * sizeof(T)) == 0)) {
+			return;
+		}
+		uploaded.assign(data, data + count);
+		if (count > 0) {
+			glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, count * sizeof(T), data);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			this->UploadCount++;
+		}
+	}
+
+	void Upload(GLenum target, GLuint buffer, void* shadow, const void* data, size_t size) {
+		if (std::memcmp(shadow, data, size) == 0) {
+			return;
+		}
+		std::memcpy(shadow, data, size);
+		glBindBuffer(target, buffer);
+		glBufferSubData(target, 0, size, data);
+		glBindBuffer(target, 0);
+		this->UploadCount++;
+	}
+};
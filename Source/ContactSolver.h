@@ -0,0 +1,207 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "BallSystem.h"
+
+// Overlap that is tolerated before contacts push balls apart, and how much of the rest goes per step.
+constexpr float CONTACT_SLOP = 0.005f;
+constexpr float CONTACT_BAUMGARTE = 0.2f;
+// Balls closing slower than this do not bounce, so resting contacts settle instead of jittering.
+constexpr float CONTACT_RESTITUTION_THRESHOLD = 1.0f;
+constexpr unsigned int CONTACT_NO_BODY = ~0u;
+
+// Sequential impulse (projected Gauss-Seidel) solver for ball contacts, with friction and warm starting.
+// All contacts of a step go into one flat array; the balls they touch are copied into a compact body
+// array, so the iterations only walk two contiguous arrays. The impulses of every contact are kept
+// until the next step and used as its starting guess, which is what lets piles come to rest.
+// The solver sees the velocity each ball will have after this step's gravity; IntegrateRange adds
+// gravity afterwards, so the result is written back without it.
+class ContactSolver {
+public:
+	void Clear() {
+		this->Contacts.clear();
+	}
+
+	void Add(const std::vector<BallContact>& contacts) {
+		this->Contacts.insert(this->Contacts.end(), contacts.begin(), contacts.end());
+	}
+
+	// Drops the warm starting impulses, e.g. because ball indices changed meaning.
+	void ResetCache() {
+		this->Cache.clear();
+	}
+
+	void Solve(BallSystem& balls, float delta_time, float elasticities, float friction, unsigned int iterations) {
+		this->Prepare(balls, delta_time, elasticities);
+		this->WarmStart();
+		for (unsigned int iteration = 0; iteration < iterations; iteration++) {
+			this->SolveVelocities(friction);
+		}
+		this->Finish(balls, delta_time);
+	}
+
+	const std::vector<BallContact>& GetContacts() const { return this->Contacts; }
+	unsigned int GetContactCount() const { return (unsigned int)this->Contacts.size(); }
+	unsigned int GetBodyCount() const { return (unsigned int)this->Bodies.size(); }
+	unsigned int GetWarmStartedCount() const { return this->WarmStartedCount; }
+
+private:
+	struct SolverBody {
+		glm::vec3 Velocity;
+		float InverseMass;
+		unsigned int Ball;
+	};
+
+	struct Constraint {
+		unsigned int BodyA;
+		unsigned int BodyB;
+		glm::vec3 Normal;
+		glm::vec3 Tangent1;
+		glm::vec3 Tangent2;
+		float NormalMass;
+		float Bias;
+		float NormalImpulse;
+		float TangentImpulse1;
+		float TangentImpulse2;
+	};
+
+	struct CachedImpulse {
+		uint64_t Key;
+		float Normal;
+		float Tangent1;
+		float Tangent2;
+	};
+
+	std::vector<BallContact> Contacts;
+	std::vector<Constraint> Constraints;
+	std::vector<SolverBody> Bodies;
+	// Ball index -> body index, CONTACT_NO_BODY for balls without contacts.
+	std::vector<unsigned int> BodySlot;
+	// Sorted by key.
+	std::vector<CachedImpulse> Cache;
+	std::vector<CachedImpulse> NextCache;
+	unsigned int WarmStartedCount = 0;
+
+	static uint64_t GetKey(const BallContact& contact) {
+		return ((uint64_t)contact.A << 32) | contact.B;
+	}
+
+	unsigned int GetBody(BallSystem& balls, unsigned int ball, float delta_time) {
+		if (this->BodySlot[ball] == CONTACT_NO_BODY) {
+			this->BodySlot[ball] = (unsigned int)this->Bodies.size();
+			this->Bodies.push_back({ balls.GetVelocity(ball) + balls.GetAcceleration(ball) * delta_time, balls.InverseMass[ball], ball });
+		}
+		return this->BodySlot[ball];
+	}
+
+	void Prepare(BallSystem& balls, float delta_time, float elasticities) {
+		this->BodySlot.assign(balls.Size(), CONTACT_NO_BODY);
+		this->Bodies.clear();
+		this->Constraints.clear();
+		this->WarmStartedCount = 0;
+		for (const BallContact& contact : this->Contacts) {
+			Constraint constraint;
+			constraint.BodyA = this->GetBody(balls, contact.A, delta_time);
+			constraint.BodyB = contact.IsStatic() ? CONTACT_NO_BODY : this->GetBody(balls, contact.B, delta_time);
+			constraint.Normal = contact.Normal;
+			// Any two directions perpendicular to the normal will do, as long as they come out the same
+			// every step for the cached friction impulses.
+			glm::vec3 axis = std::abs(contact.Normal.x) < 0.57735f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			constraint.Tangent1 = glm::normalize(glm::cross(contact.Normal, axis));
+			constraint.Tangent2 = glm::cross(contact.Normal, constraint.Tangent1);
+
+			float inverse_mass = this->Bodies[constraint.BodyA].InverseMass;
+			if (constraint.BodyB != CONTACT_NO_BODY) {
+				inverse_mass += this->Bodies[constraint.BodyB].InverseMass;
+			}
+			constraint.NormalMass = 1.0f / inverse_mass;
+
+			// Separated contacts may close the gap this step but no more; overlapping ones are pushed apart.
+			if (contact.Separation > 0.0f) {
+				constraint.Bias = -contact.Separation / delta_time;
+			} else {
+				constraint.Bias = CONTACT_BAUMGARTE * std::max(-contact.Separation - CONTACT_SLOP, 0.0f) / delta_time;
+			}
+			float normal_velocity = glm::dot(this->GetRelativeVelocity(constraint), constraint.Normal);
+			if (normal_velocity < -CONTACT_RESTITUTION_THRESHOLD) {
+				constraint.Bias = std::max(constraint.Bias, -elasticities * normal_velocity);
+			}
+
+			constraint.NormalImpulse = 0.0f;
+			constraint.TangentImpulse1 = 0.0f;
+			constraint.TangentImpulse2 = 0.0f;
+			uint64_t key = GetKey(contact);
+			auto cached = std::lower_bound(this->Cache.begin(), this->Cache.end(), key, [](const CachedImpulse& impulse, uint64_t k) { return impulse.Key < k; });
+			if (cached != this->Cache.end() && cached->Key == key) {
+				constraint.NormalImpulse = cached->Normal;
+				constraint.TangentImpulse1 = cached->Tangent1;
+				constraint.TangentImpulse2 = cached->Tangent2;
+				this->WarmStartedCount++;
+			}
+			this->Constraints.push_back(constraint);
+		}
+	}
+
+	glm::vec3 GetRelativeVelocity(const Constraint& constraint) const {
+		glm::vec3 velocity = this->Bodies[constraint.BodyA].Velocity;
+		if (constraint.BodyB != CONTACT_NO_BODY) {
+			velocity -= this->Bodies[constraint.BodyB].Velocity;
+		}
+		return velocity;
+	}
+
+	void ApplyImpulse(const Constraint& constraint, const glm::vec3& impulse) {
+		SolverBody& a = this->Bodies[constraint.BodyA];
+		a.Velocity += impulse * a.InverseMass;
+		if (constraint.BodyB != CONTACT_NO_BODY) {
+			SolverBody& b = this->Bodies[constraint.BodyB];
+			b.Velocity -= impulse * b.InverseMass;
+		}
+	}
+
+	void WarmStart() {
+		for (const Constraint& constraint : this->Constraints) {
+			this->ApplyImpulse(constraint, constraint.Normal * constraint.NormalImpulse + constraint.Tangent1 * constraint.TangentImpulse1 + constraint.Tangent2 * constraint.TangentImpulse2);
+		}
+	}
+
+	void SolveVelocities(float friction) {
+		for (Constraint& constraint : this->Constraints) {
+			// Friction first, limited by the normal impulse of the last iteration.
+			float max_friction = friction * constraint.NormalImpulse;
+			glm::vec3 velocity = this->GetRelativeVelocity(constraint);
+			float impulse1 = -constraint.NormalMass * glm::dot(velocity, constraint.Tangent1);
+			float impulse2 = -constraint.NormalMass * glm::dot(velocity, constraint.Tangent2);
+			float total1 = glm::clamp(constraint.TangentImpulse1 + impulse1, -max_friction, max_friction);
+			float total2 = glm::clamp(constraint.TangentImpulse2 + impulse2, -max_friction, max_friction);
+			impulse1 = total1 - constraint.TangentImpulse1;
+			impulse2 = total2 - constraint.TangentImpulse2;
+			constraint.TangentImpulse1 = total1;
+			constraint.TangentImpulse2 = total2;
+			this->ApplyImpulse(constraint, constraint.Tangent1 * impulse1 + constraint.Tangent2 * impulse2);
+
+			// Contacts only push: the accumulated normal impulse is clamped to zero, not each correction.
+			float normal_velocity = glm::dot(this->GetRelativeVelocity(constraint), constraint.Normal);
+			float impulse = -constraint.NormalMass * (normal_velocity - constraint.Bias);
+			float total = std::max(constraint.NormalImpulse + impulse, 0.0f);
+			impulse = total - constraint.NormalImpulse;
+			constraint.NormalImpulse = total;
+			this->ApplyImpulse(constraint, constraint.Normal * impulse);
+		}
+	}
+
+	void Finish(BallSystem& balls, float delta_time) {
+		for (const SolverBody& body : this->Bodies) {
+			balls.SetVelocity(body.Ball, body.Velocity - balls.GetAcceleration(body.Ball) * delta_time);
+		}
+		this->NextCache.clear();
+		for (size_t c = 0; c < this->Contacts.size(); c++) {
+			const Constraint& constraint = this->Constraints[c];
+			this->NextCache.push_back({ GetKey(this->Contacts[c]), constraint.NormalImpulse, constraint.TangentImpulse1, constraint.TangentImpulse2 });
+		}
+		std::sort(this->NextCache.begin(), this->NextCache.end(), [](const CachedImpulse& a, const CachedImpulse& b) { return a.Key < b.Key; });
+		std::swap(this->Cache, this->NextCache);
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+constexpr size_t FRAME_ARENA_DEFAULT_CAPACITY = 1 << 20;
+
+// Linear allocator for scratch data that only lives until the end of the frame. Allocating is a pointer
+// bump and Reset() at the start of the next frame frees everything at once; destructors are never run,
+// so only trivially destructible data belongs here. When a frame needs more than the capacity, the
+// overflow goes into extra blocks and the next Reset() grows the main block to the high-water mark,
+// so a steady-state frame never reaches malloc.
+class FrameArena {
+public:
+	explicit FrameArena(size_t capacity = FRAME_ARENA_DEFAULT_CAPACITY) {
+		this->Grow(capacity);
+	}
+
+	~FrameArena() {
+		this->ReleaseOverflow();
+		std::free(this->Memory);
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+		size_t offset = (this->Used + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= this->Capacity) {
+			this->Used = offset + size;
+			this->Requested += size;
+			return this->Memory + offset;
+		}
+
+		// Out of room, this frame has to fall back to the heap.
+		void* block = std::malloc(size + alignment);
+		if (block == nullptr) {
+			throw std::bad_alloc();
+		}
+		this->Overflow.push_back(block);
+		this->Requested += size;
+		uintptr_t address = ((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		return (void*)address;
+	}
+
+	// Uninitialized storage for count objects of T.
+	template <typename T>
+	T* AllocateArray(size_t count) {
+		return static_cast<T*>(this->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void Reset() {
+		this->Peak = std::max(this->Peak, this->Requested);
+		if (!this->Overflow.empty()) {
+			this->ReleaseOverflow();
+			this->Grow(this->Peak * 2);
+		}
+		this->Used = 0;
+		this->Requested = 0;
+	}
+
+	size_t GetUsed() const { return this->Requested; }
+	size_t GetPeak() const { return std::max(this->Peak, this->Requested); }
+	size_t GetCapacity() const { return this->Capacity; }
+
+private:
+	unsigned char* Memory = nullptr;
+	size_t Capacity = 0;
+	size_t Used = 0;
+	size_t Requested = 0;
+	size_t Peak = 0;
+	std::vector<void*> Overflow;
+
+	void Grow(size_t capacity) {
+		std::free(this->Memory);
+		this->Memory = static_cast<unsigned char*>(std::malloc(capacity));
+		if (this->Memory == nullptr) {
+			throw std::bad_alloc();
+		}
+		this->Capacity = capacity;
+	}
+
+	void ReleaseOverflow() {
+		for (void* block : this->Overflow) {
+			std::free(block);
+		}
+		this->Overflow.clear();
+	}
+};
+
+// Lets standard containers take their storage from a FrameArena: std::vector<int, FrameAllocator<int>> v(FrameAllocator<int>(arena));
+// Deallocation is a no-op, the memory comes back at the next Reset().
+template <typename T>
+class FrameAllocator {
+public:
+	typedef T value_type;
+
+	explicit FrameAllocator(FrameArena& arena) : Arena(&arena) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) : Arena(other.Arena) {}
+
+	T* allocate(size_t count) { return this->Arena->AllocateArray<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>& other) const { return this->Arena == other.Arena; }
+	template <typename U>
+	bool operator!=(const FrameAllocator<U>& other) const { return this->Arena != other.Arena; }
+
+	FrameArena* Arena;
+};
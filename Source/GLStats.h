@@ -0,0 +1,86 @@
+#pragma once
+#include "Shader.h"
+
+// Per-frame counters of the GL calls that cost CPU time: draw calls, uniform uploads and buffer uploads.
+// With glad the counting works by swapping the loader's function pointers for small forwarding hooks,
+// so it also sees the calls made inside Nexus, and a headless recorder that installs its own pointers
+// first is counted the same way. Without glad the counters stay at zero and IsAvailable() says so.
+struct GLCallCounters {
+	unsigned int DrawCalls = 0;
+	unsigned int Instances = 0;
+	unsigned int UniformUploads = 0;
+	unsigned int BufferUploads = 0;
+};
+
+// Keeps the loader's pointer and defines a hook with the same signature that bumps a counter before forwarding.
+#define GL_STATS_HOOK(name, pfn, params, args, counter) \
+	static inline pfn Original_##name = nullptr; \
+	static void APIENTRY Hook_##name params { counter; Original_##name args; }
+#define GL_STATS_INSTALL(name) \
+	if (glad_##name != nullptr) { Original_##name = glad_##name; glad_##name = Hook_##name; }
+
+class GLStats {
+public:
+	// Must be called once after the GL loader has run.
+	static bool Install() {
+#if defined(__glad_h_) || defined(GLAD_GL_H_)
+		if (Installed) {
+			return true;
+		}
+		GL_STATS_INSTALL(glDrawArrays);
+		GL_STATS_INSTALL(glDrawElements);
+		GL_STATS_INSTALL(glDrawArraysInstanced);
+		GL_STATS_INSTALL(glDrawElementsInstanced);
+		GL_STATS_INSTALL(glUniform1i);
+		GL_STATS_INSTALL(glUniform1f);
+		GL_STATS_INSTALL(glUniform3f);
+		GL_STATS_INSTALL(glUniform4f);
+		GL_STATS_INSTALL(glUniform3fv);
+		GL_STATS_INSTALL(glUniform4fv);
+		GL_STATS_INSTALL(glUniformMatrix3fv);
+		GL_STATS_INSTALL(glUniformMatrix4fv);
+		GL_STATS_INSTALL(glBufferData);
+		GL_STATS_INSTALL(glBufferSubData);
+		Installed = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static bool IsAvailable() { return Installed; }
+
+	// Call once per frame; the counters of the finished frame stay readable through GetLastFrame().
+	static void NewFrame() {
+		LastFrame = Frame;
+		Frame = GLCallCounters();
+	}
+
+	static const GLCallCounters& GetLastFrame() { return LastFrame; }
+	static GLCallCounters& GetFrame() { return Frame; }
+
+private:
+	static inline bool Installed = false;
+	static inline GLCallCounters Frame;
+	static inline GLCallCounters LastFrame;
+
+#if defined(__glad_h_) || defined(GLAD_GL_H_)
+	GL_STATS_HOOK(glDrawArrays, PFNGLDRAWARRAYSPROC, (GLenum mode, GLint first, GLsizei count), (mode, first, count), Frame.DrawCalls++; Frame.Instances++)
+	GL_STATS_HOOK(glDrawElements, PFNGLDRAWELEMENTSPROC, (GLenum mode, GLsizei count, GLenum type, const void* indices), (mode, count, type, indices), Frame.DrawCalls++; Frame.Instances++)
+	GL_STATS_HOOK(glDrawArraysInstanced, PFNGLDRAWARRAYSINSTANCEDPROC, (GLenum mode, GLint first, GLsizei count, GLsizei instances), (mode, first, count, instances), Frame.DrawCalls++; Frame.Instances += instances)
+	GL_STATS_HOOK(glDrawElementsInstanced, PFNGLDRAWELEMENTSINSTANCEDPROC, (GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances), (mode, count, type, indices, instances), Frame.DrawCalls++; Frame.Instances += instances)
+	GL_STATS_HOOK(glUniform1i, PFNGLUNIFORM1IPROC, (GLint location, GLint v0), (location, v0), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniform1f, PFNGLUNIFORM1FPROC, (GLint location, GLfloat v0), (location, v0), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniform3f, PFNGLUNIFORM3FPROC, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2), (location, v0, v1, v2), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniform4f, PFNGLUNIFORM4FPROC, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3), (location, v0, v1, v2, v3), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniform3fv, PFNGLUNIFORM3FVPROC, (GLint location, GLsizei count, const GLfloat* value), (location, count, value), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniform4fv, PFNGLUNIFORM4FVPROC, (GLint location, GLsizei count, const GLfloat* value), (location, count, value), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniformMatrix3fv, PFNGLUNIFORMMATRIX3FVPROC, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value), (location, count, transpose, value), Frame.UniformUploads++)
+	GL_STATS_HOOK(glUniformMatrix4fv, PFNGLUNIFORMMATRIX4FVPROC, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value), (location, count, transpose, value), Frame.UniformUploads++)
+	GL_STATS_HOOK(glBufferData, PFNGLBUFFERDATAPROC, (GLenum target, GLsizeiptr size, const void* data, GLenum usage), (target, size, data, usage), Frame.BufferUploads++)
+	GL_STATS_HOOK(glBufferSubData, PFNGLBUFFERSUBDATAPROC, (GLenum target, GLintptr offset, GLsizeiptr size, const void* data), (target, offset, size, data), Frame.BufferUploads++)
+#endif
+};
+
+#undef GL_STATS_HOOK
+#undef GL_STATS_INSTALL
@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+constexpr unsigned int JOB_QUEUE_CAPACITY = 1024;
+
+// A small work-stealing job system. Every thread (the workers plus the thread that owns the system)
+// has its own queue: it pops its own jobs from the back and steals from the front of the others.
+// Jobs are plain function pointers over an index range, so submitting work never allocates.
+class JobSystem {
+public:
+	explicit JobSystem(unsigned int thread_count) {
+		thread_count = std::max(1u, thread_count);
+		for (unsigned int i = 0; i < thread_count; i++) {
+			this->Queues.push_back(std::make_unique<WorkQueue>());
+		}
+		for (unsigned int i = 1; i < thread_count; i++) {
+			this->Workers.emplace_back([this, i]() { this->WorkerLoop(i); });
+		}
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(this->SleepMutex);
+			this->Running = false;
+		}
+		this->SleepCondition.notify_all();
+		for (std::thread& worker : this->Workers) {
+			worker.join();
+		}
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned int GetThreadCount() const { return (unsigned int)this->Queues.size(); }
+
+	static unsigned int GetChunkAmount(unsigned int count, unsigned int grain) {
+		return (count + grain - 1) / grain;
+	}
+
+	// Calls fn(begin, end) for every [k * grain, (k + 1) * grain) slice of [0, count) and returns when all
+	// slices are done. Slice boundaries only depend on count and grain, never on the thread count, so
+	// callers can write per-slice results to slot begin / grain and merge them in a fixed order.
+	// Must be called from the thread that created the system.
+	template <typename Fn>
+	void ParallelFor(unsigned int count, unsigned int grain, const Fn& fn) {
+		grain = std::max(1u, grain);
+		unsigned int job_amount = GetChunkAmount(count, grain);
+		if (job_amount == 0) {
+			return;
+		}
+		if (job_amount == 1 || this->GetThreadCount() == 1) {
+			for (unsigned int begin = 0; begin < count; begin += grain) {
+				fn(begin, std::min(count, begin + grain));
+			}
+			return;
+		}
+
+		std::atomic<unsigned int> remaining(job_amount);
+		JobFunction trampoline = [](const void* context, unsigned int begin, unsigned int end) {
+			(*static_cast<const Fn*>(context))(begin, end);
+		};
+
+		for (unsigned int j = 0; j < job_amount; j++) {
+			Job job = { trampoline, &fn, j * grain, std::min(count, (j + 1) * grain), &remaining };
+			this->PendingJobs.fetch_add(1, std::memory_order_release);
+			if (!this->Queues[j % this->GetThreadCount()]->Push(job)) {
+				// Queue is full, just do it here.
+				this->PendingJobs.fetch_sub(1, std::memory_order_release);
+				RunJob(job);
+			}
+		}
+		{
+			// Taking the lock orders the wake-up after the workers' predicate check.
+			std::lock_guard<std::mutex> lock(this->SleepMutex);
+		}
+		this->SleepCondition.notify_all();
+
+		// Help out until every slice has finished.
+		while (remaining.load(std::memory_order_acquire) != 0) {
+			Job job;
+			if (this->FindJob(0, job)) {
+				RunJob(job);
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+	typedef void (*JobFunction)(const void* context, unsigned int begin, unsigned int end);
+
+	struct Job {
+		JobFunction Function = nullptr;
+		const void* Context = nullptr;
+		unsigned int Begin = 0;
+		unsigned int End = 0;
+		std::atomic<unsigned int>* Remaining = nullptr;
+	};
+
+	struct WorkQueue {
+		std::mutex Mutex;
+		Job Jobs[JOB_QUEUE_CAPACITY];
+		unsigned int Head = 0;
+		unsigned int Tail = 0;
+
+		bool Push(const Job& job) {
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			if (this->Tail - this->Head == JOB_QUEUE_CAPACITY) {
+				return false;
+			}
+			this->Jobs[this->Tail % JOB_QUEUE_CAPACITY] = job;
+			this->Tail++;
+			return true;
+		}
+
+		bool Pop(Job& job) {
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			if (this->Tail == this->Head) {
+				return false;
+			}
+			this->Tail--;
+			job = this->Jobs[this->Tail % JOB_QUEUE_CAPACITY];
+			return true;
+		}
+
+		bool Steal(Job& job) {
+			std::lock_guard<std::mutex> lock(this->Mutex);
+			if (this->Tail == this->Head) {
+				return false;
+			}
+			job = this->Jobs[this->Head % JOB_QUEUE_CAPACITY];
+			this->Head++;
+			return true;
+		}
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> Queues;
+	std::vector<std::thread> Workers;
+	std::atomic<unsigned int> PendingJobs{ 0 };
+	std::mutex SleepMutex;
+	std::condition_variable SleepCondition;
+	bool Running = true;
+
+	static void RunJob(const Job& job) {
+		job.Function(job.Context, job.Begin, job.End);
+		job.Remaining->fetch_sub(1, std::memory_order_release);
+	}
+
+	bool FindJob(unsigned int index, Job& job) {
+		unsigned int thread_count = this->GetThreadCount();
+		bool found = this->Queues[index]->Pop(job);
+		for (unsigned int k = 1; !found && k < thread_count; k++) {
+			found = this->Queues[(index + k) % thread_count]->Steal(job);
+		}
+		if (found) {
+			this->PendingJobs.fetch_sub(1, std::memory_order_acq_rel);
+		}
+		return found;
+	}
+
+	void WorkerLoop(unsigned int index) {
+		while (true) {
+			Job job;
+			if (this->FindJob(index, job)) {
+				RunJob(job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(this->SleepMutex);
+			this->SleepCondition.wait(lock, [this]() {
+				return !this->Running || this->PendingJobs.load(std::memory_order_acquire) > 0;
+			});
+			if (!this->Running) {
+				return;
+			}
+		}
+	}
+};
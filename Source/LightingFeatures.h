@@ -0,0 +1,50 @@
+#pragma once
+#include "ShaderPermutations.h"
+#include "LightingUniformBlocks.h"
+#include <memory>
+#include <cstdint>
+
+// Permutation bits of lighting.frag. The switches that used to be bool uniforms are fixed per program;
+// bits 16 and up hold which of the LIGHT_AMOUNT lights are enabled, so disabled lights cost nothing.
+enum LightingFeature : uint32_t {
+	LIGHTING_BLINN_PHONG = 1u << 0,
+	LIGHTING_LIGHTING = 1u << 1,
+	LIGHTING_DIFFUSE_TEXTURE = 1u << 2,
+	LIGHTING_SPECULAR_TEXTURE = 1u << 3,
+	LIGHTING_EMISSION = 1u << 4,
+	LIGHTING_EMISSION_TEXTURE = 1u << 5,
+	LIGHTING_GAMMA = 1u << 6,
+	LIGHTING_CUBE_MAP = 1u << 7,
+	LIGHTING_INSTANCE_MATERIAL = 1u << 8,
+	LIGHTING_FOG = 1u << 9,
+	LIGHTING_CLUSTERED_LIGHTS = 1u << 10,
+	LIGHTING_SHADOW = 1u << 11
+};
+
+constexpr unsigned int LIGHTING_LIGHT_MASK_SHIFT = 16;
+
+const ShaderFeature LIGHTING_FEATURES[] = {
+	{ "PERMUTATION_BLINN_PHONG", 0, 1 },
+	{ "PERMUTATION_LIGHTING", 1, 1 },
+	{ "PERMUTATION_DIFFUSE_TEXTURE", 2, 1 },
+	{ "PERMUTATION_SPECULAR_TEXTURE", 3, 1 },
+	{ "PERMUTATION_EMISSION", 4, 1 },
+	{ "PERMUTATION_EMISSION_TEXTURE", 5, 1 },
+	{ "PERMUTATION_GAMMA", 6, 1 },
+	{ "PERMUTATION_CUBE_MAP", 7, 1 },
+	{ "PERMUTATION_INSTANCE_MATERIAL", 8, 1 },
+	{ "PERMUTATION_FOG", 9, 1 },
+	{ "PERMUTATION_CLUSTERED_LIGHTS", 10, 1 },
+	{ "PERMUTATION_SHADOW", 11, 1 },
+	{ "PERMUTATION_LIGHT_MASK", LIGHTING_LIGHT_MASK_SHIFT, LIGHT_AMOUNT }
+};
+constexpr unsigned int LIGHTING_FEATURE_COUNT = sizeof(LIGHTING_FEATURES) / sizeof(LIGHTING_FEATURES[0]);
+
+inline uint32_t LightingLightMask(uint32_t enabled_lights) {
+	return enabled_lights << LIGHTING_LIGHT_MASK_SHIFT;
+}
+
+// All lighting.frag permutations of one vertex shader, with the uniform blocks bound on link.
+inline std::unique_ptr<ShaderPermutations> CreateLightingPermutations(const std::string& vertex_path, ProgramBinaryCache* binary_cache = nullptr) {
+	return std::make_unique<ShaderPermutations>(vertex_path, "Shaders/lighting.frag", LIGHTING_FEATURES, LIGHTING_FEATURE_COUNT, LightingUniformBlocks::BindProgram, binary_cache);
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include "Shader.h"
+#include "Light.h"
+#include "Fog.h"
+#include "ViewVolume.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+// Has to match NUM_LIGHTS in lighting.frag: 0 Direction Light; 1 2 3 4 Point Light; 5 6 Spot Light;
+constexpr unsigned int LIGHT_AMOUNT = 7;
+constexpr unsigned int POINT_LIGHT_OFFSET = 1;
+constexpr unsigned int SPOT_LIGHT_OFFSET = 5;
+constexpr unsigned int CLIPPING_PLANE_AMOUNT = 6;
+
+// Binding points of the blocks in the lighting shaders.
+constexpr GLuint LIGHT_BLOCK_BINDING = 0;
+constexpr GLuint FOG_BLOCK_BINDING = 1;
+constexpr GLuint CLIPPING_BLOCK_BINDING = 2;
+// Owned by ClusteredLighting and CachedShadowMap.
+constexpr GLuint CLUSTER_BLOCK_BINDING = 3;
+constexpr GLuint SHADOW_BLOCK_BINDING = 4;
+
+// std140 images of the structs in lighting.frag. A vec3 takes 16 bytes unless a scalar follows it
+// in the same slot, bools are 4 bytes and every struct is padded to 16 bytes.
+struct LightStd140 {
+	glm::vec4 Position;
+	glm::vec4 Direction;
+	glm::vec4 Ambient;
+	glm::vec4 Diffuse;
+	glm::vec3 Specular;
+	float Constant;
+	float Linear;
+	float Quadratic;
+	float Cutoff;
+	float OuterCutoff;
+	float Exponent;
+	int Enable;
+	int Caster;
+	int Padding;
+};
+static_assert(sizeof(LightStd140) == 112, "LightStd140 must match the std140 layout of Light");
+
+struct FogStd140 {
+	int Mode;
+	int DepthType;
+	float Density;
+	float Start;
+	float End;
+	int Enable;
+	int Padding[2];
+	glm::vec4 Color;
+};
+static_assert(sizeof(FogStd140) == 48, "FogStd140 must match the std140 layout of Fog");
+
+struct PlaneStd140 {
+	glm::vec4 Position;
+	glm::vec4 Normal;
+};
+static_assert(sizeof(PlaneStd140) == 32, "PlaneStd140 must match the std140 layout of Plane");
+
+// The light and fog uniforms of lighting.frag and the clipping planes of the vertex shaders live in three uniform buffers shared by
+// every program. Each Update*() rebuilds the block on the stack and only uploads it when it differs
+// from what the GPU already has.
+class LightingUniformBlocks {
+public:
+	LightingUniformBlocks() {
+		GLuint buffers[3];
+		glGenBuffers(3, buffers);
+		this->LightBuffer = buffers[0];
+		this->FogBuffer = buffers[1];
+		this->ClippingBuffer = buffers[2];
+		CreateBuffer(this->LightBuffer, LIGHT_BLOCK_BINDING, this->Lights, sizeof(this->Lights));
+		CreateBuffer(this->FogBuffer, FOG_BLOCK_BINDING, &this->FogBlock, sizeof(this->FogBlock));
+		CreateBuffer(this->ClippingBuffer, CLIPPING_BLOCK_BINDING, this->Planes, sizeof(this->Planes));
+	}
+
+	~LightingUniformBlocks() {
+		GLuint buffers[3] = { this->LightBuffer, this->FogBuffer, this->ClippingBuffer };
+		glDeleteBuffers(3, buffers);
+	}
+
+	LightingUniformBlocks(const LightingUniformBlocks&) = delete;
+	LightingUniformBlocks& operator=(const LightingUniformBlocks&) = delete;
+
+	// Points the blocks of a program at the shared buffers, once after linking.
+	static void BindProgram(GLuint program) {
+		BindBlock(program, "LightBlock", LIGHT_BLOCK_BINDING);
+		BindBlock(program, "FogBlock", FOG_BLOCK_BINDING);
+		BindBlock(program, "ClippingBlock", CLIPPING_BLOCK_BINDING);
+		BindBlock(program, "ClusterBlock", CLUSTER_BLOCK_BINDING);
+		BindBlock(program, "ShadowBlock", SHADOW_BLOCK_BINDING);
+	}
+
+	void UpdateLights(const std::vector<Nexus::DirectionalLight*>& dir_lights, const std::vector<Nexus::PointLight*>& point_lights, const std::vector<Nexus::SpotLight*>& spot_lights) {
+		LightStd140 lights[LIGHT_AMOUNT] = {};
+		for (unsigned int i = 0; i < dir_lights.size() && i < POINT_LIGHT_OFFSET; i++) {
+			LightStd140& light = lights[i];
+			light.Direction = glm::vec4(dir_lights[i]->GetDirection(), 0.0f);
+			SetColors(light, dir_lights[i]);
+		}
+		for (unsigned int i = 0; i < point_lights.size() && POINT_LIGHT_OFFSET + i < SPOT_LIGHT_OFFSET; i++) {
+			LightStd140& light = lights[POINT_LIGHT_OFFSET + i];
+			light.Position = glm::vec4(point_lights[i]->GetPosition(), 1.0f);
+			SetAttenuation(light, point_lights[i]);
+			SetColors(light, point_lights[i]);
+		}
+		for (unsigned int i = 0; i < spot_lights.size() && SPOT_LIGHT_OFFSET + i < LIGHT_AMOUNT; i++) {
+			LightStd140& light = lights[SPOT_LIGHT_OFFSET + i];
+			light.Position = glm::vec4(spot_lights[i]->GetPosition(), 1.0f);
+			light.Direction = glm::vec4(spot_lights[i]->GetDirection(), 0.0f);
+			light.Cutoff = glm::cos(glm::radians(spot_lights[i]->GetCutoff()));
+			light.OuterCutoff = glm::cos(glm::radians(spot_lights[i]->GetOuterCutoff()));
+			SetAttenuation(light, spot_lights[i]);
+			SetColors(light, spot_lights[i]);
+		}
+		this->EnabledLights = 0;
+		for (unsigned int i = 0; i < LIGHT_AMOUNT; i++) {
+			this->EnabledLights |= lights[i].Enable ? (1u << i) : 0u;
+		}
+		this->Upload(this->LightBuffer, this->Lights, lights, sizeof(lights));
+	}
+
+	void UpdateFog(Nexus::Fog* fog) {
+		FogStd140 block = {};
+		block.Mode = fog->GetMode();
+		block.DepthType = fog->GetDepthType();
+		block.Density = fog->GetDensity();
+		block.Start = fog->GetFogStart();
+		block.End = fog->GetFogEnd();
+		block.Enable = fog->GetEnable();
+		block.Color = fog->GetColor();
+		this->Upload(this->FogBuffer, &this->FogBlock, &block, sizeof(block));
+	}
+
+	// Planes 0 to 2 go through the near plane corner and 3 to 5 through the far one. The normals are
+	// normalized here so the vertex shaders get signed distances for gl_ClipDistance from a single dot.
+	void UpdateClippingPlanes(const Nexus::ViewVolume* view_volume) {
+		PlaneStd140 planes[CLIPPING_PLANE_AMOUNT] = {};
+		for (unsigned int i = 0; i < CLIPPING_PLANE_AMOUNT; i++) {
+			planes[i].Position = glm::vec4(i <= 2 ? view_volume->NearPlaneVertex[0] : view_volume->FarPlaneVertex[1], 1.0f);
+			planes[i].Normal = glm::vec4(glm::normalize(glm::vec3(view_volume->ViewVolumeNormal[i])), 0.0f);
+		}
+		this->Upload(this->ClippingBuffer, this->Planes, planes, sizeof(planes));
+	}
+
+	// Turns the hardware clip distances written by the vertex shaders on or off. Only draws of objects
+	// that intersect the view volume need them.
+	static void EnableClipping(bool enable) {
+		for (unsigned int i = 0; i < CLIPPING_PLANE_AMOUNT; i++) {
+			if (enable) {
+				glEnable(GL_CLIP_DISTANCE0 + i);
+			} else {
+				glDisable(GL_CLIP_DISTANCE0 + i);
+			}
+		}
+	}
+
+	unsigned int GetUploadCount() const { return this->UploadCount; }
+	// Bit i is set when lights[i] is enabled, as of the last UpdateLights().
+	uint32_t GetEnabledLights() const { return this->EnabledLights; }
+
+private:
+	GLuint LightBuffer = 0;
+	GLuint FogBuffer = 0;
+	GLuint ClippingBuffer = 0;
+
+	// What the GPU currently holds.
+	LightStd140 Lights[LIGHT_AMOUNT] = {};
+	FogStd140 FogBlock = {};
+	PlaneStd140 Planes[CLIPPING_PLANE_AMOUNT] = {};
+	unsigned int UploadCount = 0;
+	uint32_t EnabledLights = 0;
+
+	// The buffers start out with the zeroed shadow copies, so both sides agree from the beginning.
+	static void CreateBuffer(GLuint buffer, GLuint binding, const void* data, GLsizeiptr size) {
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+	}
+
+	static void BindBlock(GLuint program, const char* name, GLuint binding) {
+		GLuint index = glGetUniformBlockIndex(program, name);
+		if (index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program, index, binding);
+		}
+	}
+
+	template <typename LightType>
+	static void SetColors(LightStd140& light, LightType* source) {
+		light.Ambient = glm::vec4(source->GetAmbient(), 0.0f);
+		light.Diffuse = glm::vec4(source->GetDiffuse(), 0.0f);
+		light.Specular = source->GetSpecular();
+		light.Enable = source->GetEnable();
+		light.Caster = source->GetCaster();
+	}
+
+	template <typename LightType>
+	static void SetAttenuation(LightStd140& light, LightType* source) {
+		light.Constant = source->GetConstant();
+		light.Linear = source->GetLinear();
+		light.Quadratic = source->GetQuadratic();
+	}
+
+	void Upload(GLuint buffer, void* shadow, const void* data, size_t size) {
+		if (std::memcmp(shadow, data, size) == 0) {
+			return;
+		}
+		std::memcpy(shadow, data, size);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		this->UploadCount++;
+	}
+};
@@ -4,29 +4,50 @@
 #include "ThirdPersonCamera.h"
 #include "Shader.h"
 #include "MatrixStack.h"
-#include "Texture2D.h"
 #include "Light.h"
 #include "Fog.h"
 
-#include "Rectangle.h"
-#include "Cube.h"
-#include "Sphere.h"
 #include "ViewVolume.h"
 
 #include "Ball.h"
-#include "Obstacle.h"
-
+#include "BallCulling.h"
+#include "BallRenderer.h"
+#include "PhysicsWorld.h"
+#include "GLStats.h"
+#include "UniformCache.h"
+#include "RenderBackend.h"
+#include "RenderStateCache.h"
+#include "RenderQueue.h"
+#include "StaticBatch.h"
+#include "ViewVolumeMesh.h"
+#include "TransformSystem.h"
+#include "LightingUniformBlocks.h"
+#include "LightingFeatures.h"
+#include "ClusteredLighting.h"
+#include "CachedShadowMap.h"
+#include "ProgramBinaryCache.h"
+#include "ShaderProgram.h"
+#include "Stopwatch.h"
+#include "AssetLoader.h"
+#include "FrameArena.h"
+#include "SimulationTrace.h"
+#include "TraceRecorder.h"
+#define ALLOCATION_TRACKER_IMPLEMENTATION
+#include "AllocationTracker.h"
+
+#include <optional>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <algorithm>
 #include <random>
 
-std::mt19937_64 rand_generator;
-std::uniform_real_distribution<float> unif_ball_position_xz(-8, 8);
-std::uniform_real_distribution<float> unif_ball_position_y(2, 18);
-std::uniform_real_distribution<float> unif_ball_velocity(-2, 2);
-std::uniform_real_distribution<float> unif_ball_mass(1.0f, 20.0f);
-
 class NexusDemo final : public Nexus::Application {
 public:
-	NexusDemo() {
+	NexusDemo(unsigned int thread_count) {
+		world = std::make_unique<PhysicsWorld>(thread_count);
+
 		Settings.Width = 800;
 		Settings.Height = 600;
 		Settings.WindowTitle = "Game Engine #3 | Physics Engine";
@@ -54,7 +75,14 @@ public:
 		ProjectionSettings.Aspect = (float)Settings.Width / (float)Settings.Height;
 	}
 
+	~NexusDemo() override {
+		glDeleteProgram(lighting_program);
+		glDeleteProgram(normal_program);
+	}
+
 	void Initialize() override {
+		Stopwatch startup_watch;
+
 		// Setting OpenGL
 		glEnable(GL_MULTISAMPLE);
 		glEnable(GL_DEPTH_TEST);
@@ -62,11 +90,21 @@ public:
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 		// Create shader program
-		myShader = std::make_unique<Nexus::Shader>("Shaders/lighting.vert", "Shaders/lighting.frag");
+		Stopwatch shader_watch;
+		program_cache = std::make_unique<ProgramBinaryCache>();
+		lighting_program = LoadShaderProgram("Shaders/lighting.vert", "Shaders/lighting.frag", "", program_cache.get());
+		ballShaders = CreateLightingPermutations("Shaders/instance.vert", program_cache.get());
+		lightingShaders = CreateLightingPermutations("Shaders/lighting.vert", program_cache.get());
+		lighting_blocks = std::make_unique<LightingUniformBlocks>();
+		clustered_lighting = std::make_unique<ClusteredLighting>();
+		GenerateClusterLights((unsigned int)cluster_light_count);
+		LightingUniformBlocks::BindProgram(lighting_program);
 		// myShader = std::make_unique<Nexus::Shader>("Shaders/lighting_shadow.vert", "Shaders/lighting_shadow.frag");
-		// simpleDepthShader = std::make_unique<Nexus::Shader>("Shaders/simple_depth_shader.vert", "Shaders/simple_depth_shader.frag");
+		simpleDepthShader = std::make_unique<Nexus::Shader>("Shaders/simple_depth_shader.vert", "Shaders/simple_depth_shader.frag");
+		ballDepthShader = std::make_unique<Nexus::Shader>("Shaders/simple_depth_instance.vert", "Shaders/simple_depth_shader.frag");
 		// debugDepthQuad = std::make_unique<Nexus::Shader>("Shaders/debug_quad.vert", "Shaders/debug_quad_depth.frag");
-		normalShader = std::make_unique<Nexus::Shader>("Shaders/normal_visualization.vs", "Shaders/normal_visualization.fs", "Shaders/normal_visualization.gs");
+		normal_program = LoadShaderProgram("Shaders/normal_visualization.vs", "Shaders/normal_visualization.fs", "Shaders/normal_visualization.gs", program_cache.get());
+		startup_times.NexusShaders = shader_watch.GetElapsedMilliseconds();
 		
 		// Create Camera
 		first_camera = std::make_unique<Nexus::FirstPersonCamera>(glm::vec3(0.0f, 2.0f, 5.0f));
@@ -80,15 +118,60 @@ public:
 		model = std::make_unique<Nexus::MatrixStack>();
 
 		// Create object data
-		floor = std::make_unique<Nexus::Rectangle>(20.0f, 20.0f, 10.0f, Nexus::POS_Y);
-		cube = std::make_unique<Nexus::Cube>();
-		sphere = std::make_unique<Nexus::Sphere>();
+		// The room never moves: its six walls are merged into one buffer here and drawn with one call.
+		static_batch = std::make_unique<StaticBatch>();
+		room_group = static_batch->AddGroup();
+		const glm::mat4 identity(1.0f);
+		const glm::mat4 walls[6] = {
+			identity,
+			glm::rotate(glm::translate(identity, glm::vec3(0.0f, 20.0f, 0.0f)), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+			glm::rotate(glm::translate(identity, glm::vec3(0.0f, 10.0f, -10.0f)), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+			glm::rotate(glm::translate(identity, glm::vec3(0.0f, 10.0f, 10.0f)), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+			glm::rotate(glm::translate(identity, glm::vec3(10.0f, 10.0f, 0.0f)), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
+			glm::rotate(glm::translate(identity, glm::vec3(-10.0f, 10.0f, 0.0f)), glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f))
+		};
+		for (const glm::mat4& wall : walls) {
+			static_batch->AddRectangle(room_group, wall, 20.0f, 20.0f, 10.0f);
+		}
+		static_batch->Build();
+		// Shapes that move stay in model space and are drawn with their own model matrix.
+		unit_shapes = std::make_unique<StaticBatch>();
+		unit_cube_group = unit_shapes->AddGroup();
+		unit_shapes->AddCube(unit_cube_group, identity);
+		unit_sphere_group = unit_shapes->AddGroup();
+		unit_shapes->AddSphere(unit_sphere_group, identity);
+		unit_shapes->Build();
 
 		view_volume = std::make_unique<Nexus::ViewVolume>();
+		view_volume_mesh = std::make_unique<ViewVolumeMesh>();
+		ball_renderer = std::make_unique<BallRenderer>();
+		GLStats::Install();
 
 		// Loading textures
-		texture_checkerboard = Nexus::Texture2D::CreateFromFile("Resource/Textures/chessboard-metal.png", true);
-		texture_checkerboard->SetWrappingParams(GL_REPEAT, GL_REPEAT);
+		// Every texture of the room streams in over the first frames, the placeholder is drawn until then.
+		asset_loader = std::make_unique<AssetLoader>();
+		std::error_code error;
+		for (const auto& file : std::filesystem::directory_iterator("Resource/Textures", error)) {
+			std::string extension = file.path().extension().string();
+			if (file.is_regular_file() && (extension == ".png" || extension == ".jpg")) {
+				room_texture_names.push_back(file.path().filename().string());
+			}
+		}
+		std::sort(room_texture_names.begin(), room_texture_names.end());
+		if (room_texture_names.empty()) {
+			room_texture_names.push_back("chessboard-metal.png");
+		}
+		for (unsigned int i = 0; i < room_texture_names.size(); i++) {
+			room_textures.push_back(asset_loader->Load2D("Resource/Textures/" + room_texture_names[i]));
+			if (room_texture_names[i] == "chessboard-metal.png") {
+				room_texture = i;
+			}
+		}
+		skybox_texture = asset_loader->LoadCubeMap({
+			"Resource/Textures/skybox/right.jpg", "Resource/Textures/skybox/left.jpg",
+			"Resource/Textures/skybox/top.jpg", "Resource/Textures/skybox/bottom.jpg",
+			"Resource/Textures/skybox/front.jpg", "Resource/Textures/skybox/back.jpg"
+		});
 
 		// Initial Light Setting
 		DirLights = {
@@ -109,62 +192,60 @@ public:
 		SpotLights[1]->SetCutoff(6.0f);
 		SpotLights[1]->SetOuterCutoff(30.0f);
 
-		// Shadow
-		/*
-		glGenFramebuffers(1, &depth_map_fbo);
-		glGenTextures(1, &depth_map);
-		glBindTexture(GL_TEXTURE_2D, depth_map);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		GLfloat borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-		glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_map, 0);
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		*/
+		// Shadow of the directional light, see UpdateShadowMap().
+		shadow_map = std::make_unique<CachedShadowMap>();
+		if (!shadow_map->IsComplete()) {
+			Nexus::Logger::Message(Nexus::LOG_WARNING, "Shadow map framebuffers are incomplete, shadows are off.");
+		}
 
 		// Fog
 		fog = std::make_unique<Nexus::Fog>(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), true, 0.1f, 100.0f);
 		fog->SetDensity(0.01f);
 
 		// Balls
-		for (unsigned int i = 0; i < 100; i++) {
-			glm::vec3 ball_position = glm::vec3(unif_ball_position_xz(rand_generator), unif_ball_position_y(rand_generator), unif_ball_position_xz(rand_generator));
-			glm::vec3 ball_velocity = glm::vec3(unif_ball_velocity(rand_generator), unif_ball_velocity(rand_generator), unif_ball_velocity(rand_generator));
-			float ball_mass = unif_ball_mass(rand_generator);
-			Ball temp_ball(ball_position, ball_velocity, ball_mass);
-			balls.push_back(temp_ball);
-		}
-		currnet_ball = &balls[0];
+		world->SpawnRandomBalls(100);
+		currnet_ball = Ball(&world->Balls, 0);
 
 		// Obstacle
-		obstacles = {
-			Obstacle(glm::vec3(3.0, 1.01f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
-			Obstacle(glm::vec3(-3.0, 8.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
-			Obstacle(glm::vec3(-3.0, 5.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
-			Obstacle(glm::vec3(3.0, 15.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.0f))
-		};
+		world->CreateDefaultObstacles();
+
+		// Build the permutations of the start-up settings now rather than in the first frame.
+		// After the first launch they come out of the binary cache.
+		lighting_blocks->UpdateLights(DirLights, PointLights, SpotLights);
+		ballShaders->Get(GetLightingFeatures() | LIGHTING_INSTANCE_MATERIAL);
+		lightingShaders->Get(GetLightingFeatures(GetRoomMaterial()));
+		lightingShaders->Get(GetLightingFeatures(GetObstacleMaterial()));
+		startup_times.Permutations = ballShaders->GetBuildMilliseconds() + lightingShaders->GetBuildMilliseconds();
+		startup_times.Total = startup_watch.GetElapsedMilliseconds();
+		startup_times.Warm = program_cache->GetMisses() == 0;
+
+		char message[160];
+		std::snprintf(message, sizeof(message), "Startup (%s): %.1f ms, Nexus shaders %.1f ms, permutations %.1f ms (%u cached, %u compiled).",
+			startup_times.Warm ? "warm" : "cold", startup_times.Total, startup_times.NexusShaders, startup_times.Permutations, program_cache->GetHits(), program_cache->GetMisses());
+		Nexus::Logger::Message(Nexus::LOG_INFO, message);
 	}
 
 	void Update() override {
-        for (unsigned int i = 0; i < balls.size(); i++) {
-            balls[i].ViewVolumeIncludingTest(view_volume.get());
-            balls[i].Edge(elasticities);
-            for(unsigned int j = (i + 1); j < balls.size(); j++) {
-                balls[i].CollisionWithBall(balls[j], elasticities);
-            }
-
-            for(unsigned int j = 0; j < obstacles.size(); j++) {
-                balls[i].CollisionWithObstacle(obstacles[j], elasticities);
-            }
-            balls[i].Update(DeltaTime, gravity, dragforce);
+        // A new frame starts here: keep the numbers of the last one and drop its scratch memory.
+        AllocationCount total_allocations = AllocationTracker::GetTotal();
+        last_frame_allocations = total_allocations - frame_start_allocations;
+        frame_start_allocations = total_allocations;
+        last_update_allocations = update_allocations;
+        last_render_allocations = render_allocations;
+        update_allocations = AllocationCount();
+        render_allocations = AllocationCount();
+        frame_arena.Reset();
+        AllocationScope allocation_scope(update_allocations);
+
+        GLStats::NewFrame();
+        render_state.NewFrame();
+        // A replay only moves through the recorded frames; the world waits where it was.
+        if (trace_replaying) {
+            UpdateReplay();
+        } else {
+            world->Advance(DeltaTime);
         }
+        const BallSystem& shown_balls = GetShownBalls();
 
         SetViewMatrix(Nexus::DISPLAY_MODE_DEFAULT);
         view_volume->UpdateVertices(
@@ -177,42 +258,31 @@ public:
                 ProjectionSettings.OrthogonalHeight,
                 view
         );
+        view_volume_mesh->Update(*view_volume);
+
+        UpdateSceneTransforms();
+        UpdateClusteredLights();
+
+        if (!shown_balls.Empty()) {
+            third_camera->SetTarget(shown_balls.GetRenderPosition(0));
+        }
+
+        // Classify the balls where they will be drawn this frame. With ball culling on, the camera
+        // skips the balls outside the view volume and the intersecting ones are clipped; the shadow
+        // pass still draws them all.
+        CullBalls(shown_balls, FrustumPlanes::FromViewVolume(view_volume.get()), frame_arena, ball_culling);
+        if (enable_instanced_balls) {
+            ball_renderer->Upload(shown_balls, ball_culling, enalbe_ball_culling, IsShadowEnabled());
+        }
 
-        third_camera->SetTarget(balls[0].GetPosition());
+        // Once per frame however many views Render() draws. The texture uploads bind behind the state cache.
+        asset_loader->Update();
+        render_state.Invalidate();
+        UpdateShadowMap();
 	}
 	
 	void Render(Nexus::DisplayMode monitor_type) override {
-		
-		/*
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_FRONT);
-		glFrontFace(GL_CW);
-		
-		// 1. Rendering the depth first (For shadow mapping)
-		float light_near_plane = 1.0f, light_far_plane = 20.0f;
-		glm::mat4 light_view = glm::lookAt(DirLights[0]->GetDirection() * -1.0f, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 light_projection = GetOrthoProjMatrix(-10.0f, 10.0f, -10.0f, 10.0f, light_near_plane, light_far_plane);
-		glm::mat4 light_space_matrix = light_projection * light_view;
-		simpleDepthShader->Use();
-		simpleDepthShader->SetMat4("lightSpaceMatrix", light_space_matrix);
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		RenderSceneForDepth(simpleDepthShader);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		*/
-		
-		/*
-		SetViewMatrix(monitor_type);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		debugDepthQuad->Use();
-		debugDepthQuad->SetInt("depthMap", 0);
-		debugDepthQuad->SetFloat("nearPlane", light_near_plane);
-		debugDepthQuad->SetFloat("farPlane", light_far_plane);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depth_map);
-		RenderQuad();
-		*/
+		AllocationScope allocation_scope(render_allocations);
 
 		if (Settings.EnableFaceCulling) {
 			// CW => Clockwise is the front face
@@ -233,286 +303,430 @@ public:
 		SetProjectionMatrix(monitor_type);
 		SetViewport(monitor_type);
 
-		myShader->Use();
-		myShader->SetBool("enableCulling", false);
-		myShader->SetInt("material.diffuse_texture", 0);
-		myShader->SetInt("material.specular_texture", 1);
-		myShader->SetInt("material.emission_texture", 2);
-		// myShader->SetInt("shadowMap", 4);
-		myShader->SetInt("skybox", 3);
-
-		myShader->SetMat4("view", view);
-		myShader->SetMat4("projection", projection);
-		myShader->SetVec3("viewPos", Settings.EnableGhostMode ? first_camera->GetPosition() : third_camera->GetPosition());
-		// myShader->SetMat4("lightSpaceMatrix", light_space_matrix);
-
-		// glActiveTexture(GL_TEXTURE4);
-		// glBindTexture(GL_TEXTURE_2D, depth_map);
-
-		myShader->SetBool("useBlinnPhong", Settings.UseBlinnPhongShading);
-		myShader->SetBool("useLighting", Settings.UseLighting);
-		myShader->SetBool("useDiffuseTexture", Settings.UseDiffuseTexture);
-		myShader->SetBool("useSpecularTexture", Settings.UseSpecularTexture);
-		myShader->SetBool("useEmission", Settings.UseEmission);
-		myShader->SetBool("useGamma", Settings.UseGamma);
-		myShader->SetFloat("GammaValue", Settings.GammaValue);
-		
-		for (unsigned int i = 0; i < DirLights.size(); i++) {
-			myShader->SetVec3("lights[" + std::to_string(i) + "].direction", DirLights[i]->GetDirection());
-			myShader->SetVec3("lights[" + std::to_string(i) + "].ambient", DirLights[i]->GetAmbient());
-			myShader->SetVec3("lights[" + std::to_string(i) + "].diffuse", DirLights[i]->GetDiffuse());
-			myShader->SetVec3("lights[" + std::to_string(i) + "].specular", DirLights[i]->GetSpecular());
-			myShader->SetBool("lights[" + std::to_string(i) + "].enable", DirLights[i]->GetEnable());
-			myShader->SetInt("lights[" + std::to_string(i) + "].caster", DirLights[i]->GetCaster());
-		}
-
-		for (unsigned int i = 0; i < PointLights.size(); i++) {
-			myShader->SetVec3("lights[" + std::to_string(i + 1) + "].position", PointLights[i]->GetPosition());
-			myShader->SetVec3("lights[" + std::to_string(i + 1) + "].ambient", PointLights[i]->GetAmbient());
-			myShader->SetVec3("lights[" + std::to_string(i + 1) + "].diffuse", PointLights[i]->GetDiffuse());
-			myShader->SetVec3("lights[" + std::to_string(i + 1) + "].specular", PointLights[i]->GetSpecular());
-			myShader->SetFloat("lights[" + std::to_string(i + 1) + "].constant", PointLights[i]->GetConstant());
-			myShader->SetFloat("lights[" + std::to_string(i + 1) + "].linear", PointLights[i]->GetLinear());
-			myShader->SetFloat("lights[" + std::to_string(i + 1) + "].quadratic", PointLights[i]->GetQuadratic());
-			myShader->SetFloat("lights[" + std::to_string(i + 1) + "].enable", PointLights[i]->GetEnable());
-			myShader->SetInt("lights[" + std::to_string(i + 1) + "].caster", PointLights[i]->GetCaster());
-		}
-
-		SpotLights[0]->SetPosition(third_camera->GetPosition());
-		SpotLights[0]->SetDirection(third_camera->GetFront());
-		SpotLights[1]->SetPosition(first_camera->GetPosition());
-		SpotLights[1]->SetDirection(first_camera->GetFront());
-		for (unsigned int i = 0; i < SpotLights.size(); i++) {
-			myShader->SetVec3("lights[" + std::to_string(i + 5) + "].position", SpotLights[i]->GetPosition());
-			myShader->SetVec3("lights[" + std::to_string(i + 5) + "].direction", SpotLights[i]->GetDirection());
-			myShader->SetVec3("lights[" + std::to_string(i + 5) + "].ambient", SpotLights[i]->GetAmbient());
-			myShader->SetVec3("lights[" + std::to_string(i + 5) + "].diffuse", SpotLights[i]->GetDiffuse());
-			myShader->SetVec3("lights[" + std::to_string(i + 5) + "].specular", SpotLights[i]->GetSpecular());
-			myShader->SetFloat("lights[" + std::to_string(i + 5) + "].constant", SpotLights[i]->GetConstant());
-			myShader->SetFloat("lights[" + std::to_string(i + 5) + "].linear", SpotLights[i]->GetLinear());
-			myShader->SetFloat("lights[" + std::to_string(i + 5) + "].quadratic", SpotLights[i]->GetQuadratic());
-			myShader->SetFloat("lights[" + std::to_string(i + 5) + "].cutoff", glm::cos(glm::radians(SpotLights[i]->GetCutoff())));
-			myShader->SetFloat("lights[" + std::to_string(i + 5) + "].outerCutoff", glm::cos(glm::radians(SpotLights[i]->GetOuterCutoff())));
-			myShader->SetBool("lights[" + std::to_string(i + 5) + "].enable", SpotLights[i]->GetEnable());
-			myShader->SetInt("lights[" + std::to_string(i + 5) + "].caster", SpotLights[i]->GetCaster());
-		}
-
-		myShader->SetVec4("fog.color", fog->GetColor());
-		myShader->SetFloat("fog.density", fog->GetDensity());
-		myShader->SetInt("fog.mode", fog->GetMode());
-		myShader->SetInt("fog.depthType", fog->GetDepthType());
-		myShader->SetBool("fog.enable", fog->GetEnable());
-		myShader->SetFloat("fog.f_start", fog->GetFogStart());
-		myShader->SetFloat("fog.f_end", fog->GetFogEnd());
-
-		for (unsigned int i = 0; i < 6; i++) {
-			if (i <= 2) {
-				myShader->SetVec3("clippingPlanes[" + std::to_string(i) + "].position", view_volume->NearPlaneVertex[0]);
-			} else {
-				myShader->SetVec3("clippingPlanes[" + std::to_string(i) + "].position", view_volume->FarPlaneVertex[1]);
-			}
-			myShader->SetVec3("clippingPlanes[" + std::to_string(i) + "].normal", view_volume->ViewVolumeNormal[i]);
-		}
-
-		// RenderScene(myShader);
+		UpdateLightingBlocks();
+		// The UI drawn after the last frame bound its own state.
+		render_state.Invalidate();
+		render_state.BindTexture(3, asset_loader->GetTarget(skybox_texture), asset_loader->Get(skybox_texture));
+		clustered_lighting->Bind(render_state);
+		render_state.BindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D, shadow_map->GetTexture());
+		uniforms.Use(lighting_program);
+		SetProgramUniforms(this, lighting_program);
 
 		// ==================== Draw origin and 3 axes ====================
 		if (Settings.ShowOriginAnd3Axes) {
-			this->DrawOriginAnd3Axes(myShader.get());
+			this->DrawOriginAnd3Axes();
 		}
 
-		// ==================== Draw a room ====================
-		myShader->SetBool("material.enableDiffuseTexture", true);
-		myShader->SetBool("material.enableSpecularTexture", false);
-		myShader->SetBool("material.enableEmission", false);
-		myShader->SetBool("material.enableEmissionTexture", false);
-		myShader->SetFloat("material.shininess", 64.0f);
-		model->Push();
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 20.0f, 0.0f)));
-		model->Save(glm::rotate(model->Top(), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-		model->Pop();
-
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 10.0f, -10.0f)));
-		model->Save(glm::rotate(model->Top(), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-		model->Pop();
+		// Everything else is recorded first and drawn sorted by program, material and texture.
+		render_queue.Reset();
+		glm::vec3 camera_position = Settings.EnableGhostMode ? first_camera->GetPosition() : third_camera->GetPosition();
+		float far_plane = std::max(ProjectionSettings.ClippingFar, 0.001f);
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 10.0f, 10.0f)));
-		model->Save(glm::rotate(model->Top(), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-		model->Pop();
-		
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(10.0f, 10.0f, 0.0f)));
-		model->Save(glm::rotate(model->Top(), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-		model->Pop();
+		// ==================== Draw a room ====================
+		RenderMaterial room_material = GetRoomMaterial();
+		RenderCommand room;
+		room.Program = lightingShaders->Get(GetLightingFeatures(room_material));
+		room.Material = render_queue.AddMaterial(room_material);
+		room.TextureTarget = asset_loader->GetTarget(room_textures[room_texture]);
+		room.Texture = asset_loader->Get(room_textures[room_texture]);
+		room.Draw = DrawStaticGroup;
+		room.Context = this;
+		room.Index = room_group;
+		render_queue.Submit(room, RENDER_LAYER_OPAQUE, 0.0f);
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(-10.0f, 10.0f, 0.0f)));
-		model->Save(glm::rotate(model->Top(), glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(myShader.get(), model->Top());
-		model->Pop();
-		model->Pop();
-		
 		// ==================== Draw Ball ====================
-		myShader->SetBool("enableCulling", enalbe_ball_culling);
-		myShader->SetBool("material.enableDiffuseTexture", false);
-		myShader->SetBool("material.enableSpecularTexture", false);
-		myShader->SetBool("material.enableEmission", false);
-		myShader->SetBool("material.enableEmissionTexture", false);
-		myShader->SetFloat("material.shininess", 32.0f);
-		for (unsigned int i = 0; i < balls.size(); i++) {
-			myShader->SetVec4("material.ambient", balls[i].GetAmbient());
-			myShader->SetVec4("material.diffuse", balls[i].GetDiffuse());
-			myShader->SetVec4("material.specular", balls[i].GetSpecular());
-			model->Push();
-			model->Save(balls[i].GetModel());
-			sphere->Draw(myShader.get(), model->Top());
-			model->Pop();
+		if (enable_instanced_balls) {
+			// Instanced draws with their own permutation, the colours come from the instance buffer.
+			RenderMaterial instance_material;
+			instance_material.Shininess = 32.0f;
+			RenderCommand balls;
+			balls.Program = ballShaders->Get(GetLightingFeatures() | LIGHTING_INSTANCE_MATERIAL);
+			balls.Material = render_queue.AddMaterial(instance_material);
+			balls.Draw = DrawInstancedBalls;
+			balls.Context = ball_renderer.get();
+			render_queue.Submit(balls, RENDER_LAYER_OPAQUE, 0.0f);
+		} else {
+			const BallSystem& balls = GetShownBalls();
+			for (unsigned int s = BALL_INSIDE; s <= BALL_OUTSIDE; s++) {
+				BallViewState state = (BallViewState)s;
+				if (state == BALL_OUTSIDE && enalbe_ball_culling) {
+					break;
+				}
+				RenderMaterial ball_material;
+				ball_material.Ambient = BALL_AMBIENT;
+				ball_material.Diffuse = BALL_DIFFUSE[state];
+				ball_material.Specular = BALL_SPECULAR;
+				ball_material.Shininess = 32.0f;
+				RenderCommand ball;
+				ball.Program = lighting_program;
+				ball.Material = render_queue.AddMaterial(ball_material);
+				ball.Clip = enalbe_ball_culling && state == BALL_INTERSECTION;
+				ball.Draw = DrawUnitShape;
+				ball.Context = this;
+				ball.Index = unit_sphere_group;
+				const unsigned int* indices = ball_culling.GetIndices(state);
+				for (unsigned int k = 0; k < ball_culling.GetCount(state); k++) {
+					if (indices[k] >= balls.Size()) {
+						continue;
+					}
+					ball.Model = Ball(&balls, indices[k]).GetModel();
+					render_queue.Submit(ball, RENDER_LAYER_OPAQUE, glm::distance(camera_position, balls.GetRenderPosition(indices[k])) / far_plane);
+				}
+			}
 		}
 
 		// ==================== Draw a cube ====================
-		myShader->SetBool("enableCulling", false);
-		myShader->SetBool("material.enableDiffuseTexture", false);
-		myShader->SetBool("material.enableSpecularTexture", false);
-		myShader->SetBool("material.enableEmission", false);
-		myShader->SetBool("material.enableEmissionTexture", false);
-		myShader->SetVec4("material.ambient", glm::vec4(0.02f, 0.02f, 0.02f, 1.0));
-		myShader->SetVec4("material.diffuse", glm::vec4(0.1f, 0.35f, 0.1f, 1.0));
-		myShader->SetVec4("material.specular", glm::vec4(0.45f, 0.55f, 0.45f, 1.0));
-		myShader->SetFloat("material.shininess", 16.0f);
-		for (unsigned int i = 0; i < obstacles.size(); i++) {
-
-			// obstacles[i].Edge();
-			// obstacles[i].Update(DeltaTime);
-
-			model->Push();
-			model->Save(glm::translate(model->Top(), obstacles[i].GetPosition()));
-			model->Save(glm::scale(model->Top(), glm::vec3(2.0f)));
-			cube->Draw(myShader.get(), model->Top());
-			model->Pop();
+		RenderMaterial cube_material = GetObstacleMaterial();
+		RenderCommand obstacle;
+		obstacle.Program = lightingShaders->Get(GetLightingFeatures(cube_material));
+		obstacle.Material = render_queue.AddMaterial(cube_material);
+		obstacle.Draw = DrawUnitShape;
+		obstacle.Context = this;
+		obstacle.Index = unit_cube_group;
+		for (unsigned int i = 0; i < world->Obstacles.size(); i++) {
+			obstacle.Model = scene_transforms.GetWorld(obstacle_transforms[i]);
+			render_queue.Submit(obstacle, RENDER_LAYER_OPAQUE, glm::distance(camera_position, world->Obstacles[i].GetPosition()) / far_plane);
 		}
 
 		// ==================== Draw View Volume ====================
-		model->Push();
-		myShader->SetVec4("material.ambient", glm::vec4(0.2f, 0.2f, 0.2f, 0.6f));
-		myShader->SetVec4("material.diffuse", glm::vec4(0.6f, 0.6f, 0.6f, 0.6f));
-		myShader->SetVec4("material.specular", glm::vec4(0.0f, 0.0, 0.0, 0.6f));
-		myShader->SetFloat("material.shininess", 32.0f);
-		myShader->SetMat4("model", model->Top());
-		view_volume->Draw(myShader.get(), model->Top());
-		model->Pop();
+		RenderMaterial volume_material;
+		volume_material.Ambient = glm::vec4(0.2f, 0.2f, 0.2f, 0.6f);
+		volume_material.Diffuse = glm::vec4(0.6f, 0.6f, 0.6f, 0.6f);
+		volume_material.Specular = glm::vec4(0.0f, 0.0, 0.0, 0.6f);
+		volume_material.Shininess = 32.0f;
+		RenderCommand volume;
+		volume.Program = lighting_program;
+		volume.Material = render_queue.AddMaterial(volume_material);
+		volume.Model = scene_transforms.GetWorld(scene_root);
+		volume.Draw = DrawViewVolume;
+		volume.Context = this;
+		render_queue.Submit(volume, RENDER_LAYER_TRANSLUCENT, 0.0f);
 
-		myShader->Use();
-		
 		// ==================== Draw Light Balls ====================
-		myShader->SetBool("material.enableDiffuseTexture", false);
-		myShader->SetBool("material.enableSpecularTexture", false);
-		myShader->SetBool("material.enableEmission", true);
-		myShader->SetBool("material.enableEmissionTexture", false);
+		RenderCommand light;
+		light.Program = lighting_program;
+		light.Draw = DrawUnitShape;
+		light.Context = this;
+		light.Index = unit_sphere_group;
 		for (unsigned int i = 0; i < DirLights.size(); i++) {
 			if (!DirLights[i]->GetEnable()) {
 				continue;
 			}
-			model->Push();
-			model->Save(glm::translate(model->Top(), DirLights[i]->GetDirection() * -1.0f));
-			model->Save(glm::scale(model->Top(), glm::vec3(0.5f)));
-			myShader->SetVec4("material.ambient", glm::vec4(DirLights[i]->GetAmbient(), 1.0f));
-			myShader->SetVec4("material.diffuse", glm::vec4(DirLights[i]->GetDiffuse(), 1.0f));
-			myShader->SetVec4("material.specular", glm::vec4(DirLights[i]->GetSpecular(), 1.0f));
-			myShader->SetFloat("material.shininess", 32.0f);
-			sphere->Draw(myShader.get(), model->Top());
-			model->Pop();
+			light.Material = render_queue.AddMaterial(GetLightMaterial(DirLights[i]->GetAmbient(), DirLights[i]->GetDiffuse(), DirLights[i]->GetSpecular()));
+			light.Model = scene_transforms.GetWorld(light_transforms[i]);
+			render_queue.Submit(light, RENDER_LAYER_OPAQUE, glm::distance(camera_position, DirLights[i]->GetDirection() * -1.0f) / far_plane);
 		}
-		for(unsigned int i = 0; i < PointLights.size(); i++) {
+		for (unsigned int i = 0; i < PointLights.size(); i++) {
 			if (!PointLights[i]->GetEnable()) {
 				continue;
 			}
-			model->Push();
-				model->Save(glm::translate(model->Top(), PointLights[i]->GetPosition()));
-				model->Save(glm::scale(model->Top(), glm::vec3(0.5f)));
-				myShader->SetVec4("material.ambient", glm::vec4(PointLights[i]->GetAmbient(), 1.0f));
-				myShader->SetVec4("material.diffuse", glm::vec4(PointLights[i]->GetDiffuse(), 1.0f));
-				myShader->SetVec4("material.specular", glm::vec4(PointLights[i]->GetSpecular(), 1.0f));
-				myShader->SetFloat("material.shininess", 32.0f);
-				sphere->Draw(myShader.get(), model->Top());
-			model->Pop();
+			light.Material = render_queue.AddMaterial(GetLightMaterial(PointLights[i]->GetAmbient(), PointLights[i]->GetDiffuse(), PointLights[i]->GetSpecular()));
+			light.Model = scene_transforms.GetWorld(light_transforms[DirLights.size() + i]);
+			render_queue.Submit(light, RENDER_LAYER_OPAQUE, glm::distance(camera_position, PointLights[i]->GetPosition()) / far_plane);
 		}
-		myShader->SetBool("material.enableEmission", false);
+
+		render_queue.Execute(render_state, uniforms, SetProgramUniforms, this, LightingUniformBlocks::EnableClipping);
 
 		// ImGui::ShowDemoWindow();
 	}
 
-	void RenderSceneForDepth(const std::unique_ptr<Nexus::Shader>& shader) {
-		// cubes
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 1.5f, 0.0)));
-		model->Save(glm::scale(model->Top(), glm::vec3(0.5f)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	static RenderMaterial GetRoomMaterial() {
+		RenderMaterial material;
+		material.Flags = RENDER_MATERIAL_DIFFUSE_TEXTURE;
+		material.Ambient = glm::vec4(0.2f, 0.2f, 0.2f, 1.0f);
+		material.Diffuse = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
+		material.Specular = glm::vec4(0.3f, 0.3f, 0.3f, 1.0f);
+		material.Shininess = 64.0f;
+		return material;
+	}
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(2.0f, 0.5f, 1.0)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	static RenderMaterial GetObstacleMaterial() {
+		RenderMaterial material;
+		material.Ambient = glm::vec4(0.02f, 0.02f, 0.02f, 1.0);
+		material.Diffuse = glm::vec4(0.1f, 0.35f, 0.1f, 1.0);
+		material.Specular = glm::vec4(0.45f, 0.55f, 0.45f, 1.0);
+		material.Shininess = 16.0f;
+		return material;
+	}
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(-1.0f, 0.8f, 2.0)));
-		model->Save(glm::rotate(model->Top(), glm::radians(60.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0))));
-		model->Save(glm::scale(model->Top(), glm::vec3(0.25f)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	static RenderMaterial GetLightMaterial(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular) {
+		RenderMaterial material;
+		material.Flags = RENDER_MATERIAL_EMISSION;
+		material.Ambient = glm::vec4(ambient, 1.0f);
+		material.Diffuse = glm::vec4(diffuse, 1.0f);
+		material.Specular = glm::vec4(specular, 1.0f);
+		material.Shininess = 32.0f;
+		return material;
 	}
 
-	void RenderScene(const std::unique_ptr<Nexus::Shader> &shader) {
-		// floor
-		shader->SetBool("material.enableDiffuseTexture", true);
-		shader->SetBool("material.enableSpecularTexture", false);
-		shader->SetBool("material.enableEmission", false);
-		shader->SetBool("material.enableEmissionTexture", false);
-		shader->SetFloat("material.shininess", 64.0f);
-		floor->BindTexture(0, texture_checkerboard.get());
-		floor->Draw(shader.get(), model->Top());
-
-		// cubes
-		shader->SetBool("material.enableDiffuseTexture", false);
-		shader->SetBool("material.enableSpecularTexture", false);
-		shader->SetBool("material.enableEmission", false);
-		shader->SetBool("material.enableEmissionTexture", false);
-		shader->SetVec4("material.ambient", glm::vec4(0.02f, 0.02f, 0.02f, 1.0));
-		shader->SetVec4("material.diffuse", glm::vec4(0.1f, 0.35f, 0.1f, 1.0));
-		shader->SetVec4("material.specular", glm::vec4(0.45f, 0.55f, 0.45f, 1.0));
-		shader->SetFloat("material.shininess", 16.0f);
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 1.5f, 0.0)));
-		model->Save(glm::scale(model->Top(), glm::vec3(0.5f)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	// Draw callbacks of the render queue.
+	static void DrawViewVolume(void* context, const RenderCommand& command, RenderStateCache& state) {
+		NexusDemo* demo = static_cast<NexusDemo*>(context);
+		demo->uniforms.SetMat4("model"_u, command.Model);
+		demo->uniforms.SetMat3("normalModel"_u, glm::transpose(glm::inverse(glm::mat3(command.Model))));
+		demo->view_volume_mesh->Draw(state);
+	}
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(2.0f, 0.5f, 1.0)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	// The batch is in world space already.
+	static void DrawStaticGroup(void* context, const RenderCommand& command, RenderStateCache& state) {
+		NexusDemo* demo = static_cast<NexusDemo*>(context);
+		demo->uniforms.SetMat4("model"_u, glm::mat4(1.0f));
+		demo->uniforms.SetMat3("normalModel"_u, glm::mat3(1.0f));
+		demo->static_batch->Draw(state, command.Index);
+	}
 
-		model->Push();
-		model->Save(glm::translate(model->Top(), glm::vec3(-1.0f, 0.8f, 2.0)));
-		model->Save(glm::rotate(model->Top(), glm::radians(60.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0))));
-		model->Save(glm::scale(model->Top(), glm::vec3(0.25f)));
-		cube->Draw(shader.get(), model->Top());
-		model->Pop();
+	static void DrawUnitShape(void* context, const RenderCommand& command, RenderStateCache& state) {
+		NexusDemo* demo = static_cast<NexusDemo*>(context);
+		demo->DrawUnitShape(state, command.Index, command.Model);
+	}
+
+	// One of the unit shapes (unit_cube_group, unit_sphere_group) with the current program.
+	void DrawUnitShape(RenderStateCache& state, uint32_t group, const glm::mat4& model) {
+		uniforms.SetMat4("model"_u, model);
+		uniforms.SetMat3("normalModel"_u, glm::transpose(glm::inverse(glm::mat3(model))));
+		unit_shapes->Draw(state, group);
+	}
+
+	static void DrawInstancedBalls(void* context, const RenderCommand&, RenderStateCache& state) {
+		static_cast<BallRenderer*>(context)->Draw(state);
+	}
+
+	// Runs whenever a program is made current for the frame. The uniform values are cached per program,
+	// so after the first frame these are dropped unless the camera or a setting changed.
+	static void SetProgramUniforms(void* context, GLuint program) {
+		NexusDemo* demo = static_cast<NexusDemo*>(context);
+		demo->SetFrameUniforms();
+		// The permutations have the switches compiled in.
+		if (program == demo->lighting_program) {
+			demo->SetSwitchUniforms();
+		}
+	}
+
+	// Camera uniforms of the current program; lights, fog and clipping planes come from the uniform blocks.
+	void SetFrameUniforms() {
+		uniforms.SetInt("material.diffuse_texture"_u, 0);
+		uniforms.SetInt("material.specular_texture"_u, 1);
+		uniforms.SetInt("material.emission_texture"_u, 2);
+		uniforms.SetInt("shadowMap"_u, SHADOW_MAP_UNIT);
+		uniforms.SetInt("skybox"_u, 3);
+		uniforms.SetInt("clusterLights"_u, CLUSTER_LIGHT_UNIT);
+		uniforms.SetInt("clusterGrid"_u, CLUSTER_GRID_UNIT);
+		uniforms.SetInt("clusterIndices"_u, CLUSTER_INDEX_UNIT);
+
+		uniforms.SetMat4("view"_u, view);
+		uniforms.SetMat4("projection"_u, projection);
+		uniforms.SetVec3("viewPos"_u, Settings.EnableGhostMode ? first_camera->GetPosition() : third_camera->GetPosition());
+		uniforms.SetFloat("GammaValue"_u, Settings.GammaValue);
+	}
+
+	// Runtime switches of the uber program (lighting_program); the permutations have them compiled in.
+	void SetSwitchUniforms() {
+		uniforms.SetBool("useInstanceMaterial"_u, false);
+		uniforms.SetBool("useBlinnPhong"_u, Settings.UseBlinnPhongShading);
+		uniforms.SetBool("useLighting"_u, Settings.UseLighting);
+		uniforms.SetBool("useDiffuseTexture"_u, Settings.UseDiffuseTexture);
+		uniforms.SetBool("useSpecularTexture"_u, Settings.UseSpecularTexture);
+		uniforms.SetBool("useEmission"_u, Settings.UseEmission);
+		uniforms.SetBool("useGamma"_u, Settings.UseGamma);
+	}
+
+	// Permutation bits of the global switches and the enabled lights, for solid colour materials.
+	uint32_t GetLightingFeatures() const {
+		uint32_t features = LightingLightMask(lighting_blocks->GetEnabledLights());
+		if (Settings.UseBlinnPhongShading) {
+			features |= LIGHTING_BLINN_PHONG;
+		}
+		if (Settings.UseLighting) {
+			features |= LIGHTING_LIGHTING;
+		}
+		if (Settings.UseGamma) {
+			features |= LIGHTING_GAMMA;
+		}
+		if (fog->GetEnable()) {
+			features |= LIGHTING_FOG;
+		}
+		if (clustered_lighting->GetLightCount() > 0) {
+			features |= LIGHTING_CLUSTERED_LIGHTS;
+		}
+		if (IsShadowEnabled()) {
+			features |= LIGHTING_SHADOW;
+		}
+		return features;
+	}
+
+	// The same for a material of the uber program: its texture and emission switches as lighting_program would
+	// resolve them from the settings and the material flags.
+	uint32_t GetLightingFeatures(const RenderMaterial& material) const {
+		uint32_t features = GetLightingFeatures();
+		if (Settings.UseDiffuseTexture && (material.Flags & RENDER_MATERIAL_DIFFUSE_TEXTURE)) {
+			features |= LIGHTING_DIFFUSE_TEXTURE;
+		}
+		if (Settings.UseSpecularTexture && (material.Flags & RENDER_MATERIAL_SPECULAR_TEXTURE)) {
+			features |= LIGHTING_SPECULAR_TEXTURE;
+		}
+		if (Settings.UseEmission && (material.Flags & RENDER_MATERIAL_EMISSION)) {
+			features |= LIGHTING_EMISSION;
+		}
+		if (material.Flags & RENDER_MATERIAL_EMISSION_TEXTURE) {
+			features |= LIGHTING_EMISSION_TEXTURE;
+		}
+		return features;
+	}
+
+	// Only the nodes whose object moved get new world matrices.
+	void UpdateSceneTransforms() {
+		if (scene_root == TRANSFORM_NONE || obstacle_transforms.size() != world->Obstacles.size()) {
+			// Obstacles were spawned or a snapshot was loaded.
+			scene_transforms.Clear();
+			scene_root = scene_transforms.Create();
+			obstacle_transforms.clear();
+			for (const Obstacle& obstacle : world->Obstacles) {
+				TransformHandle node = scene_transforms.Create(scene_root);
+				scene_transforms.SetScale(node, obstacle.GetSize());
+				obstacle_transforms.push_back(node);
+			}
+			light_transforms.clear();
+			for (size_t i = 0; i < DirLights.size() + PointLights.size(); i++) {
+				TransformHandle node = scene_transforms.Create(scene_root);
+				scene_transforms.SetScale(node, glm::vec3(0.5f));
+				light_transforms.push_back(node);
+			}
+		}
+		for (unsigned int i = 0; i < world->Obstacles.size(); i++) {
+			scene_transforms.SetPosition(obstacle_transforms[i], world->Obstacles[i].GetPosition());
+		}
+		for (unsigned int i = 0; i < DirLights.size(); i++) {
+			scene_transforms.SetPosition(light_transforms[i], DirLights[i]->GetDirection() * -1.0f);
+		}
+		for (unsigned int i = 0; i < PointLights.size(); i++) {
+			scene_transforms.SetPosition(light_transforms[DirLights.size() + i], PointLights[i]->GetPosition());
+		}
+		scene_transforms.Update();
+	}
+
+	// Deterministic, so the same count always gives the same lights: spread through the room, each with
+	// its own colour, range and phase.
+	void GenerateClusterLights(unsigned int count) {
+		std::mt19937 random(24);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		cluster_lights.resize(count);
+		cluster_light_bases.resize(count);
+		cluster_light_phases.resize(count);
+		for (unsigned int i = 0; i < count; i++) {
+			ClusterPointLight& light = cluster_lights[i];
+			cluster_light_bases[i] = glm::vec3(unit(random) * 19.0f - 9.5f, unit(random) * 18.0f + 1.0f, unit(random) * 19.0f - 9.5f);
+			cluster_light_phases[i] = unit(random) * 6.2831853f;
+			glm::vec3 color(unit(random), unit(random), unit(random));
+			light.Position = cluster_light_bases[i];
+			light.Range = 2.0f + unit(random) * 2.0f;
+			light.Color = color / std::max(std::max(color.x, color.y), std::max(color.z, 0.01f)) * 2.0f;
+			light.Padding = 0.0f;
+		}
+	}
+
+	// Assigns the clustered lights to the clusters of the default camera, the one the view volume
+	// follows, on the physics job threads.
+	void UpdateClusteredLights() {
+		if (animate_cluster_lights) {
+			cluster_light_time += DeltaTime;
+			for (unsigned int i = 0; i < cluster_lights.size(); i++) {
+				cluster_lights[i].Position = cluster_light_bases[i] + glm::vec3(0.0f, glm::sin(cluster_light_time + cluster_light_phases[i]), 0.0f);
+			}
+		}
+		SetProjectionMatrix(Nexus::DISPLAY_MODE_DEFAULT);
+		clustered_lighting->Update(cluster_lights, view, projection, ProjectionSettings.ClippingNear, ProjectionSettings.ClippingFar, world->GetJobSystem());
+	}
+
+	// Only uploads the blocks whose content changed since the last frame.
+	void UpdateLightingBlocks() {
+		SpotLights[0]->SetPosition(third_camera->GetPosition());
+		SpotLights[0]->SetDirection(third_camera->GetFront());
+		SpotLights[1]->SetPosition(first_camera->GetPosition());
+		SpotLights[1]->SetDirection(first_camera->GetFront());
+		lighting_blocks->UpdateLights(DirLights, PointLights, SpotLights);
+		lighting_blocks->UpdateFog(fog.get());
+		lighting_blocks->UpdateClippingPlanes(view_volume.get());
+	}
+
+	bool IsShadowEnabled() const {
+		return enable_shadows && !DirLights.empty() && DirLights[0]->GetEnable() && shadow_map->IsComplete();
+	}
+
+	// Static obstacles cast into the cached map, like the room; moving ones and the balls are dynamic.
+	static bool IsStaticCaster(const Obstacle& obstacle) {
+		return obstacle.IsStatic();
+	}
+
+	// FNV-1a over the static obstacles, so spawning obstacles or loading a snapshot re-renders the cache.
+	uint64_t GetStaticCasterSignature() const {
+		uint64_t hash = 14695981039346656037ull;
+		for (const Obstacle& obstacle : world->Obstacles) {
+			if (!IsStaticCaster(obstacle)) {
+				continue;
+			}
+			const glm::vec3 values[2] = { obstacle.GetPosition(), obstacle.GetSize() };
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+			for (size_t i = 0; i < sizeof(values); i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+		}
+		return hash;
+	}
+
+	// The room and the static obstacles only when the cached map is out of date; the moving obstacles and
+	// the balls on a copy of it every frame.
+	void UpdateShadowMap() {
+		bool enable = IsShadowEnabled();
+		if (enable) {
+			const glm::vec3 room_min(-10.0f, 0.0f, -10.0f);
+			const glm::vec3 room_max(10.0f, 20.0f, 10.0f);
+			const glm::vec3 corners[8] = {
+				view_volume->NearPlaneVertex[0], view_volume->NearPlaneVertex[1], view_volume->NearPlaneVertex[2], view_volume->NearPlaneVertex[3],
+				view_volume->FarPlaneVertex[0], view_volume->FarPlaneVertex[1], view_volume->FarPlaneVertex[2], view_volume->FarPlaneVertex[3]
+			};
+			shadow_map->Fit(DirLights[0]->GetDirection(), corners, 8, room_min, room_max);
+			shadow_map->SetStaticSignature(GetStaticCasterSignature());
+			const glm::mat4& light_space = shadow_map->GetLightSpaceMatrix();
+
+			if (shadow_map->NeedsStaticPass()) {
+				shadow_map->BeginStaticPass();
+				uniforms.Use(simpleDepthShader.get());
+				uniforms.SetMat4("lightSpaceMatrix"_u, light_space);
+				uniforms.SetMat4("model"_u, glm::mat4(1.0f));
+				static_batch->Draw(render_state, room_group);
+				for (unsigned int i = 0; i < world->Obstacles.size(); i++) {
+					if (IsStaticCaster(world->Obstacles[i])) {
+						uniforms.SetMat4("model"_u, scene_transforms.GetWorld(obstacle_transforms[i]));
+						unit_shapes->Draw(render_state, unit_cube_group);
+					}
+				}
+				shadow_map->EndPass();
+			}
+
+			shadow_map->BeginDynamicPass();
+			uniforms.Use(simpleDepthShader.get());
+			uniforms.SetMat4("lightSpaceMatrix"_u, light_space);
+			for (unsigned int i = 0; i < world->Obstacles.size(); i++) {
+				if (!IsStaticCaster(world->Obstacles[i])) {
+					uniforms.SetMat4("model"_u, scene_transforms.GetWorld(obstacle_transforms[i]));
+					unit_shapes->Draw(render_state, unit_cube_group);
+				}
+			}
+			if (enable_instanced_balls) {
+				uniforms.Use(ballDepthShader.get());
+				uniforms.SetMat4("lightSpaceMatrix"_u, light_space);
+				ball_renderer->DrawShadow(render_state);
+			} else {
+				const BallSystem& balls = GetShownBalls();
+				for (unsigned int i = 0; i < balls.Size(); i++) {
+					uniforms.SetMat4("model"_u, Ball(&balls, i).GetModel());
+					unit_shapes->Draw(render_state, unit_sphere_group);
+				}
+			}
+			shadow_map->EndPass();
+		}
+		shadow_map->UpdateBlock(enable);
 	}
 
 	void RenderQuad() {
@@ -564,50 +778,85 @@ public:
 			
 
 			if (ImGui::BeginTabItem("Ball")) {
-				ImGui::Text("Ball amount: %d", balls.size());
+				BallSystem& balls = world->Balls;
+				const PhysicsStats& physics_stats = world->GetStats();
+				ImGui::Text("Ball amount: %d", balls.Size());
+				ImGui::Text("Candidate pairs: %u, Contacts: %u", physics_stats.CandidatePairs, physics_stats.Contacts);
+				ImGui::Text("Static contacts: %u, Warm started: %u", physics_stats.StaticContacts, physics_stats.WarmStartedContacts);
+				ImGui::Text("Sleeping: %u, Awake: %u, Swept: %u", physics_stats.SleepingBalls, physics_stats.AwakeBalls, physics_stats.SweptBalls);
+				ImGui::Text("Inside: %u, Intersection: %u, Outside: %u", ball_culling.GetCount(BALL_INSIDE), ball_culling.GetCount(BALL_INTERSECTION), ball_culling.GetCount(BALL_OUTSIDE));
 				ImGui::SliderFloat3("Position", glm::value_ptr(current_generate_position), -10.0, 10.0);
 				ImGui::SliderFloat3("Velocity", glm::value_ptr(current_generate_velocity), -5.0, 5.0);
 				ImGui::SliderFloat("Mass", &current_generate_mass, 1, 20);
 				if (ImGui::Button("Generate")) {
-					Ball temp_ball(current_generate_position, current_generate_velocity, current_generate_mass);
-					balls.push_back(temp_ball);
-					currnet_ball = &balls[0];
+					balls.Add(current_generate_position, current_generate_velocity, current_generate_mass);
+					currnet_ball = Ball(&balls, 0);
 				}
 				ImGui::SameLine();
 				if (ImGui::Button("Add 10")) {
-					for (unsigned int i = 0; i < 10; i++) {
-						glm::vec3 ball_position = glm::vec3(unif_ball_position_xz(rand_generator), unif_ball_position_y(rand_generator), unif_ball_position_xz(rand_generator));
-						glm::vec3 ball_velocity = glm::vec3(unif_ball_velocity(rand_generator), unif_ball_velocity(rand_generator), unif_ball_velocity(rand_generator));
-						Ball temp_ball(ball_position, ball_velocity, unif_ball_mass(rand_generator));
-						balls.push_back(temp_ball);
-					}
+					world->SpawnRandomBalls(10);
 				}
-				if(!balls.empty()) {
+				if(!balls.Empty()) {
 					if (ImGui::Button("Delete")) {
-					    if (balls.size() == 1) {
-                            currnet_ball = nullptr;
+					    if (balls.Size() == 1) {
+                            currnet_ball = std::nullopt;
 					    }
-						balls.pop_back();
+						balls.PopBack();
 					}
                     ImGui::SameLine();
-					if(balls.size() >= 10) {
+					if(balls.Size() >= 10) {
 						if (ImGui::Button("Delete 10")) {
 							for (unsigned int i = 0; i < 10; i++) {
-								balls.pop_back();
+								balls.PopBack();
 							}
 						}
 					}
                     ImGui::SameLine();
 					if (ImGui::Button("Delete All")) {
-                        currnet_ball = nullptr;
-						balls.clear();
+                        currnet_ball = std::nullopt;
+						balls.Clear();
 					}
 				}
-				ImGui::SliderFloat("Gravity", &gravity, 0.0f, 10.0f, "%2.3f m/s^2");
-				ImGui::SliderFloat("Elasticities", &elasticities, 0.0f, 1.0f, "%2.4f");
-				ImGui::SliderFloat("Drag Force", &dragforce, 0.0f, 1.0f, "%2.3f");
+				if (ImGui::Button("Save Snapshot")) {
+					std::string path = std::string("world") + WORLD_SNAPSHOT_EXTENSION;
+					bool saved = world->SaveSnapshot(path);
+					Nexus::Logger::Message(saved ? Nexus::LOG_INFO : Nexus::LOG_WARNING, (saved ? "Saved " : "Could not save ") + path + ".");
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Load Snapshot")) {
+					std::string path = std::string("world") + WORLD_SNAPSHOT_EXTENSION;
+					Stopwatch stopwatch;
+					if (world->LoadSnapshot(path)) {
+						currnet_ball = balls.Empty() ? std::nullopt : std::optional<Ball>(Ball(&balls, 0));
+						Nexus::Logger::Message(Nexus::LOG_INFO, "Loaded " + path + ": " + std::to_string(balls.Size()) + " balls in " + std::to_string(stopwatch.GetElapsedMilliseconds()) + " ms.");
+					} else {
+						Nexus::Logger::Message(Nexus::LOG_WARNING, "Could not load " + path + ".");
+					}
+				}
+				ImGui::SliderFloat("Gravity", &world->Settings.Gravity, 0.0f, 10.0f, "%2.3f m/s^2");
+				ImGui::SliderFloat("Elasticities", &world->Settings.Elasticities, 0.0f, 1.0f, "%2.4f");
+				ImGui::SliderFloat("Drag Force", &world->Settings.DragForce, 0.0f, 1.0f, "%2.3f");
+				ImGui::Checkbox("Continuous Collision", &world->Settings.ContinuousCollision);
+				ImGui::SliderInt("Solver Iterations", &world->Settings.SolverIterations, 1, 32);
+				ImGui::SliderFloat("Friction", &world->Settings.Friction, 0.0f, 1.0f, "%2.3f");
+				ImGui::SliderFloat("Physics Rate", &world->Settings.StepRate, 10.0f, 240.0f, "%.0f Hz");
+				ImGui::SliderInt("Max Substeps", &world->Settings.MaxSubsteps, 1, 16);
+
+				if (ImGui::TreeNode("Physics Timing")) {
+					ImGui::BulletText("Threads: %u", world->GetThreadCount());
+					ImGui::BulletText("Steps this frame: %u, alpha %.2f", world->GetLastSteps(), world->GetInterpolationAlpha());
+					ImGui::BulletText("Obstacles: %zu (%u moving), tree height %d", world->Obstacles.size(), physics_stats.MovingObstacles, physics_stats.ObstacleTreeHeight);
+					ImGui::BulletText("Edge: %.3f ms", physics_stats.EdgeTime);
+					ImGui::BulletText("Broad Phase: %.3f ms", physics_stats.BroadPhaseTime);
+					ImGui::BulletText("Contacts: %.3f ms", physics_stats.ContactTime);
+					ImGui::BulletText("Solver: %.3f ms", physics_stats.SolverTime);
+					ImGui::BulletText("Obstacles: %.3f ms", physics_stats.ObstacleTime);
+					ImGui::BulletText("Integrate: %.3f ms", physics_stats.IntegrateTime);
+					ImGui::BulletText("Islands: %.3f ms", physics_stats.IslandTime);
+					ImGui::TreePop();
+				}
 
-				if (!Settings.EnableGhostMode && currnet_ball != nullptr) {
+				if (!Settings.EnableGhostMode && currnet_ball.has_value() && currnet_ball->IsValid()) {
                     if (ImGui::TreeNode("Select Ball Information")) {
                         glm::vec3 p = currnet_ball->GetPosition();
                         glm::vec3 v = currnet_ball->GetVelocity();
@@ -626,6 +875,50 @@ public:
 				ImGui::EndTabItem();
 			}
 
+			if (ImGui::BeginTabItem("Trace")) {
+				std::string trace_path = std::string("world") + TRACE_EXTENSION;
+				if (!trace_recorder.IsRecording()) {
+					if (ImGui::Button("Start Recording") && !trace_replaying) {
+						if (trace_recorder.Start(trace_path, 1.0f / world->Settings.StepRate)) {
+							world->SetTraceRecorder(&trace_recorder);
+							Nexus::Logger::Message(Nexus::LOG_INFO, "Recording " + trace_path + ".");
+						} else {
+							Nexus::Logger::Message(Nexus::LOG_WARNING, "Could not create " + trace_path + ".");
+						}
+					}
+				} else if (ImGui::Button("Stop Recording")) {
+					world->SetTraceRecorder(nullptr);
+					trace_recorder.Stop();
+				}
+				ImGui::Text("Recorded: %llu, Dropped: %llu, Written: %llu frames, %.2f MB", (unsigned long long)trace_recorder.GetRecordedFrames(), (unsigned long long)trace_recorder.GetDroppedFrames(),
+					(unsigned long long)trace_recorder.GetWrittenFrames(), trace_recorder.GetBytesWritten() / (1024.0 * 1024.0));
+				ImGui::Text("Trace: %.3f ms per step", world->GetStats().TraceTime);
+
+				ImGui::Separator();
+				if (!trace_replaying) {
+					if (ImGui::Button("Replay") && !trace_recorder.IsRecording()) {
+						if (trace_reader.Open(trace_path) && trace_reader.GetFrameCount() != 0) {
+							trace_replaying = true;
+							replay_frame = 0;
+							replay_time = 0.0f;
+							replay_shown_frame = -1;
+						} else {
+							Nexus::Logger::Message(Nexus::LOG_WARNING, "Could not open " + trace_path + ".");
+						}
+					}
+				} else {
+					if (ImGui::Button("Back to Simulation")) {
+						trace_replaying = false;
+					}
+					ImGui::SameLine();
+					ImGui::Checkbox("Play", &replay_playing);
+					ImGui::SliderInt("Frame", &replay_frame, 0, (int)trace_reader.GetFrameCount() - 1);
+					const TraceReader::FrameInfo& frame = trace_reader.GetFrame((uint32_t)replay_frame);
+					ImGui::Text("Step %llu, %u balls, %s, %u bytes", (unsigned long long)frame.Step, frame.BallCount, frame.Keyframe ? "keyframe" : "delta", frame.PayloadSize);
+				}
+				ImGui::EndTabItem();
+			}
+
 			if (ImGui::BeginTabItem("Projection")) {
 
 				ImGui::TextColored(ImVec4(1.0f, 0.5f, 1.0f, 1.0f), (ProjectionSettings.IsPerspective) ? "Perspective Projection" : "Orthogonal Projection");
@@ -687,7 +980,7 @@ public:
 				ImGui::Spacing();
 
 				for (unsigned int i = 0; i < DirLights.size(); i++) {
-					if (ImGui::TreeNode(std::string("Directional Light " + std::to_string(i)).c_str())) {
+					if (ImGui::TreeNode((void*)(intptr_t)i, "Directional Light %u", i)) {
 						DirLights[i]->GenerateDebugUI();
 						ImGui::TreePop();
 					}
@@ -695,7 +988,7 @@ public:
 				}
 
 				for (unsigned int i = 0; i < PointLights.size(); i++) {
-					if (ImGui::TreeNode(std::string("Point Light " + std::to_string(i)).c_str())) {
+					if (ImGui::TreeNode((void*)(intptr_t)(i + POINT_LIGHT_OFFSET), "Point Light %u", i)) {
 						PointLights[i]->GenerateDebugUI();
 						ImGui::TreePop();
 					}
@@ -703,13 +996,34 @@ public:
 				}
 
 				for (unsigned int i = 0; i < SpotLights.size(); i++) {
-					if (ImGui::TreeNode(std::string("Spot Light " + std::to_string(i)).c_str())) {
+					if (ImGui::TreeNode((void*)(intptr_t)(i + SPOT_LIGHT_OFFSET), "Spot Light %u", i)) {
 						SpotLights[i]->GenerateDebugUI();
 						ImGui::TreePop();
 					}
 					ImGui::Spacing();
 				}
 
+				if (ImGui::TreeNode("Shadow")) {
+					ImGui::Checkbox("Directional Light 0 Shadow", &enable_shadows);
+					const glm::vec2& extent = shadow_map->GetExtent();
+					ImGui::BulletText("Map: %d x %d, light frustum %.0f x %.0f m", SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, extent.x, extent.y);
+					ImGui::BulletText("Static passes: %u, dynamic passes: %u", shadow_map->GetStaticPasses(), shadow_map->GetDynamicPasses());
+					ImGui::TreePop();
+				}
+				ImGui::Spacing();
+
+				if (ImGui::TreeNode("Clustered Point Lights")) {
+					if (ImGui::SliderInt("Count", &cluster_light_count, 0, 1024)) {
+						GenerateClusterLights((unsigned int)cluster_light_count);
+					}
+					ImGui::Checkbox("Animate", &animate_cluster_lights);
+					ImGui::BulletText("Clusters: %u x %u x %u", CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+					ImGui::BulletText("Light indices: %u (%u dropped), up to %u per cluster", clustered_lighting->GetPairCount(), clustered_lighting->GetDroppedCount(), clustered_lighting->GetMaxCellLights());
+					ImGui::BulletText("Assignment: %.3f ms on %u threads", clustered_lighting->GetAssignMilliseconds(), world->GetThreadCount());
+					ImGui::TreePop();
+				}
+				ImGui::Spacing();
+
 				ImGui::EndTabItem();
 			}
 			
@@ -734,7 +1048,79 @@ public:
 					}
 					ImGui::EndCombo();
 				}
+				if (ImGui::BeginCombo("Room Texture", room_texture_names[room_texture].c_str())) {
+					for (unsigned int n = 0; n < room_textures.size(); n++) {
+						bool is_selected = (n == room_texture);
+						std::string label = room_texture_names[n];
+						if (asset_loader->GetState(room_textures[n]) != TEXTURE_READY) {
+							label += asset_loader->GetState(room_textures[n]) == TEXTURE_LOADING ? " (loading)" : " (failed)";
+						}
+						if (ImGui::Selectable(label.c_str(), is_selected)) {
+							room_texture = n;
+						}
+						if (is_selected) {
+							ImGui::SetItemDefaultFocus();
+						}
+					}
+					ImGui::EndCombo();
+				}
 				ImGui::Checkbox("Enable Ball Culling", &enalbe_ball_culling);
+				ImGui::Checkbox("Instanced Balls", &enable_instanced_balls);
+				ImGui::Spacing();
+
+				if (ImGui::TreeNode("Render Stats")) {
+					const GLCallCounters& counters = GLStats::GetLastFrame();
+					if (GLStats::IsAvailable()) {
+						ImGui::BulletText("Draw calls: %u (%u instances)", counters.DrawCalls, counters.Instances);
+						ImGui::BulletText("Uniform uploads: %u", counters.UniformUploads);
+						ImGui::BulletText("Buffer uploads: %u", counters.BufferUploads);
+					} else {
+						ImGui::BulletText("GL call counters are not available.");
+					}
+					const RenderStateCounters& issued = render_state.GetLastIssued();
+					const RenderStateCounters& elided = render_state.GetLastElided();
+					ImGui::BulletText("Render commands: %zu, %zu programs, %zu materials", render_queue.GetCommandCount(), render_queue.GetProgramCount(), render_queue.GetMaterialCount());
+					ImGui::BulletText("Programs: %u issued, %u elided", issued.Programs, elided.Programs);
+					ImGui::BulletText("Textures: %u issued, %u elided", issued.Textures, elided.Textures);
+					ImGui::BulletText("Vertex arrays: %u issued, %u elided", issued.VertexArrays, elided.VertexArrays);
+					ImGui::BulletText("Uniforms: %u issued, %u elided", issued.Uniforms, elided.Uniforms);
+					ImGui::BulletText("Transforms: %u nodes, %u updated", scene_transforms.GetCount(), scene_transforms.GetUpdatedCount());
+					ImGui::BulletText("Static batch: %u shapes in %u draws, %u vertices", static_batch->GetShapeCount(), static_batch->GetGroupCount(), static_batch->GetVertexCount());
+					ImGui::BulletText("Instance buffer: %s, %u / %u", ball_renderer->IsPersistent() ? "persistent" : "orphaning", ball_renderer->GetInstanceCount(), ball_renderer->GetCapacity());
+					ImGui::BulletText("Drawn instances: %u, clipped: %u", ball_renderer->GetViewCount(), ball_renderer->GetClippedCount());
+					ImGui::BulletText("Shader permutations: %zu balls, %zu room and obstacles", ballShaders->GetProgramCount(), lightingShaders->GetProgramCount());
+					ImGui::TreePop();
+				}
+
+				if (ImGui::TreeNode("Textures")) {
+					ImGui::BulletText("Ready: %u / %u, %u decode threads", asset_loader->GetReadyCount(), asset_loader->GetTextureCount(), asset_loader->GetThreadCount());
+					ImGui::BulletText("Uploaded: %.1f MB", asset_loader->GetUploadedBytes() / (1024.0f * 1024.0f));
+					ImGui::BulletText("Baked images: %u", asset_loader->GetBakedCount());
+					if (asset_loader->IsIdle()) {
+						ImGui::BulletText("Load time: %.1f ms", asset_loader->GetLoadMilliseconds());
+					}
+					ImGui::TreePop();
+				}
+
+				if (ImGui::TreeNode("Startup")) {
+					ImGui::BulletText("%s launch: %.1f ms", startup_times.Warm ? "Warm" : "Cold", startup_times.Total);
+					ImGui::BulletText("Nexus shaders: %.1f ms", startup_times.NexusShaders);
+					ImGui::BulletText("Permutations: %.1f ms", startup_times.Permutations);
+					if (program_cache->IsAvailable()) {
+						ImGui::BulletText("Program binaries: %u cached, %u compiled, %u stored", program_cache->GetHits(), program_cache->GetMisses(), program_cache->GetStores());
+					} else {
+						ImGui::BulletText("Program binaries are not supported by the driver.");
+					}
+					ImGui::TreePop();
+				}
+
+				if (ImGui::TreeNode("Heap Allocations")) {
+					ImGui::BulletText("Update: %zu (%zu bytes)", last_update_allocations.Allocations, last_update_allocations.Bytes);
+					ImGui::BulletText("Render: %zu (%zu bytes)", last_render_allocations.Allocations, last_render_allocations.Bytes);
+					ImGui::BulletText("Whole frame: %zu (%zu bytes)", last_frame_allocations.Allocations, last_frame_allocations.Bytes);
+					ImGui::BulletText("Frame arena: %zu / %zu bytes, peak %zu", frame_arena.GetUsed(), frame_arena.GetCapacity(), frame_arena.GetPeak());
+					ImGui::TreePop();
+				}
 				// ImGui::Text("Full Screen:  %s", isfullscreen ? "True" : "false");
 				ImGui::Spacing();
 
@@ -748,20 +1134,20 @@ public:
 		ImGui::End();
 	}
 
-	void DrawOriginAnd3Axes(Nexus::Shader* shader) const {
-		shader->SetBool("material.enableDiffuseTexture", false);
-		shader->SetBool("material.enableSpecularTexture", false);
-		shader->SetBool("material.enableEmission", true);
-		shader->SetBool("material.enableEmissionTexture", false);
+	void DrawOriginAnd3Axes() {
+		uniforms.SetBool("material.enableDiffuseTexture"_u, false);
+		uniforms.SetBool("material.enableSpecularTexture"_u, false);
+		uniforms.SetBool("material.enableEmission"_u, true);
+		uniforms.SetBool("material.enableEmissionTexture"_u, false);
 		
 		// Draw the origin (0, 0, 0)
 		model->Push();
 		model->Save(glm::scale(model->Top(), glm::vec3(0.1f, 0.1f, 0.1f)));
-		shader->SetVec4("material.ambient", glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
-		shader->SetVec4("material.diffuse", glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
-		shader->SetVec4("material.specular", glm::vec4(0.4f, 0.4f, 0.4f, 1.0f));
-		shader->SetFloat("material.shininess", 64.0f);
-		sphere->Draw(shader, model->Top());
+		uniforms.SetVec4("material.ambient"_u, glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
+		uniforms.SetVec4("material.diffuse"_u, glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+		uniforms.SetVec4("material.specular"_u, glm::vec4(0.4f, 0.4f, 0.4f, 1.0f));
+		uniforms.SetFloat("material.shininess"_u, 64.0f);
+		DrawUnitShape(render_state, unit_sphere_group, model->Top());
 		model->Pop();
 
 		// Draw x, y ,z axes.
@@ -769,31 +1155,31 @@ public:
 		model->Push();
 		model->Save(glm::translate(model->Top(), glm::vec3(5.0f, 0.0f, 0.0f)));
 		model->Save(glm::scale(model->Top(), glm::vec3(10.0f, 0.05f, 0.05f)));
-		shader->SetVec4("material.ambient", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		shader->SetVec4("material.diffuse", glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
-		shader->SetVec4("material.specular", glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
-		shader->SetFloat("material.shininess", 64.0f);
-		cube->Draw(shader, model->Top());
+		uniforms.SetVec4("material.ambient"_u, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+		uniforms.SetVec4("material.diffuse"_u, glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
+		uniforms.SetVec4("material.specular"_u, glm::vec4(1.0f, 0.0f, 0.0f, 1.0));
+		uniforms.SetFloat("material.shininess"_u, 64.0f);
+		DrawUnitShape(render_state, unit_cube_group, model->Top());
 		model->Pop();
 
 		model->Push();
 		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 5.0f, 0.0f)));
 		model->Save(glm::scale(model->Top(), glm::vec3(0.05f, 10.0f, 0.05f)));
-		shader->SetVec4("material.ambient", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-		shader->SetVec4("material.diffuse", glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
-		shader->SetVec4("material.specular", glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
-		shader->SetFloat("material.shininess", 64.0f);
-		cube->Draw(shader, model->Top());
+		uniforms.SetVec4("material.ambient"_u, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+		uniforms.SetVec4("material.diffuse"_u, glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
+		uniforms.SetVec4("material.specular"_u, glm::vec4(0.0f, 1.0f, 0.0f, 1.0));
+		uniforms.SetFloat("material.shininess"_u, 64.0f);
+		DrawUnitShape(render_state, unit_cube_group, model->Top());
 		model->Pop();
 
 		model->Push();
 		model->Save(glm::translate(model->Top(), glm::vec3(0.0f, 0.0f, 5.0f)));
 		model->Save(glm::scale(model->Top(), glm::vec3(0.05f, 0.05f, 10.0f)));
-		shader->SetVec4("material.ambient", glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
-		shader->SetVec4("material.diffuse", glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
-		shader->SetVec4("material.specular", glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
-		shader->SetFloat("material.shininess", 64.0f);
-		cube->Draw(shader, model->Top());
+		uniforms.SetVec4("material.ambient"_u, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		uniforms.SetVec4("material.diffuse"_u, glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
+		uniforms.SetVec4("material.specular"_u, glm::vec4(0.0f, 0.0f, 1.0f, 1.0));
+		uniforms.SetFloat("material.shininess"_u, 64.0f);
+		DrawUnitShape(render_state, unit_cube_group, model->Top());
 		model->Pop();
 		model->Pop();
 	}
@@ -1015,53 +1401,136 @@ public:
 	}
 	
 private:
-	std::unique_ptr<Nexus::Shader> myShader = nullptr;
-	std::unique_ptr<Nexus::Shader> normalShader = nullptr;
+	// The lighting uber program, with the switches as uniforms; used for the shapes with a solid colour.
+	GLuint lighting_program = 0;
+	std::unique_ptr<ShaderPermutations> ballShaders = nullptr;
+	std::unique_ptr<ShaderPermutations> lightingShaders = nullptr;
+	std::unique_ptr<ProgramBinaryCache> program_cache = nullptr;
+	GLRenderBackend render_backend;
+	RenderStateCache render_state{ &render_backend };
+	UniformCache uniforms{ &render_state };
+	RenderQueue render_queue;
+	std::unique_ptr<LightingUniformBlocks> lighting_blocks = nullptr;
+	std::unique_ptr<ClusteredLighting> clustered_lighting = nullptr;
+	// Point lights past the seven of the uniform block, with where they float around.
+	std::vector<ClusterPointLight> cluster_lights;
+	std::vector<glm::vec3> cluster_light_bases;
+	std::vector<float> cluster_light_phases;
+	int cluster_light_count = 256;
+	bool animate_cluster_lights = true;
+	float cluster_light_time = 0.0f;
+	GLuint normal_program = 0;
 	std::unique_ptr<Nexus::Shader> simpleDepthShader = nullptr;
+	std::unique_ptr<Nexus::Shader> ballDepthShader = nullptr;
 	std::unique_ptr<Nexus::Shader> debugDepthQuad = nullptr;
 	
 	std::unique_ptr<Nexus::FirstPersonCamera> first_camera = nullptr;
 	std::unique_ptr<Nexus::ThirdPersonCamera> third_camera = nullptr;
 	
+	// Only the debug axes and the old shadow pass still go through the matrix stack.
 	std::unique_ptr<Nexus::MatrixStack> model = nullptr;
+	// Everything else that moves: one node per obstacle and light marker under a common root.
+	TransformSystem scene_transforms;
+	TransformHandle scene_root = TRANSFORM_NONE;
+	std::vector<TransformHandle> obstacle_transforms;
+	std::vector<TransformHandle> light_transforms;
 	glm::mat4 view = glm::mat4(1.0f);
 	glm::mat4 projection = glm::mat4(1.0f);
 
-	std::unique_ptr<Nexus::Rectangle> floor = nullptr;
-	std::unique_ptr<Nexus::Cube> cube = nullptr;
-	std::unique_ptr<Nexus::Sphere> sphere = nullptr;
 	std::unique_ptr<Nexus::ViewVolume> view_volume = nullptr;
-
-	std::unique_ptr<Nexus::Texture2D> texture_checkerboard = nullptr;
+	std::unique_ptr<BallRenderer> ball_renderer = nullptr;
+	std::unique_ptr<StaticBatch> static_batch = nullptr;
+	uint32_t room_group = 0;
+	std::unique_ptr<StaticBatch> unit_shapes = nullptr;
+	uint32_t unit_cube_group = 0;
+	uint32_t unit_sphere_group = 0;
+	std::unique_ptr<ViewVolumeMesh> view_volume_mesh = nullptr;
+
+	std::unique_ptr<AssetLoader> asset_loader = nullptr;
+	std::vector<TextureHandle> room_textures;
+	std::vector<std::string> room_texture_names;
+	unsigned int room_texture = 0;
+	TextureHandle skybox_texture = 0;
 
 	std::vector<Nexus::DirectionalLight*> DirLights;
 	std::vector<Nexus::PointLight*> PointLights;
 	std::vector<Nexus::SpotLight*> SpotLights;
 
-	GLuint SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
-	GLuint depth_map_fbo;
-	GLuint depth_map;
+	std::unique_ptr<CachedShadowMap> shadow_map = nullptr;
+	bool enable_shadows = true;
 	
 	unsigned int quadVAO = 0;
 	unsigned int quadVBO;
 
 	std::unique_ptr<Nexus::Fog> fog;
 
-	std::vector<Ball> balls;
-	std::vector<Obstacle> obstacles;
-	bool enalbe_ball_culling = false;
+	std::unique_ptr<PhysicsWorld> world = nullptr;
+	TraceRecorder trace_recorder;
+	TraceReader trace_reader;
+	// The balls of the replayed frame, drawn instead of the world's while replaying.
+	BallSystem replay_balls;
+	bool trace_replaying = false;
+	bool replay_playing = false;
+	int replay_frame = 0;
+	int replay_shown_frame = -1;
+	float replay_time = 0.0f;
+
+	const BallSystem& GetShownBalls() const {
+		return trace_replaying ? replay_balls : world->Balls;
+	}
 
-	float gravity = 9.81f;
-	float elasticities = 0.2f;
-	float dragforce = 0.2f;
+	void UpdateReplay() {
+		int last_frame = (int)trace_reader.GetFrameCount() - 1;
+		if (replay_playing) {
+			// Plays at the recorded step rate.
+			float step_time = std::max(trace_reader.GetHeader().StepTime, 0.001f);
+			replay_time += DeltaTime;
+			while (replay_time >= step_time && replay_frame < last_frame) {
+				replay_time -= step_time;
+				replay_frame++;
+			}
+		}
+		replay_frame = std::clamp(replay_frame, 0, last_frame);
+		if (replay_frame != replay_shown_frame && trace_reader.Seek((uint32_t)replay_frame)) {
+			trace_reader.CopyTo(replay_balls);
+			replay_shown_frame = replay_frame;
+		}
+	}
+	BallCullingLists ball_culling;
+	bool enalbe_ball_culling = false;
+	bool enable_instanced_balls = true;
 
 	glm::vec3 current_generate_position = glm::vec3(0.0f);
 	glm::vec3 current_generate_velocity = glm::vec3(0.0f);
 	float current_generate_mass = 1.0f;
-	Ball* currnet_ball = nullptr;
+	std::optional<Ball> currnet_ball;
+
+	// Scratch memory of the current frame, reset at the start of Update().
+	FrameArena frame_arena;
+	AllocationCount frame_start_allocations;
+	AllocationCount update_allocations;
+	AllocationCount render_allocations;
+	AllocationCount last_update_allocations;
+	AllocationCount last_render_allocations;
+	AllocationCount last_frame_allocations;
+
+	// Milliseconds spent in Initialize(); warm when every program came out of the binary cache.
+	struct StartupTimes {
+		float Total = 0.0f;
+		float NexusShaders = 0.0f;
+		float Permutations = 0.0f;
+		bool Warm = false;
+	} startup_times;
 };
 
-int main() {
-	NexusDemo app;
+int main(int argc, char** argv) {
+	unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			thread_count = std::max(1, std::atoi(argv[++i]));
+		}
+	}
+
+	NexusDemo app(thread_count);
 	return app.Run();
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. The pages are only read from disk when they are touched.
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	explicit MappedFile(const std::string& path) {
+		this->Open(path);
+	}
+
+	~MappedFile() {
+		this->Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path) {
+		this->Close();
+#if defined(_WIN32)
+		this->File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (this->File == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(this->File, &size) || size.QuadPart == 0) {
+			this->Close();
+			return false;
+		}
+		this->Mapping = CreateFileMappingA(this->File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (this->Mapping == nullptr) {
+			this->Close();
+			return false;
+		}
+		this->Data = static_cast<const unsigned char*>(MapViewOfFile(this->Mapping, FILE_MAP_READ, 0, 0, 0));
+		this->Size = (size_t)size.QuadPart;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0) {
+			return false;
+		}
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0) {
+			void* data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (data != MAP_FAILED) {
+				this->Data = static_cast<const unsigned char*>(data);
+				this->Size = (size_t)status.st_size;
+			}
+		}
+		// The mapping keeps its own reference to the file.
+		close(file);
+#endif
+		if (this->Data == nullptr) {
+			this->Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close() {
+#if defined(_WIN32)
+		if (this->Data != nullptr) {
+			UnmapViewOfFile(this->Data);
+		}
+		if (this->Mapping != nullptr) {
+			CloseHandle(this->Mapping);
+		}
+		if (this->File != INVALID_HANDLE_VALUE) {
+			CloseHandle(this->File);
+		}
+		this->Mapping = nullptr;
+		this->File = INVALID_HANDLE_VALUE;
+#else
+		if (this->Data != nullptr) {
+			munmap(const_cast<unsigned char*>(this->Data), this->Size);
+		}
+#endif
+		this->Data = nullptr;
+		this->Size = 0;
+	}
+
+	bool IsOpen() const { return this->Data != nullptr; }
+	const unsigned char* GetData() const { return this->Data; }
+	size_t GetSize() const { return this->Size; }
+
+private:
+	const unsigned char* Data = nullptr;
+	size_t Size = 0;
+#if defined(_WIN32)
+	HANDLE File = INVALID_HANDLE_VALUE;
+	HANDLE Mapping = nullptr;
+#endif
+};
@@ -2,7 +2,6 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include "Utill.h"
 
 constexpr float MAX_SPEED = 5.0f;
 
@@ -12,15 +11,16 @@ public:
 		this->Position = positon;
 		this->Velocity = velocity;
 		this->Acceleration = glm::vec3(0.0f);
-		this->Model = glm::mat4(1.0f);
+		this->Static = velocity == glm::vec3(0.0f);
 	}
 
 	void Update(float delta_time) {
 		this->Position = this->Position + this->Velocity * delta_time;
 		this->Velocity = this->Velocity + this->Acceleration * delta_time;
-		Nexus::Utill::limit(this->Velocity, MAX_SPEED);
-
-		this->Model = glm::translate(glm::mat4(1.0f), this->Position);
+		float speed = glm::length(this->Velocity);
+		if (speed > MAX_SPEED) {
+			this->Velocity *= MAX_SPEED / speed;
+		}
 	}
 
 	void Edge() {
@@ -35,25 +35,32 @@ public:
 		}
 	}
 
-	void SetModel(glm::mat4 model) {
-		this->Model = model;
-	}
-
+	// Worked out on demand; the scene keeps its own copy in a TransformSystem and only updates it when the obstacle moved.
 	glm::mat4 GetModel() const {
-		return this->Model;
+		return glm::scale(glm::translate(glm::mat4(1.0f), this->Position), this->Size);
 	}
 
 	glm::vec3 GetPosition() const {
 		return this->Position;
 	}
 
+	glm::vec3 GetVelocity() const {
+		return this->Velocity;
+	}
+
 	glm::vec3 GetSize() const {
 		return this->Size;
 	}
+
+	// Decided when the obstacle is made: one created at rest has nothing that could ever set it moving,
+	// while a moving one stays dynamic even when a bounce passes its velocity through zero.
+	bool IsStatic() const {
+		return this->Static;
+	}
 private:
 	glm::vec3 Size = glm::vec3(2.0f);
 	glm::vec3 Position;
 	glm::vec3 Velocity;
 	glm::vec3 Acceleration;
-	glm::mat4 Model;
+	bool Static;
 };
\ No newline at end of file
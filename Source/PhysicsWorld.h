@@ -0,0 +1,706 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include "BallSystem.h"
+#include "Obstacle.h"
+#include "SpatialGrid.h"
+#include "AABBTree.h"
+#include "ContactSolver.h"
+#include "JobSystem.h"
+#include "Stopwatch.h"
+#include "MappedFile.h"
+#include "WorldSnapshot.h"
+#include "TraceRecorder.h"
+
+// Balls per job for the per-ball passes and grid cells per job for the pair pass.
+constexpr unsigned int BALL_JOB_GRAIN = 4096;
+constexpr unsigned int CELL_JOB_GRAIN = 64;
+
+struct PhysicsSettings {
+	float Gravity = 9.81f;
+	float Elasticities = 0.2f;
+	float DragForce = 0.2f;
+	// Sweep balls that move further than their radius in one step, so coarse steps do not tunnel.
+	bool ContinuousCollision = true;
+	// Contacts are solved together this many times per step; more iterations make tall piles stiffer.
+	int SolverIterations = 8;
+	float Friction = 0.3f;
+	// Advance() steps the world at this fixed rate whatever the frame rate is, and runs at most
+	// MaxSubsteps steps per frame; time beyond that is dropped, so a hitch slows the room down for a
+	// moment instead of making the next frames even longer.
+	float StepRate = 60.0f;
+	int MaxSubsteps = 4;
+};
+
+struct PhysicsStats {
+	unsigned int CandidatePairs = 0;
+	unsigned int Contacts = 0;
+	unsigned int StaticContacts = 0;
+	unsigned int WarmStartedContacts = 0;
+	unsigned int AwakeBalls = 0;
+	unsigned int SleepingBalls = 0;
+	unsigned int SweptBalls = 0;
+	unsigned int MovingObstacles = 0;
+	int ObstacleTreeHeight = 0;
+	float EdgeTime = 0.0f;
+	float BroadPhaseTime = 0.0f;
+	float ContactTime = 0.0f;
+	float SolverTime = 0.0f;
+	float ObstacleTime = 0.0f;
+	float IntegrateTime = 0.0f;
+	float IslandTime = 0.0f;
+	float TraceTime = 0.0f;
+};
+
+// The ball and obstacle simulation of the room. It has no window or GL dependency, so the demo
+// renders it while PhysicsBench steps it headless with a fixed delta time.
+class PhysicsWorld {
+public:
+	PhysicsSettings Settings;
+	BallSystem Balls;
+	std::vector<Obstacle> Obstacles;
+
+	PhysicsWorld(unsigned int thread_count, uint64_t seed = std::mt19937_64::default_seed) {
+		this->Jobs = std::make_unique<JobSystem>(thread_count);
+		this->RandGenerator.seed(seed);
+	}
+
+	void CreateDefaultObstacles() {
+		this->Obstacles = {
+			Obstacle(glm::vec3(3.0, 1.01f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
+			Obstacle(glm::vec3(-3.0, 8.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
+			Obstacle(glm::vec3(-3.0, 5.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.0f)),
+			Obstacle(glm::vec3(3.0, 15.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.0f))
+		};
+		this->RebuildObstacleTree();
+	}
+
+	// Scatters count obstacles over the room, moving at up to max_speed per axis.
+	void SpawnRandomObstacles(unsigned int count, float max_speed = 0.0f) {
+		std::uniform_real_distribution<float> unif_speed(-max_speed, max_speed);
+		for (unsigned int o = 0; o < count; o++) {
+			glm::vec3 position = glm::vec3(this->UnifBallPositionXZ(this->RandGenerator), this->UnifBallPositionY(this->RandGenerator), this->UnifBallPositionXZ(this->RandGenerator));
+			glm::vec3 velocity(0.0f);
+			if (max_speed > 0.0f) {
+				velocity = glm::vec3(unif_speed(this->RandGenerator), unif_speed(this->RandGenerator), unif_speed(this->RandGenerator));
+			}
+			this->Obstacles.emplace_back(position, velocity);
+		}
+		this->RebuildObstacleTree();
+	}
+
+	// Obstacles added or removed through the vector are picked up by the next step on their own; call this
+	// after moving or replacing obstacles in place.
+	void RebuildObstacleTree() {
+		this->ObstacleTree.Clear();
+		this->ObstacleProxies.clear();
+		this->MovingObstacles.clear();
+		for (unsigned int o = 0; o < this->Obstacles.size(); o++) {
+			this->ObstacleProxies.push_back(this->ObstacleTree.CreateProxy(GetObstacleBounds(this->Obstacles[o]), o));
+			if (!this->Obstacles[o].IsStatic()) {
+				this->MovingObstacles.push_back(o);
+			}
+		}
+	}
+
+	// Index of the first obstacle hit by the ray within max_distance, or -1. direction must be normalized.
+	int RayCastObstacles(const glm::vec3& origin, const glm::vec3& direction, float max_distance, float& distance) const {
+		int hit = -1;
+		float hit_fraction = 1.0f;
+		glm::vec3 delta = direction * max_distance;
+		this->ObstacleTree.RayCast(origin, delta, 0.0f, 1.0f, [&](unsigned int index, float max_fraction) {
+			float enter;
+			if (!GetObstacleBounds(this->Obstacles[index]).IntersectSegment(origin, delta, 0.0f, max_fraction, enter)) {
+				return max_fraction;
+			}
+			hit = (int)index;
+			hit_fraction = enter;
+			return enter;
+		});
+		distance = hit_fraction * max_distance;
+		return hit;
+	}
+
+	void SetMassRange(float min, float max) {
+		this->UnifBallMass = std::uniform_real_distribution<float>(min, max);
+	}
+
+	unsigned int SpawnRandomBall() {
+		glm::vec3 ball_position = glm::vec3(this->UnifBallPositionXZ(this->RandGenerator), this->UnifBallPositionY(this->RandGenerator), this->UnifBallPositionXZ(this->RandGenerator));
+		glm::vec3 ball_velocity = glm::vec3(this->UnifBallVelocity(this->RandGenerator), this->UnifBallVelocity(this->RandGenerator), this->UnifBallVelocity(this->RandGenerator));
+		float ball_mass = this->UnifBallMass(this->RandGenerator);
+		return this->Balls.Add(ball_position, ball_velocity, ball_mass);
+	}
+
+	void SpawnRandomBalls(unsigned int count) {
+		this->Balls.Reserve(this->Balls.Size() + count);
+		for (unsigned int i = 0; i < count; i++) {
+			this->SpawnRandomBall();
+		}
+	}
+
+	// Every pass is split into fixed slices on the job system. The contact passes only collect contacts
+	// (one list per slice); the solver takes them afterwards on this thread in slice order, so the
+	// result is bit-identical whatever the thread count is.
+	// Only awake balls are stepped. Sleeping balls sit in their own grid, which is rebuilt only when
+	// balls fall asleep or wake up, so a room of resting balls costs next to nothing.
+	void Step(float delta_time) {
+		Stopwatch stopwatch;
+		float elasticities = this->Settings.Elasticities;
+		float gravity = this->Settings.Gravity;
+		this->UpdateAwakeList();
+		float cell_size = 2.0f * this->Balls.GetMaxRadius() + BALL_CONTACT_MARGIN;
+		this->MoveObstacles(delta_time, cell_size);
+		unsigned int awake_amount = (unsigned int)this->AwakeBalls.size();
+
+		auto edge_pass = [&](unsigned int begin, unsigned int end) {
+			this->ForEachAwakeRun(begin, end, [&](unsigned int first, unsigned int last) {
+				this->Balls.SavePreviousRange(first, last);
+				this->Balls.EdgeRange(first, last, elasticities);
+			});
+		};
+		this->Jobs->ParallelFor(awake_amount, BALL_JOB_GRAIN, edge_pass);
+
+		// Awake balls against sleeping ones. A contact wakes the whole island of the sleeping ball, and
+		// that happens before the pair pass so the woken balls take part in it in this very step.
+		unsigned int sleeping_amount = (unsigned int)this->SleepingBalls.size();
+		this->BuildSleepingGrid(cell_size);
+		this->WakeContactChunkAmount = sleeping_amount == 0 ? 0 : JobSystem::GetChunkAmount(awake_amount, BALL_JOB_GRAIN);
+		if (this->WakeContactChunks.size() < this->WakeContactChunkAmount) {
+			this->WakeContactChunks.resize(this->WakeContactChunkAmount);
+		}
+		if (sleeping_amount != 0) {
+			this->Jobs->ParallelFor(awake_amount, BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+				std::vector<BallContact>& contacts = this->WakeContactChunks[begin / BALL_JOB_GRAIN];
+				contacts.clear();
+				for (unsigned int k = begin; k < end; k++) {
+					unsigned int i = this->AwakeBalls[k];
+					this->SleepingGrid.ForEachNear(this->Balls.GetPosition(i), [&](unsigned int s) {
+						unsigned int j = this->SleepingBalls[s];
+						if (this->Balls.IsTouching(i, j)) {
+							contacts.push_back(this->Balls.GetBallContact(std::min(i, j), std::max(i, j)));
+						}
+					});
+				}
+			});
+		}
+		this->WakeIslands.clear();
+		for (unsigned int chunk = 0; chunk < this->WakeContactChunkAmount; chunk++) {
+			for (const BallContact& contact : this->WakeContactChunks[chunk]) {
+				unsigned int sleeper = this->Balls.IsAwake(contact.A) ? contact.B : contact.A;
+				this->WakeIslands.push_back(this->Balls.Island[sleeper]);
+			}
+		}
+		this->WakeMarkedIslands();
+		// The woken balls were appended to AwakeBalls; they get the edge pass the others had.
+		unsigned int woken_begin = awake_amount;
+		awake_amount = (unsigned int)this->AwakeBalls.size();
+		if (awake_amount > woken_begin) {
+			this->Jobs->ParallelFor(awake_amount - woken_begin, BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+				edge_pass(woken_begin + begin, woken_begin + end);
+			});
+		}
+		this->Stats.EdgeTime = stopwatch.Lap();
+
+		// Broad phase: only pairs sharing or neighbouring a grid cell reach the narrow phase. The woken
+		// balls are in the grid, so their contacts with each other and with the awake balls (including
+		// the ones that woke them) are all found here.
+		this->Grid.Build(awake_amount, cell_size, [&](unsigned int k) { return this->Balls.GetPosition(this->AwakeBalls[k]); });
+		unsigned int cell_amount = this->Grid.GetCellAmount();
+		this->ContactChunkAmount = JobSystem::GetChunkAmount(cell_amount, CELL_JOB_GRAIN);
+		if (this->ContactChunks.size() < this->ContactChunkAmount) {
+			this->ContactChunks.resize(this->ContactChunkAmount);
+			this->CandidatePairChunks.resize(this->ContactChunkAmount);
+		}
+		this->Jobs->ParallelFor(cell_amount, CELL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+			unsigned int chunk = begin / CELL_JOB_GRAIN;
+			std::vector<BallContact>& contacts = this->ContactChunks[chunk];
+			contacts.clear();
+			this->CandidatePairChunks[chunk] = this->Grid.ForEachCandidatePairInCells(begin, end, [&](unsigned int a, unsigned int b) {
+				unsigned int i = this->AwakeBalls[a], j = this->AwakeBalls[b];
+				if (this->Balls.IsTouching(i, j)) {
+					contacts.push_back(this->Balls.GetBallContact(std::min(i, j), std::max(i, j)));
+				}
+			});
+		});
+		this->Stats.BroadPhaseTime = stopwatch.Lap();
+
+		// Walls, floor and obstacles enter the solver as contacts with an immovable body.
+		this->StaticChunkAmount = JobSystem::GetChunkAmount(awake_amount, BALL_JOB_GRAIN);
+		if (this->StaticContactChunks.size() < this->StaticChunkAmount) {
+			this->StaticContactChunks.resize(this->StaticChunkAmount);
+		}
+		this->Jobs->ParallelFor(awake_amount, BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+			std::vector<BallContact>& contacts = this->StaticContactChunks[begin / BALL_JOB_GRAIN];
+			contacts.clear();
+			this->ForEachAwakeRun(begin, end, [&](unsigned int first, unsigned int last) {
+				this->Balls.FindStaticContacts(first, last, this->Obstacles, this->ObstacleTree, contacts);
+			});
+		});
+		this->Stats.ContactTime = stopwatch.Lap();
+
+		this->Stats.CandidatePairs = 0;
+		this->Stats.Contacts = 0;
+		this->Stats.StaticContacts = 0;
+		this->Solver.Clear();
+		for (unsigned int chunk = 0; chunk < this->ContactChunkAmount; chunk++) {
+			this->Stats.CandidatePairs += this->CandidatePairChunks[chunk];
+			this->Stats.Contacts += (unsigned int)this->ContactChunks[chunk].size();
+			this->Solver.Add(this->ContactChunks[chunk]);
+		}
+		for (unsigned int chunk = 0; chunk < this->StaticChunkAmount; chunk++) {
+			this->Stats.StaticContacts += (unsigned int)this->StaticContactChunks[chunk].size();
+			this->Solver.Add(this->StaticContactChunks[chunk]);
+		}
+		this->Balls.SetGravity(gravity);
+		this->Solver.Solve(this->Balls, delta_time, elasticities, std::max(this->Settings.Friction, 0.0f), (unsigned int)std::max(this->Settings.SolverIterations, 1));
+		this->Stats.WarmStartedContacts = this->Solver.GetWarmStartedCount();
+		this->Stats.SolverTime = stopwatch.Lap();
+
+		this->Jobs->ParallelFor(awake_amount, BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+			this->ForEachAwakeRun(begin, end, [&](unsigned int first, unsigned int last) {
+				this->Balls.CollisionWithObstacles(first, last, this->Obstacles, this->ObstacleTree, elasticities);
+				this->Balls.UpdateRestTime(first, last, delta_time);
+			});
+		});
+		this->Stats.ObstacleTime = stopwatch.Lap();
+
+		// Fast balls are integrated with the others, then swept from where they started.
+		bool continuous = this->Settings.ContinuousCollision;
+		unsigned int swept_chunk_amount = JobSystem::GetChunkAmount(awake_amount, BALL_JOB_GRAIN);
+		if (this->SweptChunks.size() < swept_chunk_amount) {
+			this->SweptChunks.resize(swept_chunk_amount);
+		}
+		this->Jobs->ParallelFor(awake_amount, BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+			std::vector<SweptBall>& fast = this->SweptChunks[begin / BALL_JOB_GRAIN];
+			fast.clear();
+			this->ForEachAwakeRun(begin, end, [&](unsigned int first, unsigned int last) {
+				if (continuous) {
+					this->Balls.FindFastBalls(first, last, delta_time, fast);
+				}
+				this->Balls.IntegrateRange(first, last, delta_time, gravity);
+			});
+			this->Balls.SweepRange(fast, delta_time, this->Obstacles, this->ObstacleTree, elasticities);
+		});
+		this->Stats.SweptBalls = 0;
+		for (unsigned int chunk = 0; chunk < swept_chunk_amount; chunk++) {
+			this->Stats.SweptBalls += (unsigned int)this->SweptChunks[chunk].size();
+		}
+		this->Stats.IntegrateTime = stopwatch.Lap();
+
+		this->SleepRestingIslands();
+		this->Stats.AwakeBalls = (unsigned int)this->AwakeBalls.size();
+		this->Stats.SleepingBalls = (unsigned int)this->SleepingBalls.size();
+		this->Stats.IslandTime = stopwatch.Lap();
+
+		if (this->Recorder != nullptr) {
+			this->Recorder->Record(this->StepCount, this->Balls);
+		}
+		this->StepCount++;
+		this->Stats.TraceTime = stopwatch.Lap();
+	}
+
+	// Runs the fixed steps that fit into frame_time plus the time left over from earlier frames, then
+	// places every awake ball between its last two steps for drawing. Returns how many steps ran.
+	unsigned int Advance(float frame_time) {
+		float step_time = 1.0f / std::max(this->Settings.StepRate, 1.0f);
+		this->Accumulator += frame_time;
+		unsigned int steps = 0;
+		while (this->Accumulator >= step_time && steps < (unsigned int)std::max(this->Settings.MaxSubsteps, 1)) {
+			this->Step(step_time);
+			this->Accumulator -= step_time;
+			steps++;
+		}
+		if (this->Accumulator >= step_time) {
+			this->Accumulator = std::fmod(this->Accumulator, step_time);
+		}
+		this->Interpolate(this->Accumulator / step_time);
+		this->LastSteps = steps;
+		return steps;
+	}
+
+	void Interpolate(float alpha) {
+		this->InterpolationAlpha = alpha;
+		this->UpdateAwakeList();
+		this->Jobs->ParallelFor((unsigned int)this->AwakeBalls.size(), BALL_JOB_GRAIN, [&](unsigned int begin, unsigned int end) {
+			this->ForEachAwakeRun(begin, end, [&](unsigned int first, unsigned int last) {
+				this->Balls.InterpolateRange(first, last, alpha);
+			});
+		});
+	}
+
+	// Every step is handed to recorder until it is set back to nullptr.
+	void SetTraceRecorder(TraceRecorder* recorder) {
+		this->Recorder = recorder;
+	}
+
+	uint64_t GetStepCount() const { return this->StepCount; }
+	unsigned int GetLastSteps() const { return this->LastSteps; }
+	float GetInterpolationAlpha() const { return this->InterpolationAlpha; }
+
+	// Wakes every ball, e.g. after something outside the simulation moved them.
+	void WakeAll() {
+		for (unsigned int i = 0; i < this->Balls.Size(); i++) {
+			this->Balls.Wake(i);
+		}
+		this->ListsDirty = true;
+	}
+
+	// Writes every ball and obstacle, the settings and the random generator to path (see WorldSnapshot.h).
+	bool SaveSnapshot(const std::string& path) const {
+		if (!IsWorldSnapshotHostSupported()) {
+			return false;
+		}
+		WorldSnapshotHeader header = {};
+		header.Magic = WORLD_SNAPSHOT_MAGIC;
+		header.Version = WORLD_SNAPSHOT_VERSION;
+		header.BallCount = this->Balls.Size();
+		header.ObstacleCount = (uint32_t)this->Obstacles.size();
+		header.Gravity = this->Settings.Gravity;
+		header.Elasticities = this->Settings.Elasticities;
+		header.DragForce = this->Settings.DragForce;
+		header.StepRate = this->Settings.StepRate;
+		header.MaxSubsteps = this->Settings.MaxSubsteps;
+		header.SolverIterations = this->Settings.SolverIterations;
+		header.Friction = this->Settings.Friction;
+		header.ContinuousCollision = this->Settings.ContinuousCollision ? 1 : 0;
+		header.MassMin = this->UnifBallMass.a();
+		header.MassMax = this->UnifBallMass.b();
+		header.Accumulator = this->Accumulator;
+
+		std::vector<WorldSnapshotObstacle> obstacles;
+		for (const Obstacle& obstacle : this->Obstacles) {
+			glm::vec3 position = obstacle.GetPosition(), velocity = obstacle.GetVelocity();
+			obstacles.push_back({ { position.x, position.y, position.z }, { velocity.x, velocity.y, velocity.z } });
+		}
+		std::ostringstream random;
+		random << this->RandGenerator;
+		std::string random_state = random.str();
+
+		const void* sections[SNAPSHOT_SECTION_COUNT];
+		auto arrays = GetSnapshotArrays(this->Balls);
+		for (unsigned int s = 0; s < SNAPSHOT_FLOAT_SECTIONS; s++) {
+			sections[s] = arrays[s]->data();
+			header.Sections[s].Size = (uint64_t)arrays[s]->size() * sizeof(float);
+		}
+		sections[SNAPSHOT_AWAKE] = this->Balls.Awake.data();
+		header.Sections[SNAPSHOT_AWAKE].Size = this->Balls.Awake.size();
+		sections[SNAPSHOT_ISLAND] = this->Balls.Island.data();
+		header.Sections[SNAPSHOT_ISLAND].Size = (uint64_t)this->Balls.Island.size() * sizeof(unsigned int);
+		sections[SNAPSHOT_OBSTACLES] = obstacles.data();
+		header.Sections[SNAPSHOT_OBSTACLES].Size = (uint64_t)obstacles.size() * sizeof(WorldSnapshotObstacle);
+		sections[SNAPSHOT_RANDOM] = random_state.data();
+		header.Sections[SNAPSHOT_RANDOM].Size = random_state.size();
+		uint64_t offset = sizeof(WorldSnapshotHeader);
+		for (unsigned int s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+			offset = (offset + WORLD_SNAPSHOT_ALIGNMENT - 1) / WORLD_SNAPSHOT_ALIGNMENT * WORLD_SNAPSHOT_ALIGNMENT;
+			header.Sections[s].Offset = offset;
+			offset += header.Sections[s].Size;
+		}
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+		const char padding[WORLD_SNAPSHOT_ALIGNMENT] = {};
+		uint64_t written = sizeof(WorldSnapshotHeader);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(WorldSnapshotHeader));
+		for (unsigned int s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+			file.write(padding, (std::streamsize)(header.Sections[s].Offset - written));
+			file.write(static_cast<const char*>(sections[s]), (std::streamsize)header.Sections[s].Size);
+			written = header.Sections[s].Offset + header.Sections[s].Size;
+		}
+		return file.good();
+	}
+
+	// Replaces the whole world with a snapshot. The file is mapped and each array copied in one go, so even
+	// a million balls take a fraction of a second. Returns false, leaving the world as it was, when the file
+	// is missing or not a snapshot of this version.
+	// Stepping a loaded world always gives the same result, but not quite the one the saved world would
+	// have reached: the solver's warm starting impulses and the obstacle tree are rebuilt, not saved.
+	bool LoadSnapshot(const std::string& path) {
+		MappedFile file(path);
+		const WorldSnapshotHeader* header = ReadWorldSnapshotHeader(file.GetData(), file.GetSize());
+		if (header == nullptr) {
+			return false;
+		}
+		const unsigned char* data = file.GetData();
+		auto section = [&](WorldSnapshotSection s) { return data + header->Sections[s].Offset; };
+		std::mt19937_64 generator;
+		std::istringstream random(std::string(reinterpret_cast<const char*>(section(SNAPSHOT_RANDOM)), (size_t)header->Sections[SNAPSHOT_RANDOM].Size));
+		random >> generator;
+		if (random.fail()) {
+			return false;
+		}
+
+		this->Settings.Gravity = header->Gravity;
+		this->Settings.Elasticities = header->Elasticities;
+		this->Settings.DragForce = header->DragForce;
+		this->Settings.StepRate = header->StepRate;
+		this->Settings.MaxSubsteps = header->MaxSubsteps;
+		this->Settings.SolverIterations = header->SolverIterations;
+		this->Settings.Friction = header->Friction;
+		this->Settings.ContinuousCollision = header->ContinuousCollision != 0;
+		this->UnifBallMass = std::uniform_real_distribution<float>(header->MassMin, header->MassMax);
+		this->RandGenerator = generator;
+		this->Accumulator = header->Accumulator;
+
+		this->Balls.Resize(header->BallCount);
+		if (header->BallCount != 0) {
+			auto arrays = GetSnapshotArrays(this->Balls);
+			for (unsigned int s = 0; s < SNAPSHOT_FLOAT_SECTIONS; s++) {
+				std::memcpy(arrays[s]->data(), section((WorldSnapshotSection)s), (size_t)header->Sections[s].Size);
+			}
+			std::memcpy(this->Balls.Awake.data(), section(SNAPSHOT_AWAKE), (size_t)header->Sections[SNAPSHOT_AWAKE].Size);
+			std::memcpy(this->Balls.Island.data(), section(SNAPSHOT_ISLAND), (size_t)header->Sections[SNAPSHOT_ISLAND].Size);
+		}
+		this->Balls.UpdateDerived();
+
+		this->Obstacles.clear();
+		const unsigned char* obstacles = section(SNAPSHOT_OBSTACLES);
+		for (uint32_t o = 0; o < header->ObstacleCount; o++) {
+			WorldSnapshotObstacle obstacle;
+			std::memcpy(&obstacle, obstacles + o * sizeof(WorldSnapshotObstacle), sizeof(WorldSnapshotObstacle));
+			this->Obstacles.emplace_back(glm::vec3(obstacle.Position[0], obstacle.Position[1], obstacle.Position[2]), glm::vec3(obstacle.Velocity[0], obstacle.Velocity[1], obstacle.Velocity[2]));
+		}
+		this->RebuildObstacleTree();
+
+		// The sleep state comes from the snapshot, so the loaded settings must not wake everything.
+		this->LastSettings = this->Settings;
+		this->ListsDirty = true;
+		this->Solver.ResetCache();
+		return true;
+	}
+
+	const PhysicsStats& GetStats() const { return this->Stats; }
+	unsigned int GetThreadCount() const { return this->Jobs->GetThreadCount(); }
+	// For other per-frame work of the main thread, between steps.
+	JobSystem* GetJobSystem() const { return this->Jobs.get(); }
+
+private:
+	std::mt19937_64 RandGenerator;
+	std::uniform_real_distribution<float> UnifBallPositionXZ = std::uniform_real_distribution<float>(-8, 8);
+	std::uniform_real_distribution<float> UnifBallPositionY = std::uniform_real_distribution<float>(2, 18);
+	std::uniform_real_distribution<float> UnifBallVelocity = std::uniform_real_distribution<float>(-2, 2);
+	std::uniform_real_distribution<float> UnifBallMass = std::uniform_real_distribution<float>(1.0f, 20.0f);
+
+	SpatialGrid Grid = SpatialGrid(glm::vec3(-10.0f, 0.0f, -10.0f), glm::vec3(10.0f, 20.0f, 10.0f));
+	SpatialGrid SleepingGrid = SpatialGrid(glm::vec3(-10.0f, 0.0f, -10.0f), glm::vec3(10.0f, 20.0f, 10.0f));
+	std::unique_ptr<JobSystem> Jobs = nullptr;
+	std::vector<std::vector<BallContact>> ContactChunks;
+	std::vector<std::vector<BallContact>> WakeContactChunks;
+	std::vector<std::vector<BallContact>> StaticContactChunks;
+	std::vector<unsigned int> CandidatePairChunks;
+	std::vector<std::vector<SweptBall>> SweptChunks;
+	unsigned int ContactChunkAmount = 0;
+	unsigned int WakeContactChunkAmount = 0;
+	unsigned int StaticChunkAmount = 0;
+	ContactSolver Solver;
+	PhysicsStats Stats;
+	float Accumulator = 0.0f;
+	float InterpolationAlpha = 1.0f;
+	unsigned int LastSteps = 0;
+	uint64_t StepCount = 0;
+	TraceRecorder* Recorder = nullptr;
+
+	AABBTree ObstacleTree;
+	std::vector<int> ObstacleProxies;
+	std::vector<unsigned int> MovingObstacles;
+
+	// The float arrays of a BallSystem in WorldSnapshotSection order.
+	template <typename System>
+	static auto GetSnapshotArrays(System& balls) -> std::array<decltype(&balls.PositionX), SNAPSHOT_FLOAT_SECTIONS> {
+		return {
+			&balls.PositionX, &balls.PositionY, &balls.PositionZ,
+			&balls.VelocityX, &balls.VelocityY, &balls.VelocityZ,
+			&balls.ForceX, &balls.ForceY, &balls.ForceZ,
+			&balls.Mass,
+			&balls.PreviousX, &balls.PreviousY, &balls.PreviousZ,
+			&balls.RestTime
+		};
+	}
+
+	static AABB GetObstacleBounds(const Obstacle& obstacle) {
+		glm::vec3 half_extents = obstacle.GetSize() / 2.0f;
+		return AABB(obstacle.GetPosition() - half_extents, obstacle.GetPosition() + half_extents);
+	}
+
+	// Moves the obstacles that have a velocity, refits their leaves and wakes the sleeping balls they reach.
+	void MoveObstacles(float delta_time, float cell_size) {
+		if (this->ObstacleProxies.size() != this->Obstacles.size()) {
+			this->RebuildObstacleTree();
+		}
+		this->Stats.MovingObstacles = (unsigned int)this->MovingObstacles.size();
+		this->Stats.ObstacleTreeHeight = this->ObstacleTree.GetHeight();
+		if (this->MovingObstacles.empty()) {
+			return;
+		}
+		this->BuildSleepingGrid(cell_size);
+		this->WakeIslands.clear();
+		for (unsigned int o : this->MovingObstacles) {
+			Obstacle& obstacle = this->Obstacles[o];
+			glm::vec3 before = obstacle.GetPosition();
+			obstacle.Edge();
+			obstacle.Update(delta_time);
+			AABB bounds = GetObstacleBounds(obstacle);
+			this->ObstacleTree.MoveProxy(this->ObstacleProxies[o], bounds, obstacle.GetPosition() - before);
+			if (this->SleepingBalls.empty()) {
+				continue;
+			}
+			glm::vec3 reach(this->Balls.GetMaxRadius() + BALL_CONTACT_MARGIN);
+			this->SleepingGrid.ForEachInBox(bounds.Min - reach, bounds.Max + reach, [&](unsigned int s) {
+				unsigned int i = this->SleepingBalls[s];
+				glm::vec3 radius(this->Balls.Radius[i] + BALL_CONTACT_MARGIN);
+				if (bounds.Overlaps(AABB(this->Balls.GetPosition(i) - radius, this->Balls.GetPosition(i) + radius))) {
+					this->WakeIslands.push_back(this->Balls.Island[i]);
+				}
+			});
+		}
+		this->WakeMarkedIslands();
+	}
+
+	void BuildSleepingGrid(float cell_size) {
+		if (!this->SleepingGridDirty) {
+			return;
+		}
+		this->SleepingGrid.Build((unsigned int)this->SleepingBalls.size(), cell_size, [&](unsigned int k) { return this->Balls.GetPosition(this->SleepingBalls[k]); });
+		this->SleepingGridDirty = false;
+	}
+
+	// Ball indices in increasing order, except for balls woken during the current step.
+	std::vector<unsigned int> AwakeBalls;
+	std::vector<unsigned int> SleepingBalls;
+	bool SleepingGridDirty = true;
+	bool ListsDirty = true;
+	unsigned int ListRevision = 0;
+	PhysicsSettings LastSettings;
+	std::vector<unsigned int> WakeIslands;
+	// Union-find over the awake balls, indexed by position in AwakeBalls.
+	std::vector<unsigned int> IslandParent;
+	std::vector<unsigned char> IslandResting;
+	std::vector<unsigned int> AwakeSlot;
+
+	// Rebuilds the awake and sleeping lists after balls were added or removed. Moving a slider changes
+	// how every ball should move, so that wakes everything.
+	void UpdateAwakeList() {
+		bool settings_changed = this->Settings.Gravity != this->LastSettings.Gravity || this->Settings.Elasticities != this->LastSettings.Elasticities || this->Settings.DragForce != this->LastSettings.DragForce
+			|| this->Settings.ContinuousCollision != this->LastSettings.ContinuousCollision || this->Settings.SolverIterations != this->LastSettings.SolverIterations
+			|| this->Settings.Friction != this->LastSettings.Friction;
+		if (settings_changed) {
+			this->LastSettings = this->Settings;
+			this->WakeAll();
+		}
+		if (!this->ListsDirty && this->ListRevision == this->Balls.GetRevision()) {
+			return;
+		}
+		if (this->ListRevision != this->Balls.GetRevision()) {
+			// A removed ball's index may be reused, so its cached impulses would land on another ball.
+			this->Solver.ResetCache();
+		}
+		this->AwakeBalls.clear();
+		this->SleepingBalls.clear();
+		for (unsigned int i = 0; i < this->Balls.Size(); i++) {
+			(this->Balls.IsAwake(i) ? this->AwakeBalls : this->SleepingBalls).push_back(i);
+		}
+		this->ListsDirty = false;
+		this->ListRevision = this->Balls.GetRevision();
+		this->SleepingGridDirty = true;
+	}
+
+	// Calls fn(first, last) for every run of consecutive ball indices in AwakeBalls[begin, end), so the
+	// range kernels (and their SIMD paths) still see contiguous arrays.
+	template <typename Fn>
+	void ForEachAwakeRun(unsigned int begin, unsigned int end, const Fn& fn) const {
+		unsigned int k = begin;
+		while (k < end) {
+			unsigned int first = this->AwakeBalls[k++];
+			unsigned int last = first + 1;
+			while (k < end && this->AwakeBalls[k] == last) {
+				k++;
+				last++;
+			}
+			fn(first, last);
+		}
+	}
+
+	void WakeMarkedIslands() {
+		if (this->WakeIslands.empty()) {
+			return;
+		}
+		std::sort(this->WakeIslands.begin(), this->WakeIslands.end());
+		size_t kept = 0;
+		for (unsigned int i : this->SleepingBalls) {
+			if (std::binary_search(this->WakeIslands.begin(), this->WakeIslands.end(), this->Balls.Island[i])) {
+				this->Balls.Wake(i);
+				this->AwakeBalls.push_back(i);
+			} else {
+				this->SleepingBalls[kept++] = i;
+			}
+		}
+		this->SleepingBalls.resize(kept);
+		this->SleepingGridDirty = true;
+	}
+
+	unsigned int FindIsland(unsigned int k) {
+		while (this->IslandParent[k] != k) {
+			this->IslandParent[k] = this->IslandParent[this->IslandParent[k]];
+			k = this->IslandParent[k];
+		}
+		return k;
+	}
+
+	// Groups the awake balls by this step's contacts and puts every island whose balls have all been
+	// at rest for BALL_SLEEP_TIME to sleep.
+	void SleepRestingIslands() {
+		unsigned int awake_amount = (unsigned int)this->AwakeBalls.size();
+		this->AwakeSlot.resize(this->Balls.Size());
+		this->IslandParent.resize(awake_amount);
+		for (unsigned int k = 0; k < awake_amount; k++) {
+			this->AwakeSlot[this->AwakeBalls[k]] = k;
+			this->IslandParent[k] = k;
+		}
+		auto unite = [&](const BallContact& contact) {
+			unsigned int a = this->FindIsland(this->AwakeSlot[contact.A]);
+			unsigned int b = this->FindIsland(this->AwakeSlot[contact.B]);
+			if (a != b) {
+				this->IslandParent[std::max(a, b)] = std::min(a, b);
+			}
+		};
+		for (unsigned int chunk = 0; chunk < this->ContactChunkAmount; chunk++) {
+			std::for_each(this->ContactChunks[chunk].begin(), this->ContactChunks[chunk].end(), unite);
+		}
+
+		this->IslandResting.assign(awake_amount, 1);
+		for (unsigned int k = 0; k < awake_amount; k++) {
+			if (this->Balls.RestTime[this->AwakeBalls[k]] < BALL_SLEEP_TIME) {
+				this->IslandResting[this->FindIsland(k)] = 0;
+			}
+		}
+		for (unsigned int k = 0; k < awake_amount; k++) {
+			unsigned int root = this->FindIsland(k);
+			if (this->IslandResting[root]) {
+				this->Balls.Sleep(this->AwakeBalls[k], this->AwakeBalls[root]);
+			}
+		}
+		size_t kept = 0;
+		for (unsigned int i : this->AwakeBalls) {
+			if (this->Balls.IsAwake(i)) {
+				this->AwakeBalls[kept++] = i;
+			} else {
+				this->SleepingBalls.push_back(i);
+				this->SleepingGridDirty = true;
+			}
+		}
+		this->AwakeBalls.resize(kept);
+	}
+};
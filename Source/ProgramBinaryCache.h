@@ -0,0 +1,166 @@
+#pragma once
+#include "Shader.h"
+#include "Logger.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+constexpr uint32_t PROGRAM_BINARY_MAGIC = 0x4250584E; // "NXPB"
+constexpr uint32_t PROGRAM_BINARY_VERSION = 1;
+// Far beyond any real program; a header claiming more than this (or more than the file holds) is corrupt.
+constexpr uint32_t PROGRAM_BINARY_MAX_LENGTH = 64u << 20;
+
+// Linked programs saved with glGetProgramBinary and loaded back with glProgramBinary on the next launch.
+// A file is named after the hash of everything that went into the program plus the driver strings,
+// so editing a shader, changing a define or updating the driver simply misses and compiles again.
+// Needs GL 4.1 (or ARB_get_program_binary) with at least one binary format, checked on the running
+// context; otherwise every Load() misses and nothing is stored.
+class ProgramBinaryCache {
+public:
+	explicit ProgramBinaryCache(const std::string& directory = "ShaderCache") : Directory(directory) {
+		if (IsSupported()) {
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			this->Available = formats > 0;
+		}
+		if (!this->Available) {
+			return;
+		}
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		this->DriverHash = Hash(GetString(GL_VENDOR));
+		this->DriverHash = Hash(GetString(GL_RENDERER), this->DriverHash);
+		this->DriverHash = Hash(GetString(GL_VERSION), this->DriverHash);
+	}
+
+	ProgramBinaryCache(const ProgramBinaryCache&) = delete;
+	ProgramBinaryCache& operator=(const ProgramBinaryCache&) = delete;
+
+	bool IsAvailable() const { return this->Available; }
+
+	// Key of a program built from these sources, defines included.
+	uint64_t MakeKey(const std::string& vertex_source, const std::string& fragment_source, const std::string& geometry_source = "") const {
+		return Hash(geometry_source, Hash(fragment_source, Hash(vertex_source, this->DriverHash)));
+	}
+
+	// Returns a linked program, or 0 on a miss. A file the driver refuses is deleted.
+	GLuint Load(uint64_t key) {
+		if (this->Available) {
+			std::string path = this->GetPath(key);
+			std::error_code error;
+			uintmax_t file_size = std::filesystem::file_size(path, error);
+			std::ifstream file(path, std::ios::binary);
+			Header header = {};
+			if (!error && file && file.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.Magic == PROGRAM_BINARY_MAGIC && header.Version == PROGRAM_BINARY_VERSION) {
+				bool fits = header.Length > 0 && header.Length <= PROGRAM_BINARY_MAX_LENGTH && header.Length <= file_size - sizeof(header);
+				std::vector<char> binary(fits ? header.Length : 0);
+				if (fits && file.read(binary.data(), header.Length)) {
+					GLuint program = glCreateProgram();
+					glProgramBinary(program, header.Format, binary.data(), (GLsizei)header.Length);
+					GLint success = 0;
+					glGetProgramiv(program, GL_LINK_STATUS, &success);
+					if (success) {
+						this->Hits++;
+						return program;
+					}
+					glDeleteProgram(program);
+				}
+				file.close();
+				std::remove(path.c_str());
+			}
+		}
+		this->Misses++;
+		return 0;
+	}
+
+	// Call between glAttachShader and glLinkProgram so the driver keeps the binary around.
+	void PrepareForLink(GLuint program) const {
+		if (this->Available) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	void Store(uint64_t key, GLuint program) {
+		if (!this->Available) {
+			return;
+		}
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			return;
+		}
+		std::vector<char> binary(length);
+		Header header = { PROGRAM_BINARY_MAGIC, PROGRAM_BINARY_VERSION, 0, 0 };
+		GLsizei written = 0;
+		glGetProgramBinary(program, length, &written, &header.Format, binary.data());
+		header.Length = (uint32_t)written;
+		std::ofstream file(this->GetPath(key), std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !file.write(binary.data(), written)) {
+			Nexus::Logger::Message(Nexus::LOG_WARNING, "Failed to write program binary: " + this->GetPath(key));
+			return;
+		}
+		this->Stores++;
+	}
+
+	unsigned int GetHits() const { return this->Hits; }
+	unsigned int GetMisses() const { return this->Misses; }
+	unsigned int GetStores() const { return this->Stores; }
+
+private:
+	struct Header {
+		uint32_t Magic;
+		uint32_t Version;
+		GLenum Format;
+		uint32_t Length;
+	};
+
+	std::string Directory;
+	bool Available = false;
+	uint64_t DriverHash = 0;
+	unsigned int Hits = 0;
+	unsigned int Misses = 0;
+	unsigned int Stores = 0;
+
+	// FNV-1a, chained through seed.
+	static uint64_t Hash(const std::string& text, uint64_t seed = 14695981039346656037ull) {
+		uint64_t hash = seed;
+		for (unsigned char c : text) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static bool IsSupported() {
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 1)) {
+			return true;
+		}
+		GLint extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+		for (GLint i = 0; i < extensions; i++) {
+			const GLubyte* name = glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (name != nullptr && std::strcmp(reinterpret_cast<const char*>(name), "GL_ARB_get_program_binary") == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static std::string GetString(GLenum name) {
+		const GLubyte* text = glGetString(name);
+		return text != nullptr ? std::string(reinterpret_cast<const char*>(text)) : std::string();
+	}
+
+	std::string GetPath(uint64_t key) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return (std::filesystem::path(this->Directory) / name).string();
+	}
+};
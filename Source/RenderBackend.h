@@ -0,0 +1,97 @@
+#pragma once
+#include "Shader.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+// The state-changing GL calls that RenderStateCache and UniformCache make. GLRenderBackend forwards them
+// to GL; NullRenderBackend only records them, so the state cache and the render queue can be run and
+// checked without a context.
+class RenderBackend {
+public:
+	virtual ~RenderBackend() = default;
+
+	virtual void UseProgram(GLuint program) = 0;
+	virtual void BindTexture(unsigned int unit, GLenum target, GLuint texture) = 0;
+	virtual void BindVertexArray(GLuint vertex_array) = 0;
+	virtual GLint GetUniformLocation(GLuint program, const char* name) = 0;
+	virtual void Uniform1i(GLint location, GLint value) = 0;
+	virtual void Uniform1f(GLint location, GLfloat value) = 0;
+	virtual void Uniform3fv(GLint location, const GLfloat* value) = 0;
+	virtual void Uniform4fv(GLint location, const GLfloat* value) = 0;
+	virtual void UniformMatrix3fv(GLint location, const GLfloat* value) = 0;
+	virtual void UniformMatrix4fv(GLint location, const GLfloat* value) = 0;
+};
+
+class GLRenderBackend final : public RenderBackend {
+public:
+	void UseProgram(GLuint program) override { glUseProgram(program); }
+	void BindTexture(unsigned int unit, GLenum target, GLuint texture) override {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+	}
+	void BindVertexArray(GLuint vertex_array) override { glBindVertexArray(vertex_array); }
+	GLint GetUniformLocation(GLuint program, const char* name) override { return glGetUniformLocation(program, name); }
+	void Uniform1i(GLint location, GLint value) override { glUniform1i(location, value); }
+	void Uniform1f(GLint location, GLfloat value) override { glUniform1f(location, value); }
+	void Uniform3fv(GLint location, const GLfloat* value) override { glUniform3fv(location, 1, value); }
+	void Uniform4fv(GLint location, const GLfloat* value) override { glUniform4fv(location, 1, value); }
+	void UniformMatrix3fv(GLint location, const GLfloat* value) override { glUniformMatrix3fv(location, 1, GL_FALSE, value); }
+	void UniformMatrix4fv(GLint location, const GLfloat* value) override { glUniformMatrix4fv(location, 1, GL_FALSE, value); }
+};
+
+enum RenderCallKind {
+	RENDER_CALL_USE_PROGRAM,
+	RENDER_CALL_BIND_TEXTURE,
+	RENDER_CALL_BIND_VERTEX_ARRAY,
+	RENDER_CALL_UNIFORM,
+	RENDER_CALL_KIND_COUNT
+};
+
+struct RecordedRenderCall {
+	RenderCallKind Kind;
+	// Program, texture or vertex array name, or the uniform location.
+	GLuint Object;
+	// Texture unit, or the first component of a uniform value.
+	float Value;
+};
+
+// Records every call instead of making it. Uniform locations are handed out per (program, name) in the
+// order they are first asked for.
+class NullRenderBackend final : public RenderBackend {
+public:
+	void UseProgram(GLuint program) override { this->Record(RENDER_CALL_USE_PROGRAM, program, 0.0f); }
+	void BindTexture(unsigned int unit, GLenum, GLuint texture) override { this->Record(RENDER_CALL_BIND_TEXTURE, texture, (float)unit); }
+	void BindVertexArray(GLuint vertex_array) override { this->Record(RENDER_CALL_BIND_VERTEX_ARRAY, vertex_array, 0.0f); }
+	GLint GetUniformLocation(GLuint program, const char* name) override {
+		auto inserted = this->Locations.emplace(std::to_string(program) + ":" + name, (GLint)this->Locations.size());
+		return inserted.first->second;
+	}
+	void Uniform1i(GLint location, GLint value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, (float)value); }
+	void Uniform1f(GLint location, GLfloat value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, value); }
+	void Uniform3fv(GLint location, const GLfloat* value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, value[0]); }
+	void Uniform4fv(GLint location, const GLfloat* value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, value[0]); }
+	void UniformMatrix3fv(GLint location, const GLfloat* value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, value[0]); }
+	void UniformMatrix4fv(GLint location, const GLfloat* value) override { this->Record(RENDER_CALL_UNIFORM, (GLuint)location, value[0]); }
+
+	const std::vector<RecordedRenderCall>& GetCalls() const { return this->Calls; }
+	unsigned int GetCount(RenderCallKind kind) const { return this->Counts[kind]; }
+
+	void Clear() {
+		this->Calls.clear();
+		for (unsigned int& count : this->Counts) {
+			count = 0;
+		}
+	}
+
+private:
+	std::vector<RecordedRenderCall> Calls;
+	unsigned int Counts[RENDER_CALL_KIND_COUNT] = {};
+	std::unordered_map<std::string, GLint> Locations;
+
+	void Record(RenderCallKind kind, GLuint object, float value) {
+		this->Calls.push_back({ kind, object, value });
+		this->Counts[kind]++;
+	}
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include "Shader.h"
+#include "RenderStateCache.h"
+#include "UniformCache.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Opaque draws go first, front to back; translucent ones after them, back to front.
+enum RenderLayer : uint32_t {
+	RENDER_LAYER_OPAQUE,
+	RENDER_LAYER_TRANSLUCENT
+};
+
+enum RenderMaterialFlag : uint32_t {
+	RENDER_MATERIAL_DIFFUSE_TEXTURE = 1u << 0,
+	RENDER_MATERIAL_SPECULAR_TEXTURE = 1u << 1,
+	RENDER_MATERIAL_EMISSION = 1u << 2,
+	RENDER_MATERIAL_EMISSION_TEXTURE = 1u << 3
+};
+
+// The "material" uniform struct of lighting.frag.
+struct RenderMaterial {
+	uint32_t Flags = 0;
+	glm::vec4 Ambient = glm::vec4(0.0f);
+	glm::vec4 Diffuse = glm::vec4(0.0f);
+	glm::vec4 Specular = glm::vec4(0.0f);
+	float Shininess = 32.0f;
+
+	bool operator==(const RenderMaterial& other) const {
+		return this->Flags == other.Flags && this->Ambient == other.Ambient && this->Diffuse == other.Diffuse && this->Specular == other.Specular && this->Shininess == other.Shininess;
+	}
+};
+
+struct RenderCommand;
+// Issues the draw itself; everything the key covers is already current.
+typedef void (*RenderDrawFunction)(void* context, const RenderCommand& command, RenderStateCache& state);
+// Runs when the queue makes a new program current, e.g. to set the camera uniforms.
+typedef void (*RenderProgramFunction)(void* context, GLuint program);
+// Turns the clipping planes on or off between draws that differ in Clip.
+typedef void (*RenderClipFunction)(bool enable);
+
+constexpr uint32_t RENDER_NO_MATERIAL = ~0u;
+
+struct RenderCommand {
+	uint64_t Key = 0;
+	GLuint Program = 0;
+	uint32_t Material = RENDER_NO_MATERIAL;
+	GLenum TextureTarget = GL_TEXTURE_2D;
+	// Bound to unit 0 when not 0.
+	GLuint Texture = 0;
+	bool Clip = false;
+	glm::mat4 Model = glm::mat4(1.0f);
+	RenderDrawFunction Draw = nullptr;
+	void* Context = nullptr;
+	// Free for the draw function, e.g. which part of Context to draw.
+	uint32_t Index = 0;
+};
+
+// Draws are recorded during the frame and issued together by Execute(), sorted by a 64-bit key so that
+// draws sharing a program, a material and a texture follow each other and the state cache can drop the
+// changes between them. Key, from the highest bit down:
+//
+//   opaque:       layer (2) | program (12) | material (12) | texture (12) | clip (1) | depth (25)
+//   translucent:  layer (2) | inverted depth (25) | program (12) | material (12) | texture (12) | clip (1)
+//
+// Programs, materials and textures are numbered in the order they are first seen in the frame. Commands
+// with equal keys keep the order they were submitted in, so the result does not depend on the sort.
+class RenderQueue {
+public:
+	// Forgets the commands of the last frame; the buffers are kept.
+	void Reset() {
+		this->Commands.clear();
+		this->Materials.clear();
+		this->Programs.clear();
+		this->Textures.clear();
+	}
+
+	// Returns the number to put in RenderCommand::Material; equal materials get the same number.
+	uint32_t AddMaterial(const RenderMaterial& material) {
+		for (uint32_t m = 0; m < this->Materials.size(); m++) {
+			if (this->Materials[m] == material) {
+				return m;
+			}
+		}
+		this->Materials.push_back(material);
+		return (uint32_t)this->Materials.size() - 1;
+	}
+
+	const RenderMaterial& GetMaterial(uint32_t material) const { return this->Materials[material]; }
+
+	// depth is the distance to the camera over the far plane, [0, 1].
+	void Submit(RenderCommand command, RenderLayer layer, float depth) {
+		uint64_t program = Intern(this->Programs, command.Program) & RENDER_KEY_ID_MASK;
+		uint64_t material = (command.Material == RENDER_NO_MATERIAL ? RENDER_KEY_ID_MASK : command.Material) & RENDER_KEY_ID_MASK;
+		uint64_t texture = (command.Texture == 0 ? 0 : Intern(this->Textures, command.Texture) + 1) & RENDER_KEY_ID_MASK;
+		uint64_t quantized = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * (float)RENDER_KEY_DEPTH_MASK);
+		uint64_t state = (program << 25) | (material << 13) | (texture << 1) | (command.Clip ? 1 : 0);
+		uint64_t key = (uint64_t)layer << 62;
+		if (layer == RENDER_LAYER_TRANSLUCENT) {
+			key |= ((RENDER_KEY_DEPTH_MASK - quantized) << 37) | state;
+		} else {
+			key |= (state << 25) | quantized;
+		}
+		command.Key = key;
+		this->Commands.push_back(command);
+	}
+
+	// Sorts the commands and draws them. Material uniforms are only sent when the material or the
+	// program changes, and then through the uniform cache, which drops the values that are already set.
+	void Execute(RenderStateCache& state, UniformCache& uniforms, RenderProgramFunction on_program, void* context, RenderClipFunction on_clip) {
+		this->Sort();
+		GLuint program = RENDER_STATE_UNKNOWN;
+		uint32_t material = RENDER_NO_MATERIAL;
+		bool clip = false;
+		for (uint32_t index : this->Order) {
+			const RenderCommand& command = this->Commands[index];
+			if (command.Program != program) {
+				uniforms.Use(command.Program);
+				program = command.Program;
+				material = RENDER_NO_MATERIAL;
+				if (on_program != nullptr) {
+					on_program(context, program);
+				}
+			}
+			if (command.Material != material && command.Material != RENDER_NO_MATERIAL) {
+				ApplyMaterial(uniforms, this->Materials[command.Material]);
+				material = command.Material;
+			}
+			if (command.Texture != 0) {
+				state.BindTexture(0, command.TextureTarget, command.Texture);
+			}
+			if (command.Clip != clip && on_clip != nullptr) {
+				on_clip(command.Clip);
+				clip = command.Clip;
+			}
+			command.Draw(command.Context, command, state);
+		}
+		if (clip) {
+			on_clip(false);
+		}
+	}
+
+	size_t GetCommandCount() const { return this->Commands.size(); }
+	size_t GetMaterialCount() const { return this->Materials.size(); }
+	size_t GetProgramCount() const { return this->Programs.size(); }
+	// The command indices in draw order, after Execute().
+	const std::vector<uint32_t>& GetOrder() const { return this->Order; }
+	const RenderCommand& GetCommand(uint32_t index) const { return this->Commands[index]; }
+
+	static void ApplyMaterial(UniformCache& uniforms, const RenderMaterial& material) {
+		uniforms.SetBool("material.enableDiffuseTexture"_u, (material.Flags & RENDER_MATERIAL_DIFFUSE_TEXTURE) != 0);
+		uniforms.SetBool("material.enableSpecularTexture"_u, (material.Flags & RENDER_MATERIAL_SPECULAR_TEXTURE) != 0);
+		uniforms.SetBool("material.enableEmission"_u, (material.Flags & RENDER_MATERIAL_EMISSION) != 0);
+		uniforms.SetBool("material.enableEmissionTexture"_u, (material.Flags & RENDER_MATERIAL_EMISSION_TEXTURE) != 0);
+		uniforms.SetVec4("material.ambient"_u, material.Ambient);
+		uniforms.SetVec4("material.diffuse"_u, material.Diffuse);
+		uniforms.SetVec4("material.specular"_u, material.Specular);
+		uniforms.SetFloat("material.shininess"_u, material.Shininess);
+	}
+
+private:
+	static constexpr uint64_t RENDER_KEY_ID_MASK = (1u << 12) - 1;
+	static constexpr uint64_t RENDER_KEY_DEPTH_MASK = (1u << 25) - 1;
+
+	std::vector<RenderCommand> Commands;
+	std::vector<RenderMaterial> Materials;
+	std::vector<GLuint> Programs;
+	std::vector<GLuint> Textures;
+	// Sort buffers, kept between frames.
+	std::vector<uint64_t> Keys;
+	std::vector<uint64_t> SwapKeys;
+	std::vector<uint32_t> Order;
+	std::vector<uint32_t> SwapOrder;
+
+	// A frame has a handful of programs and textures, a linear search is all it takes.
+	static uint32_t Intern(std::vector<GLuint>& names, GLuint name) {
+		for (uint32_t n = 0; n < names.size(); n++) {
+			if (names[n] == name) {
+				return n;
+			}
+		}
+		names.push_back(name);
+		return (uint32_t)names.size() - 1;
+	}
+
+	// LSD radix sort on the keys, a byte per pass. Passes where every key has the same byte are skipped,
+	// which with a few programs and materials is most of the high ones. Stable, like every LSD sort.
+	void Sort() {
+		size_t count = this->Commands.size();
+		this->Keys.resize(count);
+		this->SwapKeys.resize(count);
+		this->Order.resize(count);
+		this->SwapOrder.resize(count);
+		uint32_t histograms[8][256] = {};
+		for (size_t i = 0; i < count; i++) {
+			uint64_t key = this->Commands[i].Key;
+			this->Keys[i] = key;
+			this->Order[i] = (uint32_t)i;
+			for (unsigned int pass = 0; pass < 8; pass++) {
+				histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+			}
+		}
+		for (unsigned int pass = 0; pass < 8; pass++) {
+			uint32_t* histogram = histograms[pass];
+			unsigned int shift = pass * 8;
+			if (count == 0 || histogram[(this->Keys[0] >> shift) & 0xFF] == count) {
+				continue;
+			}
+			uint32_t offset = 0;
+			for (unsigned int bucket = 0; bucket < 256; bucket++) {
+				uint32_t bucket_count = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucket_count;
+			}
+			for (size_t i = 0; i < count; i++) {
+				uint32_t destination = histogram[(this->Keys[i] >> shift) & 0xFF]++;
+				this->SwapKeys[destination] = this->Keys[i];
+				this->SwapOrder[destination] = this->Order[i];
+			}
+			this->Keys.swap(this->SwapKeys);
+			this->Order.swap(this->SwapOrder);
+		}
+	}
+};
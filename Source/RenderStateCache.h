@@ -0,0 +1,213 @@
+#pragma once
+#include "RenderBackend.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+constexpr unsigned int RENDER_STATE_TEXTURE_UNITS = 16;
+constexpr GLuint RENDER_STATE_UNKNOWN = ~0u;
+
+struct RenderStateCounters {
+	unsigned int Programs = 0;
+	unsigned int Textures = 0;
+	unsigned int VertexArrays = 0;
+	unsigned int Uniforms = 0;
+};
+
+// Remembers the bound program, textures and vertex array and the last value of every uniform, and only
+// passes a change on to the backend when it really changes something. Counts what was issued and what
+// was dropped. Code that binds behind its back (AssetLoader binds while uploading) must be followed by
+// the matching Invalidate call. Uniform values are remembered per program and outlive Invalidate(), so
+// anything that writes a uniform of a program the cache has seen without going through it (a
+// Nexus::Shader::Set* call, or a Nexus shape's Draw, which sets "model" itself) must be followed by
+// InvalidateUniforms() as well.
+class RenderStateCache {
+public:
+	explicit RenderStateCache(RenderBackend* backend) : Backend(backend) {
+		this->UniformEntries.resize(RENDER_STATE_INITIAL_UNIFORMS);
+		this->Invalidate();
+	}
+
+	RenderBackend* GetBackend() const { return this->Backend; }
+
+	// Call once per frame; the counters of the finished frame stay readable through GetLastIssued()/GetLastElided().
+	void NewFrame() {
+		this->LastIssued = this->Issued;
+		this->LastElided = this->Elided;
+		this->Issued = RenderStateCounters();
+		this->Elided = RenderStateCounters();
+	}
+
+	// Forgets the bindings, not the uniform values: those belong to the programs and survive.
+	void Invalidate() {
+		this->Program = RENDER_STATE_UNKNOWN;
+		this->VertexArray = RENDER_STATE_UNKNOWN;
+		for (unsigned int unit = 0; unit < RENDER_STATE_TEXTURE_UNITS; unit++) {
+			this->Textures[unit] = RENDER_STATE_UNKNOWN;
+		}
+	}
+
+	void InvalidateVertexArray() { this->VertexArray = RENDER_STATE_UNKNOWN; }
+
+	// Forgets the uniform values, so the next value set at every location is sent.
+	void InvalidateUniforms() {
+		for (UniformEntry& entry : this->UniformEntries) {
+			entry.Used = false;
+		}
+		this->UniformCount = 0;
+	}
+
+	// Something else made program current (e.g. Nexus::Shader::Use); keeps the cache in step without a call.
+	void NoteProgram(GLuint program) { this->Program = program; }
+
+	void UseProgram(GLuint program) {
+		if (this->Program == program) {
+			this->Elided.Programs++;
+			return;
+		}
+		this->Program = program;
+		this->Issued.Programs++;
+		this->Backend->UseProgram(program);
+	}
+
+	void BindTexture(unsigned int unit, GLenum target, GLuint texture) {
+		// Units past the tracked ones are always bound.
+		if (unit < RENDER_STATE_TEXTURE_UNITS) {
+			if (this->Textures[unit] == texture) {
+				this->Elided.Textures++;
+				return;
+			}
+			this->Textures[unit] = texture;
+		}
+		this->Issued.Textures++;
+		this->Backend->BindTexture(unit, target, texture);
+	}
+
+	void BindVertexArray(GLuint vertex_array) {
+		if (this->VertexArray == vertex_array) {
+			this->Elided.VertexArrays++;
+			return;
+		}
+		this->VertexArray = vertex_array;
+		this->Issued.VertexArrays++;
+		this->Backend->BindVertexArray(vertex_array);
+	}
+
+	GLuint GetProgram() const { return this->Program; }
+
+	// Uniform setters for the current program. Scalars and vectors are compared with the last value sent
+	// to the same location of the same program; matrices are always sent.
+	void Uniform1i(GLint location, GLint value) {
+		if (this->IsUnchanged(location, &value, sizeof(value))) {
+			return;
+		}
+		this->Backend->Uniform1i(location, value);
+	}
+
+	void Uniform1f(GLint location, GLfloat value) {
+		if (this->IsUnchanged(location, &value, sizeof(value))) {
+			return;
+		}
+		this->Backend->Uniform1f(location, value);
+	}
+
+	void Uniform3fv(GLint location, const GLfloat* value) {
+		if (this->IsUnchanged(location, value, 3 * sizeof(GLfloat))) {
+			return;
+		}
+		this->Backend->Uniform3fv(location, value);
+	}
+
+	void Uniform4fv(GLint location, const GLfloat* value) {
+		if (this->IsUnchanged(location, value, 4 * sizeof(GLfloat))) {
+			return;
+		}
+		this->Backend->Uniform4fv(location, value);
+	}
+
+	void UniformMatrix3fv(GLint location, const GLfloat* value) {
+		if (location >= 0) {
+			this->Issued.Uniforms++;
+			this->Backend->UniformMatrix3fv(location, value);
+		}
+	}
+
+	void UniformMatrix4fv(GLint location, const GLfloat* value) {
+		if (location >= 0) {
+			this->Issued.Uniforms++;
+			this->Backend->UniformMatrix4fv(location, value);
+		}
+	}
+
+	const RenderStateCounters& GetIssued() const { return this->Issued; }
+	const RenderStateCounters& GetElided() const { return this->Elided; }
+	const RenderStateCounters& GetLastIssued() const { return this->LastIssued; }
+	const RenderStateCounters& GetLastElided() const { return this->LastElided; }
+
+private:
+	static constexpr size_t RENDER_STATE_INITIAL_UNIFORMS = 512;
+
+	struct UniformEntry {
+		uint64_t Key = 0;
+		unsigned char Value[16];
+		bool Used = false;
+	};
+
+	RenderBackend* Backend;
+	GLuint Program;
+	GLuint VertexArray;
+	GLuint Textures[RENDER_STATE_TEXTURE_UNITS];
+	RenderStateCounters Issued;
+	RenderStateCounters Elided;
+	RenderStateCounters LastIssued;
+	RenderStateCounters LastElided;
+	// Open addressing with linear probing on (program, location), kept at most half full.
+	std::vector<UniformEntry> UniformEntries;
+	size_t UniformCount = 0;
+
+	// Also stores value as the last one when it is not. Location -1 (optimised out) is never sent.
+	bool IsUnchanged(GLint location, const void* value, size_t size) {
+		if (location < 0) {
+			return true;
+		}
+		uint64_t key = ((uint64_t)this->Program << 32) | (uint32_t)location;
+		UniformEntry& entry = this->FindUniform(key);
+		if (entry.Used && std::memcmp(entry.Value, value, size) == 0) {
+			this->Elided.Uniforms++;
+			return true;
+		}
+		if (!entry.Used) {
+			entry.Used = true;
+			entry.Key = key;
+			this->UniformCount++;
+		}
+		std::memcpy(entry.Value, value, size);
+		this->Issued.Uniforms++;
+		if (this->UniformCount * 2 > this->UniformEntries.size()) {
+			this->GrowUniforms();
+		}
+		return false;
+	}
+
+	UniformEntry& FindUniform(uint64_t key) {
+		uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+		size_t mask = this->UniformEntries.size() - 1;
+		size_t slot = (size_t)(hash >> 32) & mask;
+		while (this->UniformEntries[slot].Used && this->UniformEntries[slot].Key != key) {
+			slot = (slot + 1) & mask;
+		}
+		return this->UniformEntries[slot];
+	}
+
+	void GrowUniforms() {
+		std::vector<UniformEntry> old_entries;
+		old_entries.swap(this->UniformEntries);
+		this->UniformEntries.resize(old_entries.size() * 2);
+		for (const UniformEntry& entry : old_entries) {
+			if (entry.Used) {
+				this->FindUniform(entry.Key) = entry;
+			}
+		}
+	}
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include "Shader.h"
+#include "ShaderProgram.h"
+#include "ProgramBinaryCache.h"
+#include "Stopwatch.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// One compile-time switch of a shader: the bits [Shift, Shift + Bits) of the permutation mask are
+// written into the source as "#define Name value".
+struct ShaderFeature {
+	const char* Name;
+	unsigned int Shift;
+	unsigned int Bits;
+};
+
+// Every combination of features of one vertex/fragment pair is a separate program, compiled the first
+// time its mask is asked for and kept until the end. The sources get "#define PERMUTATION 1" and one
+// define per feature right after #version, so the shaders can turn their switches into constants and
+// let the compiler drop the branches. on_link runs once per new program, e.g. to bind uniform blocks.
+// With a binary cache a permutation seen by an earlier launch is loaded instead of compiled.
+class ShaderPermutations {
+public:
+	ShaderPermutations(const std::string& vertex_path, const std::string& fragment_path, const ShaderFeature* features, unsigned int feature_count, void (*on_link)(GLuint) = nullptr, ProgramBinaryCache* binary_cache = nullptr)
+		: VertexPath(vertex_path), FragmentPath(fragment_path), Features(features, features + feature_count), OnLink(on_link), BinaryCache(binary_cache) {
+		this->VertexSource = ReadShaderSource(vertex_path);
+		this->FragmentSource = ReadShaderSource(fragment_path);
+	}
+
+	~ShaderPermutations() {
+		for (auto& program : this->Programs) {
+			if (program.second != 0) {
+				glDeleteProgram(program.second);
+			}
+		}
+	}
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+	// Returns 0 when the permutation failed to build; the error is logged only once.
+	GLuint Get(uint32_t mask) {
+		auto it = this->Programs.find(mask);
+		if (it != this->Programs.end()) {
+			return it->second;
+		}
+		Stopwatch stopwatch;
+		GLuint program = this->Build(mask);
+		this->BuildMilliseconds += stopwatch.GetElapsedMilliseconds();
+		this->Programs.emplace(mask, program);
+		return program;
+	}
+
+	size_t GetProgramCount() const { return this->Programs.size(); }
+	// Time spent compiling or loading programs so far.
+	float GetBuildMilliseconds() const { return this->BuildMilliseconds; }
+
+private:
+	std::string VertexPath;
+	std::string FragmentPath;
+	std::string VertexSource;
+	std::string FragmentSource;
+	std::vector<ShaderFeature> Features;
+	void (*OnLink)(GLuint) = nullptr;
+	ProgramBinaryCache* BinaryCache = nullptr;
+	std::unordered_map<uint32_t, GLuint> Programs;
+	float BuildMilliseconds = 0.0f;
+
+	std::string BuildDefines(uint32_t mask) const {
+		std::string defines = "#define PERMUTATION 1\n";
+		for (const ShaderFeature& feature : this->Features) {
+			uint32_t value = (mask >> feature.Shift) & ((1u << feature.Bits) - 1u);
+			defines += "#define " + std::string(feature.Name) + " " + std::to_string(value) + "\n";
+		}
+		return defines;
+	}
+
+	// #version has to stay the first statement, so the defines go on the line after it.
+	static std::string Inject(const std::string& source, const std::string& defines) {
+		size_t version = source.find("#version");
+		if (version == std::string::npos) {
+			return defines + source;
+		}
+		size_t line_end = source.find('\n', version);
+		if (line_end == std::string::npos) {
+			return source + "\n" + defines;
+		}
+		return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+	}
+
+	GLuint Build(uint32_t mask) const {
+		std::string defines = this->BuildDefines(mask);
+		std::string label = this->VertexPath + " + " + this->FragmentPath + " (permutation " + std::to_string(mask) + ")";
+		GLuint program = BuildShaderProgram(Inject(this->VertexSource, defines), Inject(this->FragmentSource, defines), "", label, this->BinaryCache);
+		if (program != 0 && this->OnLink != nullptr) {
+			this->OnLink(program);
+		}
+		return program;
+	}
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include "Shader.h"
+#include "Logger.h"
+#include "ProgramBinaryCache.h"
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// Programs built here rather than by Nexus::Shader, so a launch after the first loads them from the
+// binary cache instead of compiling them. Delete them with glDeleteProgram.
+
+inline std::string ReadShaderSource(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		Nexus::Logger::Message(Nexus::LOG_ERROR, "Failed to read shader file: " + path);
+		return "";
+	}
+	std::stringstream stream;
+	stream << file.rdbuf();
+	return stream.str();
+}
+
+inline GLuint CompileShaderStage(GLenum type, const std::string& source, const std::string& label) {
+	GLuint shader = glCreateShader(type);
+	const char* text = source.c_str();
+	glShaderSource(shader, 1, &text, nullptr);
+	glCompileShader(shader);
+	GLint success = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		Nexus::Logger::Message(Nexus::LOG_ERROR, "Failed to compile " + label + ": " + log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// Links the sources into a program, or loads it from binary_cache when an earlier launch stored it.
+// geometry_source may be empty; label names the program in the log. Returns 0 on failure.
+inline GLuint BuildShaderProgram(const std::string& vertex_source, const std::string& fragment_source, const std::string& geometry_source, const std::string& label, ProgramBinaryCache* binary_cache = nullptr) {
+	uint64_t key = 0;
+	if (binary_cache != nullptr) {
+		key = binary_cache->MakeKey(vertex_source, fragment_source, geometry_source);
+		GLuint program = binary_cache->Load(key);
+		if (program != 0) {
+			return program;
+		}
+	}
+
+	GLuint stages[3] = {
+		CompileShaderStage(GL_VERTEX_SHADER, vertex_source, label + " (vertex)"),
+		CompileShaderStage(GL_FRAGMENT_SHADER, fragment_source, label + " (fragment)"),
+		geometry_source.empty() ? 0 : CompileShaderStage(GL_GEOMETRY_SHADER, geometry_source, label + " (geometry)")
+	};
+	GLuint program = 0;
+	if (stages[0] != 0 && stages[1] != 0 && (geometry_source.empty() || stages[2] != 0)) {
+		program = glCreateProgram();
+		for (GLuint stage : stages) {
+			if (stage != 0) {
+				glAttachShader(program, stage);
+			}
+		}
+		if (binary_cache != nullptr) {
+			binary_cache->PrepareForLink(program);
+		}
+		glLinkProgram(program);
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			char log[1024];
+			glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+			Nexus::Logger::Message(Nexus::LOG_ERROR, "Failed to link " + label + ": " + log);
+			glDeleteProgram(program);
+			program = 0;
+		} else {
+			for (GLuint stage : stages) {
+				if (stage != 0) {
+					glDetachShader(program, stage);
+				}
+			}
+			if (binary_cache != nullptr) {
+				binary_cache->Store(key, program);
+			}
+		}
+	}
+	for (GLuint stage : stages) {
+		if (stage != 0) {
+			glDeleteShader(stage);
+		}
+	}
+	return program;
+}
+
+// The same from files, like Nexus::Shader takes them.
+inline GLuint LoadShaderProgram(const std::string& vertex_path, const std::string& fragment_path, const std::string& geometry_path = "", ProgramBinaryCache* binary_cache = nullptr) {
+	std::string label = vertex_path + " + " + fragment_path + (geometry_path.empty() ? "" : " + " + geometry_path);
+	return BuildShaderProgram(ReadShaderSource(vertex_path), ReadShaderSource(fragment_path), geometry_path.empty() ? "" : ReadShaderSource(geometry_path), label, binary_cache);
+}
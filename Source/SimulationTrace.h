@@ -0,0 +1,275 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "BallSystem.h"
+#include "MappedFile.h"
+
+// Layout of the .ntrace files written by TraceRecorder: a file header followed by one frame per recorded
+// step. A frame is a header plus a payload of quantized ball state; keyframes hold every ball, the other
+// frames only the change since the frame before them. Frames are only ever appended, so a trace cut off
+// by a crash is still readable up to its last complete frame.
+constexpr uint32_t TRACE_FILE_MAGIC = 0x52545850; // "PXTR"
+constexpr uint32_t TRACE_FRAME_MAGIC = 0x4D415246; // "FRAM"
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr const char* TRACE_EXTENSION = ".ntrace";
+// Positions and radii are kept to the millimetre, velocities to 1/256 m/s.
+constexpr float TRACE_POSITION_SCALE = 1000.0f;
+constexpr float TRACE_VELOCITY_SCALE = 256.0f;
+
+// Quantized values of a frame are stored channel by channel: all X positions, then all Y positions...
+// Only keyframes carry the radius channel; balls do not change size between keyframes.
+enum TraceChannel : uint32_t {
+	TRACE_POSITION_X, TRACE_POSITION_Y, TRACE_POSITION_Z,
+	TRACE_VELOCITY_X, TRACE_VELOCITY_Y, TRACE_VELOCITY_Z,
+	TRACE_RADIUS,
+	TRACE_CHANNEL_COUNT
+};
+constexpr unsigned int TRACE_DELTA_CHANNELS = TRACE_RADIUS;
+
+enum TraceFrameFlag : uint32_t {
+	TRACE_FRAME_KEYFRAME = 1u << 0
+};
+
+struct TraceFileHeader {
+	uint32_t Magic;
+	uint32_t Version;
+	float StepTime;
+	float PositionScale;
+	float VelocityScale;
+	uint32_t KeyframeInterval;
+	uint32_t Reserved[2];
+};
+static_assert(sizeof(TraceFileHeader) == 32, "TraceFileHeader must not have padding");
+
+struct TraceFrameHeader {
+	uint32_t Magic;
+	uint32_t Flags;
+	uint64_t Step;
+	uint32_t BallCount;
+	uint32_t PayloadSize;
+	// FNV-1a of the payload, so a torn write at the end of the file is not taken for a frame.
+	uint32_t Checksum;
+	uint32_t Reserved;
+};
+static_assert(sizeof(TraceFrameHeader) == 32, "TraceFrameHeader must not have padding");
+
+inline uint32_t GetTraceChecksum(const unsigned char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// NaN and values far outside the room are clamped rather than left to an undefined conversion.
+inline int32_t QuantizeTrace(float value, float scale) {
+	float scaled = value * scale;
+	scaled = scaled == scaled ? scaled : 0.0f;
+	scaled = std::min(std::max(scaled, -1.0e9f), 1.0e9f);
+	return (int32_t)std::floor(scaled + 0.5f);
+}
+
+// The payload codec. Every value is coded as its difference to a base value: the same ball in the frame
+// before for delta frames, the ball before it in the same channel for keyframes. Differences are zigzag
+// varints with the lowest bit clear; a run of zero differences, which is what every sleeping ball gives,
+// is a single varint with the lowest bit set.
+inline void WriteTraceVarint(std::vector<unsigned char>& out, uint64_t value) {
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+inline bool ReadTraceVarint(const unsigned char*& data, const unsigned char* end, uint64_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 64 && data < end; shift += 7) {
+		unsigned char byte = *data++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// base == nullptr codes each value against the one before it.
+inline void EncodeTraceChannel(const int32_t* values, const int32_t* base, uint32_t count, std::vector<unsigned char>& out) {
+	uint64_t zero_run = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		int64_t reference = base != nullptr ? base[i] : (i == 0 ? 0 : values[i - 1]);
+		int64_t delta = (int64_t)values[i] - reference;
+		if (delta == 0) {
+			zero_run++;
+			continue;
+		}
+		if (zero_run != 0) {
+			WriteTraceVarint(out, ((zero_run - 1) << 1) | 1);
+			zero_run = 0;
+		}
+		uint64_t zigzag = delta < 0 ? ((uint64_t)(-delta) << 1) - 1 : (uint64_t)delta << 1;
+		WriteTraceVarint(out, zigzag << 1);
+	}
+	if (zero_run != 0) {
+		WriteTraceVarint(out, ((zero_run - 1) << 1) | 1);
+	}
+}
+
+// values holds the base for delta frames and is decoded in place.
+inline bool DecodeTraceChannel(const unsigned char*& data, const unsigned char* end, int32_t* values, uint32_t count, bool keyframe) {
+	uint32_t i = 0;
+	while (i < count) {
+		uint64_t token;
+		if (!ReadTraceVarint(data, end, token)) {
+			return false;
+		}
+		if (token & 1) {
+			uint64_t run = (token >> 1) + 1;
+			if (run > count - i) {
+				return false;
+			}
+			for (uint64_t r = 0; r < run; r++, i++) {
+				values[i] = keyframe ? (i == 0 ? 0 : values[i - 1]) : values[i];
+			}
+			continue;
+		}
+		uint64_t zigzag = token >> 1;
+		int64_t delta = (zigzag & 1) ? -(int64_t)((zigzag + 1) >> 1) : (int64_t)(zigzag >> 1);
+		int64_t reference = keyframe ? (i == 0 ? 0 : values[i - 1]) : values[i];
+		values[i] = (int32_t)(reference + delta);
+		i++;
+	}
+	return true;
+}
+
+// Reads a finished (or cut off) trace: the frames are indexed once on Open, and Seek decodes from the
+// closest keyframe, or just the next frame when scrubbing forward one step at a time.
+class TraceReader {
+public:
+	struct FrameInfo {
+		uint64_t Offset;
+		uint64_t Step;
+		uint32_t BallCount;
+		uint32_t PayloadSize;
+		bool Keyframe;
+		// Index of the keyframe this frame is decoded from.
+		uint32_t KeyframeIndex;
+	};
+
+	bool Open(const std::string& path) {
+		this->Frames.clear();
+		this->Current = -1;
+		if (!this->File.Open(path) || this->File.GetSize() < sizeof(TraceFileHeader)) {
+			return false;
+		}
+		std::memcpy(&this->Header, this->File.GetData(), sizeof(TraceFileHeader));
+		if (this->Header.Magic != TRACE_FILE_MAGIC || this->Header.Version != TRACE_VERSION) {
+			this->File.Close();
+			return false;
+		}
+		const unsigned char* data = this->File.GetData();
+		uint64_t size = this->File.GetSize();
+		uint64_t offset = sizeof(TraceFileHeader);
+		uint32_t keyframe = 0;
+		while (size - offset >= sizeof(TraceFrameHeader)) {
+			TraceFrameHeader frame;
+			std::memcpy(&frame, data + offset, sizeof(TraceFrameHeader));
+			uint64_t payload = offset + sizeof(TraceFrameHeader);
+			if (frame.Magic != TRACE_FRAME_MAGIC || frame.PayloadSize > size - payload || GetTraceChecksum(data + payload, frame.PayloadSize) != frame.Checksum) {
+				break;
+			}
+			bool is_keyframe = (frame.Flags & TRACE_FRAME_KEYFRAME) != 0;
+			if (is_keyframe) {
+				keyframe = (uint32_t)this->Frames.size();
+			} else if (this->Frames.empty() || this->Frames.back().BallCount != frame.BallCount) {
+				break;
+			}
+			this->Frames.push_back({ offset, frame.Step, frame.BallCount, frame.PayloadSize, is_keyframe, keyframe });
+			offset = payload + frame.PayloadSize;
+		}
+		this->ValidSize = offset;
+		return true;
+	}
+
+	// Decodes frame into the current state.
+	bool Seek(uint32_t frame) {
+		if (frame >= this->Frames.size()) {
+			return false;
+		}
+		if ((int64_t)frame == this->Current) {
+			return true;
+		}
+		uint32_t first = this->Frames[frame].KeyframeIndex;
+		if (this->Current >= (int64_t)first && this->Current < (int64_t)frame) {
+			first = (uint32_t)this->Current + 1;
+		}
+		for (uint32_t f = first; f <= frame; f++) {
+			if (!this->Decode(f)) {
+				this->Current = -1;
+				return false;
+			}
+			this->Current = f;
+		}
+		return true;
+	}
+
+	const TraceFileHeader& GetHeader() const { return this->Header; }
+	uint32_t GetFrameCount() const { return (uint32_t)this->Frames.size(); }
+	const FrameInfo& GetFrame(uint32_t frame) const { return this->Frames[frame]; }
+	// Bytes up to the end of the last complete frame.
+	uint64_t GetValidSize() const { return this->ValidSize; }
+	uint64_t GetFileSize() const { return this->File.GetSize(); }
+
+	uint32_t GetBallCount() const { return this->BallCount; }
+	glm::vec3 GetPosition(uint32_t i) const { return glm::vec3(this->Value(TRACE_POSITION_X, i), this->Value(TRACE_POSITION_Y, i), this->Value(TRACE_POSITION_Z, i)) / this->Header.PositionScale; }
+	glm::vec3 GetVelocity(uint32_t i) const { return glm::vec3(this->Value(TRACE_VELOCITY_X, i), this->Value(TRACE_VELOCITY_Y, i), this->Value(TRACE_VELOCITY_Z, i)) / this->Header.VelocityScale; }
+	float GetRadius(uint32_t i) const { return this->Value(TRACE_RADIUS, i) / this->Header.PositionScale; }
+
+	// Puts the current frame into balls, so it can be drawn like the live simulation.
+	void CopyTo(BallSystem& balls) const {
+		balls.Resize(this->BallCount);
+		for (uint32_t i = 0; i < this->BallCount; i++) {
+			balls.SetPosition(i, this->GetPosition(i));
+			balls.SetVelocity(i, this->GetVelocity(i));
+			balls.Mass[i] = std::max(this->GetRadius(i), 0.001f) / BALL_RADIUS_PER_MASS;
+			balls.Awake[i] = 1;
+		}
+		balls.UpdateDerived();
+	}
+
+private:
+	MappedFile File;
+	TraceFileHeader Header = {};
+	std::vector<FrameInfo> Frames;
+	uint64_t ValidSize = 0;
+	int64_t Current = -1;
+	uint32_t BallCount = 0;
+	std::vector<int32_t> Values;
+
+	float Value(uint32_t channel, uint32_t i) const {
+		return (float)this->Values[(size_t)channel * this->BallCount + i];
+	}
+
+	bool Decode(uint32_t frame) {
+		const FrameInfo& info = this->Frames[frame];
+		if (info.Keyframe) {
+			this->BallCount = info.BallCount;
+			this->Values.assign((size_t)TRACE_CHANNEL_COUNT * info.BallCount, 0);
+		}
+		const unsigned char* data = this->File.GetData() + info.Offset + sizeof(TraceFrameHeader);
+		const unsigned char* end = data + info.PayloadSize;
+		unsigned int channels = info.Keyframe ? TRACE_CHANNEL_COUNT : TRACE_DELTA_CHANNELS;
+		for (unsigned int c = 0; c < channels; c++) {
+			if (!DecodeTraceChannel(data, end, this->Values.data() + (size_t)c * this->BallCount, this->BallCount, info.Keyframe)) {
+				return false;
+			}
+		}
+		return data == end;
+	}
+};
@@ -0,0 +1,195 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+constexpr int MAX_GRID_RESOLUTION = 128;
+
+// Uniform grid broad phase over the room. The grid is rebuilt from scratch every step with a
+// counting sort, so balls are stored cell by cell and each cell is a contiguous range.
+class SpatialGrid {
+public:
+	SpatialGrid(glm::vec3 bounds_min, glm::vec3 bounds_max) {
+		this->BoundsMin = bounds_min;
+		this->BoundsMax = bounds_max;
+	}
+
+	// min_cell_size must be at least the largest distance at which two balls can interact,
+	// then every colliding pair lives in the same cell or in two neighbouring cells.
+	template <typename PositionFn>
+	void Build(unsigned int count, float min_cell_size, PositionFn position) {
+		glm::vec3 extent = this->BoundsMax - this->BoundsMin;
+		float largest_extent = std::max(extent.x, std::max(extent.y, extent.z));
+		// Aim for about one ball per cell: smaller cells only add empty cells to walk.
+		float cell_size_per_ball = std::cbrt(extent.x * extent.y * extent.z / std::max(count, 1u));
+		this->CellSize = std::max(std::max(min_cell_size, cell_size_per_ball), largest_extent / MAX_GRID_RESOLUTION);
+		this->ResolutionX = std::max(1, (int)std::ceil(extent.x / this->CellSize));
+		this->ResolutionY = std::max(1, (int)std::ceil(extent.y / this->CellSize));
+		this->ResolutionZ = std::max(1, (int)std::ceil(extent.z / this->CellSize));
+
+		unsigned int cell_amount = this->GetCellAmount();
+		this->CellStart.assign(cell_amount + 1, 0);
+		this->BallCells.resize(count);
+		this->SortedBalls.resize(count);
+
+		// Count the balls of each cell, then turn the counts into start offsets.
+		for (unsigned int i = 0; i < count; i++) {
+			this->BallCells[i] = this->CellIndex(position(i));
+			this->CellStart[this->BallCells[i] + 1]++;
+		}
+		for (unsigned int c = 0; c < cell_amount; c++) {
+			this->CellStart[c + 1] += this->CellStart[c];
+		}
+
+		// Scatter, keeping the ball order inside each cell stable.
+		this->CellCursor.assign(this->CellStart.begin(), this->CellStart.end() - 1);
+		for (unsigned int i = 0; i < count; i++) {
+			this->SortedBalls[this->CellCursor[this->BallCells[i]]++] = i;
+		}
+	}
+
+	// Calls callback(i, j) with i < j once for every pair of balls sharing or neighbouring a cell.
+	template <typename Callback>
+	void ForEachCandidatePair(Callback callback) {
+		this->CandidatePairCount = this->ForEachCandidatePairInCells(0, this->GetCellAmount(), callback);
+	}
+
+	// Same as ForEachCandidatePair but only for pairs whose first ball lives in cells [cell_begin, cell_end).
+	// Each cell only looks at itself and its 13 "forward" neighbours, so no pair is visited twice, and
+	// disjoint cell ranges can be walked in parallel. Returns how many candidate pairs were visited.
+	template <typename Callback>
+	unsigned int ForEachCandidatePairInCells(unsigned int cell_begin, unsigned int cell_end, Callback callback) const {
+		unsigned int candidate_pairs = 0;
+
+		for (unsigned int cell = cell_begin; cell < cell_end; cell++) {
+			unsigned int begin = this->CellStart[cell];
+			unsigned int end = this->CellStart[cell + 1];
+			if (begin == end) {
+				continue;
+			}
+			int x = cell % this->ResolutionX;
+			int y = (cell / this->ResolutionX) % this->ResolutionY;
+			int z = cell / (this->ResolutionX * this->ResolutionY);
+
+			// Pairs inside the same cell.
+			for (unsigned int a = begin; a < end; a++) {
+				for (unsigned int b = a + 1; b < end; b++) {
+					EmitPair(this->SortedBalls[a], this->SortedBalls[b], callback);
+				}
+			}
+			candidate_pairs += (end - begin) * (end - begin - 1) / 2;
+
+			// Pairs with the forward neighbours.
+			for (const glm::ivec3& offset : NEIGHBOUR_OFFSETS) {
+				int nx = x + offset.x, ny = y + offset.y, nz = z + offset.z;
+				if (nx < 0 || ny < 0 || nz < 0 || nx >= this->ResolutionX || ny >= this->ResolutionY || nz >= this->ResolutionZ) {
+					continue;
+				}
+				unsigned int neighbour = this->LinearIndex(nx, ny, nz);
+				unsigned int neighbour_begin = this->CellStart[neighbour];
+				unsigned int neighbour_end = this->CellStart[neighbour + 1];
+				for (unsigned int a = begin; a < end; a++) {
+					for (unsigned int b = neighbour_begin; b < neighbour_end; b++) {
+						EmitPair(this->SortedBalls[a], this->SortedBalls[b], callback);
+					}
+				}
+				candidate_pairs += (end - begin) * (neighbour_end - neighbour_begin);
+			}
+		}
+
+		return candidate_pairs;
+	}
+
+	// Calls callback(i) for every ball in the cell of position and the 26 cells around it, i.e. every ball
+	// that can touch a ball at position when the grid was built with a large enough min_cell_size.
+	template <typename Callback>
+	void ForEachNear(const glm::vec3& position, Callback callback) const {
+		glm::ivec3 center = this->CellCoordinates(position);
+		for (int z = std::max(center.z - 1, 0); z <= std::min(center.z + 1, this->ResolutionZ - 1); z++) {
+			for (int y = std::max(center.y - 1, 0); y <= std::min(center.y + 1, this->ResolutionY - 1); y++) {
+				for (int x = std::max(center.x - 1, 0); x <= std::min(center.x + 1, this->ResolutionX - 1); x++) {
+					unsigned int cell = this->LinearIndex(x, y, z);
+					for (unsigned int k = this->CellStart[cell]; k < this->CellStart[cell + 1]; k++) {
+						callback(this->SortedBalls[k]);
+					}
+				}
+			}
+		}
+	}
+
+	// Calls callback(i) for every ball in the cells overlapping [box_min, box_max].
+	template <typename Callback>
+	void ForEachInBox(const glm::vec3& box_min, const glm::vec3& box_max, Callback callback) const {
+		glm::ivec3 first = this->CellCoordinates(box_min);
+		glm::ivec3 last = this->CellCoordinates(box_max);
+		for (int z = first.z; z <= last.z; z++) {
+			for (int y = first.y; y <= last.y; y++) {
+				for (int x = first.x; x <= last.x; x++) {
+					unsigned int cell = this->LinearIndex(x, y, z);
+					for (unsigned int k = this->CellStart[cell]; k < this->CellStart[cell + 1]; k++) {
+						callback(this->SortedBalls[k]);
+					}
+				}
+			}
+		}
+	}
+
+	unsigned int GetCandidatePairCount() const { return this->CandidatePairCount; }
+	unsigned int GetCellAmount() const { return this->ResolutionX * this->ResolutionY * this->ResolutionZ; }
+	float GetCellSize() const { return this->CellSize; }
+	glm::ivec3 GetResolution() const { return glm::ivec3(this->ResolutionX, this->ResolutionY, this->ResolutionZ); }
+
+private:
+	static constexpr int NEIGHBOUR_AMOUNT = 13;
+	static inline const glm::ivec3 NEIGHBOUR_OFFSETS[NEIGHBOUR_AMOUNT] = {
+		glm::ivec3( 1,  0, 0),
+		glm::ivec3(-1,  1, 0), glm::ivec3( 0,  1, 0), glm::ivec3( 1,  1, 0),
+		glm::ivec3(-1, -1, 1), glm::ivec3( 0, -1, 1), glm::ivec3( 1, -1, 1),
+		glm::ivec3(-1,  0, 1), glm::ivec3( 0,  0, 1), glm::ivec3( 1,  0, 1),
+		glm::ivec3(-1,  1, 1), glm::ivec3( 0,  1, 1), glm::ivec3( 1,  1, 1),
+	};
+
+	glm::vec3 BoundsMin;
+	glm::vec3 BoundsMax;
+	float CellSize = 1.0f;
+	int ResolutionX = 1;
+	int ResolutionY = 1;
+	int ResolutionZ = 1;
+
+	std::vector<unsigned int> CellStart;
+	std::vector<unsigned int> CellCursor;
+	std::vector<unsigned int> BallCells;
+	std::vector<unsigned int> SortedBalls;
+	unsigned int CandidatePairCount = 0;
+
+	template <typename Callback>
+	static void EmitPair(unsigned int a, unsigned int b, Callback& callback) {
+		if (a < b) {
+			callback(a, b);
+		} else {
+			callback(b, a);
+		}
+	}
+
+	unsigned int LinearIndex(int x, int y, int z) const {
+		return (z * this->ResolutionY + y) * this->ResolutionX + x;
+	}
+
+	glm::ivec3 CellCoordinates(const glm::vec3& position) const {
+		// Balls that have left the room are clamped into the border cells.
+		glm::vec3 local = (position - this->BoundsMin) / this->CellSize;
+		return glm::ivec3(ClampCell(local.x, this->ResolutionX), ClampCell(local.y, this->ResolutionY), ClampCell(local.z, this->ResolutionZ));
+	}
+
+	// Clamped as a float so that NaN and huge coordinates never reach the int conversion; std::max
+	// with 0 first turns NaN into 0.
+	static int ClampCell(float coordinate, int resolution) {
+		return (int)std::min(std::max(0.0f, std::floor(coordinate)), (float)(resolution - 1));
+	}
+
+	unsigned int CellIndex(const glm::vec3& position) const {
+		glm::ivec3 cell = this->CellCoordinates(position);
+		return this->LinearIndex(cell.x, cell.y, cell.z);
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include "Shader.h"
+#include "RenderStateCache.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+// Matches the vertex attributes of lighting.vert (locations 0 to 2).
+struct StaticVertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+};
+
+// Geometry that never moves, transformed once at load time and merged into a single vertex and index
+// buffer. Each group is a contiguous index range, so everything that shares a material is one draw and
+// the whole batch needs only one vertex array. The vertices are already in world space: draw them with
+// identity model and normal matrices. Shapes added with an identity matrix make a batch of unit meshes
+// instead, for things that move: draw a group with the object's own model matrix.
+class StaticBatch {
+public:
+	StaticBatch() = default;
+
+	~StaticBatch() {
+		this->Release();
+	}
+
+	StaticBatch(const StaticBatch&) = delete;
+	StaticBatch& operator=(const StaticBatch&) = delete;
+
+	// Returns the group to add the shapes of one material to.
+	uint32_t AddGroup() {
+		this->Groups.emplace_back();
+		return (uint32_t)this->Groups.size() - 1;
+	}
+
+	// A width x height rectangle in the XZ plane facing +Y, like Nexus::Rectangle with POS_Y; the texture
+	// repeats texture_repeat times across it.
+	void AddRectangle(uint32_t group, const glm::mat4& model, float width, float height, float texture_repeat) {
+		this->AddQuad(group, model, glm::vec3(0.0f), glm::vec3(width * 0.5f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, height * 0.5f), glm::vec3(0.0f, 1.0f, 0.0f), texture_repeat);
+		this->ShapeCount++;
+	}
+
+	// A unit cube around the origin, like Nexus::Cube.
+	void AddCube(uint32_t group, const glm::mat4& model) {
+		const glm::vec3 axes[3] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+		for (unsigned int a = 0; a < 3; a++) {
+			glm::vec3 u = axes[(a + 1) % 3] * 0.5f;
+			glm::vec3 v = axes[(a + 2) % 3] * 0.5f;
+			this->AddQuad(group, model, axes[a] * 0.5f, u, v, axes[a], 1.0f);
+			this->AddQuad(group, model, axes[a] * -0.5f, u, v, -axes[a], 1.0f);
+		}
+		this->ShapeCount++;
+	}
+
+	// A unit sphere around the origin, like Nexus::Sphere, with the same tessellation as BallRenderer.
+	void AddSphere(uint32_t group, const glm::mat4& model, unsigned int sectors = 36, unsigned int stacks = 18) {
+		const float pi = 3.14159265358979f;
+		Group& target = this->Groups[group];
+		glm::mat3 linear(model);
+		glm::mat3 normal_model = glm::transpose(glm::inverse(linear));
+		uint32_t base = (uint32_t)target.Vertices.size();
+		for (unsigned int i = 0; i <= stacks; i++) {
+			float phi = pi / 2.0f - i * pi / stacks;
+			for (unsigned int j = 0; j <= sectors; j++) {
+				float theta = j * 2.0f * pi / sectors;
+				glm::vec3 p = glm::vec3(std::cos(phi) * std::cos(theta), std::sin(phi), std::cos(phi) * std::sin(theta));
+				target.Vertices.push_back({ glm::vec3(model * glm::vec4(p, 1.0f)), glm::normalize(normal_model * p), glm::vec2((float)j / sectors, (float)i / stacks) });
+			}
+		}
+		// Clockwise seen from outside; a mirroring model matrix flips that, so the triangles flip with it.
+		bool mirrored = glm::determinant(linear) < 0.0f;
+		for (unsigned int i = 0; i < stacks; i++) {
+			for (unsigned int j = 0; j < sectors; j++) {
+				uint32_t k1 = base + i * (sectors + 1) + j;
+				uint32_t k2 = k1 + sectors + 1;
+				if (i != 0) {
+					target.Indices.insert(target.Indices.end(), { k1, mirrored ? k1 + 1 : k2, mirrored ? k2 : k1 + 1 });
+				}
+				if (i != stacks - 1) {
+					target.Indices.insert(target.Indices.end(), { k1 + 1, mirrored ? k2 + 1 : k2, mirrored ? k2 : k2 + 1 });
+				}
+			}
+		}
+		this->ShapeCount++;
+	}
+
+	// Call once, after every shape is added: uploads the groups and frees their CPU copies.
+	void Build() {
+		std::vector<StaticVertex> vertices;
+		std::vector<uint32_t> indices;
+		for (Group& group : this->Groups) {
+			uint32_t base = (uint32_t)vertices.size();
+			group.FirstIndex = (uint32_t)indices.size();
+			group.IndexCount = (uint32_t)group.Indices.size();
+			vertices.insert(vertices.end(), group.Vertices.begin(), group.Vertices.end());
+			for (uint32_t index : group.Indices) {
+				indices.push_back(base + index);
+			}
+			group.Vertices = std::vector<StaticVertex>();
+			group.Indices = std::vector<uint32_t>();
+		}
+		this->Release();
+		this->VertexCount = (uint32_t)vertices.size();
+		this->IndexCount = (uint32_t)indices.size();
+
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glGenBuffers(1, &this->EBO);
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(StaticVertex), vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, Position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, TexCoords));
+		glBindVertexArray(0);
+	}
+
+	// One draw call for the whole group.
+	void Draw(RenderStateCache& state, uint32_t group) {
+		const Group& range = this->Groups[group];
+		if (this->VAO == 0 || range.IndexCount == 0) {
+			return;
+		}
+		state.BindVertexArray(this->VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)range.IndexCount, GL_UNSIGNED_INT, (void*)((size_t)range.FirstIndex * sizeof(uint32_t)));
+	}
+
+	uint32_t GetGroupCount() const { return (uint32_t)this->Groups.size(); }
+	uint32_t GetVertexCount() const { return this->VertexCount; }
+	uint32_t GetIndexCount() const { return this->IndexCount; }
+	// Shapes merged so far, i.e. the draws the batch saves.
+	uint32_t GetShapeCount() const { return this->ShapeCount; }
+
+private:
+	struct Group {
+		std::vector<StaticVertex> Vertices;
+		std::vector<uint32_t> Indices;
+		uint32_t FirstIndex = 0;
+		uint32_t IndexCount = 0;
+	};
+
+	std::vector<Group> Groups;
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+	uint32_t VertexCount = 0;
+	uint32_t IndexCount = 0;
+	uint32_t ShapeCount = 0;
+
+	// A quad around center spanning +-u and +-v, with clockwise front faces seen from normal like the
+	// rest of the scene (glFrontFace(GL_CW)). The winding is picked after the transform, so a mirroring
+	// model matrix does not turn the quad inside out.
+	void AddQuad(uint32_t group, const glm::mat4& model, const glm::vec3& center, const glm::vec3& u, const glm::vec3& v, const glm::vec3& normal, float texture_repeat) {
+		Group& target = this->Groups[group];
+		glm::mat3 linear(model);
+		glm::mat3 normal_model = glm::transpose(glm::inverse(linear));
+		glm::vec3 world_normal = glm::normalize(normal_model * normal);
+		const glm::vec2 corners[4] = { glm::vec2(-1.0f, -1.0f), glm::vec2(1.0f, -1.0f), glm::vec2(1.0f, 1.0f), glm::vec2(-1.0f, 1.0f) };
+		uint32_t base = (uint32_t)target.Vertices.size();
+		for (const glm::vec2& corner : corners) {
+			glm::vec3 position = center + u * corner.x + v * corner.y;
+			glm::vec2 tex_coords = (corner * 0.5f + 0.5f) * texture_repeat;
+			target.Vertices.push_back({ glm::vec3(model * glm::vec4(position, 1.0f)), world_normal, tex_coords });
+		}
+		bool clockwise = glm::dot(glm::cross(linear * u, linear * v), world_normal) < 0.0f;
+		if (clockwise) {
+			target.Indices.insert(target.Indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+		} else {
+			target.Indices.insert(target.Indices.end(), { base, base + 2, base + 1, base, base + 3, base + 2 });
+		}
+	}
+
+	void Release() {
+		if (this->VAO != 0) {
+			glDeleteBuffers(1, &this->VBO);
+			glDeleteBuffers(1, &this->EBO);
+			glDeleteVertexArrays(1, &this->VAO);
+			this->VAO = this->VBO = this->EBO = 0;
+		}
+	}
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <chrono>
+
+class Stopwatch {
+public:
+	Stopwatch() {
+		this->Reset();
+	}
+
+	void Reset() {
+		this->Start = std::chrono::steady_clock::now();
+	}
+
+	float GetElapsedMilliseconds() const {
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->Start).count();
+	}
+
+	// Returns the time since the last lap (or construction) and starts a new one.
+	float Lap() {
+		float elapsed = this->GetElapsedMilliseconds();
+		this->Reset();
+		return elapsed;
+	}
+
+private:
+	std::chrono::steady_clock::time_point Start;
+};
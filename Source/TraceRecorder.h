@@ -0,0 +1,198 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include "BallSystem.h"
+#include "SimulationTrace.h"
+
+constexpr unsigned int TRACE_RING_CAPACITY = 4;
+constexpr unsigned int TRACE_KEYFRAME_INTERVAL = 120;
+
+// Records every physics step into a .ntrace file (see SimulationTrace.h). Record only copies the ball
+// arrays into a free slot of a fixed ring and returns; a writer thread quantizes and codes the frames and
+// appends them to the file. When the writer falls behind, the step is dropped (and counted) instead of making the physics wait,
+// so memory stays at TRACE_RING_CAPACITY slots however long the recording runs. A dropped step leaves a gap
+// in the step numbers; the next frame is still coded against the last written one.
+class TraceRecorder {
+public:
+	TraceRecorder() = default;
+
+	~TraceRecorder() {
+		this->Stop();
+	}
+
+	TraceRecorder(const TraceRecorder&) = delete;
+	TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+	bool Start(const std::string& path, float step_time, unsigned int keyframe_interval = TRACE_KEYFRAME_INTERVAL) {
+		this->Stop();
+		this->File.open(path, std::ios::binary | std::ios::trunc);
+		if (!this->File) {
+			return false;
+		}
+		TraceFileHeader header = {};
+		header.Magic = TRACE_FILE_MAGIC;
+		header.Version = TRACE_VERSION;
+		header.StepTime = step_time;
+		header.PositionScale = TRACE_POSITION_SCALE;
+		header.VelocityScale = TRACE_VELOCITY_SCALE;
+		header.KeyframeInterval = std::max(keyframe_interval, 1u);
+		this->File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		this->KeyframeInterval = header.KeyframeInterval;
+		this->Head.store(0, std::memory_order_relaxed);
+		this->Tail.store(0, std::memory_order_relaxed);
+		this->RecordedFrames = 0;
+		this->DroppedFrames = 0;
+		this->WrittenFrames.store(0, std::memory_order_relaxed);
+		this->BytesWritten.store(sizeof(header), std::memory_order_relaxed);
+		this->LastRevision = ~0u;
+		this->Running.store(true, std::memory_order_release);
+		this->Writer = std::thread([this]() { this->WriterLoop(); });
+		return true;
+	}
+
+	// Writes out every frame still in the ring and closes the file.
+	void Stop() {
+		if (!this->Writer.joinable()) {
+			return;
+		}
+		this->Running.store(false, std::memory_order_release);
+		this->WriterWake.notify_one();
+		this->Writer.join();
+		this->File.close();
+	}
+
+	bool IsRecording() const { return this->Writer.joinable(); }
+
+	// Called by the physics thread after a step; never waits for the writer.
+	void Record(uint64_t step, const BallSystem& balls) {
+		uint32_t head = this->Head.load(std::memory_order_relaxed);
+		if (head - this->Tail.load(std::memory_order_acquire) == TRACE_RING_CAPACITY) {
+			this->DroppedFrames++;
+			return;
+		}
+		TraceSlot& slot = this->Ring[head % TRACE_RING_CAPACITY];
+		uint32_t count = balls.Size();
+		slot.Step = step;
+		slot.BallCount = count;
+		// Balls added or removed: the delta against the last frame would pair up the wrong balls.
+		slot.Keyframe = balls.GetRevision() != this->LastRevision;
+		this->LastRevision = balls.GetRevision();
+		slot.Values.resize((size_t)TRACE_CHANNEL_COUNT * count);
+		const std::vector<float>* sources[TRACE_CHANNEL_COUNT] = {
+			&balls.PositionX, &balls.PositionY, &balls.PositionZ,
+			&balls.VelocityX, &balls.VelocityY, &balls.VelocityZ,
+			&balls.Radius
+		};
+		for (unsigned int c = 0; c < TRACE_CHANNEL_COUNT; c++) {
+			std::copy(sources[c]->begin(), sources[c]->end(), slot.Values.begin() + (size_t)c * count);
+		}
+		this->Head.store(head + 1, std::memory_order_release);
+		this->RecordedFrames++;
+		// Without the lock a wake-up can be missed; the writer then finds the frame on its next timeout.
+		this->WriterWake.notify_one();
+	}
+
+	uint64_t GetRecordedFrames() const { return this->RecordedFrames; }
+	uint64_t GetDroppedFrames() const { return this->DroppedFrames; }
+	uint64_t GetWrittenFrames() const { return this->WrittenFrames.load(std::memory_order_relaxed); }
+	uint64_t GetBytesWritten() const { return this->BytesWritten.load(std::memory_order_relaxed); }
+
+private:
+	struct TraceSlot {
+		uint64_t Step = 0;
+		uint32_t BallCount = 0;
+		bool Keyframe = false;
+		// The ball arrays in TraceChannel order.
+		std::vector<float> Values;
+	};
+
+	// Single producer (Record) and single consumer (the writer): Head is only written by the producer,
+	// Tail only by the consumer, and a slot belongs to whichever side the two counters give it to.
+	TraceSlot Ring[TRACE_RING_CAPACITY];
+	std::atomic<uint32_t> Head{ 0 };
+	std::atomic<uint32_t> Tail{ 0 };
+	std::atomic<bool> Running{ false };
+	std::thread Writer;
+	std::mutex WriterMutex;
+	std::condition_variable WriterWake;
+	unsigned int LastRevision = ~0u;
+	uint64_t RecordedFrames = 0;
+	uint64_t DroppedFrames = 0;
+	std::atomic<uint64_t> WrittenFrames{ 0 };
+	std::atomic<uint64_t> BytesWritten{ 0 };
+
+	// Writer thread only.
+	std::ofstream File;
+	unsigned int KeyframeInterval = TRACE_KEYFRAME_INTERVAL;
+	std::vector<int32_t> Current;
+	std::vector<int32_t> Previous;
+	uint32_t PreviousCount = 0;
+	unsigned int SinceKeyframe = 0;
+	std::vector<unsigned char> Payload;
+
+	void WriterLoop() {
+		this->Previous.clear();
+		this->PreviousCount = 0;
+		this->SinceKeyframe = 0;
+		while (true) {
+			uint32_t tail = this->Tail.load(std::memory_order_relaxed);
+			if (tail == this->Head.load(std::memory_order_acquire)) {
+				if (!this->Running.load(std::memory_order_acquire)) {
+					// Record is not called any more once Stop has begun, so the ring is really empty.
+					if (tail == this->Head.load(std::memory_order_acquire)) {
+						break;
+					}
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(this->WriterMutex);
+				this->WriterWake.wait_for(lock, std::chrono::milliseconds(1));
+				continue;
+			}
+			this->WriteFrame(this->Ring[tail % TRACE_RING_CAPACITY]);
+			this->Tail.store(tail + 1, std::memory_order_release);
+		}
+		this->File.flush();
+	}
+
+	void WriteFrame(TraceSlot& slot) {
+		bool keyframe = slot.Keyframe || this->Previous.empty() || slot.BallCount != this->PreviousCount || this->SinceKeyframe >= this->KeyframeInterval;
+		uint32_t count = slot.BallCount;
+		this->Current.resize(slot.Values.size());
+		for (size_t v = 0; v < slot.Values.size(); v++) {
+			bool velocity = v >= (size_t)TRACE_VELOCITY_X * count && v < (size_t)TRACE_RADIUS * count;
+			this->Current[v] = QuantizeTrace(slot.Values[v], velocity ? TRACE_VELOCITY_SCALE : TRACE_POSITION_SCALE);
+		}
+		this->Payload.clear();
+		unsigned int channels = keyframe ? TRACE_CHANNEL_COUNT : TRACE_DELTA_CHANNELS;
+		for (unsigned int c = 0; c < channels; c++) {
+			const int32_t* values = this->Current.data() + (size_t)c * count;
+			EncodeTraceChannel(values, keyframe ? nullptr : this->Previous.data() + (size_t)c * count, count, this->Payload);
+		}
+		TraceFrameHeader header = {};
+		header.Magic = TRACE_FRAME_MAGIC;
+		header.Flags = keyframe ? (uint32_t)TRACE_FRAME_KEYFRAME : 0u;
+		header.Step = slot.Step;
+		header.BallCount = count;
+		header.PayloadSize = (uint32_t)this->Payload.size();
+		header.Checksum = GetTraceChecksum(this->Payload.data(), this->Payload.size());
+		this->File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		this->File.write(reinterpret_cast<const char*>(this->Payload.data()), (std::streamsize)this->Payload.size());
+		// Keyframes are where a reader can start, so make sure they reach the disk.
+		if (keyframe) {
+			this->File.flush();
+		}
+		this->SinceKeyframe = keyframe ? 1 : this->SinceKeyframe + 1;
+		this->Previous.swap(this->Current);
+		this->PreviousCount = count;
+		this->WrittenFrames.fetch_add(1, std::memory_order_relaxed);
+		this->BytesWritten.fetch_add(sizeof(header) + this->Payload.size(), std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_SYSTEM_SSE2
+#endif
+
+typedef uint32_t TransformHandle;
+constexpr TransformHandle TRANSFORM_NONE = ~0u;
+
+// Position, rotation and scale of scene objects in a parent/child hierarchy. Setting a local value only
+// marks the node; Update() then works out the world matrices of the marked nodes and everything below
+// them in one pass, so a frame where nothing moved costs nothing and one where a few objects moved costs
+// a few matrix products, however large the scene is. Parents are created before their children, which
+// makes handle order a valid update order.
+class TransformSystem {
+public:
+	// The parent must already exist; it cannot be changed later.
+	TransformHandle Create(TransformHandle parent = TRANSFORM_NONE) {
+		TransformHandle node = (TransformHandle)this->Parent.size();
+		this->Parent.push_back(parent);
+		this->FirstChild.push_back(TRANSFORM_NONE);
+		this->NextSibling.push_back(TRANSFORM_NONE);
+		if (parent != TRANSFORM_NONE) {
+			this->NextSibling[node] = this->FirstChild[parent];
+			this->FirstChild[parent] = node;
+		}
+		this->Position.push_back(glm::vec3(0.0f));
+		this->Rotation.push_back(glm::mat3(1.0f));
+		this->Scale.push_back(glm::vec3(1.0f));
+		this->Local.push_back(glm::mat4(1.0f));
+		this->World.push_back(glm::mat4(1.0f));
+		this->Flags.push_back(0);
+		this->MarkDirty(node);
+		return node;
+	}
+
+	// Removes every node; handles handed out before are invalid afterwards.
+	void Clear() {
+		this->Parent.clear();
+		this->FirstChild.clear();
+		this->NextSibling.clear();
+		this->Position.clear();
+		this->Rotation.clear();
+		this->Scale.clear();
+		this->Local.clear();
+		this->World.clear();
+		this->Flags.clear();
+		this->Dirty.clear();
+	}
+
+	// Setting the value a node already has does not mark it.
+	void SetPosition(TransformHandle node, const glm::vec3& position) {
+		if (this->Position[node] != position) {
+			this->Position[node] = position;
+			this->MarkDirty(node);
+		}
+	}
+
+	void SetScale(TransformHandle node, const glm::vec3& scale) {
+		if (this->Scale[node] != scale) {
+			this->Scale[node] = scale;
+			this->MarkDirty(node);
+		}
+	}
+
+	void SetRotation(TransformHandle node, float radians, const glm::vec3& axis) {
+		this->SetRotation(node, glm::mat3(glm::rotate(glm::mat4(1.0f), radians, axis)));
+	}
+
+	void SetRotation(TransformHandle node, const glm::mat3& rotation) {
+		const glm::mat3& current = this->Rotation[node];
+		if (current[0] != rotation[0] || current[1] != rotation[1] || current[2] != rotation[2]) {
+			this->Rotation[node] = rotation;
+			this->MarkDirty(node);
+		}
+	}
+
+	const glm::vec3& GetPosition(TransformHandle node) const { return this->Position[node]; }
+	const glm::vec3& GetScale(TransformHandle node) const { return this->Scale[node]; }
+	TransformHandle GetParent(TransformHandle node) const { return this->Parent[node]; }
+
+	// Valid after the Update() that followed the last change.
+	const glm::mat4& GetLocal(TransformHandle node) const { return this->Local[node]; }
+	const glm::mat4& GetWorld(TransformHandle node) const { return this->World[node]; }
+
+	// Brings the world matrices of the marked nodes and their descendants up to date.
+	void Update() {
+		this->UpdatedCount = 0;
+		if (this->Dirty.empty()) {
+			return;
+		}
+		// The descendants of a moved node move with it.
+		for (size_t d = 0; d < this->Dirty.size(); d++) {
+			for (TransformHandle child = this->FirstChild[this->Dirty[d]]; child != TRANSFORM_NONE; child = this->NextSibling[child]) {
+				if ((this->Flags[child] & TRANSFORM_WORLD_DIRTY) == 0) {
+					this->Flags[child] |= TRANSFORM_WORLD_DIRTY;
+					this->Dirty.push_back(child);
+				}
+			}
+		}
+		// Parents first. The list is a handful of nodes on most frames, so sorting it is cheap.
+		std::sort(this->Dirty.begin(), this->Dirty.end());
+		for (TransformHandle node : this->Dirty) {
+			if (this->Flags[node] & TRANSFORM_LOCAL_DIRTY) {
+				this->Local[node] = this->ComposeLocal(node);
+			}
+			TransformHandle parent = this->Parent[node];
+			if (parent == TRANSFORM_NONE) {
+				this->World[node] = this->Local[node];
+			} else {
+				Multiply(this->World[parent], this->Local[node], this->World[node]);
+			}
+			this->Flags[node] = 0;
+		}
+		this->UpdatedCount = (unsigned int)this->Dirty.size();
+		this->Dirty.clear();
+	}
+
+	unsigned int GetCount() const { return (unsigned int)this->Parent.size(); }
+	// World matrices worked out by the last Update().
+	unsigned int GetUpdatedCount() const { return this->UpdatedCount; }
+
+private:
+	enum TransformFlag : uint8_t {
+		TRANSFORM_LOCAL_DIRTY = 1u << 0,
+		TRANSFORM_WORLD_DIRTY = 1u << 1
+	};
+
+	std::vector<TransformHandle> Parent;
+	std::vector<TransformHandle> FirstChild;
+	std::vector<TransformHandle> NextSibling;
+	std::vector<glm::vec3> Position;
+	std::vector<glm::mat3> Rotation;
+	std::vector<glm::vec3> Scale;
+	std::vector<glm::mat4> Local;
+	std::vector<glm::mat4> World;
+	std::vector<uint8_t> Flags;
+	// Marked nodes, each at most once.
+	std::vector<TransformHandle> Dirty;
+	unsigned int UpdatedCount = 0;
+
+	void MarkDirty(TransformHandle node) {
+		if ((this->Flags[node] & (TRANSFORM_LOCAL_DIRTY | TRANSFORM_WORLD_DIRTY)) == 0) {
+			this->Dirty.push_back(node);
+		}
+		this->Flags[node] |= TRANSFORM_LOCAL_DIRTY | TRANSFORM_WORLD_DIRTY;
+	}
+
+	// translate * rotate * scale, without going through three 4x4 products.
+	glm::mat4 ComposeLocal(TransformHandle node) const {
+		const glm::mat3& rotation = this->Rotation[node];
+		const glm::vec3& scale = this->Scale[node];
+		return glm::mat4(
+			glm::vec4(rotation[0] * scale.x, 0.0f),
+			glm::vec4(rotation[1] * scale.y, 0.0f),
+			glm::vec4(rotation[2] * scale.z, 0.0f),
+			glm::vec4(this->Position[node], 1.0f)
+		);
+	}
+
+	// result = parent * local; result may not alias parent.
+	static void Multiply(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result) {
+#if defined(TRANSFORM_SYSTEM_SSE2)
+		const float* a = &parent[0][0];
+		const float* b = &local[0][0];
+		float* out = &result[0][0];
+		__m128 a0 = _mm_loadu_ps(a);
+		__m128 a1 = _mm_loadu_ps(a + 4);
+		__m128 a2 = _mm_loadu_ps(a + 8);
+		__m128 a3 = _mm_loadu_ps(a + 12);
+		for (unsigned int column = 0; column < 4; column++) {
+			const float* bc = b + column * 4;
+			__m128 sum = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+			_mm_storeu_ps(out + column * 4, sum);
+		}
+#else
+		result = parent * local;
+#endif
+	}
+};
@@ -0,0 +1,141 @@
+#pragma once
+#include "Shader.h"
+#include "RenderStateCache.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// A uniform name with its FNV-1a hash worked out by the compiler: "material.diffuse"_u.
+struct UniformName {
+	uint64_t Hash;
+	const char* Text;
+};
+
+constexpr uint64_t HashUniformName(const char* text, size_t length) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+constexpr UniformName operator""_u(const char* text, size_t length) {
+	return UniformName{ HashUniformName(text, length), text };
+}
+
+// Uniform locations of every program, looked up only the first time a (program, name) pair is seen.
+// The setters never build a std::string, so once every location has been seen the render path does not
+// touch the heap. Program changes and values go through the state cache, which drops the redundant ones.
+class UniformCache {
+public:
+	explicit UniformCache(RenderStateCache* state) : State(state) {
+		this->Entries.resize(UNIFORM_CACHE_INITIAL_CAPACITY);
+	}
+
+	// Makes the shader current; the setters below write to it until the next Use().
+	void Use(Nexus::Shader* shader) {
+		this->State->UseProgram(this->GetProgram(shader));
+	}
+
+	// Same for a program that is not wrapped in a Nexus::Shader.
+	void Use(GLuint program) {
+		this->State->UseProgram(program);
+	}
+
+	GLuint GetProgram() const { return this->State->GetProgram(); }
+
+	// Nexus::Shader hides its program; it is read back once, the first time the shader is made current.
+	GLuint GetProgram(Nexus::Shader* shader) {
+		for (const auto& known : this->Shaders) {
+			if (known.first == shader) {
+				return known.second;
+			}
+		}
+		shader->Use();
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		this->State->NoteProgram((GLuint)program);
+		this->Shaders.emplace_back(shader, (GLuint)program);
+		return (GLuint)program;
+	}
+
+	GLint GetLocation(UniformName name) {
+		GLuint program = this->GetProgram();
+		size_t mask = this->Entries.size() - 1;
+		for (size_t slot = Slot(name.Hash, program) & mask; ; slot = (slot + 1) & mask) {
+			Entry& entry = this->Entries[slot];
+			if (!entry.Used) {
+				break;
+			}
+			if (entry.Program == program && entry.Hash == name.Hash && SameName(entry.Text, name.Text)) {
+				return entry.Location;
+			}
+		}
+
+		GLint location = this->State->GetBackend()->GetUniformLocation(program, name.Text);
+		this->Insert({ name.Hash, name.Text, program, location, true });
+		return location;
+	}
+
+	void SetBool(UniformName name, bool value) { this->State->Uniform1i(this->GetLocation(name), (int)value); }
+	void SetInt(UniformName name, int value) { this->State->Uniform1i(this->GetLocation(name), value); }
+	void SetFloat(UniformName name, float value) { this->State->Uniform1f(this->GetLocation(name), value); }
+	void SetVec3(UniformName name, const glm::vec3& value) { this->State->Uniform3fv(this->GetLocation(name), glm::value_ptr(value)); }
+	void SetVec4(UniformName name, const glm::vec4& value) { this->State->Uniform4fv(this->GetLocation(name), glm::value_ptr(value)); }
+	void SetMat3(UniformName name, const glm::mat3& value) { this->State->UniformMatrix3fv(this->GetLocation(name), glm::value_ptr(value)); }
+	void SetMat4(UniformName name, const glm::mat4& value) { this->State->UniformMatrix4fv(this->GetLocation(name), glm::value_ptr(value)); }
+
+private:
+	static constexpr size_t UNIFORM_CACHE_INITIAL_CAPACITY = 256;
+
+	// The name is kept next to its hash, so two names that happen to share a hash get their own entries
+	// instead of one silently taking the other's location. The literals outlive the cache.
+	struct Entry {
+		uint64_t Hash = 0;
+		const char* Text = nullptr;
+		GLuint Program = 0;
+		GLint Location = -1;
+		bool Used = false;
+	};
+
+	// Open addressing with linear probing, kept at most half full.
+	std::vector<Entry> Entries;
+	size_t EntryCount = 0;
+	RenderStateCache* State;
+	std::vector<std::pair<Nexus::Shader*, GLuint>> Shaders;
+
+	static size_t Slot(uint64_t hash, GLuint program) {
+		return (size_t)(hash ^ ((uint64_t)program * 0x9E3779B97F4A7C15ull));
+	}
+
+	// The same literal is almost always the same pointer, so the string compare seldom runs.
+	static bool SameName(const char* a, const char* b) {
+		return a == b || std::strcmp(a, b) == 0;
+	}
+
+	void Insert(const Entry& inserted) {
+		if ((this->EntryCount + 1) * 2 > this->Entries.size()) {
+			std::vector<Entry> old_entries;
+			old_entries.swap(this->Entries);
+			this->Entries.resize(old_entries.size() * 2);
+			this->EntryCount = 0;
+			for (const Entry& entry : old_entries) {
+				if (entry.Used) {
+					this->Insert(entry);
+				}
+			}
+		}
+		size_t mask = this->Entries.size() - 1;
+		size_t slot = Slot(inserted.Hash, inserted.Program) & mask;
+		while (this->Entries[slot].Used) {
+			slot = (slot + 1) & mask;
+		}
+		this->Entries[slot] = inserted;
+		this->EntryCount++;
+	}
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include "Shader.h"
+#include "ViewVolume.h"
+#include "StaticBatch.h"
+#include "RenderStateCache.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// The view volume of the main camera as a solid, rebuilt every frame from the corners Nexus::ViewVolume
+// works out, so it draws with the lighting programs like the rest of the scene instead of needing a
+// Nexus::Shader. The vertices are in world space.
+class ViewVolumeMesh {
+public:
+	ViewVolumeMesh() {
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(this->Vertices), nullptr, GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, Position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, TexCoords));
+		glBindVertexArray(0);
+	}
+
+	~ViewVolumeMesh() {
+		glDeleteBuffers(1, &this->VBO);
+		glDeleteVertexArrays(1, &this->VAO);
+	}
+
+	ViewVolumeMesh(const ViewVolumeMesh&) = delete;
+	ViewVolumeMesh& operator=(const ViewVolumeMesh&) = delete;
+
+	// Call after ViewVolume::UpdateVertices(). The corners are put in order around the view axis here,
+	// so nothing depends on the order Nexus keeps them in.
+	void Update(const Nexus::ViewVolume& volume) {
+		glm::vec3 near_corners[4], far_corners[4];
+		for (unsigned int i = 0; i < 4; i++) {
+			near_corners[i] = glm::vec3(volume.NearPlaneVertex[i]);
+			far_corners[i] = glm::vec3(volume.FarPlaneVertex[i]);
+		}
+		glm::vec3 near_center = (near_corners[0] + near_corners[1] + near_corners[2] + near_corners[3]) * 0.25f;
+		glm::vec3 far_center = (far_corners[0] + far_corners[1] + far_corners[2] + far_corners[3]) * 0.25f;
+		glm::vec3 axis = far_center - near_center;
+		if (glm::dot(axis, axis) <= 0.0f) {
+			return;
+		}
+		axis = glm::normalize(axis);
+		glm::vec3 side = std::abs(axis.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 u = glm::normalize(glm::cross(axis, side));
+		glm::vec3 v = glm::cross(axis, u);
+		SortAroundAxis(near_corners, near_center, u, v);
+		SortAroundAxis(far_corners, far_center, u, v);
+
+		glm::vec3 center = (near_center + far_center) * 0.5f;
+		StaticVertex* out = this->Vertices;
+		out = WriteFace(out, center, near_corners[0], near_corners[1], near_corners[2], near_corners[3]);
+		out = WriteFace(out, center, far_corners[0], far_corners[1], far_corners[2], far_corners[3]);
+		for (unsigned int i = 0; i < 4; i++) {
+			unsigned int next = (i + 1) % 4;
+			out = WriteFace(out, center, near_corners[i], near_corners[next], far_corners[next], far_corners[i]);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(this->Vertices), this->Vertices);
+	}
+
+	void Draw(RenderStateCache& state) {
+		state.BindVertexArray(this->VAO);
+		glDrawArrays(GL_TRIANGLES, 0, VIEW_VOLUME_VERTEX_COUNT);
+	}
+
+private:
+	static constexpr int VIEW_VOLUME_VERTEX_COUNT = 6 * 6;
+
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	StaticVertex Vertices[VIEW_VOLUME_VERTEX_COUNT] = {};
+
+	static void SortAroundAxis(glm::vec3* corners, const glm::vec3& center, const glm::vec3& u, const glm::vec3& v) {
+		std::sort(corners, corners + 4, [&](const glm::vec3& a, const glm::vec3& b) {
+			return std::atan2(glm::dot(a - center, v), glm::dot(a - center, u)) < std::atan2(glm::dot(b - center, v), glm::dot(b - center, u));
+		});
+	}
+
+	// Two triangles of the quad a b c d, facing away from center and clockwise seen from outside like
+	// the rest of the scene (glFrontFace(GL_CW)).
+	static StaticVertex* WriteFace(StaticVertex* out, const glm::vec3& center, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		if (glm::dot(normal, normal) <= 0.0f) {
+			normal = glm::cross(c - a, d - a);
+		}
+		bool outward = glm::dot(normal, (a + b + c + d) * 0.25f - center) > 0.0f;
+		normal = glm::dot(normal, normal) > 0.0f ? glm::normalize(outward ? normal : -normal) : glm::vec3(0.0f);
+		// a b c is counter-clockwise around the outward normal when outward, so it is emitted reversed.
+		const glm::vec3* corners[6] = { &a, &c, &b, &a, &d, &c };
+		if (!outward) {
+			std::swap(corners[1], corners[2]);
+			std::swap(corners[4], corners[5]);
+		}
+		for (const glm::vec3* corner : corners) {
+			*out++ = { *corner, normal, glm::vec2(0.0f) };
+		}
+		return out;
+	}
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Layout of the world snapshots written by PhysicsWorld::SaveSnapshot: a fixed header followed by one
+// section per ball array, each starting on a 16 byte boundary. Every array is stored exactly as
+// BallSystem keeps it, little-endian, so loading is one copy per array however many balls there are.
+constexpr uint32_t WORLD_SNAPSHOT_MAGIC = 0x50534E4E; // "NNSP"
+constexpr uint32_t WORLD_SNAPSHOT_VERSION = 1;
+constexpr unsigned int WORLD_SNAPSHOT_ALIGNMENT = 16;
+constexpr const char* WORLD_SNAPSHOT_EXTENSION = ".nsnap";
+
+enum WorldSnapshotSection : uint32_t {
+	SNAPSHOT_POSITION_X, SNAPSHOT_POSITION_Y, SNAPSHOT_POSITION_Z,
+	SNAPSHOT_VELOCITY_X, SNAPSHOT_VELOCITY_Y, SNAPSHOT_VELOCITY_Z,
+	SNAPSHOT_FORCE_X, SNAPSHOT_FORCE_Y, SNAPSHOT_FORCE_Z,
+	SNAPSHOT_MASS,
+	SNAPSHOT_PREVIOUS_X, SNAPSHOT_PREVIOUS_Y, SNAPSHOT_PREVIOUS_Z,
+	SNAPSHOT_REST_TIME,
+	// The float arrays above come first, so a loop over [0, SNAPSHOT_FLOAT_SECTIONS) copies them all.
+	SNAPSHOT_AWAKE,
+	SNAPSHOT_ISLAND,
+	SNAPSHOT_OBSTACLES,
+	// std::mt19937_64 written with operator<<, so the state does not depend on the library's layout.
+	SNAPSHOT_RANDOM,
+	SNAPSHOT_SECTION_COUNT
+};
+constexpr unsigned int SNAPSHOT_FLOAT_SECTIONS = SNAPSHOT_REST_TIME + 1;
+
+struct WorldSnapshotSectionRange {
+	uint64_t Offset;
+	uint64_t Size;
+};
+
+struct WorldSnapshotObstacle {
+	float Position[3];
+	float Velocity[3];
+};
+
+struct WorldSnapshotHeader {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t BallCount;
+	uint32_t ObstacleCount;
+	// PhysicsSettings
+	float Gravity;
+	float Elasticities;
+	float DragForce;
+	float StepRate;
+	int32_t MaxSubsteps;
+	int32_t SolverIterations;
+	float Friction;
+	uint32_t ContinuousCollision;
+	// Range of the masses SpawnRandomBall picks from, and the step time left over from the last frame.
+	float MassMin;
+	float MassMax;
+	float Accumulator;
+	uint32_t Reserved;
+	WorldSnapshotSectionRange Sections[SNAPSHOT_SECTION_COUNT];
+};
+static_assert(sizeof(WorldSnapshotHeader) == 64 + 16 * SNAPSHOT_SECTION_COUNT, "WorldSnapshotHeader must not have padding");
+static_assert(sizeof(WorldSnapshotObstacle) == 24, "WorldSnapshotObstacle must not have padding");
+
+// Snapshots are copied straight into memory, so they can only be read and written on little-endian hosts.
+inline bool IsWorldSnapshotHostSupported() {
+	uint32_t one = 1;
+	unsigned char first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+// Bytes per element of a section, 0 for sections without a fixed element count.
+inline size_t GetWorldSnapshotElementSize(uint32_t section) {
+	if (section < SNAPSHOT_FLOAT_SECTIONS || section == SNAPSHOT_ISLAND) {
+		return 4;
+	}
+	if (section == SNAPSHOT_AWAKE) {
+		return 1;
+	}
+	return section == SNAPSHOT_OBSTACLES ? sizeof(WorldSnapshotObstacle) : 0;
+}
+
+// The header of a snapshot, or nullptr when the data is not a complete snapshot of this version.
+inline const WorldSnapshotHeader* ReadWorldSnapshotHeader(const unsigned char* data, size_t size) {
+	if (data == nullptr || size < sizeof(WorldSnapshotHeader) || !IsWorldSnapshotHostSupported()) {
+		return nullptr;
+	}
+	const WorldSnapshotHeader* header = reinterpret_cast<const WorldSnapshotHeader*>(data);
+	if (header->Magic != WORLD_SNAPSHOT_MAGIC || header->Version != WORLD_SNAPSHOT_VERSION) {
+		return nullptr;
+	}
+	for (uint32_t s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+		const WorldSnapshotSectionRange& range = header->Sections[s];
+		uint64_t count = s == SNAPSHOT_OBSTACLES ? header->ObstacleCount : header->BallCount;
+		size_t element_size = GetWorldSnapshotElementSize(s);
+		if (element_size != 0 && range.Size != count * element_size) {
+			return nullptr;
+		}
+		if (range.Offset % WORLD_SNAPSHOT_ALIGNMENT != 0 || range.Offset > size || range.Size > size - range.Offset) {
+			return nullptr;
+		}
+	}
+	return header;
+}
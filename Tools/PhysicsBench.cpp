@@ -0,0 +1,234 @@
+// Headless physics benchmark: steps a seeded PhysicsWorld with a fixed delta time and prints JSON.
+//
+// PhysicsBench [--steps N] [--dt SECONDS] [--seed S] [--threads T] [--mass MIN MAX] [--counts 1000,10000,...] [--discrete]
+//               [--obstacles N] [--obstacle-speed V] [--iterations N] [--friction F]
+//               [--load-snapshot PATH] [--save-snapshot PATH] [--trace PATH]
+//
+// --discrete turns continuous collision off, to compare the cost of sweeping fast balls.
+// --obstacles N scatters N more obstacles over the room, --obstacle-speed V makes them move.
+// --iterations and --friction override the contact solver settings.
+// --load-snapshot starts from a saved world instead of spawning balls (--counts, --mass, --obstacles and the
+// solver settings are ignored then); --save-snapshot writes the world after the last step, one file per
+// count with the ball count appended to the name.
+// --trace records every step to PATH (see Source/TraceRecorder.h), to measure what recording costs.
+//
+// The checksum is a hash of the final ball state; it only changes when the simulation does.
+
+#include "PhysicsWorld.h"
+#include "Stopwatch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static uint64_t GetPeakResidentBytes() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (uint64_t)counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return (uint64_t)usage.ru_maxrss;
+#else
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+	// FNV-1a
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t HashWorld(const PhysicsWorld& world) {
+	const BallSystem& balls = world.Balls;
+	uint64_t hash = 14695981039346656037ull;
+	for (const std::vector<float>* array : { &balls.PositionX, &balls.PositionY, &balls.PositionZ, &balls.VelocityX, &balls.VelocityY, &balls.VelocityZ }) {
+		hash = HashBytes(hash, array->data(), array->size() * sizeof(float));
+	}
+	return hash;
+}
+
+static std::vector<unsigned int> ParseCounts(const char* text) {
+	std::vector<unsigned int> counts;
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) {
+			counts.push_back((unsigned int)std::strtoul(item.c_str(), nullptr, 10));
+		}
+	}
+	return counts;
+}
+
+int main(int argc, char** argv) {
+	unsigned int steps = 100;
+	float delta_time = 1.0f / 60.0f;
+	uint64_t seed = 1;
+	unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency());
+	// Light balls by default so a million of them still fit in the room.
+	float mass_min = 1.0f;
+	float mass_max = 1.0f;
+	std::vector<unsigned int> counts = { 1000, 10000, 100000, 1000000 };
+	bool continuous = true;
+	unsigned int obstacle_count = 0;
+	float obstacle_speed = 0.0f;
+	int iterations = PhysicsSettings().SolverIterations;
+	float friction = PhysicsSettings().Friction;
+	std::string load_path, save_path, trace_path;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+			steps = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+			delta_time = std::strtof(argv[++i], nullptr);
+		} else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			thread_count = std::max(1, std::atoi(argv[++i]));
+		} else if (std::strcmp(argv[i], "--mass") == 0 && i + 2 < argc) {
+			mass_min = std::strtof(argv[++i], nullptr);
+			mass_max = std::strtof(argv[++i], nullptr);
+		} else if (std::strcmp(argv[i], "--counts") == 0 && i + 1 < argc) {
+			counts = ParseCounts(argv[++i]);
+		} else if (std::strcmp(argv[i], "--discrete") == 0) {
+			continuous = false;
+		} else if (std::strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc) {
+			obstacle_count = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "--obstacle-speed") == 0 && i + 1 < argc) {
+			obstacle_speed = std::strtof(argv[++i], nullptr);
+		} else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+			iterations = std::max(1, std::atoi(argv[++i]));
+		} else if (std::strcmp(argv[i], "--friction") == 0 && i + 1 < argc) {
+			friction = std::strtof(argv[++i], nullptr);
+		} else if (std::strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+			load_path = argv[++i];
+		} else if (std::strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+			save_path = argv[++i];
+		} else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else {
+			std::fprintf(stderr, "Usage: %s [--steps N] [--dt SECONDS] [--seed S] [--threads T] [--mass MIN MAX] [--counts 1000,10000,...] [--discrete] [--obstacles N] [--obstacle-speed V] [--iterations N] [--friction F] [--load-snapshot PATH] [--save-snapshot PATH] [--trace PATH]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// A loaded world replaces the spawned one, so there is only one run.
+	if (!load_path.empty()) {
+		counts = { 0 };
+	}
+
+	std::printf("{\n");
+	std::printf("  \"steps\": %u,\n", steps);
+	std::printf("  \"dt\": %.9g,\n", delta_time);
+	std::printf("  \"seed\": %llu,\n", (unsigned long long)seed);
+	std::printf("  \"threads\": %u,\n", thread_count);
+	std::printf("  \"mass\": [%.9g, %.9g],\n", mass_min, mass_max);
+	std::printf("  \"continuous\": %s,\n", continuous ? "true" : "false");
+	std::printf("  \"solver_iterations\": %d,\n", iterations);
+	std::printf("  \"friction\": %.9g,\n", friction);
+	std::printf("  \"results\": [\n");
+
+	for (size_t c = 0; c < counts.size(); c++) {
+		PhysicsWorld world(thread_count, seed);
+		world.SetMassRange(mass_min, mass_max);
+		world.Settings.ContinuousCollision = continuous;
+		world.Settings.SolverIterations = iterations;
+		world.Settings.Friction = friction;
+		world.CreateDefaultObstacles();
+		world.SpawnRandomBalls(counts[c]);
+		world.SpawnRandomObstacles(obstacle_count, obstacle_speed);
+		double load_seconds = 0.0;
+		if (!load_path.empty()) {
+			Stopwatch load_stopwatch;
+			if (!world.LoadSnapshot(load_path)) {
+				std::fprintf(stderr, "Could not load snapshot %s\n", load_path.c_str());
+				return 1;
+			}
+			load_seconds = load_stopwatch.GetElapsedMilliseconds() / 1000.0;
+			counts[c] = world.Balls.Size();
+		}
+
+		TraceRecorder recorder;
+		if (!trace_path.empty()) {
+			if (!recorder.Start(trace_path + (counts.size() > 1 ? "." + std::to_string(counts[c]) : std::string()), delta_time)) {
+				std::fprintf(stderr, "Could not create trace %s\n", trace_path.c_str());
+				return 1;
+			}
+			world.SetTraceRecorder(&recorder);
+		}
+
+		Stopwatch stopwatch;
+		double trace_milliseconds = 0.0;
+		for (unsigned int s = 0; s < steps; s++) {
+			world.Step(delta_time);
+			trace_milliseconds += world.GetStats().TraceTime;
+		}
+		double seconds = stopwatch.GetElapsedMilliseconds() / 1000.0;
+		world.SetTraceRecorder(nullptr);
+		recorder.Stop();
+		if (!save_path.empty() && !world.SaveSnapshot(save_path + (counts.size() > 1 ? "." + std::to_string(counts[c]) : std::string()))) {
+			std::fprintf(stderr, "Could not save snapshot %s\n", save_path.c_str());
+			return 1;
+		}
+
+		double steps_per_second = seconds > 0.0 ? steps / seconds : 0.0;
+		double ball_steps = (double)steps * counts[c];
+		double ns_per_ball_step = ball_steps > 0.0 ? seconds * 1e9 / ball_steps : 0.0;
+
+		std::printf("    {\n");
+		std::printf("      \"balls\": %u,\n", counts[c]);
+		// After setup, so a loaded snapshot reports its own obstacles.
+		std::printf("      \"obstacles\": %zu,\n", world.Obstacles.size());
+		std::printf("      \"seconds\": %.6f,\n", seconds);
+		if (!load_path.empty()) {
+			std::printf("      \"load_seconds\": %.6f,\n", load_seconds);
+		}
+		std::printf("      \"steps_per_second\": %.3f,\n", steps_per_second);
+		std::printf("      \"ns_per_ball_step\": %.3f,\n", ns_per_ball_step);
+		std::printf("      \"candidate_pairs\": %u,\n", world.GetStats().CandidatePairs);
+		std::printf("      \"contacts\": %u,\n", world.GetStats().Contacts);
+		std::printf("      \"static_contacts\": %u,\n", world.GetStats().StaticContacts);
+		std::printf("      \"warm_started\": %u,\n", world.GetStats().WarmStartedContacts);
+		std::printf("      \"awake\": %u,\n", world.GetStats().AwakeBalls);
+		std::printf("      \"sleeping\": %u,\n", world.GetStats().SleepingBalls);
+		std::printf("      \"swept\": %u,\n", world.GetStats().SweptBalls);
+		if (!trace_path.empty()) {
+			std::printf("      \"trace_seconds\": %.6f,\n", trace_milliseconds / 1000.0);
+			std::printf("      \"trace_frames\": %llu,\n", (unsigned long long)recorder.GetWrittenFrames());
+			std::printf("      \"trace_dropped\": %llu,\n", (unsigned long long)recorder.GetDroppedFrames());
+			std::printf("      \"trace_bytes\": %llu,\n", (unsigned long long)recorder.GetBytesWritten());
+		}
+		std::printf("      \"peak_rss_bytes\": %llu,\n", (unsigned long long)GetPeakResidentBytes());
+		std::printf("      \"checksum\": \"%016llx\"\n", (unsigned long long)HashWorld(world));
+		std::printf("    }%s\n", c + 1 < counts.size() ? "," : "");
+		std::fflush(stdout);
+	}
+
+	std::printf("  ]\n");
+	std::printf("}\n");
+	return 0;
+}
@@ -0,0 +1,284 @@
+// Headless check of the render queue and the state cache: submits a shuffled frame of draws to a RenderQueue
+// running on a NullRenderBackend, checks the order they come out in and that exactly the redundant binds and
+// uniforms were dropped, and prints what was issued and elided as JSON. Exits with 1 when a check fails.
+//
+// RenderQueueCheck [--programs N] [--materials N] [--textures N] [--draws N] [--translucent N] [--seed S]
+//
+// Every program draws every material with every texture --draws times, in a random order and at random
+// depths; --translucent more draws with a program and a material of their own go on top of them.
+// The same frame is executed three times: once on a fresh cache, once again with the values of the first
+// still current, and once after Invalidate() and InvalidateUniforms(), which must cost what the first did.
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct CheckScene {
+	unsigned int Programs = 3;
+	unsigned int Materials = 4;
+	unsigned int Textures = 3;
+	unsigned int Draws = 5;
+	unsigned int Translucent = 16;
+	unsigned int Seed = 1;
+	// Per submitted command, filled by Submit().
+	std::vector<float> Depths;
+	std::vector<RenderLayer> Layers;
+};
+
+struct DrawRecord {
+	std::vector<uint32_t> Drawn;
+	GLuint VertexArray = 1;
+};
+
+struct FrameResult {
+	const char* Name;
+	RenderStateCounters Issued;
+	RenderStateCounters Elided;
+	unsigned int Calls[RENDER_CALL_KIND_COUNT];
+};
+
+unsigned int failures = 0;
+
+void Check(bool condition, const char* frame, const char* what) {
+	if (!condition) {
+		std::fprintf(stderr, "%s frame: %s\n", frame, what);
+		failures++;
+	}
+}
+
+// Every draw shares one vertex array, so all but the first bind must be dropped.
+void DrawCommand(void* context, const RenderCommand& command, RenderStateCache& state) {
+	DrawRecord* record = static_cast<DrawRecord*>(context);
+	state.BindVertexArray(record->VertexArray);
+	record->Drawn.push_back(command.Index);
+}
+
+RenderMaterial MakeMaterial(unsigned int m) {
+	RenderMaterial material;
+	material.Ambient = glm::vec4(0.01f * (m + 1));
+	material.Diffuse = glm::vec4(0.1f * (m + 1));
+	material.Specular = glm::vec4(0.2f * (m + 1));
+	material.Shininess = 8.0f + m;
+	return material;
+}
+
+// The same commands every time: the random order and depths only depend on the seed.
+void Submit(RenderQueue& queue, CheckScene& scene, DrawRecord& record) {
+	std::mt19937 random(scene.Seed);
+	std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+	std::vector<RenderCommand> commands;
+	std::vector<RenderLayer> layers;
+	for (unsigned int p = 0; p < scene.Programs; p++) {
+		for (unsigned int m = 0; m < scene.Materials; m++) {
+			uint32_t material = queue.AddMaterial(MakeMaterial(m));
+			for (unsigned int t = 0; t < scene.Textures; t++) {
+				for (unsigned int d = 0; d < scene.Draws; d++) {
+					RenderCommand command;
+					command.Program = 1 + p;
+					command.Material = material;
+					command.Texture = 100 + t;
+					commands.push_back(command);
+					layers.push_back(RENDER_LAYER_OPAQUE);
+				}
+			}
+		}
+	}
+	RenderMaterial glass = MakeMaterial(scene.Materials);
+	glass.Flags = RENDER_MATERIAL_EMISSION;
+	uint32_t glass_material = queue.AddMaterial(glass);
+	for (unsigned int i = 0; i < scene.Translucent; i++) {
+		RenderCommand command;
+		command.Program = 1 + scene.Programs;
+		command.Material = glass_material;
+		command.Texture = 100 + i % std::max(scene.Textures, 1u);
+		commands.push_back(command);
+		layers.push_back(RENDER_LAYER_TRANSLUCENT);
+	}
+
+	std::vector<uint32_t> shuffled(commands.size());
+	for (uint32_t i = 0; i < shuffled.size(); i++) {
+		shuffled[i] = i;
+	}
+	std::shuffle(shuffled.begin(), shuffled.end(), random);
+	scene.Depths.clear();
+	scene.Layers.clear();
+	record.Drawn.clear();
+	for (uint32_t i = 0; i < shuffled.size(); i++) {
+		RenderCommand command = commands[shuffled[i]];
+		command.Draw = DrawCommand;
+		command.Context = &record;
+		command.Index = i;
+		scene.Depths.push_back(depth(random));
+		scene.Layers.push_back(layers[shuffled[i]]);
+		queue.Submit(command, scene.Layers.back(), scene.Depths.back());
+	}
+}
+
+// Opaque draws in one run per program, per material within it and per texture within that, each run front to
+// back; then the translucent ones back to front. Equal keys keep the order they were submitted in.
+void CheckOrder(const RenderQueue& queue, const CheckScene& scene, const DrawRecord& record, const char* frame) {
+	const std::vector<uint32_t>& order = queue.GetOrder();
+	Check(record.Drawn.size() == queue.GetCommandCount(), frame, "not every command was drawn");
+	Check(record.Drawn == order, frame, "draws do not follow GetOrder()");
+	std::vector<uint64_t> closed;
+	for (size_t i = 1; i < order.size(); i++) {
+		const RenderCommand& previous = queue.GetCommand(order[i - 1]);
+		const RenderCommand& command = queue.GetCommand(order[i]);
+		Check(previous.Key <= command.Key, frame, "keys are not sorted");
+		Check(previous.Key != command.Key || order[i - 1] < order[i], frame, "equal keys lost their submission order");
+		RenderLayer previous_layer = scene.Layers[order[i - 1]];
+		RenderLayer layer = scene.Layers[order[i]];
+		Check(previous_layer <= layer, frame, "a translucent draw comes before an opaque one");
+		if (layer == RENDER_LAYER_TRANSLUCENT) {
+			if (previous_layer == RENDER_LAYER_TRANSLUCENT) {
+				Check(scene.Depths[order[i - 1]] >= scene.Depths[order[i]], frame, "translucent draws are not back to front");
+			}
+			continue;
+		}
+		uint64_t previous_state = ((uint64_t)previous.Program << 40) | ((uint64_t)previous.Material << 20) | previous.Texture;
+		uint64_t state = ((uint64_t)command.Program << 40) | ((uint64_t)command.Material << 20) | command.Texture;
+		if (previous_state == state) {
+			Check(scene.Depths[order[i - 1]] <= scene.Depths[order[i]], frame, "opaque draws are not front to back");
+		} else {
+			closed.push_back(previous_state);
+			Check(std::find(closed.begin(), closed.end(), state) == closed.end(), frame, "an opaque state is split into several runs");
+			Check(previous.Program == command.Program || std::find_if(closed.begin(), closed.end(), [&](uint64_t c) { return (c >> 40) == command.Program; }) == closed.end(), frame, "a program is split into several runs");
+		}
+	}
+}
+
+// What the state cache must let through on a cold cache: one change per run of equal programs or textures.
+void CountRuns(const RenderQueue& queue, unsigned int& programs, unsigned int& textures) {
+	programs = textures = 0;
+	GLuint program = RENDER_STATE_UNKNOWN, texture = RENDER_STATE_UNKNOWN;
+	for (uint32_t index : queue.GetOrder()) {
+		const RenderCommand& command = queue.GetCommand(index);
+		programs += command.Program != program;
+		textures += command.Texture != texture;
+		program = command.Program;
+		texture = command.Texture;
+	}
+}
+
+FrameResult Execute(const char* name, RenderQueue& queue, CheckScene& scene, DrawRecord& record, RenderStateCache& state, UniformCache& uniforms, NullRenderBackend& backend) {
+	queue.Reset();
+	backend.Clear();
+	state.NewFrame();
+	Submit(queue, scene, record);
+	queue.Execute(state, uniforms, nullptr, nullptr, nullptr);
+	CheckOrder(queue, scene, record, name);
+	FrameResult result = { name, state.GetIssued(), state.GetElided(), {} };
+	for (unsigned int kind = 0; kind < RENDER_CALL_KIND_COUNT; kind++) {
+		result.Calls[kind] = backend.GetCount((RenderCallKind)kind);
+	}
+	Check(result.Calls[RENDER_CALL_USE_PROGRAM] == result.Issued.Programs, name, "program changes issued and made differ");
+	Check(result.Calls[RENDER_CALL_BIND_TEXTURE] == result.Issued.Textures, name, "texture binds issued and made differ");
+	Check(result.Calls[RENDER_CALL_BIND_VERTEX_ARRAY] == result.Issued.VertexArrays, name, "vertex array binds issued and made differ");
+	Check(result.Calls[RENDER_CALL_UNIFORM] == result.Issued.Uniforms, name, "uniforms issued and made differ");
+	Check(result.Issued.Textures + result.Elided.Textures == queue.GetCommandCount(), name, "a texture bind was neither issued nor elided");
+	return result;
+}
+
+void PrintCounters(const char* name, const RenderStateCounters& counters, const char* end) {
+	std::printf("      \"%s\": { \"programs\": %u, \"textures\": %u, \"vertex_arrays\": %u, \"uniforms\": %u }%s\n", name, counters.Programs, counters.Textures, counters.VertexArrays, counters.Uniforms, end);
+}
+
+bool ParseCount(int argc, char** argv, int& i, unsigned int& value) {
+	if (i + 1 >= argc) {
+		return false;
+	}
+	value = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+	return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+	CheckScene scene;
+	bool valid = true;
+	for (int i = 1; i < argc && valid; i++) {
+		if (std::strcmp(argv[i], "--programs") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Programs);
+		} else if (std::strcmp(argv[i], "--materials") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Materials);
+		} else if (std::strcmp(argv[i], "--textures") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Textures);
+		} else if (std::strcmp(argv[i], "--draws") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Draws);
+		} else if (std::strcmp(argv[i], "--translucent") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Translucent);
+		} else if (std::strcmp(argv[i], "--seed") == 0) {
+			valid = ParseCount(argc, argv, i, scene.Seed);
+		} else {
+			valid = false;
+		}
+	}
+	// Programs, materials and textures get 12 bits each in the sort key.
+	if (!valid || scene.Programs == 0 || scene.Programs >= 4095 || scene.Materials == 0 || scene.Materials >= 4095 || scene.Textures == 0 || scene.Textures >= 4095 || scene.Draws == 0) {
+		std::fprintf(stderr, "Usage: %s [--programs N] [--materials N] [--textures N] [--draws N] [--translucent N] [--seed S]\n", argv[0]);
+		return 1;
+	}
+
+	NullRenderBackend backend;
+	RenderStateCache state(&backend);
+	UniformCache uniforms(&state);
+	RenderQueue queue;
+	DrawRecord record;
+
+	unsigned int programs = scene.Programs + (scene.Translucent != 0 ? 1 : 0);
+	unsigned int material_sets = scene.Programs * scene.Materials + (scene.Translucent != 0 ? 1 : 0);
+	unsigned int uniform_sets = material_sets * 8;
+	// ApplyMaterial sends four flags and four values. On a cold cache a program's first material sends all
+	// eight; every later one only its four values, as the flags of the opaque materials are all equal.
+	unsigned int cold_uniforms = programs * 8 + scene.Programs * (scene.Materials - 1) * 4;
+	// Run again, each program starts with its first material while the last one is still set.
+	unsigned int warm_uniforms = scene.Materials > 1 ? scene.Programs * scene.Materials * 4 : 0;
+
+	FrameResult frames[3];
+	frames[0] = Execute("cold", queue, scene, record, state, uniforms, backend);
+	unsigned int program_runs = 0, texture_runs = 0;
+	CountRuns(queue, program_runs, texture_runs);
+	frames[1] = Execute("warm", queue, scene, record, state, uniforms, backend);
+	state.Invalidate();
+	state.InvalidateUniforms();
+	frames[2] = Execute("invalidated", queue, scene, record, state, uniforms, backend);
+
+	for (const FrameResult& frame : { frames[0], frames[2] }) {
+		Check(frame.Issued.Programs == program_runs && program_runs == programs, frame.Name, "program changes are not one per program");
+		Check(frame.Issued.Textures == texture_runs, frame.Name, "texture binds are not one per run of equal textures");
+		Check(frame.Issued.Uniforms == cold_uniforms, frame.Name, "uniforms sent differ from a cold cache");
+		Check(frame.Issued.VertexArrays == 1, frame.Name, "the shared vertex array was bound more than once");
+	}
+	Check(frames[1].Issued.Uniforms == warm_uniforms, frames[1].Name, "uniforms sent differ from a warm cache");
+	Check(frames[1].Issued.VertexArrays == 0, frames[1].Name, "the vertex array still bound was bound again");
+	for (const FrameResult& frame : frames) {
+		Check(frame.Issued.Uniforms + frame.Elided.Uniforms == uniform_sets, frame.Name, "a uniform was neither issued nor elided");
+	}
+
+	std::printf("{\n");
+	std::printf("  \"commands\": %u,\n", (unsigned int)queue.GetCommandCount());
+	std::printf("  \"programs\": %u,\n", (unsigned int)queue.GetProgramCount());
+	std::printf("  \"materials\": %u,\n", (unsigned int)queue.GetMaterialCount());
+	std::printf("  \"textures\": %u,\n", scene.Textures);
+	std::printf("  \"seed\": %u,\n", scene.Seed);
+	std::printf("  \"frames\": [\n");
+	for (unsigned int f = 0; f < 3; f++) {
+		std::printf("    {\n");
+		std::printf("      \"name\": \"%s\",\n", frames[f].Name);
+		PrintCounters("issued", frames[f].Issued, ",");
+		PrintCounters("elided", frames[f].Elided, "");
+		std::printf("    }%s\n", f == 2 ? "" : ",");
+	}
+	std::printf("  ],\n");
+	std::printf("  \"failures\": %u\n", failures);
+	std::printf("}\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+// Offline texture baker: decodes PNG/JPG files once and writes .ntex files (see Source/BakedTexture.h)
+// with the whole mip chain, optionally block compressed, that AssetLoader maps and uploads as they are.
+//
+// TextureBaker [--bc] [--no-flip] [--no-mips] [--out DIR] FILE_OR_DIRECTORY...
+//
+// --bc       BC1 for opaque images, BC3 for images with alpha
+// --no-flip  keep the file's top-down row order (cube map faces)
+// --no-mips  only bake level 0
+// --out DIR  write the baked files into DIR instead of next to their source
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "BakedTexture.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Image {
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<unsigned char> Pixels;
+};
+
+struct BakeOptions {
+	bool Compress = false;
+	bool Flip = true;
+	bool Mipmaps = true;
+	std::string OutputDirectory;
+};
+
+// 2x2 box filter; an odd row or column is folded into the last texel.
+static Image Downsample(const Image& source) {
+	Image result;
+	result.Width = std::max(1u, source.Width / 2);
+	result.Height = std::max(1u, source.Height / 2);
+	result.Pixels.resize((size_t)result.Width * result.Height * 4);
+	for (uint32_t y = 0; y < result.Height; y++) {
+		uint32_t y0 = std::min(source.Height - 1, y * 2);
+		uint32_t y1 = std::min(source.Height - 1, y * 2 + 1);
+		for (uint32_t x = 0; x < result.Width; x++) {
+			uint32_t x0 = std::min(source.Width - 1, x * 2);
+			uint32_t x1 = std::min(source.Width - 1, x * 2 + 1);
+			for (unsigned int c = 0; c < 4; c++) {
+				unsigned int sum = source.Pixels[((size_t)y0 * source.Width + x0) * 4 + c] + source.Pixels[((size_t)y0 * source.Width + x1) * 4 + c]
+					+ source.Pixels[((size_t)y1 * source.Width + x0) * 4 + c] + source.Pixels[((size_t)y1 * source.Width + x1) * 4 + c];
+				result.Pixels[((size_t)y * result.Width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+	return result;
+}
+
+static uint16_t PackRGB565(int r, int g, int b) {
+	return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static void UnpackRGB565(uint16_t color, int out[3]) {
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+static void WriteLittleEndian(unsigned char* out, uint64_t value, unsigned int bytes) {
+	for (unsigned int i = 0; i < bytes; i++) {
+		out[i] = (unsigned char)(value >> (8 * i));
+	}
+}
+
+// BC1 colour block in four-colour mode. Endpoints are the corners of the colour bounding box, pulled
+// in by 1/16 of its size, which is cheap and close enough for the scene textures.
+static void EncodeColorBlock(const unsigned char block[16][4], unsigned char* out) {
+	int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+	for (unsigned int i = 0; i < 16; i++) {
+		for (unsigned int c = 0; c < 3; c++) {
+			low[c] = std::min(low[c], (int)block[i][c]);
+			high[c] = std::max(high[c], (int)block[i][c]);
+		}
+	}
+	for (unsigned int c = 0; c < 3; c++) {
+		int inset = (high[c] - low[c]) / 16;
+		low[c] += inset;
+		high[c] -= inset;
+	}
+	uint16_t color0 = PackRGB565(high[0], high[1], high[2]);
+	uint16_t color1 = PackRGB565(low[0], low[1], low[2]);
+	if (color0 < color1) {
+		std::swap(color0, color1);
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1) {
+		int palette[4][3];
+		UnpackRGB565(color0, palette[0]);
+		UnpackRGB565(color1, palette[1]);
+		for (unsigned int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (unsigned int i = 0; i < 16; i++) {
+			unsigned int best = 0;
+			int best_distance = 1 << 30;
+			for (unsigned int p = 0; p < 4; p++) {
+				int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = p;
+				}
+			}
+			indices |= best << (2 * i);
+		}
+	}
+	WriteLittleEndian(out, color0, 2);
+	WriteLittleEndian(out + 2, color1, 2);
+	WriteLittleEndian(out + 4, indices, 4);
+}
+
+// BC3 alpha block in eight-value mode between the smallest and largest alpha.
+static void EncodeAlphaBlock(const unsigned char block[16][4], unsigned char* out) {
+	int alpha0 = 0, alpha1 = 255;
+	for (unsigned int i = 0; i < 16; i++) {
+		alpha0 = std::max(alpha0, (int)block[i][3]);
+		alpha1 = std::min(alpha1, (int)block[i][3]);
+	}
+	uint64_t indices = 0;
+	if (alpha0 != alpha1) {
+		int palette[8] = { alpha0, alpha1 };
+		for (int p = 1; p <= 6; p++) {
+			palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+		}
+		for (unsigned int i = 0; i < 16; i++) {
+			unsigned int best = 0;
+			int best_distance = 1 << 30;
+			for (unsigned int p = 0; p < 8; p++) {
+				int distance = std::abs(block[i][3] - palette[p]);
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+	out[0] = (unsigned char)alpha0;
+	out[1] = (unsigned char)alpha1;
+	WriteLittleEndian(out + 2, indices, 6);
+}
+
+static std::vector<unsigned char> Compress(const Image& image, uint32_t format) {
+	unsigned int block_bytes = GetBakedBlockBytes(format);
+	uint32_t blocks_x = (image.Width + 3) / 4, blocks_y = (image.Height + 3) / 4;
+	std::vector<unsigned char> data((size_t)blocks_x * blocks_y * block_bytes);
+	unsigned char block[16][4];
+	for (uint32_t by = 0; by < blocks_y; by++) {
+		for (uint32_t bx = 0; bx < blocks_x; bx++) {
+			// Blocks hanging over the edge repeat the last row and column.
+			for (unsigned int i = 0; i < 16; i++) {
+				uint32_t x = std::min(image.Width - 1, bx * 4 + i % 4);
+				uint32_t y = std::min(image.Height - 1, by * 4 + i / 4);
+				std::memcpy(block[i], &image.Pixels[((size_t)y * image.Width + x) * 4], 4);
+			}
+			unsigned char* out = &data[((size_t)by * blocks_x + bx) * block_bytes];
+			if (format == BAKED_FORMAT_BC3) {
+				EncodeAlphaBlock(block, out);
+				out += 8;
+			}
+			EncodeColorBlock(block, out);
+		}
+	}
+	return data;
+}
+
+static bool Bake(const std::filesystem::path& source, const BakeOptions& options) {
+	int width = 0, height = 0, channels = 0;
+	unsigned char* pixels = stbi_load(source.string().c_str(), &width, &height, &channels, 4);
+	if (pixels == nullptr) {
+		std::fprintf(stderr, "%s: %s\n", source.string().c_str(), stbi_failure_reason());
+		return false;
+	}
+	Image image;
+	image.Width = (uint32_t)width;
+	image.Height = (uint32_t)height;
+	image.Pixels.assign(pixels, pixels + (size_t)width * height * 4);
+	stbi_image_free(pixels);
+
+	if (options.Flip) {
+		size_t row_bytes = (size_t)image.Width * 4;
+		for (uint32_t y = 0; y < image.Height / 2; y++) {
+			std::swap_ranges(image.Pixels.begin() + y * row_bytes, image.Pixels.begin() + (y + 1) * row_bytes, image.Pixels.begin() + (image.Height - 1 - y) * row_bytes);
+		}
+	}
+
+	bool opaque = true;
+	for (size_t i = 3; i < image.Pixels.size(); i += 4) {
+		opaque = opaque && image.Pixels[i] == 255;
+	}
+	uint32_t format = !options.Compress ? BAKED_FORMAT_RGBA8 : (opaque ? BAKED_FORMAT_BC1 : BAKED_FORMAT_BC3);
+
+	BakedTextureHeader header = {};
+	header.Magic = BAKED_TEXTURE_MAGIC;
+	header.Version = BAKED_TEXTURE_VERSION;
+	header.Format = format;
+	header.Flags = options.Flip ? (uint32_t)BAKED_FLAG_FLIPPED : 0u;
+	header.Width = image.Width;
+	header.Height = image.Height;
+	header.SourceSize = (uint32_t)std::filesystem::file_size(source);
+	MappedFile source_file(source.string());
+	header.SourceHash = HashBakedSource(source_file.GetData(), source_file.GetSize());
+
+	std::vector<std::vector<unsigned char>> levels;
+	uint64_t offset = sizeof(BakedTextureHeader);
+	while (true) {
+		levels.push_back(format == BAKED_FORMAT_RGBA8 ? image.Pixels : Compress(image, format));
+		offset = (offset + BAKED_TEXTURE_ALIGNMENT - 1) / BAKED_TEXTURE_ALIGNMENT * BAKED_TEXTURE_ALIGNMENT;
+		BakedTextureLevel& level = header.Levels[header.LevelCount++];
+		level.Width = image.Width;
+		level.Height = image.Height;
+		level.Offset = offset;
+		level.Size = levels.back().size();
+		offset += level.Size;
+		if (!options.Mipmaps || (image.Width == 1 && image.Height == 1) || header.LevelCount == BAKED_TEXTURE_MAX_LEVELS) {
+			break;
+		}
+		image = Downsample(image);
+	}
+
+	std::filesystem::path target = options.OutputDirectory.empty() ? source.parent_path() : std::filesystem::path(options.OutputDirectory);
+	target /= source.filename().string() + BAKED_TEXTURE_EXTENSION;
+	std::ofstream file(target, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	const char padding[BAKED_TEXTURE_ALIGNMENT] = {};
+	for (unsigned int l = 0; l < header.LevelCount; l++) {
+		file.write(padding, header.Levels[l].Offset - (uint64_t)file.tellp());
+		file.write(reinterpret_cast<const char*>(levels[l].data()), levels[l].size());
+	}
+	if (!file) {
+		std::fprintf(stderr, "%s: failed to write\n", target.string().c_str());
+		return false;
+	}
+
+	const char* format_names[] = { "RGBA8", "BC1", "BC3" };
+	std::printf("%s: %ux%u, %u levels, %s, %llu -> %llu bytes\n", target.string().c_str(), header.Width, header.Height, header.LevelCount, format_names[format],
+		(unsigned long long)std::filesystem::file_size(source), (unsigned long long)offset);
+	return true;
+}
+
+static bool IsImage(const std::filesystem::path& path) {
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+int main(int argc, char** argv) {
+	BakeOptions options;
+	std::vector<std::filesystem::path> sources;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--bc") == 0) {
+			options.Compress = true;
+		} else if (std::strcmp(argv[i], "--no-flip") == 0) {
+			options.Flip = false;
+		} else if (std::strcmp(argv[i], "--no-mips") == 0) {
+			options.Mipmaps = false;
+		} else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			options.OutputDirectory = argv[++i];
+		} else if (argv[i][0] != '-') {
+			sources.push_back(argv[i]);
+		} else {
+			sources.clear();
+			break;
+		}
+	}
+	if (sources.empty()) {
+		std::fprintf(stderr, "Usage: %s [--bc] [--no-flip] [--no-mips] [--out DIR] FILE_OR_DIRECTORY...\n", argv[0]);
+		return 1;
+	}
+	if (!options.OutputDirectory.empty()) {
+		std::filesystem::create_directories(options.OutputDirectory);
+	}
+
+	// Directories are baked one level deep, the same files AssetLoader picks up.
+	std::vector<std::filesystem::path> files;
+	for (const std::filesystem::path& source : sources) {
+		if (std::filesystem::is_directory(source)) {
+			for (const auto& entry : std::filesystem::directory_iterator(source)) {
+				if (entry.is_regular_file() && IsImage(entry.path())) {
+					files.push_back(entry.path());
+				}
+			}
+		} else {
+			files.push_back(source);
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	unsigned int failures = 0;
+	for (const std::filesystem::path& file : files) {
+		failures += Bake(file, options) ? 0 : 1;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// Prints statistics of a simulation trace (see Source/SimulationTrace.h) as JSON, without running physics.
+//
+// TraceStats [--decode] FILE
+//
+// --decode  also decodes every frame, to time the decoder and report the ball state of the last frame
+//
+// Frames whose step number does not follow the one before were dropped by the recorder; a file that
+// ends in the middle of a frame (e.g. after a crash) is read up to its last complete frame.
+
+#include "SimulationTrace.h"
+#include "Stopwatch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+
+int main(int argc, char** argv) {
+	bool decode = false;
+	std::string path;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--decode") == 0) {
+			decode = true;
+		} else if (argv[i][0] != '-' && path.empty()) {
+			path = argv[i];
+		} else {
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty()) {
+		std::fprintf(stderr, "Usage: %s [--decode] FILE\n", argv[0]);
+		return 1;
+	}
+
+	TraceReader reader;
+	if (!reader.Open(path)) {
+		std::fprintf(stderr, "%s is not a trace of version %u\n", path.c_str(), TRACE_VERSION);
+		return 1;
+	}
+
+	uint32_t frame_count = reader.GetFrameCount();
+	uint64_t keyframes = 0, keyframe_bytes = 0, delta_bytes = 0, dropped = 0, ball_steps = 0;
+	uint32_t min_balls = frame_count == 0 ? 0 : UINT32_MAX, max_balls = 0;
+	for (uint32_t f = 0; f < frame_count; f++) {
+		const TraceReader::FrameInfo& frame = reader.GetFrame(f);
+		uint64_t bytes = sizeof(TraceFrameHeader) + frame.PayloadSize;
+		if (frame.Keyframe) {
+			keyframes++;
+			keyframe_bytes += bytes;
+		} else {
+			delta_bytes += bytes;
+		}
+		if (f != 0 && frame.Step > reader.GetFrame(f - 1).Step + 1) {
+			dropped += frame.Step - reader.GetFrame(f - 1).Step - 1;
+		}
+		min_balls = std::min(min_balls, frame.BallCount);
+		max_balls = std::max(max_balls, frame.BallCount);
+		ball_steps += frame.BallCount;
+	}
+	uint64_t frame_bytes = keyframe_bytes + delta_bytes;
+	// What the same frames would take as raw floats (position and velocity).
+	double raw_bytes = (double)ball_steps * 6 * sizeof(float);
+
+	std::printf("{\n");
+	std::printf("  \"file\": \"%s\",\n", path.c_str());
+	std::printf("  \"file_bytes\": %llu,\n", (unsigned long long)reader.GetFileSize());
+	std::printf("  \"truncated_bytes\": %llu,\n", (unsigned long long)(reader.GetFileSize() - reader.GetValidSize()));
+	std::printf("  \"step_time\": %.9g,\n", reader.GetHeader().StepTime);
+	std::printf("  \"keyframe_interval\": %u,\n", reader.GetHeader().KeyframeInterval);
+	std::printf("  \"frames\": %u,\n", frame_count);
+	std::printf("  \"keyframes\": %llu,\n", (unsigned long long)keyframes);
+	std::printf("  \"dropped_steps\": %llu,\n", (unsigned long long)dropped);
+	if (frame_count != 0) {
+		std::printf("  \"first_step\": %llu,\n", (unsigned long long)reader.GetFrame(0).Step);
+		std::printf("  \"last_step\": %llu,\n", (unsigned long long)reader.GetFrame(frame_count - 1).Step);
+		std::printf("  \"recorded_seconds\": %.3f,\n", (reader.GetFrame(frame_count - 1).Step - reader.GetFrame(0).Step + 1) * (double)reader.GetHeader().StepTime);
+	}
+	std::printf("  \"balls\": [%u, %u],\n", min_balls, max_balls);
+	std::printf("  \"keyframe_bytes\": %llu,\n", (unsigned long long)keyframe_bytes);
+	std::printf("  \"delta_bytes\": %llu,\n", (unsigned long long)delta_bytes);
+	std::printf("  \"bytes_per_frame\": %.1f,\n", frame_count == 0 ? 0.0 : (double)frame_bytes / frame_count);
+	std::printf("  \"bytes_per_ball_step\": %.3f,\n", ball_steps == 0 ? 0.0 : (double)frame_bytes / ball_steps);
+	std::printf("  \"compression_ratio\": %.2f", frame_bytes == 0 ? 0.0 : raw_bytes / frame_bytes);
+
+	if (decode && frame_count != 0) {
+		Stopwatch stopwatch;
+		for (uint32_t f = 0; f < frame_count; f++) {
+			if (!reader.Seek(f)) {
+				std::printf("\n}\n");
+				std::fprintf(stderr, "Frame %u does not decode\n", f);
+				return 1;
+			}
+		}
+		double seconds = stopwatch.GetElapsedMilliseconds() / 1000.0;
+		glm::vec3 bounds_min(0.0f), bounds_max(0.0f);
+		double speed_sum = 0.0;
+		float max_speed = 0.0f;
+		for (uint32_t i = 0; i < reader.GetBallCount(); i++) {
+			glm::vec3 position = reader.GetPosition(i);
+			bounds_min = i == 0 ? position : glm::min(bounds_min, position);
+			bounds_max = i == 0 ? position : glm::max(bounds_max, position);
+			float speed = glm::length(reader.GetVelocity(i));
+			speed_sum += speed;
+			max_speed = std::max(max_speed, speed);
+		}
+		std::printf(",\n");
+		std::printf("  \"decode_seconds\": %.6f,\n", seconds);
+		std::printf("  \"last_frame\": {\n");
+		std::printf("    \"mean_speed\": %.6f,\n", reader.GetBallCount() == 0 ? 0.0 : speed_sum / reader.GetBallCount());
+		std::printf("    \"max_speed\": %.6f,\n", max_speed);
+		std::printf("    \"bounds_min\": [%.3f, %.3f, %.3f],\n", bounds_min.x, bounds_min.y, bounds_min.z);
+		std::printf("    \"bounds_max\": [%.3f, %.3f, %.3f]\n", bounds_max.x, bounds_max.y, bounds_max.z);
+		std::printf("  }\n");
+	} else {
+		std::printf("\n");
+	}
+	std::printf("}\n");
+	return 0;
+}